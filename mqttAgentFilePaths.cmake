@@ -13,5 +13,27 @@ set( MQTT_AGENT_INCLUDE_PUBLIC_DIRS
 # MQTT Agent library source files.
 set( MQTT_AGENT_SOURCES
      "${CMAKE_CURRENT_LIST_DIR}/source/core_mqtt_agent.c"
-     "${CMAKE_CURRENT_LIST_DIR}/source/core_mqtt_agent_command_functions.c" )
+     "${CMAKE_CURRENT_LIST_DIR}/source/core_mqtt_agent_command_functions.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/core_mqtt_agent_batch.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/core_mqtt_agent_completion.c" )
 
+
+# MQTT Agent POSIX port include directories. The port requires Linux, and its
+# transport requires the coreMQTT include directories.
+set( MQTT_AGENT_POSIX_PORT_INCLUDE_PUBLIC_DIRS
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix" )
+
+# MQTT Agent POSIX port source files: transport, message interface, command
+# pool, time function, agent thread start, completion event, shared memory
+# queue, session store and spool. The shared memory queue uses shm_open(), which requires linking with
+# librt on glibc older than 2.34.
+set( MQTT_AGENT_POSIX_PORT_SOURCES
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_agent_message.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_agent_thread.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_clock.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_command_pool.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_completion.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_session_store.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_shared_queue.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_spool.c"
+     "${CMAKE_CURRENT_LIST_DIR}/source/portable/posix/posix_transport.c" )
@@ -40,17 +40,40 @@
 /* Standard includes. */
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <assert.h>
 
 /* MQTT agent include. */
 #include "core_mqtt_agent.h"
 #include "core_mqtt_agent_command_functions.h"
+#include "core_mqtt_agent_completion.h"
 
 /* MQTT Agent default logging configuration include. */
 #include "core_mqtt_agent_default_logging.h"
 
+/* Without fences for this compiler, only the completion queue uses them here,
+ * and it falls back to a compiler barrier, which is enough on a single core.
+ * The batch and completion modules require real fences. */
+#if !defined( MQTT_AGENT_RELEASE_FENCE ) || !defined( MQTT_AGENT_ACQUIRE_FENCE )
+    #define MQTT_AGENT_COMPILER_BARRIER_FENCES
+    #undef MQTT_AGENT_RELEASE_FENCE
+    #undef MQTT_AGENT_ACQUIRE_FENCE
+    #define MQTT_AGENT_RELEASE_FENCE()    compilerBarrier()
+    #define MQTT_AGENT_ACQUIRE_FENCE()    compilerBarrier()
+#endif
+
 /*-----------------------------------------------------------*/
 
+#ifdef MQTT_AGENT_COMPILER_BARRIER_FENCES
+
+/**
+ * @brief Keep the compiler from moving memory accesses across a call. The
+ * call goes through a volatile pointer, so the compiler cannot tell that it
+ * does nothing, and must assume it reads and writes any memory.
+ */
+    static void compilerBarrier( void );
+#endif
+
 /**
  * @brief Track an operation by adding it to a list, indicating it is anticipating
  * an acknowledgment.
@@ -83,6 +106,33 @@ static MQTTStatus_t addAwaitingOperation( MQTTAgentContext_t * pAgentContext,
 static MQTTAgentAckInfo_t * getAwaitingOperation( MQTTAgentContext_t * pAgentContext,
                                                   uint16_t incomingPacketId );
 
+/**
+ * @brief Notify the session callback, if any, that a publish stopped waiting
+ * for its acknowledgment.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pAckInfo Entry of the operation in the list of pending acks.
+ */
+static void notifySession( const MQTTAgentContext_t * pAgentContext,
+                           const MQTTAgentAckInfo_t * pAckInfo );
+
+/**
+ * @brief Add an operation to the list of pending acks.
+ *
+ * A publish is given to the session callback before it is sent, so the
+ * callback is notified if the publish cannot be added to the list, as it will
+ * not wait for its acknowledgment.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] packetId Packet ID of pending ack.
+ * @param[in] pCommand Pointer to command that is expecting an ack.
+ *
+ * @return The status of addAwaitingOperation().
+ */
+static MQTTStatus_t awaitAcknowledgment( MQTTAgentContext_t * pAgentContext,
+                                         uint16_t packetId,
+                                         MQTTAgentCommand_t * pCommand );
+
 /**
  * @brief Populate the parameters of a #MQTTAgentCommand struct.
  *
@@ -161,7 +211,7 @@ static void mqttEventCallback( MQTTContext_t * pMqttContext,
  * @param[in] packetType The type of the incoming packet, either SUBACK, UNSUBACK,
  * PUBACK, or PUBCOMP.
  */
-static void handleAcks( const MQTTAgentContext_t * pAgentContext,
+static void handleAcks( MQTTAgentContext_t * pAgentContext,
                         const MQTTPacketInfo_t * pPacketInfo,
                         const MQTTDeserializedInfo_t * pDeserializedInfo,
                         MQTTAgentAckInfo_t * pAckInfo,
@@ -188,6 +238,13 @@ static MQTTAgentContext_t * getAgentFromMQTTContext( MQTTContext_t * pMQTTContex
  * @param[in] blockTimeMs Maximum amount of time in milliseconds to wait (in the
  * Blocked state, so not consuming any CPU time) for the command to be posted to the
  * MQTT agent should the MQTT agent's event queue be full.
+ * @param[in] conflate Whether a newer publish to the same topic may supersede
+ * the command. Only used for a PUBLISH.
+ * @param[in] pSubscriber Task holding the subscriptions of the command. Only
+ * used for a SUBSCRIBE or UNSUBSCRIBE.
+ *
+ * @param[in] pCommandStorage Storage given by the caller for the command, or
+ * NULL to get one from the command pool.
  *
  * @return #MQTTSuccess if the command was posted to the MQTT agent's event queue.
  * Otherwise an enumerated error code.
@@ -197,7 +254,10 @@ static MQTTStatus_t createAndAddCommand( MQTTAgentCommandType_t commandType,
                                          void * pMqttInfoParam,
                                          MQTTAgentCommandCallback_t commandCompleteCallback,
                                          MQTTAgentCommandContext_t * pCommandCompleteCallbackContext,
-                                         uint32_t blockTimeMs );
+                                         uint32_t blockTimeMs,
+                                         bool conflate,
+                                         const void * pSubscriber,
+                                         MQTTAgentCommand_t * pCommandStorage );
 
 /**
  * @brief Helper function to mark a command as complete and invoke its callback.
@@ -213,11 +273,262 @@ static void concludeCommand( const MQTTAgentContext_t * pAgentContext,
                              MQTTStatus_t returnCode,
                              uint8_t * pSubackCodes );
 
+/**
+ * @brief Invoke the callback of a command with the given return information,
+ * or post it to the completion queue if the command has a context but no
+ * callback, then release it with the releaseCommand callback unless its
+ * storage was given by the caller.
+ *
+ * @param[in] pAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand Command to complete.
+ * @param[in] pReturnInfo Return information passed to the callback.
+ */
+static void concludeCommandWithInfo( const MQTTAgentContext_t * pAgentContext,
+                                     MQTTAgentCommand_t * pCommand,
+                                     MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Post the completion of a command to a completion queue, and wake the
+ * task reaping it. The completion is dropped if the queue is full.
+ *
+ * @param[in] pCompletionQueue Queue to post to.
+ * @param[in] pCommand Command that completed.
+ * @param[in] pReturnInfo Return information of the command.
+ */
+static void postCompletion( MQTTAgentCompletionQueue_t * pCompletionQueue,
+                            const MQTTAgentCommand_t * pCommand,
+                            const MQTTAgentReturnInfo_t * pReturnInfo );
+
+#if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+
+/**
+ * @brief Receive commands without blocking until the commands received ahead
+ * fill #MQTTAgentContext_t.pStagedCommands or the queue is empty.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ */
+    static void stageCommands( MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Check whether a command received ahead supersedes a publish.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand Publish enqueued with conflation allowed.
+ *
+ * @return `true` if a later publish to the same topic with conflation allowed
+ * has been received, else `false`.
+ */
+    static bool isSuperseded( const MQTTAgentContext_t * pMqttAgentContext,
+                              const MQTTAgentCommand_t * pCommand );
+#endif /* if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U ) */
+
+#if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+
+/**
+ * @brief Find an active subscription by its topic filter.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pTopicFilter Topic filter to find.
+ * @param[in] topicFilterLength Length of the topic filter.
+ *
+ * @return Index of the subscription, or the number of subscriptions if there
+ * is none.
+ */
+    static size_t findSubscription( const MQTTAgentContext_t * pMqttAgentContext,
+                                    const char * pTopicFilter,
+                                    uint16_t topicFilterLength );
+
+/**
+ * @brief Add an active subscription, copying its topic filter, without holds.
+ * It is not kept if the subscriptions are full or the topic filter is too
+ * long.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pSubscribeInfo The subscription.
+ */
+    static void addSubscription( MQTTAgentContext_t * pMqttAgentContext,
+                                 const MQTTSubscribeInfo_t * pSubscribeInfo );
+
+/**
+ * @brief Remove an active subscription and its holds, keeping the others in
+ * order.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] index Index of the subscription.
+ */
+    static void removeSubscription( MQTTAgentContext_t * pMqttAgentContext,
+                                    size_t index );
+
+/**
+ * @brief Update the active subscriptions from the SUBACK or UNSUBACK of a
+ * SUBSCRIBE or UNSUBSCRIBE command.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand The SUBSCRIBE or UNSUBSCRIBE command.
+ * @param[in] pSubackCodes Status codes of the SUBACK, or NULL.
+ * @param[in] subackCodeCount Number of status codes.
+ */
+    static void updateSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                     const MQTTAgentCommand_t * pCommand,
+                                     const uint8_t * pSubackCodes,
+                                     size_t subackCodeCount );
+
+/**
+ * @brief Handle the SUBACK of a SUBSCRIBE sent by replaySubscriptions(),
+ * removing the subscriptions the broker refused.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pPacketInfo The SUBACK.
+ * @param[in] packetId Packet ID of the SUBACK.
+ *
+ * @return `true` if the SUBACK was for a replayed SUBSCRIBE, else `false`.
+ */
+    static bool handleReplayAck( MQTTAgentContext_t * pMqttAgentContext,
+                                 const MQTTPacketInfo_t * pPacketInfo,
+                                 uint16_t packetId );
+
+/**
+ * @brief Get the size of a SUBSCRIBE packet from its remaining length.
+ *
+ * @param[in] remainingLength Remaining length of the packet.
+ *
+ * @return Size of the packet.
+ */
+    static size_t getSubscribePacketSize( size_t remainingLength );
+
+/**
+ * @brief Subscribe again to the active subscriptions, in as few SUBSCRIBE
+ * packets as fit in the network buffer. The SUBACKs are handled by
+ * handleReplayAck().
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] replayAll `true` to subscribe again to all active subscriptions,
+ * `false` to only subscribe again to those whose replayed SUBSCRIBE was not
+ * acknowledged.
+ *
+ * @return #MQTTSuccess, or the return code of MQTT_Subscribe().
+ */
+    static MQTTStatus_t replaySubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                             bool replayAll );
+
+/**
+ * @brief Share the active subscriptions of a SUBSCRIBE or UNSUBSCRIBE command
+ * with the other tasks holding them. A SUBSCRIBE to active subscriptions only,
+ * and an UNSUBSCRIBE from subscriptions other tasks still hold only, are
+ * completed without being sent. An UNSUBSCRIBE is otherwise sent without the
+ * topic filters other tasks still hold.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand The SUBSCRIBE or UNSUBSCRIBE command.
+ * @param[out] ppCommandArgs Arguments to send the command with.
+ * @param[out] ppSubackCodes Status codes to complete a SUBSCRIBE with if it is
+ * not sent.
+ * @param[out] pSendCommand Whether the command must be sent to the broker.
+ *
+ * @return #MQTTSuccess, the return code of checkHolds(), or #MQTTNoMemory if
+ * the topic filters to send do not fit in `sharedSubscribeInfo`.
+ */
+    static MQTTStatus_t shareSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                            const MQTTAgentCommand_t * pCommand,
+                                            void ** ppCommandArgs,
+                                            uint8_t ** ppSubackCodes,
+                                            bool * pSendCommand );
+
+/**
+ * @brief Add the holds of the task of a SUBSCRIBE command completed without
+ * being sent, or release the holds of the task of an UNSUBSCRIBE command. The
+ * subscriptions no task holds any more are removed when their UNSUBACK is
+ * received.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand The SUBSCRIBE or UNSUBSCRIBE command.
+ */
+    static void holdSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                   const MQTTAgentCommand_t * pCommand );
+
+/**
+ * @brief Find the hold of a task on an active subscription.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] index Index of the subscription.
+ * @param[in] pSubscriber The task.
+ *
+ * @return Index of the hold, or the number of holds if the task holds none.
+ */
+    static size_t findHold( const MQTTAgentContext_t * pMqttAgentContext,
+                            size_t index,
+                            const void * pSubscriber );
+
+/**
+ * @brief Add a hold of a task on an active subscription.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] index Index of the subscription.
+ * @param[in] pSubscriber The task.
+ */
+    static void addHold( MQTTAgentContext_t * pMqttAgentContext,
+                         size_t index,
+                         const void * pSubscriber );
+
+/**
+ * @brief Release a hold of a task on an active subscription.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] holdIndex Index of the hold.
+ */
+    static void releaseHold( MQTTAgentContext_t * pMqttAgentContext,
+                             size_t holdIndex );
+
+/**
+ * @brief Count the subscriptions and holds a SUBSCRIBE command would add.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand The SUBSCRIBE command.
+ * @param[in,out] pNewSubscriptions Number of subscriptions to add.
+ * @param[in,out] pNewHolds Number of holds to add.
+ */
+    static void countNewHolds( const MQTTAgentContext_t * pMqttAgentContext,
+                               const MQTTAgentCommand_t * pCommand,
+                               size_t * pNewSubscriptions,
+                               size_t * pNewHolds );
+
+/**
+ * @brief Check that the subscriptions and holds of a SUBSCRIBE command fit,
+ * with those of the SUBSCRIBE commands waiting for their SUBACK, and that the
+ * task of an UNSUBSCRIBE command holds each active subscription it releases.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] pCommand The SUBSCRIBE or UNSUBSCRIBE command.
+ *
+ * @return #MQTTSuccess, #MQTTNoMemory if the subscriptions or holds of a
+ * SUBSCRIBE do not fit, or #MQTTBadParameter if the task of an UNSUBSCRIBE
+ * does not hold one of its active subscriptions.
+ */
+    static MQTTStatus_t checkHolds( const MQTTAgentContext_t * pMqttAgentContext,
+                                    const MQTTAgentCommand_t * pCommand );
+#endif /* if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U ) */
+
+/**
+ * @brief Get the next command to process: the oldest command received ahead,
+ * if any, else a command from the queue. A publish superseded by a later one
+ * is completed, and the next command returned instead.
+ *
+ * @param[in] pMqttAgentContext Agent context for the MQTT connection.
+ * @param[in] blockTimeMs Time to wait for a command from the queue.
+ *
+ * @return The next command, or NULL if no command was received.
+ */
+static MQTTAgentCommand_t * receiveCommand( MQTTAgentContext_t * pMqttAgentContext,
+                                            uint32_t blockTimeMs );
+
 /**
  * @brief Resend QoS 1 and 2 publishes after resuming a session.
  *
  * @param[in] pMqttAgentContext Agent context for the MQTT connection.
  *
+ * A publish that fails to resend stays in the list of pending acknowledgments
+ * to be resent by the next call.
+ *
  * @return #MQTTSuccess if all publishes resent successfully, else error code
  * from #MQTT_Publish.
  */
@@ -279,6 +590,109 @@ static bool validateParams( MQTTAgentCommandType_t commandType,
  */
 static bool isSpaceInPendingAckList( const MQTTAgentContext_t * pAgentContext );
 
+/**
+ * @brief Get the function that executes a command.
+ *
+ * Built-in command types are looked up in #commandFunctionTable, and command
+ * types above #NUM_COMMANDS in the table registered with
+ * MQTTAgent_RegisterCommands(). Any other command type, or no command, runs
+ * the function for #NONE.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ * @param[in] pCommand Command to execute, or NULL if no command was received.
+ *
+ * @return Function to execute for the command.
+ */
+static MQTTAgentCommandFunc_t getCommandFunction( const MQTTAgentContext_t * pMqttAgentContext,
+                                                  const MQTTAgentCommand_t * pCommand );
+
+/**
+ * @brief Get the time left until a timer expires.
+ *
+ * @param[in] pTimer Running timer.
+ * @param[in] nowMs Current time.
+ *
+ * @return Milliseconds until the timer expires, or zero if it has expired.
+ */
+static uint32_t getTimerRemainingMs( const MQTTAgentTimer_t * pTimer,
+                                     uint32_t nowMs );
+
+/**
+ * @brief Insert a timer in the list of running timers, after every timer
+ * expiring no later than it.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ * @param[in] pTimer Timer to insert. It must not be in any list.
+ * @param[in] nowMs Current time.
+ */
+static void insertTimer( MQTTAgentContext_t * pMqttAgentContext,
+                         MQTTAgentTimer_t * pTimer,
+                         uint32_t nowMs );
+
+/**
+ * @brief Remove a timer from a list of timers.
+ *
+ * @param[in] ppList Pointer to the head of the list.
+ * @param[in] pTimer Timer to remove.
+ */
+static void removeTimer( MQTTAgentTimer_t ** ppList,
+                         const MQTTAgentTimer_t * pTimer );
+
+/**
+ * @brief Call the callbacks of expired timers, and reload periodic timers.
+ *
+ * Timers are only run if they had expired on entry, so a timer restarted with
+ * no delay by a callback runs on the next call rather than in a loop.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ */
+static void processTimers( MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Get the time to wait for a command: #MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME,
+ * or less if a timer expires sooner, or no time if received packets may be
+ * waiting to be processed.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ *
+ * @return Time in milliseconds to wait for a command.
+ */
+static uint32_t getCommandWaitTimeMs( const MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Check whether the last publish of a producer is awaiting an
+ * acknowledgment.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ * @param[in] pProducer Producer to check.
+ *
+ * @return `true` if the publish is in the list of pending acknowledgments,
+ * else `false`.
+ */
+static bool isProducerPublishPending( const MQTTAgentContext_t * pMqttAgentContext,
+                                      const MQTTAgentProducer_t * pProducer );
+
+/**
+ * @brief Timer callback of producers, which publishes a payload pulled from
+ * the producer if the publish can be sent.
+ *
+ * @param[in] pMqttAgentContext Agent context for MQTT connection.
+ * @param[in] pTimer Timer of the producer.
+ */
+static void producerTimerCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                   MQTTAgentTimer_t * pTimer );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Functions executing each built-in command type, indexed by
+ * #MQTTAgentCommandType_t.
+ *
+ * The table is constant and resolved at link time, so it is not rebuilt for
+ * each command processed.
+ */
+static const MQTTAgentCommandFunc_t commandFunctionTable[ NUM_COMMANDS ] = MQTT_AGENT_FUNCTION_TABLE;
+
 /*-----------------------------------------------------------*/
 
 static bool isSpaceInPendingAckList( const MQTTAgentContext_t * pAgentContext )
@@ -417,6 +831,47 @@ static MQTTAgentAckInfo_t * getAwaitingOperation( MQTTAgentContext_t * pAgentCon
 
 /*-----------------------------------------------------------*/
 
+static void notifySession( const MQTTAgentContext_t * pAgentContext,
+                           const MQTTAgentAckInfo_t * pAckInfo )
+{
+    assert( pAgentContext != NULL );
+    assert( pAckInfo != NULL );
+    assert( pAckInfo->pOriginalCommand != NULL );
+
+    /* Only publishes can be resent when a session is resumed, so subscribes
+     * and unsubscribes are not saved. */
+    if( ( pAgentContext->pSessionCallback != NULL ) &&
+        ( pAckInfo->pOriginalCommand->commandType == PUBLISH ) )
+    {
+        pAgentContext->pSessionCallback( pAgentContext->pSessionCallbackContext,
+                                         pAckInfo->packetId,
+                                         NULL );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t awaitAcknowledgment( MQTTAgentContext_t * pAgentContext,
+                                         uint16_t packetId,
+                                         MQTTAgentCommand_t * pCommand )
+{
+    MQTTStatus_t status;
+    MQTTAgentAckInfo_t ackInfo;
+
+    status = addAwaitingOperation( pAgentContext, packetId, pCommand );
+
+    if( status != MQTTSuccess )
+    {
+        ackInfo.packetId = packetId;
+        ackInfo.pOriginalCommand = pCommand;
+        notifySession( pAgentContext, &ackInfo );
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
 static MQTTStatus_t createCommand( MQTTAgentCommandType_t commandType,
                                    const MQTTAgentContext_t * pMqttAgentContext,
                                    void * pMqttInfoParam,
@@ -531,55 +986,116 @@ static MQTTStatus_t addCommandToQueue( const MQTTAgentContext_t * pAgentContext,
 
 /*-----------------------------------------------------------*/
 
+static MQTTAgentCommandFunc_t getCommandFunction( const MQTTAgentContext_t * pMqttAgentContext,
+                                                  const MQTTAgentCommand_t * pCommand )
+{
+    MQTTAgentCommandFunc_t commandFunction = commandFunctionTable[ NONE ];
+    size_t customIndex;
+
+    if( pCommand != NULL )
+    {
+        if( ( uint32_t ) pCommand->commandType < ( uint32_t ) NUM_COMMANDS )
+        {
+            commandFunction = commandFunctionTable[ pCommand->commandType ];
+        }
+        else
+        {
+            customIndex = ( size_t ) pCommand->commandType - ( size_t ) NUM_COMMANDS;
+
+            if( customIndex < pMqttAgentContext->customCommandCount )
+            {
+                commandFunction = pMqttAgentContext->pCustomCommandTable[ customIndex ];
+            }
+            else
+            {
+                LogWarn( ( "An incorrect command type was received by the processCommand function."
+                           " Type = %d.", pCommand->commandType ) );
+            }
+        }
+    }
+
+    return commandFunction;
+}
+
+/*-----------------------------------------------------------*/
+
 static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
                                     MQTTAgentCommand_t * pCommand,
                                     bool * pEndLoop )
 {
-    const MQTTAgentCommandFunc_t pCommandFunctionTable[ NUM_COMMANDS ] = MQTT_AGENT_FUNCTION_TABLE;
     MQTTStatus_t operationStatus = MQTTSuccess;
     bool ackAdded = false;
     MQTTAgentCommandFunc_t commandFunction = NULL;
     void * pCommandArgs = NULL;
     MQTTAgentCommandFuncReturns_t commandOutParams = { 0 };
+    bool receiveMore = false;
+    uint32_t processLoopCount = 0U;
+    bool sendCommand = true;
+    uint8_t * pSubackCodes = NULL;
 
     assert( pMqttAgentContext != NULL );
     assert( pEndLoop != NULL );
 
+    commandFunction = getCommandFunction( pMqttAgentContext, pCommand );
+
     if( pCommand != NULL )
     {
-        assert( ( uint32_t ) pCommand->commandType < ( uint32_t ) NUM_COMMANDS );
+        pCommandArgs = pCommand->pArgs;
+    }
 
-        if( ( uint32_t ) pCommand->commandType < ( uint32_t ) NUM_COMMANDS )
-        {
-            commandFunction = pCommandFunctionTable[ pCommand->commandType ];
-            pCommandArgs = pCommand->pArgs;
-        }
-        else
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        if( ( pCommand != NULL ) && ( pCommandArgs != NULL ) &&
+            ( ( pCommand->commandType == SUBSCRIBE ) || ( pCommand->commandType == UNSUBSCRIBE ) ) )
         {
-            LogWarn( ( "An incorrect command type was received by the processCommand function."
-                       " Type = %d.", pCommand->commandType ) );
-            commandFunction = pCommandFunctionTable[ NONE ];
+            operationStatus = shareSubscriptions( pMqttAgentContext, pCommand, &pCommandArgs, &pSubackCodes, &sendCommand );
+
+            if( operationStatus != MQTTSuccess )
+            {
+                /* Only this command is rejected. It is completed with the error
+                 * without being sent, and nothing more is done with it, so that
+                 * the command loop goes on with the commands of other tasks. */
+                concludeCommand( pMqttAgentContext, pCommand, operationStatus, NULL );
+                operationStatus = MQTTSuccess;
+                sendCommand = false;
+                pCommand = NULL;
+                pCommandArgs = NULL;
+            }
+            else
+            {
+                /* Empty else MISRA 15.7 */
+            }
         }
     }
-    else
+    #endif
+
+    if( ( operationStatus == MQTTSuccess ) && sendCommand )
     {
-        commandFunction = pCommandFunctionTable[ NONE ];
+        operationStatus = commandFunction( pMqttAgentContext, pCommandArgs, &commandOutParams );
     }
 
-    operationStatus = commandFunction( pMqttAgentContext, pCommandArgs, &commandOutParams );
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        if( ( operationStatus == MQTTSuccess ) && ( pCommand != NULL ) && ( pCommandArgs != NULL ) &&
+            ( ( ( pCommand->commandType == SUBSCRIBE ) && !sendCommand ) || ( pCommand->commandType == UNSUBSCRIBE ) ) )
+        {
+            holdSubscriptions( pMqttAgentContext, pCommand );
+        }
+    }
+    #endif
 
     if( ( operationStatus == MQTTSuccess ) &&
         commandOutParams.addAcknowledgment &&
         ( commandOutParams.packetId != MQTT_PACKET_ID_INVALID ) )
     {
-        operationStatus = addAwaitingOperation( pMqttAgentContext, commandOutParams.packetId, pCommand );
+        operationStatus = awaitAcknowledgment( pMqttAgentContext, commandOutParams.packetId, pCommand );
         ackAdded = ( operationStatus == MQTTSuccess );
     }
 
     if( ( pCommand != NULL ) && ( ackAdded != true ) )
     {
         /* The command is complete, call the callback. */
-        concludeCommand( pMqttAgentContext, pCommand, operationStatus, NULL );
+        concludeCommand( pMqttAgentContext, pCommand, operationStatus, pSubackCodes );
     }
 
     /* Run the process loop if there were no errors and the MQTT connection
@@ -595,7 +1111,20 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
             {
                 operationStatus = MQTT_ProcessLoop( &( pMqttAgentContext->mqttContext ) );
             }
-        } while( pMqttAgentContext->packetReceivedInLoop );
+
+            processLoopCount++;
+            receiveMore = pMqttAgentContext->packetReceivedInLoop;
+
+            #if ( MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS > 0U )
+            {
+                /* Leave packets still to be received for a later iteration of
+                 * the command loop, so that queued commands are not starved.
+                 * packetReceivedInLoop stays set, so the command loop will not
+                 * wait for a command before receiving them. */
+                receiveMore = receiveMore && ( processLoopCount < MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS );
+            }
+            #endif
+        } while( receiveMore );
     }
 
     if( operationStatus == MQTTNeedMoreBytes )
@@ -612,7 +1141,7 @@ static MQTTStatus_t processCommand( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
-static void handleAcks( const MQTTAgentContext_t * pAgentContext,
+static void handleAcks( MQTTAgentContext_t * pAgentContext,
                         const MQTTPacketInfo_t * pPacketInfo,
                         const MQTTDeserializedInfo_t * pDeserializedInfo,
                         MQTTAgentAckInfo_t * pAckInfo,
@@ -623,8 +1152,31 @@ static void handleAcks( const MQTTAgentContext_t * pAgentContext,
     assert( pAckInfo != NULL );
     assert( pAckInfo->pOriginalCommand != NULL );
 
-    /* A SUBACK's status codes start 2 bytes after the variable header. */
-    pSubackCodes = ( packetType == MQTT_PACKET_TYPE_SUBACK ) ? ( pPacketInfo->pRemainingData + 2U ) : NULL;
+    /* A SUBACK's status codes start 2 bytes after the variable header. They
+     * are only passed on when the packet is long enough to carry any, since
+     * the remaining data comes straight from the broker. */
+    if( ( packetType == MQTT_PACKET_TYPE_SUBACK ) &&
+        ( pPacketInfo->pRemainingData != NULL ) &&
+        ( pPacketInfo->remainingLength > 2U ) )
+    {
+        pSubackCodes = &( pPacketInfo->pRemainingData[ 2U ] );
+    }
+
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        if( ( pAckInfo->pOriginalCommand->pArgs != NULL ) &&
+            ( ( ( packetType == MQTT_PACKET_TYPE_SUBACK ) && ( pAckInfo->pOriginalCommand->commandType == SUBSCRIBE ) ) ||
+              ( ( packetType == MQTT_PACKET_TYPE_UNSUBACK ) && ( pAckInfo->pOriginalCommand->commandType == UNSUBSCRIBE ) ) ) )
+        {
+            updateSubscriptions( pAgentContext,
+                                 pAckInfo->pOriginalCommand,
+                                 pSubackCodes,
+                                 ( pSubackCodes != NULL ) ? ( pPacketInfo->remainingLength - 2U ) : 0U );
+        }
+    }
+    #endif /* if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U ) */
+
+    notifySession( pAgentContext, pAckInfo );
 
     concludeCommand( pAgentContext,
                      pAckInfo->pOriginalCommand,
@@ -639,8 +1191,9 @@ static void handleAcks( const MQTTAgentContext_t * pAgentContext,
 
 static MQTTAgentContext_t * getAgentFromMQTTContext( MQTTContext_t * pMQTTContext )
 {
-    MQTTAgentContext_t ctx = { 0 };
-    ptrdiff_t offset = ( ( uint8_t * ) &( ctx.mqttContext ) ) - ( ( uint8_t * ) &ctx );
+    /* The offset is a compile time constant, so recovering the agent context
+     * costs no stack and no initialization on the receive path. */
+    const ptrdiff_t offset = ( ptrdiff_t ) offsetof( MQTTAgentContext_t, mqttContext );
 
     /* MISRA Ref 11.3.1 [Misaligned access] */
     /* More details at: https://github.com/FreeRTOS/coreMQTT-Agent/blob/main/MISRA.md#rule-113 */
@@ -697,6 +1250,14 @@ static void mqttEventCallback( MQTTContext_t * pMqttContext,
                                 pAckInfo,
                                 pPacketInfo->type );
                 }
+
+                #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+                    else if( ( pPacketInfo->type == MQTT_PACKET_TYPE_SUBACK ) &&
+                             handleReplayAck( pAgentContext, pPacketInfo, packetIdentifier ) )
+                    {
+                        /* The SUBACK of a SUBSCRIBE sent by MQTTAgent_ResumeSession(). */
+                    }
+                #endif
                 else
                 {
                     LogError( ( "No operation found matching packet id %u.\n", packetIdentifier ) );
@@ -726,7 +1287,10 @@ static MQTTStatus_t createAndAddCommand( MQTTAgentCommandType_t commandType,
                                          void * pMqttInfoParam,
                                          MQTTAgentCommandCallback_t commandCompleteCallback,
                                          MQTTAgentCommandContext_t * pCommandCompleteCallbackContext,
-                                         uint32_t blockTimeMs )
+                                         uint32_t blockTimeMs,
+                                         bool conflate,
+                                         const void * pSubscriber,
+                                         MQTTAgentCommand_t * pCommandStorage )
 {
     MQTTStatus_t statusReturn = MQTTBadParameter;
     MQTTAgentCommand_t * pCommand;
@@ -736,7 +1300,14 @@ static MQTTStatus_t createAndAddCommand( MQTTAgentCommandType_t commandType,
      * is the initial value but not a valid packet ID. */
     if( pMqttAgentContext->mqttContext.nextPacketId != MQTT_PACKET_ID_INVALID )
     {
-        pCommand = pMqttAgentContext->agentInterface.getCommand( blockTimeMs );
+        if( pCommandStorage != NULL )
+        {
+            pCommand = pCommandStorage;
+        }
+        else
+        {
+            pCommand = pMqttAgentContext->agentInterface.getCommand( blockTimeMs );
+        }
 
         if( pCommand != NULL )
         {
@@ -749,67 +1320,914 @@ static MQTTStatus_t createAndAddCommand( MQTTAgentCommandType_t commandType,
 
             if( statusReturn == MQTTSuccess )
             {
+                pCommand->callerOwned = ( pCommandStorage != NULL );
+
+                #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+                {
+                    pCommand->conflate = conflate && ( commandType == PUBLISH );
+                }
+                #else
+                {
+                    ( void ) conflate;
+                }
+                #endif
+
+                #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+                {
+                    pCommand->pSubscriber = pSubscriber;
+                }
+                #else
+                {
+                    ( void ) pSubscriber;
+                }
+                #endif
+
                 statusReturn = addCommandToQueue( pMqttAgentContext, pCommand, blockTimeMs );
             }
 
-            if( statusReturn != MQTTSuccess )
+            if( ( statusReturn != MQTTSuccess ) && ( pCommandStorage == NULL ) )
+            {
+                /* Could not send the command to the queue so release the command
+                 * structure again. */
+                commandReleased = pMqttAgentContext->agentInterface.releaseCommand( pCommand );
+
+                if( !commandReleased )
+                {
+                    LogError( ( "Command %p could not be released.",
+                                ( void * ) pCommand ) );
+                }
+            }
+        }
+        else
+        {
+            /* Ran out of MQTTAgentCommand_t structures - pool is empty. */
+            statusReturn = MQTTNoMemory;
+        }
+    }
+    else
+    {
+        LogError( ( "MQTT context must be initialized." ) );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+static void concludeCommand( const MQTTAgentContext_t * pAgentContext,
+                             MQTTAgentCommand_t * pCommand,
+                             MQTTStatus_t returnCode,
+                             uint8_t * pSubackCodes )
+{
+    MQTTAgentReturnInfo_t returnInfo;
+
+    ( void ) memset( &returnInfo, 0x00, sizeof( MQTTAgentReturnInfo_t ) );
+
+    returnInfo.returnCode = returnCode;
+    returnInfo.pSubackCodes = pSubackCodes;
+
+    concludeCommandWithInfo( pAgentContext, pCommand, &returnInfo );
+}
+
+/*-----------------------------------------------------------*/
+
+static void concludeCommandWithInfo( const MQTTAgentContext_t * pAgentContext,
+                                     MQTTAgentCommand_t * pCommand,
+                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    bool commandReleased = false;
+    bool callerOwned;
+
+    assert( pAgentContext != NULL );
+    assert( pAgentContext->agentInterface.releaseCommand != NULL );
+    assert( pCommand != NULL );
+
+    /* Storage given by the caller may be reused as soon as the command has
+     * completed, so it is not read after the callback. */
+    callerOwned = pCommand->callerOwned;
+
+    if( pCommand->pCommandCompleteCallback != NULL )
+    {
+        pCommand->pCommandCompleteCallback( pCommand->pCmdContext, pReturnInfo );
+    }
+    else if( ( pAgentContext->pCompletionQueue != NULL ) && ( pCommand->pCmdContext != NULL ) )
+    {
+        postCompletion( pAgentContext->pCompletionQueue, pCommand, pReturnInfo );
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    if( !callerOwned )
+    {
+        commandReleased = pAgentContext->agentInterface.releaseCommand( pCommand );
+
+        if( !commandReleased )
+        {
+            LogError( ( "Failed to release command %p of type %d.",
+                        ( void * ) pCommand,
+                        pCommand->commandType ) );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+#ifdef MQTT_AGENT_COMPILER_BARRIER_FENCES
+
+/**
+ * @brief Function called by compilerBarrier().
+ */
+    static void emptyFunction( void )
+    {
+    }
+
+/**
+ * @brief Pointer to emptyFunction(), read again at each call.
+ */
+    static void ( *volatile pEmptyFunction )( void ) = emptyFunction;
+
+    static void compilerBarrier( void )
+    {
+        pEmptyFunction();
+    }
+
+/*-----------------------------------------------------------*/
+#endif /* ifdef MQTT_AGENT_COMPILER_BARRIER_FENCES */
+
+static void postCompletion( MQTTAgentCompletionQueue_t * pCompletionQueue,
+                            const MQTTAgentCommand_t * pCommand,
+                            const MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    uint32_t postedCount = pCompletionQueue->postedCount;
+    MQTTAgentCompletionEntry_t * pEntry;
+
+    if( ( postedCount - pCompletionQueue->reapedCount ) >= pCompletionQueue->entryCount )
+    {
+        pCompletionQueue->overflowCount++;
+        LogError( ( "Completion queue full, dropping completion of command %p.",
+                    ( const void * ) pCommand ) );
+    }
+    else
+    {
+        /* Pairs with the fence in reapCompletions(), so the entry is not
+         * written before the reaping task has copied it out. */
+        MQTT_AGENT_ACQUIRE_FENCE();
+
+        pEntry = &( pCompletionQueue->pEntries[ postedCount & ( pCompletionQueue->entryCount - 1U ) ] );
+        pEntry->pCmdCompleteCallbackContext = pCommand->pCmdContext;
+        pEntry->returnInfo = *pReturnInfo;
+        pEntry->returnInfo.pSubackCodes = NULL;
+
+        /* Publish the entry to the reaping task only once it is written. */
+        MQTT_AGENT_RELEASE_FENCE();
+        pCompletionQueue->postedCount = postedCount + 1U;
+        pCompletionQueue->completionInterface.wake( pCompletionQueue->completionInterface.pEventCtx,
+                                                    &( pCompletionQueue->postedCount ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+
+    static void stageCommands( MQTTAgentContext_t * pMqttAgentContext )
+    {
+        MQTTAgentCommand_t * pCommand = NULL;
+        size_t index;
+        bool received = true;
+
+        while( received && ( pMqttAgentContext->stagedCommandCount < MQTT_AGENT_CONFLATION_LOOKAHEAD ) )
+        {
+            pCommand = NULL;
+            received = pMqttAgentContext->agentInterface.recv( pMqttAgentContext->agentInterface.pMsgCtx,
+                                                               &( pCommand ),
+                                                               0U );
+            received = received && ( pCommand != NULL );
+
+            if( received )
+            {
+                index = ( pMqttAgentContext->stagedCommandStart + pMqttAgentContext->stagedCommandCount ) %
+                        MQTT_AGENT_CONFLATION_LOOKAHEAD;
+                pMqttAgentContext->pStagedCommands[ index ] = pCommand;
+                pMqttAgentContext->stagedCommandCount++;
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool isSuperseded( const MQTTAgentContext_t * pMqttAgentContext,
+                              const MQTTAgentCommand_t * pCommand )
+    {
+        const MQTTPublishInfo_t * pPublishInfo = ( const MQTTPublishInfo_t * ) pCommand->pArgs;
+        const MQTTPublishInfo_t * pLaterPublishInfo;
+        const MQTTAgentCommand_t * pLaterCommand;
+        bool superseded = false;
+        size_t i;
+
+        for( i = 0U; ( i < pMqttAgentContext->stagedCommandCount ) && !superseded; i++ )
+        {
+            pLaterCommand = pMqttAgentContext->pStagedCommands[ ( pMqttAgentContext->stagedCommandStart + i ) %
+                                                                MQTT_AGENT_CONFLATION_LOOKAHEAD ];
+
+            if( ( pLaterCommand->commandType == PUBLISH ) && pLaterCommand->conflate )
+            {
+                pLaterPublishInfo = ( const MQTTPublishInfo_t * ) pLaterCommand->pArgs;
+                superseded = ( pLaterPublishInfo->topicNameLength == pPublishInfo->topicNameLength ) &&
+                             ( memcmp( pLaterPublishInfo->pTopicName,
+                                       pPublishInfo->pTopicName,
+                                       pPublishInfo->topicNameLength ) == 0 );
+            }
+        }
+
+        return superseded;
+    }
+
+#endif /* if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U ) */
+
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+
+    static size_t findSubscription( const MQTTAgentContext_t * pMqttAgentContext,
+                                    const char * pTopicFilter,
+                                    uint16_t topicFilterLength )
+    {
+        size_t i;
+
+        for( i = 0U; i < pMqttAgentContext->subscriptionCount; i++ )
+        {
+            if( ( pMqttAgentContext->subscribeInfo[ i ].topicFilterLength == topicFilterLength ) &&
+                ( memcmp( pMqttAgentContext->subscriptions[ i ].topicFilter, pTopicFilter, topicFilterLength ) == 0 ) )
+            {
+                break;
+            }
+        }
+
+        return i;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void addSubscription( MQTTAgentContext_t * pMqttAgentContext,
+                                 const MQTTSubscribeInfo_t * pSubscribeInfo )
+    {
+        size_t index = pMqttAgentContext->subscriptionCount;
+
+        if( ( index == MQTT_AGENT_MAX_SUBSCRIPTIONS ) ||
+            ( pSubscribeInfo->topicFilterLength > MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH ) )
+        {
+            LogWarn( ( "Subscription to %.*s is not kept, and is not subscribed to again after reconnecting.",
+                       pSubscribeInfo->topicFilterLength,
+                       pSubscribeInfo->pTopicFilter ) );
+        }
+        else
+        {
+            ( void ) memcpy( pMqttAgentContext->subscriptions[ index ].topicFilter,
+                             pSubscribeInfo->pTopicFilter,
+                             pSubscribeInfo->topicFilterLength );
+            pMqttAgentContext->subscriptions[ index ].replayPacketId = MQTT_PACKET_ID_INVALID;
+            pMqttAgentContext->subscriptions[ index ].refCount = 0U;
+            pMqttAgentContext->subscribeInfo[ index ] = *pSubscribeInfo;
+            pMqttAgentContext->subscribeInfo[ index ].pTopicFilter = pMqttAgentContext->subscriptions[ index ].topicFilter;
+            pMqttAgentContext->subscriptionCount++;
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void removeSubscription( MQTTAgentContext_t * pMqttAgentContext,
+                                    size_t index )
+    {
+        MQTTAgentSubscriptionHold_t * pHolds = pMqttAgentContext->subscriptionHolds;
+        size_t i = 0U;
+
+        while( i < pMqttAgentContext->subscriptionHoldCount )
+        {
+            if( pHolds[ i ].subscriptionIndex == index )
+            {
+                pMqttAgentContext->subscriptionHoldCount--;
+                pHolds[ i ] = pHolds[ pMqttAgentContext->subscriptionHoldCount ];
+            }
+            else
+            {
+                if( pHolds[ i ].subscriptionIndex > index )
+                {
+                    pHolds[ i ].subscriptionIndex--;
+                }
+
+                i++;
+            }
+        }
+
+        /* The order is kept, as replayed SUBSCRIBEs carry runs of consecutive
+         * subscriptions whose SUBACK status codes are in the same order. */
+        for( i = index; ( i + 1U ) < pMqttAgentContext->subscriptionCount; i++ )
+        {
+            pMqttAgentContext->subscriptions[ i ] = pMqttAgentContext->subscriptions[ i + 1U ];
+            pMqttAgentContext->subscribeInfo[ i ] = pMqttAgentContext->subscribeInfo[ i + 1U ];
+            pMqttAgentContext->subscribeInfo[ i ].pTopicFilter = pMqttAgentContext->subscriptions[ i ].topicFilter;
+        }
+
+        pMqttAgentContext->subscriptionCount--;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void updateSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                     const MQTTAgentCommand_t * pCommand,
+                                     const uint8_t * pSubackCodes,
+                                     size_t subackCodeCount )
+    {
+        const MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+        const MQTTSubscribeInfo_t * pSubscribeInfo;
+        size_t index;
+        size_t i;
+
+        assert( pSubscribeArgs != NULL );
+
+        for( i = 0U; i < pSubscribeArgs->numSubscriptions; i++ )
+        {
+            pSubscribeInfo = &( pSubscribeArgs->pSubscribeInfo[ i ] );
+            index = findSubscription( pMqttAgentContext,
+                                      pSubscribeInfo->pTopicFilter,
+                                      pSubscribeInfo->topicFilterLength );
+
+            if( pCommand->commandType == UNSUBSCRIBE )
+            {
+                /* Subscriptions other tasks still hold were not sent. */
+                if( ( index < pMqttAgentContext->subscriptionCount ) &&
+                    ( pMqttAgentContext->subscriptions[ index ].refCount == 0U ) )
+                {
+                    removeSubscription( pMqttAgentContext, index );
+                }
+            }
+            else if( i >= subackCodeCount )
+            {
+                /* The SUBACK has no status code for this topic filter. */
+            }
+            else if( pSubackCodes[ i ] == ( uint8_t ) MQTTSubAckFailure )
+            {
+                if( index < pMqttAgentContext->subscriptionCount )
+                {
+                    removeSubscription( pMqttAgentContext, index );
+                }
+            }
+            else
+            {
+                if( index == pMqttAgentContext->subscriptionCount )
+                {
+                    addSubscription( pMqttAgentContext, pSubscribeInfo );
+                }
+
+                if( index < pMqttAgentContext->subscriptionCount )
+                {
+                    pMqttAgentContext->subscribeInfo[ index ].qos = pSubscribeInfo->qos;
+                    pMqttAgentContext->subscriptions[ index ].replayPacketId = MQTT_PACKET_ID_INVALID;
+                    addHold( pMqttAgentContext, index, pCommand->pSubscriber );
+                }
+            }
+        }
+    }
+
+/*-----------------------------------------------------------*/
+
+    static bool handleReplayAck( MQTTAgentContext_t * pMqttAgentContext,
+                                 const MQTTPacketInfo_t * pPacketInfo,
+                                 uint16_t packetId )
+    {
+        size_t subackCodeCount = 0U;
+        size_t codeIndex = 0U;
+        size_t i = 0U;
+        bool found = false;
+
+        if( ( pPacketInfo->pRemainingData != NULL ) && ( pPacketInfo->remainingLength > 2U ) )
+        {
+            subackCodeCount = pPacketInfo->remainingLength - 2U;
+        }
+
+        while( i < pMqttAgentContext->subscriptionCount )
+        {
+            if( pMqttAgentContext->subscriptions[ i ].replayPacketId != packetId )
+            {
+                i++;
+            }
+            else if( codeIndex >= subackCodeCount )
+            {
+                /* Without a status code, the subscription is sent again on
+                 * the next reconnection. */
+                found = true;
+                i++;
+            }
+            else if( pPacketInfo->pRemainingData[ 2U + codeIndex ] == ( uint8_t ) MQTTSubAckFailure )
+            {
+                LogWarn( ( "Broker refused subscription to %.*s when subscribing again.",
+                           pMqttAgentContext->subscribeInfo[ i ].topicFilterLength,
+                           pMqttAgentContext->subscribeInfo[ i ].pTopicFilter ) );
+                removeSubscription( pMqttAgentContext, i );
+                found = true;
+                codeIndex++;
+            }
+            else
+            {
+                pMqttAgentContext->subscriptions[ i ].replayPacketId = MQTT_PACKET_ID_INVALID;
+                found = true;
+                codeIndex++;
+                i++;
+            }
+        }
+
+        return found;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static size_t getSubscribePacketSize( size_t remainingLength )
+    {
+        size_t encodedLength = 1U;
+
+        /* The remaining length is encoded in 7 bits per byte. */
+        if( remainingLength >= 2097152U )
+        {
+            encodedLength = 4U;
+        }
+        else if( remainingLength >= 16384U )
+        {
+            encodedLength = 3U;
+        }
+        else if( remainingLength >= 128U )
+        {
+            encodedLength = 2U;
+        }
+        else
+        {
+            /* Empty else MISRA 15.7 */
+        }
+
+        return 1U + encodedLength + remainingLength;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static MQTTStatus_t replaySubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                             bool replayAll )
+    {
+        MQTTStatus_t statusResult = MQTTSuccess;
+        MQTTContext_t * pMqttContext = &( pMqttAgentContext->mqttContext );
+        MQTTAgentSubscription_t * pSubscriptions = pMqttAgentContext->subscriptions;
+        size_t start = 0U;
+        size_t end;
+        size_t remainingLength;
+        size_t i;
+        uint16_t packetId;
+
+        if( replayAll )
+        {
+            /* Subscriptions released by an UNSUBSCRIBE whose UNSUBACK was not
+             * received are not subscribed to again. */
+            i = 0U;
+
+            while( i < pMqttAgentContext->subscriptionCount )
+            {
+                if( pSubscriptions[ i ].refCount == 0U )
+                {
+                    removeSubscription( pMqttAgentContext, i );
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+
+        while( ( start < pMqttAgentContext->subscriptionCount ) && ( statusResult == MQTTSuccess ) )
+        {
+            if( !replayAll && ( pSubscriptions[ start ].replayPacketId == MQTT_PACKET_ID_INVALID ) )
+            {
+                /* The broker acknowledged this subscription, and kept it in
+                 * the session. */
+                start++;
+            }
+            else
+            {
+                /* The packet identifier takes 2 bytes, and each topic filter
+                 * its length, 2 bytes of length and 1 byte of QoS. A packet
+                 * always carries at least one subscription. */
+                remainingLength = 2U + pMqttAgentContext->subscribeInfo[ start ].topicFilterLength + 3U;
+                end = start + 1U;
+
+                while( ( end < pMqttAgentContext->subscriptionCount ) &&
+                       ( replayAll || ( pSubscriptions[ end ].replayPacketId != MQTT_PACKET_ID_INVALID ) ) &&
+                       ( getSubscribePacketSize( remainingLength + pMqttAgentContext->subscribeInfo[ end ].topicFilterLength + 3U ) <=
+                         pMqttContext->networkBuffer.size ) )
+                {
+                    remainingLength += pMqttAgentContext->subscribeInfo[ end ].topicFilterLength + 3U;
+                    end++;
+                }
+
+                packetId = MQTT_GetPacketId( pMqttContext );
+                statusResult = MQTT_Subscribe( pMqttContext,
+                                               &( pMqttAgentContext->subscribeInfo[ start ] ),
+                                               end - start,
+                                               packetId );
+
+                if( statusResult == MQTTSuccess )
+                {
+                    for( i = start; i < end; i++ )
+                    {
+                        pSubscriptions[ i ].replayPacketId = packetId;
+                    }
+                }
+                else
+                {
+                    LogError( ( "Failed to subscribe again. Error code=%s\n", MQTT_Status_strerror( statusResult ) ) );
+                }
+
+                start = end;
+            }
+        }
+
+        return statusResult;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static MQTTStatus_t shareSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                            const MQTTAgentCommand_t * pCommand,
+                                            void ** ppCommandArgs,
+                                            uint8_t ** ppSubackCodes,
+                                            bool * pSendCommand )
+    {
+        const MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+        const MQTTSubscribeInfo_t * pSubscribeInfo;
+        MQTTStatus_t statusResult;
+        size_t sharedCount = 0U;
+        size_t sendCount = 0U;
+        size_t index;
+        size_t i;
+
+        statusResult = checkHolds( pMqttAgentContext, pCommand );
+
+        for( i = 0U; ( statusResult == MQTTSuccess ) && ( i < pSubscribeArgs->numSubscriptions ); i++ )
+        {
+            pSubscribeInfo = &( pSubscribeArgs->pSubscribeInfo[ i ] );
+            index = findSubscription( pMqttAgentContext,
+                                      pSubscribeInfo->pTopicFilter,
+                                      pSubscribeInfo->topicFilterLength );
+
+            if( pCommand->commandType == SUBSCRIBE )
+            {
+                /* A subscription being unsubscribed from, or at a lower QoS,
+                 * is subscribed to again. */
+                if( ( index < pMqttAgentContext->subscriptionCount ) &&
+                    ( pMqttAgentContext->subscriptions[ index ].refCount > 0U ) &&
+                    ( pMqttAgentContext->subscriptions[ index ].refCount < UINT16_MAX ) &&
+                    ( pSubscribeInfo->qos <= pMqttAgentContext->subscribeInfo[ index ].qos ) &&
+                    ( i < MQTT_AGENT_MAX_SUBSCRIPTIONS ) )
+                {
+                    pMqttAgentContext->sharedSubackCodes[ i ] = ( uint8_t ) pMqttAgentContext->subscribeInfo[ index ].qos;
+                    sharedCount++;
+                }
+                else
+                {
+                    sendCount++;
+                }
+            }
+            else if( ( index < pMqttAgentContext->subscriptionCount ) &&
+                     ( pMqttAgentContext->subscriptions[ index ].refCount > 1U ) )
+            {
+                sharedCount++;
+            }
+            else
+            {
+                if( sendCount < MQTT_AGENT_MAX_SUBSCRIPTIONS )
+                {
+                    pMqttAgentContext->sharedSubscribeInfo[ sendCount ] = *pSubscribeInfo;
+                }
+
+                sendCount++;
+            }
+        }
+
+        if( ( statusResult != MQTTSuccess ) || ( sharedCount == 0U ) )
+        {
+            /* The command fails, or is sent as it is. */
+        }
+        else if( sendCount == 0U )
+        {
+            *pSendCommand = false;
+
+            if( pCommand->commandType == SUBSCRIBE )
+            {
+                *ppSubackCodes = pMqttAgentContext->sharedSubackCodes;
+            }
+        }
+        else if( pCommand->commandType == SUBSCRIBE )
+        {
+            /* Subscribing again to an active subscription is harmless, and
+             * its SUBACK counts the command as a holder. */
+        }
+        else if( sendCount > MQTT_AGENT_MAX_SUBSCRIPTIONS )
+        {
+            LogError( ( "Too many topic filters to unsubscribe from without the ones held by other tasks: %lu.",
+                        ( unsigned long ) sendCount ) );
+            statusResult = MQTTNoMemory;
+        }
+        else
+        {
+            pMqttAgentContext->sharedSubscribeArgs.pSubscribeInfo = pMqttAgentContext->sharedSubscribeInfo;
+            pMqttAgentContext->sharedSubscribeArgs.numSubscriptions = sendCount;
+            *ppCommandArgs = &( pMqttAgentContext->sharedSubscribeArgs );
+        }
+
+        return statusResult;
+    }
+
+/*-----------------------------------------------------------*/
+
+    static void holdSubscriptions( MQTTAgentContext_t * pMqttAgentContext,
+                                   const MQTTAgentCommand_t * pCommand )
+    {
+        const MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+        const MQTTSubscribeInfo_t * pSubscribeInfo;
+        size_t holdIndex;
+        size_t index;
+        size_t i;
+
+        for( i = 0U; i < pSubscribeArgs->numSubscriptions; i++ )
+        {
+            pSubscribeInfo = &( pSubscribeArgs->pSubscribeInfo[ i ] );
+            index = findSubscription( pMqttAgentContext,
+                                      pSubscribeInfo->pTopicFilter,
+                                      pSubscribeInfo->topicFilterLength );
+
+            if( index == pMqttAgentContext->subscriptionCount )
             {
-                /* Could not send the command to the queue so release the command
-                 * structure again. */
-                commandReleased = pMqttAgentContext->agentInterface.releaseCommand( pCommand );
+                /* The topic filter is not kept. */
+            }
+            else if( pCommand->commandType == SUBSCRIBE )
+            {
+                addHold( pMqttAgentContext, index, pCommand->pSubscriber );
+            }
+            else
+            {
+                /* checkHolds() made sure the task holds the subscription. When
+                 * it is the last hold, the UNSUBSCRIBE was sent for it, and the
+                 * subscription is removed on its UNSUBACK. */
+                holdIndex = findHold( pMqttAgentContext, index, pCommand->pSubscriber );
 
-                if( !commandReleased )
+                if( holdIndex < pMqttAgentContext->subscriptionHoldCount )
                 {
-                    LogError( ( "Command %p could not be released.",
-                                ( void * ) pCommand ) );
+                    releaseHold( pMqttAgentContext, holdIndex );
                 }
             }
         }
-        else
+    }
+
+/*-----------------------------------------------------------*/
+
+    static size_t findHold( const MQTTAgentContext_t * pMqttAgentContext,
+                            size_t index,
+                            const void * pSubscriber )
+    {
+        size_t i;
+
+        for( i = 0U; i < pMqttAgentContext->subscriptionHoldCount; i++ )
         {
-            /* Ran out of MQTTAgentCommand_t structures - pool is empty. */
-            statusReturn = MQTTNoMemory;
+            if( ( pMqttAgentContext->subscriptionHolds[ i ].subscriptionIndex == index ) &&
+                ( pMqttAgentContext->subscriptionHolds[ i ].pSubscriber == pSubscriber ) )
+            {
+                break;
+            }
         }
+
+        return i;
     }
-    else
+
+/*-----------------------------------------------------------*/
+
+    static void addHold( MQTTAgentContext_t * pMqttAgentContext,
+                         size_t index,
+                         const void * pSubscriber )
     {
-        LogError( ( "MQTT context must be initialized." ) );
+        MQTTAgentSubscription_t * pSubscription = &( pMqttAgentContext->subscriptions[ index ] );
+        MQTTAgentSubscriptionHold_t * pHold;
+        size_t holdIndex = findHold( pMqttAgentContext, index, pSubscriber );
+
+        if( pSubscription->refCount == UINT16_MAX )
+        {
+            LogWarn( ( "Too many holds on subscription to %.*s.",
+                       pMqttAgentContext->subscribeInfo[ index ].topicFilterLength,
+                       pMqttAgentContext->subscribeInfo[ index ].pTopicFilter ) );
+        }
+        else if( holdIndex < pMqttAgentContext->subscriptionHoldCount )
+        {
+            pMqttAgentContext->subscriptionHolds[ holdIndex ].holdCount++;
+            pSubscription->refCount++;
+        }
+        else if( holdIndex < MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS )
+        {
+            pHold = &( pMqttAgentContext->subscriptionHolds[ holdIndex ] );
+            pHold->pSubscriber = pSubscriber;
+            pHold->subscriptionIndex = index;
+            pHold->holdCount = 1U;
+            pMqttAgentContext->subscriptionHoldCount++;
+            pSubscription->refCount++;
+        }
+        else
+        {
+            /* checkHolds() keeps room for the holds of the SUBSCRIBE commands
+             * it lets through. */
+            LogWarn( ( "Hold on subscription to %.*s is not kept.",
+                       pMqttAgentContext->subscribeInfo[ index ].topicFilterLength,
+                       pMqttAgentContext->subscribeInfo[ index ].pTopicFilter ) );
+        }
     }
 
-    return statusReturn;
-}
+/*-----------------------------------------------------------*/
+
+    static void releaseHold( MQTTAgentContext_t * pMqttAgentContext,
+                             size_t holdIndex )
+    {
+        MQTTAgentSubscriptionHold_t * pHold = &( pMqttAgentContext->subscriptionHolds[ holdIndex ] );
+
+        pMqttAgentContext->subscriptions[ pHold->subscriptionIndex ].refCount--;
+        pHold->holdCount--;
+
+        if( pHold->holdCount == 0U )
+        {
+            pMqttAgentContext->subscriptionHoldCount--;
+            *pHold = pMqttAgentContext->subscriptionHolds[ pMqttAgentContext->subscriptionHoldCount ];
+        }
+    }
 
 /*-----------------------------------------------------------*/
 
-static void concludeCommand( const MQTTAgentContext_t * pAgentContext,
-                             MQTTAgentCommand_t * pCommand,
-                             MQTTStatus_t returnCode,
-                             uint8_t * pSubackCodes )
-{
-    bool commandReleased = false;
-    MQTTAgentReturnInfo_t returnInfo;
+    static void countNewHolds( const MQTTAgentContext_t * pMqttAgentContext,
+                               const MQTTAgentCommand_t * pCommand,
+                               size_t * pNewSubscriptions,
+                               size_t * pNewHolds )
+    {
+        const MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+        const MQTTSubscribeInfo_t * pSubscribeInfo;
+        size_t index;
+        size_t i;
 
-    ( void ) memset( &returnInfo, 0x00, sizeof( MQTTAgentReturnInfo_t ) );
-    assert( pAgentContext != NULL );
-    assert( pAgentContext->agentInterface.releaseCommand != NULL );
-    assert( pCommand != NULL );
+        for( i = 0U; i < pSubscribeArgs->numSubscriptions; i++ )
+        {
+            pSubscribeInfo = &( pSubscribeArgs->pSubscribeInfo[ i ] );
+            index = findSubscription( pMqttAgentContext,
+                                      pSubscribeInfo->pTopicFilter,
+                                      pSubscribeInfo->topicFilterLength );
+
+            /* Topic filters too long to copy are not kept, so take no room. A
+             * topic filter repeated in several commands is counted each time. */
+            if( pSubscribeInfo->topicFilterLength > MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH )
+            {
+                /* Empty else MISRA 15.7 */
+            }
+            else if( index == pMqttAgentContext->subscriptionCount )
+            {
+                ( *pNewSubscriptions )++;
+                ( *pNewHolds )++;
+            }
+            else if( findHold( pMqttAgentContext, index, pCommand->pSubscriber ) == pMqttAgentContext->subscriptionHoldCount )
+            {
+                ( *pNewHolds )++;
+            }
+            else
+            {
+                /* Empty else MISRA 15.7 */
+            }
+        }
+    }
 
-    returnInfo.returnCode = returnCode;
-    returnInfo.pSubackCodes = pSubackCodes;
+/*-----------------------------------------------------------*/
 
-    if( pCommand->pCommandCompleteCallback != NULL )
+    static MQTTStatus_t checkHolds( const MQTTAgentContext_t * pMqttAgentContext,
+                                    const MQTTAgentCommand_t * pCommand )
     {
-        pCommand->pCommandCompleteCallback( pCommand->pCmdContext, &returnInfo );
+        const MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pCommand->pArgs;
+        const MQTTSubscribeInfo_t * pSubscribeInfo;
+        const MQTTAgentAckInfo_t * pAckInfo;
+        MQTTStatus_t statusResult = MQTTSuccess;
+        size_t newSubscriptions = 0U;
+        size_t newHolds = 0U;
+        size_t index;
+        size_t i;
+
+        if( pCommand->commandType == SUBSCRIBE )
+        {
+            /* The subscriptions of a SUBSCRIBE are kept when its SUBACK is
+             * received, so room is kept for those waiting for it. */
+            for( i = 0U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+            {
+                pAckInfo = &( pMqttAgentContext->pPendingAcks[ i ] );
+
+                if( ( pAckInfo->packetId != MQTT_PACKET_ID_INVALID ) &&
+                    ( pAckInfo->pOriginalCommand != NULL ) &&
+                    ( pAckInfo->pOriginalCommand->commandType == SUBSCRIBE ) &&
+                    ( pAckInfo->pOriginalCommand->pArgs != NULL ) )
+                {
+                    countNewHolds( pMqttAgentContext, pAckInfo->pOriginalCommand, &newSubscriptions, &newHolds );
+                }
+            }
+
+            countNewHolds( pMqttAgentContext, pCommand, &newSubscriptions, &newHolds );
+
+            if( ( ( pMqttAgentContext->subscriptionCount + newSubscriptions ) > MQTT_AGENT_MAX_SUBSCRIPTIONS ) ||
+                ( ( pMqttAgentContext->subscriptionHoldCount + newHolds ) > MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS ) )
+            {
+                LogError( ( "No room to keep the subscriptions of a SUBSCRIBE command. Subscriptions: %lu, holds: %lu.",
+                            ( unsigned long ) newSubscriptions,
+                            ( unsigned long ) newHolds ) );
+                statusResult = MQTTNoMemory;
+            }
+        }
+        else
+        {
+            for( i = 0U; ( statusResult == MQTTSuccess ) && ( i < pSubscribeArgs->numSubscriptions ); i++ )
+            {
+                pSubscribeInfo = &( pSubscribeArgs->pSubscribeInfo[ i ] );
+                index = findSubscription( pMqttAgentContext,
+                                          pSubscribeInfo->pTopicFilter,
+                                          pSubscribeInfo->topicFilterLength );
+
+                if( ( index < pMqttAgentContext->subscriptionCount ) &&
+                    ( findHold( pMqttAgentContext, index, pCommand->pSubscriber ) == pMqttAgentContext->subscriptionHoldCount ) )
+                {
+                    LogError( ( "Cannot unsubscribe from %.*s, which the task does not hold.",
+                                pSubscribeInfo->topicFilterLength,
+                                pSubscribeInfo->pTopicFilter ) );
+                    statusResult = MQTTBadParameter;
+                }
+            }
+        }
+
+        return statusResult;
     }
 
-    commandReleased = pAgentContext->agentInterface.releaseCommand( pCommand );
+#endif /* if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U ) */
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentCommand_t * receiveCommand( MQTTAgentContext_t * pMqttAgentContext,
+                                            uint32_t blockTimeMs )
+{
+    MQTTAgentCommand_t * pCommand = NULL;
+
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+    {
+        MQTTAgentReturnInfo_t returnInfo;
+        bool superseded = false;
+
+        do
+        {
+            pCommand = NULL;
+
+            if( pMqttAgentContext->stagedCommandCount > 0U )
+            {
+                pCommand = pMqttAgentContext->pStagedCommands[ pMqttAgentContext->stagedCommandStart ];
+                pMqttAgentContext->stagedCommandStart = ( pMqttAgentContext->stagedCommandStart + 1U ) %
+                                                        MQTT_AGENT_CONFLATION_LOOKAHEAD;
+                pMqttAgentContext->stagedCommandCount--;
+            }
+            else
+            {
+                ( void ) pMqttAgentContext->agentInterface.recv( pMqttAgentContext->agentInterface.pMsgCtx,
+                                                                 &( pCommand ),
+                                                                 blockTimeMs );
+            }
+
+            superseded = false;
+
+            if( ( pCommand != NULL ) && ( pCommand->commandType == PUBLISH ) && pCommand->conflate )
+            {
+                stageCommands( pMqttAgentContext );
+                superseded = isSuperseded( pMqttAgentContext, pCommand );
+            }
+
+            if( superseded )
+            {
+                ( void ) memset( &returnInfo, 0x00, sizeof( MQTTAgentReturnInfo_t ) );
+                returnInfo.returnCode = MQTTSuccess;
+                returnInfo.superseded = true;
 
-    if( !commandReleased )
+                concludeCommandWithInfo( pMqttAgentContext, pCommand, &returnInfo );
+            }
+        } while( superseded );
+    }
+    #else /* if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U ) */
     {
-        LogError( ( "Failed to release command %p of type %d.",
-                    ( void * ) pCommand,
-                    pCommand->commandType ) );
+        ( void ) pMqttAgentContext->agentInterface.recv( pMqttAgentContext->agentInterface.pMsgCtx,
+                                                         &( pCommand ),
+                                                         blockTimeMs );
     }
+    #endif /* if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U ) */
+
+    return pCommand;
 }
 
 /*-----------------------------------------------------------*/
@@ -842,8 +2260,10 @@ static MQTTStatus_t resendPublishes( MQTTAgentContext_t * pMqttAgentContext )
 
             if( statusResult != MQTTSuccess )
             {
-                concludeCommand( pMqttAgentContext, pFoundAck->pOriginalCommand, statusResult, NULL );
-                ( void ) memset( pFoundAck, 0x00, sizeof( MQTTAgentAckInfo_t ) );
+                /* Leave the publish pending, so the next resumed session sends
+                 * it again. The broker may already hold a QoS 2 publish with
+                 * this packet ID, so completing it here and reusing the ID
+                 * later could lose a message. */
                 LogError( ( "Failed to resend publishes. Error code=%s\n", MQTT_Status_strerror( statusResult ) ) );
                 break;
             }
@@ -885,6 +2305,8 @@ static void clearPendingAcknowledgments( MQTTAgentContext_t * pMqttAgentContext,
 
             if( clearEntry )
             {
+                notifySession( pMqttAgentContext, &( pendingAcks[ i ] ) );
+
                 /* Receive failed to indicate network error. */
                 concludeCommand( pMqttAgentContext, pendingAcks[ i ].pOriginalCommand, MQTTRecvFailed, NULL );
 
@@ -960,7 +2382,291 @@ static bool validateParams( MQTTAgentCommandType_t commandType,
             break;
     }
 
-    return ret;
+    return ret;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getTimerRemainingMs( const MQTTAgentTimer_t * pTimer,
+                                     uint32_t nowMs )
+{
+    /* Unsigned arithmetic keeps the elapsed time correct when the time wraps. */
+    uint32_t elapsedMs = nowMs - pTimer->startTimeMs;
+
+    return ( elapsedMs >= pTimer->delayMs ) ? 0U : ( pTimer->delayMs - elapsedMs );
+}
+
+/*-----------------------------------------------------------*/
+
+static void insertTimer( MQTTAgentContext_t * pMqttAgentContext,
+                         MQTTAgentTimer_t * pTimer,
+                         uint32_t nowMs )
+{
+    MQTTAgentTimer_t ** ppNext = &( pMqttAgentContext->pTimerList );
+    uint32_t remainingMs = getTimerRemainingMs( pTimer, nowMs );
+
+    while( ( *ppNext != NULL ) &&
+           ( getTimerRemainingMs( *ppNext, nowMs ) <= remainingMs ) )
+    {
+        ppNext = &( ( *ppNext )->pNext );
+    }
+
+    pTimer->pNext = *ppNext;
+    *ppNext = pTimer;
+}
+
+/*-----------------------------------------------------------*/
+
+static void removeTimer( MQTTAgentTimer_t ** ppList,
+                         const MQTTAgentTimer_t * pTimer )
+{
+    MQTTAgentTimer_t ** ppNext = ppList;
+
+    while( ( *ppNext != NULL ) && ( *ppNext != pTimer ) )
+    {
+        ppNext = &( ( *ppNext )->pNext );
+    }
+
+    if( *ppNext != NULL )
+    {
+        *ppNext = pTimer->pNext;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void processTimers( MQTTAgentContext_t * pMqttAgentContext )
+{
+    MQTTAgentTimer_t * pTimer;
+    MQTTAgentTimer_t ** ppExpiredTail = &( pMqttAgentContext->pExpiredTimerList );
+    uint32_t nowMs;
+
+    if( pMqttAgentContext->pTimerList != NULL )
+    {
+        nowMs = pMqttAgentContext->mqttContext.getTime();
+
+        /* The list is sorted, so the expired timers are at its head. Move them
+         * to the expired list, where MQTTAgent_StopTimer() can still remove
+         * them before their callback runs. */
+        while( ( pMqttAgentContext->pTimerList != NULL ) &&
+               ( getTimerRemainingMs( pMqttAgentContext->pTimerList, nowMs ) == 0U ) )
+        {
+            pTimer = pMqttAgentContext->pTimerList;
+            pMqttAgentContext->pTimerList = pTimer->pNext;
+            pTimer->pNext = NULL;
+            *ppExpiredTail = pTimer;
+            ppExpiredTail = &( pTimer->pNext );
+        }
+
+        while( pMqttAgentContext->pExpiredTimerList != NULL )
+        {
+            pTimer = pMqttAgentContext->pExpiredTimerList;
+            pMqttAgentContext->pExpiredTimerList = pTimer->pNext;
+            pTimer->pNext = NULL;
+
+            if( pTimer->periodMs != 0U )
+            {
+                /* Reload from the expiry time so the period does not drift,
+                 * unless a whole period has already been missed. */
+                pTimer->startTimeMs += pTimer->delayMs;
+                pTimer->delayMs = pTimer->periodMs;
+
+                if( getTimerRemainingMs( pTimer, nowMs ) == 0U )
+                {
+                    pTimer->startTimeMs = nowMs;
+                }
+
+                insertTimer( pMqttAgentContext, pTimer, nowMs );
+            }
+
+            /* Called last, as the callback may stop or restart the timer. */
+            pTimer->callback( pMqttAgentContext, pTimer );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getCommandWaitTimeMs( const MQTTAgentContext_t * pMqttAgentContext )
+{
+    uint32_t waitTimeMs = MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME;
+    uint32_t remainingMs;
+
+    if( pMqttAgentContext->packetReceivedInLoop )
+    {
+        /* The last MQTT_ProcessLoop() call received a packet, and more may be
+         * waiting since the number of calls in a row is limited. */
+        waitTimeMs = 0U;
+    }
+    else if( pMqttAgentContext->pTimerList != NULL )
+    {
+        remainingMs = getTimerRemainingMs( pMqttAgentContext->pTimerList,
+                                           pMqttAgentContext->mqttContext.getTime() );
+
+        if( remainingMs < waitTimeMs )
+        {
+            waitTimeMs = remainingMs;
+        }
+    }
+
+    return waitTimeMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isProducerPublishPending( const MQTTAgentContext_t * pMqttAgentContext,
+                                      const MQTTAgentProducer_t * pProducer )
+{
+    const MQTTAgentAckInfo_t * pendingAcks = pMqttAgentContext->pPendingAcks;
+    bool pending = false;
+    size_t i;
+
+    if( pProducer->packetId != MQTT_PACKET_ID_INVALID )
+    {
+        for( i = 0; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+        {
+            /* The packet ID may have been reused by another command once the
+             * publish of the producer completed, so check the arguments too. */
+            if( ( pendingAcks[ i ].packetId == pProducer->packetId ) &&
+                ( pendingAcks[ i ].pOriginalCommand != NULL ) &&
+                ( pendingAcks[ i ].pOriginalCommand->pArgs == ( const void * ) &( pProducer->publishInfo ) ) )
+            {
+                pending = true;
+                break;
+            }
+        }
+    }
+
+    return pending;
+}
+
+/*-----------------------------------------------------------*/
+
+static void producerTimerCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                   MQTTAgentTimer_t * pTimer )
+{
+    MQTTAgentProducer_t * pProducer = ( MQTTAgentProducer_t * ) pTimer->pTimerContext;
+    MQTTAgentCommand_t * pCommand = NULL;
+    MQTTStatus_t statusResult = MQTTSuccess;
+    size_t payloadLength = 0U;
+    bool canSend;
+    bool filled = false;
+    bool commandReleased;
+
+    canSend = ( pMqttAgentContext->mqttContext.connectStatus == MQTTConnected );
+
+    if( canSend && ( pProducer->publishInfo.qos != MQTTQoS0 ) )
+    {
+        /* Keep at most one publish of the producer awaiting an ack. Skipped
+         * samples are conflated into the next publish. */
+        canSend = ( !isProducerPublishPending( pMqttAgentContext, pProducer ) ) &&
+                  isSpaceInPendingAckList( pMqttAgentContext );
+
+        if( canSend )
+        {
+            /* The command records the publish in the list of pending acks. */
+            pCommand = pMqttAgentContext->agentInterface.getCommand( 0U );
+            canSend = ( pCommand != NULL );
+        }
+    }
+
+    if( canSend )
+    {
+        filled = pProducer->fill( pProducer,
+                                  pProducer->pPayloadBuffer,
+                                  pProducer->payloadBufferSize,
+                                  &payloadLength );
+
+        if( filled && ( payloadLength > pProducer->payloadBufferSize ) )
+        {
+            LogError( ( "Producer payload length %lu exceeds its buffer size %lu.",
+                        ( unsigned long ) payloadLength,
+                        ( unsigned long ) pProducer->payloadBufferSize ) );
+            filled = false;
+        }
+    }
+    else
+    {
+        pProducer->skipCount++;
+    }
+
+    if( filled )
+    {
+        pProducer->publishInfo.pPayload = pProducer->pPayloadBuffer;
+        pProducer->publishInfo.payloadLength = payloadLength;
+        /* A resumed session may have set the flag to resend the last sample. */
+        pProducer->publishInfo.dup = false;
+        pProducer->packetId = MQTT_PACKET_ID_INVALID;
+
+        if( pCommand != NULL )
+        {
+            ( void ) memset( pCommand, 0x00, sizeof( MQTTAgentCommand_t ) );
+            pCommand->commandType = PUBLISH;
+            pCommand->pArgs = &( pProducer->publishInfo );
+            pProducer->packetId = MQTT_GetPacketId( &( pMqttAgentContext->mqttContext ) );
+
+            /* Saved before the send, as by MQTTAgentCommand_Publish(). */
+            if( pMqttAgentContext->pSessionCallback != NULL )
+            {
+                pMqttAgentContext->pSessionCallback( pMqttAgentContext->pSessionCallbackContext,
+                                                     pProducer->packetId,
+                                                     &( pProducer->publishInfo ) );
+            }
+        }
+
+        statusResult = MQTT_Publish( &( pMqttAgentContext->mqttContext ),
+                                     &( pProducer->publishInfo ),
+                                     pProducer->packetId );
+
+        if( ( statusResult != MQTTSuccess ) && ( pCommand != NULL ) )
+        {
+            /* Release the state record coreMQTT kept for the failed send, and
+             * the saved copy, as MQTTAgentCommand_Publish() does. */
+            if( statusResult == MQTTSendFailed )
+            {
+                ( void ) MQTT_CancelCallback( &( pMqttAgentContext->mqttContext ), pProducer->packetId );
+            }
+
+            if( pMqttAgentContext->pSessionCallback != NULL )
+            {
+                pMqttAgentContext->pSessionCallback( pMqttAgentContext->pSessionCallbackContext,
+                                                     pProducer->packetId,
+                                                     NULL );
+            }
+        }
+
+        if( ( statusResult == MQTTSuccess ) && ( pCommand != NULL ) )
+        {
+            statusResult = awaitAcknowledgment( pMqttAgentContext, pProducer->packetId, pCommand );
+
+            if( statusResult == MQTTSuccess )
+            {
+                /* The command is now owned by the list of pending acks. */
+                pCommand = NULL;
+            }
+        }
+
+        if( statusResult == MQTTSuccess )
+        {
+            pProducer->publishCount++;
+        }
+        else
+        {
+            LogError( ( "Producer publish failed with status %s.",
+                        MQTT_Status_strerror( statusResult ) ) );
+        }
+    }
+
+    if( pCommand != NULL )
+    {
+        commandReleased = pMqttAgentContext->agentInterface.releaseCommand( pCommand );
+
+        if( !commandReleased )
+        {
+            LogError( ( "Command %p could not be released.",
+                        ( void * ) pCommand ) );
+        }
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -1055,13 +2761,11 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
     /* Loop until an error or we receive a terminate command. */
     while( operationStatus == MQTTSuccess )
     {
-        /* Wait for the next command, if any. */
-        pCommand = NULL;
-        ( void ) pMqttAgentContext->agentInterface.recv(
-            pMqttAgentContext->agentInterface.pMsgCtx,
-            &( pCommand ),
-            MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME
-            );
+        /* Run the callbacks of expired timers. */
+        processTimers( pMqttAgentContext );
+
+        /* Wait for the next command, if any, until the next timer expires. */
+        pCommand = receiveCommand( pMqttAgentContext, getCommandWaitTimeMs( pMqttAgentContext ) );
         operationStatus = processCommand( pMqttAgentContext, pCommand, &endLoop );
 
         if( operationStatus != MQTTSuccess )
@@ -1082,6 +2786,75 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext )
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MQTTAgent_Step( MQTTAgentContext_t * pMqttAgentContext,
+                             uint32_t * pWaitTimeMs,
+                             bool * pEndLoop )
+{
+    MQTTAgentCommand_t * pCommand;
+    MQTTStatus_t operationStatus = MQTTSuccess;
+    bool endLoop = false;
+    bool receiveMore;
+    size_t commandCount = 0U;
+
+    if( ( pMqttAgentContext == NULL ) ||
+        ( pMqttAgentContext->agentInterface.pMsgCtx == NULL ) ||
+        ( pWaitTimeMs == NULL ) ||
+        ( pEndLoop == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext=%p, pWaitTimeMs=%p, pEndLoop=%p.",
+                    ( void * ) pMqttAgentContext,
+                    ( void * ) pWaitTimeMs,
+                    ( void * ) pEndLoop ) );
+        operationStatus = MQTTBadParameter;
+    }
+    else
+    {
+        /* Run the callbacks of expired timers. */
+        processTimers( pMqttAgentContext );
+
+        /* Process the queued commands without waiting. When there is none,
+         * only the process loop is run. */
+        do
+        {
+            pCommand = receiveCommand( pMqttAgentContext, 0U );
+            operationStatus = processCommand( pMqttAgentContext, pCommand, &endLoop );
+            commandCount++;
+            receiveMore = ( pCommand != NULL ) && !endLoop;
+
+            #if ( MQTT_AGENT_MAX_STEP_COMMANDS > 0U )
+            {
+                /* Return to the event loop while commands may still be
+                 * queued, so that a task filling the queue does not starve
+                 * the other event sources of the loop. */
+                receiveMore = receiveMore && ( commandCount < MQTT_AGENT_MAX_STEP_COMMANDS );
+            }
+            #endif
+        } while( receiveMore );
+
+        if( operationStatus != MQTTSuccess )
+        {
+            LogError( ( "MQTT operation failed with status %s\n",
+                        MQTT_Status_strerror( operationStatus ) ) );
+        }
+
+        if( ( pCommand != NULL ) && !endLoop )
+        {
+            /* The limit was reached, so call again without waiting. */
+            *pWaitTimeMs = 0U;
+        }
+        else
+        {
+            *pWaitTimeMs = getCommandWaitTimeMs( pMqttAgentContext );
+        }
+
+        *pEndLoop = endLoop;
+    }
+
+    return operationStatus;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
                                       bool sessionPresent )
 {
@@ -1104,6 +2877,17 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
             clearPendingAcknowledgments( pMqttAgentContext, true );
 
             statusResult = resendPublishes( pMqttAgentContext );
+
+            /* Subscriptions sent again on the previous connection may not
+             * have reached the broker. */
+            #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+            {
+                if( statusResult == MQTTSuccess )
+                {
+                    statusResult = replaySubscriptions( pMqttAgentContext, false );
+                }
+            }
+            #endif
         }
 
         /* If we wanted to resume a session but none existed with the broker, we
@@ -1113,6 +2897,14 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
         {
             /* We have a clean session, so clear all operations pending acknowledgments. */
             clearPendingAcknowledgments( pMqttAgentContext, false );
+
+            /* The broker has no subscriptions, so subscribe again to those the
+             * agent kept. */
+            #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+            {
+                statusResult = replaySubscriptions( pMqttAgentContext, true );
+            }
+            #endif
         }
     }
     else
@@ -1125,6 +2917,245 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MQTTAgent_RegisterCommands( MQTTAgentContext_t * pMqttAgentContext,
+                                         const MQTTAgentCommandFunc_t * pCommandTable,
+                                         size_t numCommands )
+{
+    MQTTStatus_t statusReturn = MQTTSuccess;
+    size_t i;
+
+    if( ( pMqttAgentContext == NULL ) ||
+        ( ( pCommandTable == NULL ) && ( numCommands > 0U ) ) )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext=%p, pCommandTable=%p, numCommands=%lu.",
+                    ( void * ) pMqttAgentContext,
+                    ( const void * ) pCommandTable,
+                    ( unsigned long ) numCommands ) );
+        statusReturn = MQTTBadParameter;
+    }
+    else if( numCommands > MQTT_AGENT_MAX_CUSTOM_COMMANDS )
+    {
+        LogError( ( "Invalid parameter: numCommands=%lu exceeds the maximum of %lu.",
+                    ( unsigned long ) numCommands,
+                    ( unsigned long ) MQTT_AGENT_MAX_CUSTOM_COMMANDS ) );
+        statusReturn = MQTTBadParameter;
+    }
+    else
+    {
+        for( i = 0U; ( i < numCommands ) && ( statusReturn == MQTTSuccess ); i++ )
+        {
+            if( pCommandTable[ i ] == NULL )
+            {
+                LogError( ( "Invalid parameter: pCommandTable[ %lu ] is NULL.",
+                            ( unsigned long ) i ) );
+                statusReturn = MQTTBadParameter;
+            }
+        }
+    }
+
+    if( statusReturn == MQTTSuccess )
+    {
+        pMqttAgentContext->pCustomCommandTable = ( numCommands > 0U ) ? pCommandTable : NULL;
+        pMqttAgentContext->customCommandCount = numCommands;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_SetCompletionQueue( MQTTAgentContext_t * pMqttAgentContext,
+                                           struct MQTTAgentCompletionQueue * pCompletionQueue )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( pMqttAgentContext == NULL )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext=%p.",
+                    ( void * ) pMqttAgentContext ) );
+    }
+    else
+    {
+        pMqttAgentContext->pCompletionQueue = pCompletionQueue;
+        statusReturn = MQTTSuccess;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_SetSessionCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                           MQTTAgentSessionCallback_t sessionCallback,
+                                           void * pSessionContext )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( pMqttAgentContext == NULL )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext=%p.",
+                    ( void * ) pMqttAgentContext ) );
+    }
+    else
+    {
+        pMqttAgentContext->pSessionCallback = sessionCallback;
+        pMqttAgentContext->pSessionCallbackContext = pSessionContext;
+        statusReturn = MQTTSuccess;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_RestorePublish( MQTTAgentContext_t * pMqttAgentContext,
+                                       uint16_t packetId,
+                                       MQTTPublishInfo_t * pPublishInfo,
+                                       MQTTAgentCommand_t * pCommandStorage )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    /* If the packet ID is zero then the MQTT context has not been initialized as 0
+     * is the initial value but not a valid packet ID. */
+    if( ( pMqttAgentContext == NULL ) ||
+        ( pMqttAgentContext->mqttContext.nextPacketId == MQTT_PACKET_ID_INVALID ) ||
+        ( packetId == MQTT_PACKET_ID_INVALID ) ||
+        ( pPublishInfo == NULL ) ||
+        ( pCommandStorage == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext=%p, packetId=%hu, "
+                    "pPublishInfo=%p, pCommandStorage=%p.",
+                    ( void * ) pMqttAgentContext,
+                    ( unsigned short ) packetId,
+                    ( void * ) pPublishInfo,
+                    ( void * ) pCommandStorage ) );
+    }
+    else if( pPublishInfo->qos == MQTTQoS0 )
+    {
+        LogError( ( "Only QoS 1 and QoS 2 publishes can be restored." ) );
+    }
+    else
+    {
+        statusReturn = createCommand( PUBLISH,
+                                      pMqttAgentContext,
+                                      pPublishInfo,
+                                      NULL,
+                                      NULL,
+                                      pCommandStorage );
+
+        if( statusReturn == MQTTSuccess )
+        {
+            /* The session callback is not notified, as the publish was saved
+             * when it was first sent. */
+            pCommandStorage->callerOwned = true;
+            statusReturn = addAwaitingOperation( pMqttAgentContext, packetId, pCommandStorage );
+        }
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_StartTimer( MQTTAgentContext_t * pMqttAgentContext,
+                                   MQTTAgentTimer_t * pTimer,
+                                   uint32_t delayMs,
+                                   uint32_t periodMs )
+{
+    MQTTStatus_t statusReturn = MQTTSuccess;
+
+    if( ( pMqttAgentContext == NULL ) ||
+        ( pMqttAgentContext->mqttContext.getTime == NULL ) ||
+        ( pTimer == NULL ) ||
+        ( pTimer->callback == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pMqttAgentContext and pTimer must be "
+                    "initialized and pTimer must have a callback." ) );
+        statusReturn = MQTTBadParameter;
+    }
+    else
+    {
+        /* Restart the timer if it is already running. */
+        removeTimer( &( pMqttAgentContext->pTimerList ), pTimer );
+        removeTimer( &( pMqttAgentContext->pExpiredTimerList ), pTimer );
+
+        pTimer->startTimeMs = pMqttAgentContext->mqttContext.getTime();
+        pTimer->delayMs = delayMs;
+        pTimer->periodMs = periodMs;
+
+        insertTimer( pMqttAgentContext, pTimer, pTimer->startTimeMs );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_StopTimer( MQTTAgentContext_t * pMqttAgentContext,
+                                  MQTTAgentTimer_t * pTimer )
+{
+    MQTTStatus_t statusReturn = MQTTSuccess;
+
+    if( ( pMqttAgentContext == NULL ) || ( pTimer == NULL ) )
+    {
+        statusReturn = MQTTBadParameter;
+    }
+    else
+    {
+        removeTimer( &( pMqttAgentContext->pTimerList ), pTimer );
+        removeTimer( &( pMqttAgentContext->pExpiredTimerList ), pTimer );
+        pTimer->pNext = NULL;
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_StartProducer( MQTTAgentContext_t * pMqttAgentContext,
+                                      MQTTAgentProducer_t * pProducer,
+                                      uint32_t periodMs )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( ( pProducer == NULL ) ||
+        ( pProducer->fill == NULL ) ||
+        ( pProducer->pPayloadBuffer == NULL ) ||
+        ( pProducer->publishInfo.pTopicName == NULL ) ||
+        ( pProducer->publishInfo.topicNameLength == 0U ) ||
+        ( periodMs == 0U ) )
+    {
+        LogError( ( "Invalid parameter: pProducer must set a topic, fill function "
+                    "and payload buffer, and periodMs must not be zero." ) );
+    }
+    else
+    {
+        pProducer->timer.callback = producerTimerCallback;
+        pProducer->timer.pTimerContext = pProducer;
+
+        statusReturn = MQTTAgent_StartTimer( pMqttAgentContext, &( pProducer->timer ), periodMs, periodMs );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_StopProducer( MQTTAgentContext_t * pMqttAgentContext,
+                                     MQTTAgentProducer_t * pProducer )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+
+    if( pProducer != NULL )
+    {
+        statusReturn = MQTTAgent_StopTimer( pMqttAgentContext, &( pProducer->timer ) );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
 MQTTStatus_t MQTTAgent_CancelAll( MQTTAgentContext_t * pMqttAgentContext )
 {
     MQTTStatus_t statusReturn = MQTTSuccess;
@@ -1139,6 +3170,20 @@ MQTTStatus_t MQTTAgent_CancelAll( MQTTAgentContext_t * pMqttAgentContext )
     }
     else
     {
+        #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+        {
+            /* Cancel the operations received ahead of the command loop. */
+            while( pMqttAgentContext->stagedCommandCount > 0U )
+            {
+                pReceivedCommand = pMqttAgentContext->pStagedCommands[ pMqttAgentContext->stagedCommandStart ];
+                pMqttAgentContext->stagedCommandStart = ( pMqttAgentContext->stagedCommandStart + 1U ) %
+                                                        MQTT_AGENT_CONFLATION_LOOKAHEAD;
+                pMqttAgentContext->stagedCommandCount--;
+                concludeCommand( pMqttAgentContext, pReceivedCommand, MQTTRecvFailed, NULL );
+            }
+        }
+        #endif
+
         /* Cancel all operations waiting in the queue. */
         do
         {
@@ -1161,6 +3206,7 @@ MQTTStatus_t MQTTAgent_CancelAll( MQTTAgentContext_t * pMqttAgentContext )
         {
             if( pendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID )
             {
+                notifySession( pMqttAgentContext, &( pendingAcks[ i ] ) );
                 concludeCommand( pMqttAgentContext, pendingAcks[ i ].pOriginalCommand, MQTTRecvFailed, NULL );
 
                 /* Now remove it from the list. */
@@ -1191,7 +3237,10 @@ MQTTStatus_t MQTTAgent_Subscribe( const MQTTAgentContext_t * pMqttAgentContext,
                                             pSubscriptionArgs,                         /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            pCommandInfo->pSubscriber,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1216,7 +3265,10 @@ MQTTStatus_t MQTTAgent_Unsubscribe( const MQTTAgentContext_t * pMqttAgentContext
                                             pSubscriptionArgs,                         /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            pCommandInfo->pSubscriber,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1241,7 +3293,47 @@ MQTTStatus_t MQTTAgent_Publish( const MQTTAgentContext_t * pMqttAgentContext,
                                             pPublishInfo,                              /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            pCommandInfo->conflate,
+                                            NULL,
+                                            NULL );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_PublishWithStorage( const MQTTAgentContext_t * pMqttAgentContext,
+                                           MQTTPublishInfo_t * pPublishInfo,
+                                           const MQTTAgentCommandInfo_t * pCommandInfo,
+                                           MQTTAgentCommand_t * pCommandStorage )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+    bool paramsValid = false;
+
+    paramsValid = validateStruct( pMqttAgentContext, pCommandInfo ) &&
+                  validateParams( PUBLISH, pPublishInfo );
+
+    if( pCommandStorage == NULL )
+    {
+        LogError( ( "pCommandStorage cannot be NULL." ) );
+    }
+    else if( paramsValid )
+    {
+        statusReturn = createAndAddCommand( PUBLISH,                                   /* commandType */
+                                            pMqttAgentContext,                         /* mqttContextHandle */
+                                            pPublishInfo,                              /* pMqttInfoParam */
+                                            pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
+                                            pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
+                                            pCommandInfo->blockTimeMs,
+                                            pCommandInfo->conflate,
+                                            NULL,
+                                            pCommandStorage );
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
     }
 
     return statusReturn;
@@ -1264,7 +3356,10 @@ MQTTStatus_t MQTTAgent_ProcessLoop( const MQTTAgentContext_t * pMqttAgentContext
                                             NULL,                                      /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1289,7 +3384,10 @@ MQTTStatus_t MQTTAgent_Connect( const MQTTAgentContext_t * pMqttAgentContext,
                                             pConnectArgs,
                                             pCommandInfo->cmdCompleteCallback,
                                             pCommandInfo->pCmdCompleteCallbackContext,
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1312,7 +3410,10 @@ MQTTStatus_t MQTTAgent_Disconnect( const MQTTAgentContext_t * pMqttAgentContext,
                                             NULL,                                      /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1335,7 +3436,10 @@ MQTTStatus_t MQTTAgent_Ping( const MQTTAgentContext_t * pMqttAgentContext,
                                             NULL,                                      /* pMqttInfoParam */
                                             pCommandInfo->cmdCompleteCallback,         /* commandCompleteCallback */
                                             pCommandInfo->pCmdCompleteCallbackContext, /* pCommandCompleteCallbackContext */
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
     }
 
     return statusReturn;
@@ -1358,7 +3462,46 @@ MQTTStatus_t MQTTAgent_Terminate( const MQTTAgentContext_t * pMqttAgentContext,
                                             NULL,
                                             pCommandInfo->cmdCompleteCallback,
                                             pCommandInfo->pCmdCompleteCallbackContext,
-                                            pCommandInfo->blockTimeMs );
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
+    }
+
+    return statusReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgent_CustomCommand( const MQTTAgentContext_t * pMqttAgentContext,
+                                      uint32_t commandId,
+                                      void * pArgs,
+                                      const MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    MQTTStatus_t statusReturn = MQTTBadParameter;
+    bool paramsValid = false;
+
+    paramsValid = validateStruct( pMqttAgentContext, pCommandInfo );
+
+    if( paramsValid && ( ( size_t ) commandId >= pMqttAgentContext->customCommandCount ) )
+    {
+        LogError( ( "Command %lu is not registered. Number of registered commands=%lu.",
+                    ( unsigned long ) commandId,
+                    ( unsigned long ) pMqttAgentContext->customCommandCount ) );
+        paramsValid = false;
+    }
+
+    if( paramsValid )
+    {
+        statusReturn = createAndAddCommand( ( MQTTAgentCommandType_t ) ( ( uint32_t ) NUM_COMMANDS + commandId ),
+                                            pMqttAgentContext,
+                                            pArgs,
+                                            pCommandInfo->cmdCompleteCallback,
+                                            pCommandInfo->pCmdCompleteCallbackContext,
+                                            pCommandInfo->blockTimeMs,
+                                            false,
+                                            NULL,
+                                            NULL );
     }
 
     return statusReturn;
@@ -0,0 +1,421 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file core_mqtt_agent_batch.c
+ * @brief Implements batching of small messages into envelope publishes.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/* Header include. */
+#include "core_mqtt_agent_batch.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/* Envelopes are handed between tasks, so real fences are required. */
+#if !defined( MQTT_AGENT_RELEASE_FENCE ) || !defined( MQTT_AGENT_ACQUIRE_FENCE )
+    #error "Define MQTT_AGENT_RELEASE_FENCE() and MQTT_AGENT_ACQUIRE_FENCE() for this compiler to use batches."
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Completion callback of an envelope publish. Invokes the completion
+ * callback of each message in the envelope, then releases the envelope.
+ *
+ * @param[in] pCmdCallbackContext The envelope.
+ * @param[in] pReturnInfo Return information of the envelope publish.
+ */
+static void envelopeCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                      MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Send the envelope being filled.
+ *
+ * @param[in] pBatch Batch to send from.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue the envelope publish.
+ *
+ * @return Status of MQTTAgent_Publish().
+ */
+static MQTTStatus_t sendEnvelope( MQTTAgentBatch_t * pBatch,
+                                  uint32_t blockTimeMs );
+
+/**
+ * @brief Check whether the envelope being filled is due to be sent.
+ *
+ * @param[in] pBatch Batch to check.
+ *
+ * @return `true` if the envelope has a message and the delay of the batch has
+ * passed since its first message was added, else `false`.
+ */
+static bool isEnvelopeDue( const MQTTAgentBatch_t * pBatch );
+
+/*-----------------------------------------------------------*/
+
+static void envelopeCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                      MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    /* MISRA Ref 11.2.1 [Opaque command context] */
+    /* More details at: https://github.com/FreeRTOS/coreMQTT-Agent/blob/main/MISRA.md#rule-112 */
+    /* coverity[misra_c_2012_rule_11_2_violation] */
+    MQTTAgentBatchEnvelope_t * pEnvelope = ( MQTTAgentBatchEnvelope_t * ) ( void * ) pCmdCallbackContext;
+    const MQTTAgentBatchMessage_t * pMessage;
+    size_t i;
+
+    assert( pEnvelope != NULL );
+
+    for( i = 0U; i < pEnvelope->messageCount; i++ )
+    {
+        pMessage = &( pEnvelope->messages[ i ] );
+
+        if( pMessage->cmdCompleteCallback != NULL )
+        {
+            pMessage->cmdCompleteCallback( pMessage->pCmdCompleteCallbackContext, pReturnInfo );
+        }
+    }
+
+    /* Hand the envelope back to the task adding messages last, as it may
+     * start filling the envelope again as soon as this is cleared. The fence
+     * keeps the reads of the messages above from moving past it. */
+    MQTT_AGENT_RELEASE_FENCE();
+    pEnvelope->inFlight = false;
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t sendEnvelope( MQTTAgentBatch_t * pBatch,
+                                  uint32_t blockTimeMs )
+{
+    MQTTStatus_t statusResult;
+    MQTTAgentBatchEnvelope_t * pEnvelope = &( pBatch->envelopes[ pBatch->fillIndex ] );
+    MQTTAgentCommandInfo_t commandInfo;
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( MQTTAgentCommandInfo_t ) );
+
+    /* MISRA Ref 11.2.1 [Opaque command context] */
+    /* More details at: https://github.com/FreeRTOS/coreMQTT-Agent/blob/main/MISRA.md#rule-112 */
+    /* coverity[misra_c_2012_rule_11_2_violation] */
+    commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) ( void * ) pEnvelope;
+    commandInfo.cmdCompleteCallback = envelopeCompleteCallback;
+    commandInfo.blockTimeMs = blockTimeMs;
+
+    pEnvelope->publishInfo.payloadLength = pBatch->fillLength;
+    pEnvelope->messageCount = pBatch->fillCount;
+    pEnvelope->inFlight = true;
+
+    statusResult = MQTTAgent_Publish( pBatch->pAgentContext, &( pEnvelope->publishInfo ), &commandInfo );
+
+    if( statusResult == MQTTSuccess )
+    {
+        /* Fill the other envelope from now on. */
+        pBatch->fillIndex = ( pBatch->fillIndex + 1U ) % 2U;
+        pBatch->fillLength = 0U;
+        pBatch->fillCount = 0U;
+    }
+    else
+    {
+        /* The envelope was not enqueued, so keep filling it. */
+        pEnvelope->inFlight = false;
+        LogError( ( "Failed to send envelope of %lu messages: %s",
+                    ( unsigned long ) pBatch->fillCount,
+                    MQTT_Status_strerror( statusResult ) ) );
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isEnvelopeDue( const MQTTAgentBatch_t * pBatch )
+{
+    uint32_t elapsedMs;
+    bool due = false;
+
+    if( pBatch->fillCount > 0U )
+    {
+        /* Unsigned subtraction is correct across a wrap of the time. */
+        elapsedMs = pBatch->pAgentContext->mqttContext.getTime() - pBatch->firstMessageTimeMs;
+        due = ( elapsedMs >= pBatch->maxDelayMs );
+    }
+
+    return due;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentBatch_Init( MQTTAgentBatch_t * pBatch,
+                                  const MQTTAgentContext_t * pMqttAgentContext,
+                                  const MQTTPublishInfo_t * pPublishInfo,
+                                  uint8_t * pBuffer,
+                                  size_t bufferSize,
+                                  uint32_t maxDelayMs )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+    size_t i;
+
+    if( ( pBatch == NULL ) || ( pMqttAgentContext == NULL ) || ( pPublishInfo == NULL ) || ( pBuffer == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pBatch=%p, pMqttAgentContext=%p, pPublishInfo=%p, pBuffer=%p.",
+                    ( void * ) pBatch,
+                    ( const void * ) pMqttAgentContext,
+                    ( const void * ) pPublishInfo,
+                    ( void * ) pBuffer ) );
+    }
+    else if( pMqttAgentContext->mqttContext.getTime == NULL )
+    {
+        LogError( ( "The MQTT context must have a time function to batch messages." ) );
+    }
+    else if( ( pPublishInfo->pTopicName == NULL ) || ( pPublishInfo->topicNameLength == 0U ) )
+    {
+        LogError( ( "Invalid topic: pTopicName=%p, topicNameLength=%hu.",
+                    ( const void * ) pPublishInfo->pTopicName,
+                    ( unsigned short ) pPublishInfo->topicNameLength ) );
+    }
+    else if( ( bufferSize / 2U ) <= MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE )
+    {
+        LogError( ( "Buffer of %lu bytes is too small for two envelopes.",
+                    ( unsigned long ) bufferSize ) );
+    }
+    else
+    {
+        ( void ) memset( pBatch, 0x00, sizeof( MQTTAgentBatch_t ) );
+        pBatch->pAgentContext = pMqttAgentContext;
+        pBatch->envelopeSize = bufferSize / 2U;
+        pBatch->maxDelayMs = maxDelayMs;
+
+        for( i = 0U; i < 2U; i++ )
+        {
+            pBatch->envelopes[ i ].publishInfo = *pPublishInfo;
+            pBatch->envelopes[ i ].pBuffer = &( pBuffer[ i * pBatch->envelopeSize ] );
+            pBatch->envelopes[ i ].publishInfo.pPayload = pBatch->envelopes[ i ].pBuffer;
+            pBatch->envelopes[ i ].publishInfo.payloadLength = 0U;
+        }
+
+        statusResult = MQTTSuccess;
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentBatch_Add( MQTTAgentBatch_t * pBatch,
+                                 const uint8_t * pMessage,
+                                 size_t messageLength,
+                                 const MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+    MQTTAgentBatchEnvelope_t * pEnvelope;
+    uint8_t * pPayload;
+
+    if( ( pBatch == NULL ) || ( pBatch->pAgentContext == NULL ) || ( pCommandInfo == NULL ) ||
+        ( ( pMessage == NULL ) && ( messageLength > 0U ) ) )
+    {
+        LogError( ( "Invalid parameter: pBatch=%p, pMessage=%p, pCommandInfo=%p.",
+                    ( void * ) pBatch,
+                    ( const void * ) pMessage,
+                    ( const void * ) pCommandInfo ) );
+        statusResult = MQTTBadParameter;
+    }
+    else if( ( messageLength > MQTT_AGENT_BATCH_MAX_MESSAGE_LENGTH ) ||
+             ( messageLength > ( pBatch->envelopeSize - MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE ) ) )
+    {
+        LogError( ( "Message of %lu bytes does not fit in an envelope of %lu bytes.",
+                    ( unsigned long ) messageLength,
+                    ( unsigned long ) pBatch->envelopeSize ) );
+        statusResult = MQTTBadParameter;
+    }
+    else
+    {
+        /* Send the envelope being filled first if the message does not fit. */
+        if( ( pBatch->fillCount == MQTT_AGENT_BATCH_MAX_MESSAGES ) ||
+            ( ( pBatch->envelopeSize - pBatch->fillLength ) < ( MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE + messageLength ) ) )
+        {
+            statusResult = sendEnvelope( pBatch, pCommandInfo->blockTimeMs );
+        }
+
+        pEnvelope = &( pBatch->envelopes[ pBatch->fillIndex ] );
+
+        if( ( statusResult == MQTTSuccess ) && ( pBatch->fillCount == 0U ) && pEnvelope->inFlight )
+        {
+            LogWarn( ( "Both envelopes of the batch are being sent." ) );
+            statusResult = MQTTNoMemory;
+        }
+
+        if( statusResult == MQTTSuccess )
+        {
+            /* Pairs with the fence in envelopeCompleteCallback(), so the
+             * envelope is not written before the agent task is done with it. */
+            MQTT_AGENT_ACQUIRE_FENCE();
+
+            if( pBatch->fillCount == 0U )
+            {
+                pBatch->firstMessageTimeMs = pBatch->pAgentContext->mqttContext.getTime();
+            }
+
+            pPayload = pEnvelope->pBuffer;
+            pPayload[ pBatch->fillLength ] = ( uint8_t ) ( messageLength >> 8 );
+            pPayload[ pBatch->fillLength + 1U ] = ( uint8_t ) ( messageLength & 0xFFU );
+
+            if( messageLength > 0U )
+            {
+                ( void ) memcpy( &( pPayload[ pBatch->fillLength + MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE ] ),
+                                 pMessage,
+                                 messageLength );
+            }
+
+            pEnvelope->messages[ pBatch->fillCount ].cmdCompleteCallback = pCommandInfo->cmdCompleteCallback;
+            pEnvelope->messages[ pBatch->fillCount ].pCmdCompleteCallbackContext = pCommandInfo->pCmdCompleteCallbackContext;
+            pBatch->fillLength += MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE + messageLength;
+            pBatch->fillCount++;
+
+            /* The message was added, so a failure to send the envelope now is
+             * only reported by the next call. */
+            if( isEnvelopeDue( pBatch ) )
+            {
+                ( void ) sendEnvelope( pBatch, pCommandInfo->blockTimeMs );
+            }
+        }
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentBatch_Flush( MQTTAgentBatch_t * pBatch,
+                                   uint32_t blockTimeMs )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+
+    if( ( pBatch == NULL ) || ( pBatch->pAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pBatch=%p.", ( void * ) pBatch ) );
+        statusResult = MQTTBadParameter;
+    }
+    else if( pBatch->fillCount > 0U )
+    {
+        statusResult = sendEnvelope( pBatch, blockTimeMs );
+    }
+    else
+    {
+        /* Nothing to send. */
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentBatch_FlushIfDue( MQTTAgentBatch_t * pBatch,
+                                        uint32_t blockTimeMs )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+
+    if( ( pBatch == NULL ) || ( pBatch->pAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pBatch=%p.", ( void * ) pBatch ) );
+        statusResult = MQTTBadParameter;
+    }
+    else if( isEnvelopeDue( pBatch ) )
+    {
+        statusResult = sendEnvelope( pBatch, blockTimeMs );
+    }
+    else
+    {
+        /* Nothing due. */
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentBatch_GetNextMessage( const void * pEnvelope,
+                                            size_t envelopeLength,
+                                            size_t * pOffset,
+                                            const uint8_t ** ppMessage,
+                                            size_t * pMessageLength )
+{
+    MQTTStatus_t statusResult = MQTTSuccess;
+    const uint8_t * pBytes = ( const uint8_t * ) pEnvelope;
+    size_t remainingLength;
+    size_t messageLength;
+
+    if( ( ( pEnvelope == NULL ) && ( envelopeLength > 0U ) ) || ( pOffset == NULL ) ||
+        ( ppMessage == NULL ) || ( pMessageLength == NULL ) || ( *pOffset > envelopeLength ) )
+    {
+        LogError( ( "Invalid parameter: pEnvelope=%p, pOffset=%p, ppMessage=%p, pMessageLength=%p.",
+                    pEnvelope,
+                    ( void * ) pOffset,
+                    ( void * ) ppMessage,
+                    ( void * ) pMessageLength ) );
+        statusResult = MQTTBadParameter;
+    }
+    else if( *pOffset == envelopeLength )
+    {
+        statusResult = MQTTNoDataAvailable;
+    }
+    else
+    {
+        remainingLength = envelopeLength - *pOffset;
+
+        if( remainingLength < MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE )
+        {
+            statusResult = MQTTBadResponse;
+        }
+        else
+        {
+            messageLength = ( ( size_t ) pBytes[ *pOffset ] << 8 ) | ( size_t ) pBytes[ *pOffset + 1U ];
+
+            if( messageLength > ( remainingLength - MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE ) )
+            {
+                statusResult = MQTTBadResponse;
+            }
+            else
+            {
+                *ppMessage = &( pBytes[ *pOffset + MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE ] );
+                *pMessageLength = messageLength;
+                *pOffset += MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE + messageLength;
+            }
+        }
+
+        if( statusResult == MQTTBadResponse )
+        {
+            LogError( ( "Malformed envelope: message at offset %lu exceeds the envelope length %lu.",
+                        ( unsigned long ) *pOffset,
+                        ( unsigned long ) envelopeLength ) );
+        }
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
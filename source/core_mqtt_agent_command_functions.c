@@ -74,11 +74,38 @@ MQTTStatus_t MQTTAgentCommand_Publish( MQTTAgentContext_t * pMqttAgentContext,
     if( pPublishInfo->qos != MQTTQoS0 )
     {
         pReturnFlags->packetId = MQTT_GetPacketId( &( pMqttAgentContext->mqttContext ) );
+
+        /* The publish is saved before any of it reaches the network, so that
+         * it can be resent if the application stops during or right after the
+         * send. */
+        if( pMqttAgentContext->pSessionCallback != NULL )
+        {
+            pMqttAgentContext->pSessionCallback( pMqttAgentContext->pSessionCallbackContext,
+                                                 pReturnFlags->packetId,
+                                                 pPublishInfo );
+        }
     }
 
     LogInfo( ( "Publishing message to %.*s.\n", ( int ) pPublishInfo->topicNameLength, pPublishInfo->pTopicName ) );
     ret = MQTT_Publish( &( pMqttAgentContext->mqttContext ), pPublishInfo, pReturnFlags->packetId );
 
+    if( ( ret == MQTTSendFailed ) && ( pPublishInfo->qos != MQTTQoS0 ) )
+    {
+        /* coreMQTT reserves the state record before sending, and keeps it when
+         * the send fails. The command completes with the error, so nothing
+         * would ever release the record. */
+        ( void ) MQTT_CancelCallback( &( pMqttAgentContext->mqttContext ), pReturnFlags->packetId );
+    }
+
+    if( ( ret != MQTTSuccess ) && ( pPublishInfo->qos != MQTTQoS0 ) &&
+        ( pMqttAgentContext->pSessionCallback != NULL ) )
+    {
+        /* The publish will not wait for an acknowledgment. */
+        pMqttAgentContext->pSessionCallback( pMqttAgentContext->pSessionCallbackContext,
+                                             pReturnFlags->packetId,
+                                             NULL );
+    }
+
     /* Add to pending ack list, or call callback if QoS 0. */
     pReturnFlags->addAcknowledgment = ( pPublishInfo->qos != MQTTQoS0 ) && ( ret == MQTTSuccess );
     pReturnFlags->runProcessLoop = true;
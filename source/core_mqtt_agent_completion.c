@@ -0,0 +1,434 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file core_mqtt_agent_completion.c
+ * @brief Implements completion handles which can be polled or waited on.
+ */
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/* Header include. */
+#include "core_mqtt_agent_completion.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/* Completions are handed between tasks, so real fences are required. */
+#if !defined( MQTT_AGENT_RELEASE_FENCE ) || !defined( MQTT_AGENT_ACQUIRE_FENCE )
+    #error "Define MQTT_AGENT_RELEASE_FENCE() and MQTT_AGENT_ACQUIRE_FENCE() for this compiler to use completion handles and queues."
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Completion callback of a command with a completion handle. Records
+ * the return information in the handle, then wakes its group.
+ *
+ * @param[in] pCmdCallbackContext The completion handle.
+ * @param[in] pReturnInfo Return information of the command.
+ */
+static void completionCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Wait until a handle, or all handles of a group, have completed.
+ *
+ * @param[in] pGroup Group to wait on.
+ * @param[in] pCompletion Handle to wait for, or NULL to wait for all handles
+ * of @p pGroup.
+ * @param[in] timeoutMs Maximum time to wait.
+ *
+ * @return #MQTTNoDataAvailable if not complete within @p timeoutMs, else
+ * #MQTTSuccess.
+ */
+static MQTTStatus_t waitForCompletion( MQTTAgentCompletionGroup_t * pGroup,
+                                       const MQTTAgentCompletion_t * pCompletion,
+                                       uint32_t timeoutMs );
+
+/**
+ * @brief Copy the oldest posted completions out of a completion queue.
+ *
+ * @param[in] pQueue Queue to reap from.
+ * @param[in] postedCount Posted count of the queue read by the caller.
+ * @param[out] pEntries Array to copy the completions to.
+ * @param[in] maxEntries Number of entries in @p pEntries.
+ *
+ * @return Number of completions copied.
+ */
+static size_t reapCompletions( MQTTAgentCompletionQueue_t * pQueue,
+                               uint32_t postedCount,
+                               MQTTAgentCompletionEntry_t * pEntries,
+                               size_t maxEntries );
+
+/*-----------------------------------------------------------*/
+
+static void completionCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    /* MISRA Ref 11.2.1 [Opaque command context] */
+    /* More details at: https://github.com/FreeRTOS/coreMQTT-Agent/blob/main/MISRA.md#rule-112 */
+    /* coverity[misra_c_2012_rule_11_2_violation] */
+    MQTTAgentCompletion_t * pCompletion = ( MQTTAgentCompletion_t * ) ( void * ) pCmdCallbackContext;
+    MQTTAgentCompletionGroup_t * pGroup;
+
+    assert( pCompletion != NULL );
+    assert( pReturnInfo != NULL );
+
+    pGroup = pCompletion->pGroup;
+    pCompletion->returnCode = pReturnInfo->returnCode;
+    pCompletion->superseded = pReturnInfo->superseded;
+
+    /* The waiting task may prepare the handle again as soon as it is marked
+     * complete, so it is not accessed after this. The fence makes the return
+     * code visible before the handle is seen complete or counted. */
+    MQTT_AGENT_RELEASE_FENCE();
+    pCompletion->complete = true;
+    pGroup->completedCount++;
+    pGroup->completionInterface.wake( pGroup->completionInterface.pEventCtx,
+                                      &( pGroup->completedCount ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t waitForCompletion( MQTTAgentCompletionGroup_t * pGroup,
+                                       const MQTTAgentCompletion_t * pCompletion,
+                                       uint32_t timeoutMs )
+{
+    MQTTStatus_t statusResult = MQTTNoDataAvailable;
+    uint32_t startTimeMs = pGroup->getTime();
+    uint32_t elapsedMs = 0U;
+    uint32_t observedCount;
+    bool complete;
+    bool timedOut = false;
+
+    do
+    {
+        /* Read the count before checking for completion, so that a completion
+         * after the check changes the count and the wait returns at once. */
+        observedCount = pGroup->completedCount;
+
+        if( pCompletion != NULL )
+        {
+            complete = pCompletion->complete;
+        }
+        else
+        {
+            complete = ( observedCount == pGroup->startedCount );
+        }
+
+        if( complete )
+        {
+            /* Pairs with the fence in completionCallback(), so the caller
+             * reads the return codes written before the completion. */
+            MQTT_AGENT_ACQUIRE_FENCE();
+            statusResult = MQTTSuccess;
+        }
+        else if( elapsedMs >= timeoutMs )
+        {
+            timedOut = true;
+        }
+        else
+        {
+            pGroup->completionInterface.wait( pGroup->completionInterface.pEventCtx,
+                                              &( pGroup->completedCount ),
+                                              observedCount,
+                                              timeoutMs - elapsedMs );
+
+            /* Unsigned subtraction is correct across a wrap of the time. */
+            elapsedMs = pGroup->getTime() - startTimeMs;
+        }
+    } while( ( statusResult != MQTTSuccess ) && !timedOut );
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t reapCompletions( MQTTAgentCompletionQueue_t * pQueue,
+                               uint32_t postedCount,
+                               MQTTAgentCompletionEntry_t * pEntries,
+                               size_t maxEntries )
+{
+    uint32_t reapedCount = pQueue->reapedCount;
+    size_t entryCount = ( size_t ) ( postedCount - reapedCount );
+    size_t i;
+
+    if( entryCount > maxEntries )
+    {
+        entryCount = maxEntries;
+    }
+
+    /* Pairs with the fence in the agent task before it posts, so the entries
+     * are read only after they are written. */
+    MQTT_AGENT_ACQUIRE_FENCE();
+
+    for( i = 0U; i < entryCount; i++ )
+    {
+        pEntries[ i ] = pQueue->pEntries[ ( reapedCount + ( uint32_t ) i ) & ( pQueue->entryCount - 1U ) ];
+    }
+
+    /* Hand the entries back to the agent task only once they are copied. */
+    MQTT_AGENT_RELEASE_FENCE();
+    pQueue->reapedCount = reapedCount + ( uint32_t ) entryCount;
+
+    return entryCount;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletionGroup_Init( MQTTAgentCompletionGroup_t * pGroup,
+                                            const MQTTAgentCompletionInterface_t * pCompletionInterface,
+                                            MQTTGetCurrentTimeFunc_t getTimeFunction )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( ( pGroup == NULL ) || ( pCompletionInterface == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pGroup=%p, pCompletionInterface=%p.",
+                    ( void * ) pGroup,
+                    ( const void * ) pCompletionInterface ) );
+    }
+    else if( getTimeFunction == NULL )
+    {
+        LogError( ( "A time function is required to wait for completions." ) );
+    }
+    else if( ( pCompletionInterface->wait == NULL ) || ( pCompletionInterface->wake == NULL ) )
+    {
+        LogError( ( "Invalid completion interface: wait and wake functions are required." ) );
+    }
+    else
+    {
+        ( void ) memset( pGroup, 0x00, sizeof( MQTTAgentCompletionGroup_t ) );
+        pGroup->completionInterface = *pCompletionInterface;
+        pGroup->getTime = getTimeFunction;
+        statusResult = MQTTSuccess;
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletion_Prepare( MQTTAgentCompletion_t * pCompletion,
+                                          MQTTAgentCompletionGroup_t * pGroup,
+                                          MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( ( pCompletion == NULL ) || ( pGroup == NULL ) || ( pCommandInfo == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pCompletion=%p, pGroup=%p, pCommandInfo=%p.",
+                    ( void * ) pCompletion,
+                    ( void * ) pGroup,
+                    ( void * ) pCommandInfo ) );
+    }
+    else
+    {
+        pCompletion->pGroup = pGroup;
+        pCompletion->returnCode = MQTTSuccess;
+        pCompletion->superseded = false;
+        pCompletion->complete = false;
+        pGroup->startedCount++;
+
+        /* MISRA Ref 11.2.1 [Opaque command context] */
+        /* More details at: https://github.com/FreeRTOS/coreMQTT-Agent/blob/main/MISRA.md#rule-112 */
+        /* coverity[misra_c_2012_rule_11_2_violation] */
+        pCommandInfo->pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) ( void * ) pCompletion;
+        pCommandInfo->cmdCompleteCallback = completionCallback;
+        statusResult = MQTTSuccess;
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletion_Abort( MQTTAgentCompletion_t * pCompletion,
+                                        MQTTStatus_t returnCode )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( ( pCompletion == NULL ) || ( pCompletion->pGroup == NULL ) || pCompletion->complete )
+    {
+        LogError( ( "Invalid parameter: pCompletion=%p is not a pending handle.",
+                    ( void * ) pCompletion ) );
+    }
+    else
+    {
+        /* The agent task never saw the command, so take it out of the count
+         * of started handles rather than adding it to the completed ones. */
+        pCompletion->pGroup->startedCount--;
+        pCompletion->returnCode = returnCode;
+        pCompletion->complete = true;
+        statusResult = MQTTSuccess;
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletion_Wait( const MQTTAgentCompletion_t * pCompletion,
+                                       uint32_t timeoutMs )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( ( pCompletion == NULL ) || ( pCompletion->pGroup == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pCompletion=%p is not a prepared handle.",
+                    ( const void * ) pCompletion ) );
+    }
+    else
+    {
+        statusResult = waitForCompletion( pCompletion->pGroup, pCompletion, timeoutMs );
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletionGroup_Wait( MQTTAgentCompletionGroup_t * pGroup,
+                                            uint32_t timeoutMs )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( pGroup == NULL )
+    {
+        LogError( ( "Invalid parameter: pGroup=%p.", ( void * ) pGroup ) );
+    }
+    else
+    {
+        statusResult = waitForCompletion( pGroup, NULL, timeoutMs );
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletionQueue_Init( MQTTAgentCompletionQueue_t * pQueue,
+                                            MQTTAgentCompletionEntry_t * pEntries,
+                                            uint32_t entryCount,
+                                            const MQTTAgentCompletionInterface_t * pCompletionInterface,
+                                            MQTTGetCurrentTimeFunc_t getTimeFunction )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+
+    if( ( pQueue == NULL ) || ( pEntries == NULL ) || ( pCompletionInterface == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pQueue=%p, pEntries=%p, pCompletionInterface=%p.",
+                    ( void * ) pQueue,
+                    ( void * ) pEntries,
+                    ( const void * ) pCompletionInterface ) );
+    }
+    else if( ( entryCount == 0U ) || ( ( entryCount & ( entryCount - 1U ) ) != 0U ) )
+    {
+        LogError( ( "Invalid parameter: entryCount=%lu is not a power of two.",
+                    ( unsigned long ) entryCount ) );
+    }
+    else if( getTimeFunction == NULL )
+    {
+        LogError( ( "A time function is required to wait for completions." ) );
+    }
+    else if( ( pCompletionInterface->wait == NULL ) || ( pCompletionInterface->wake == NULL ) )
+    {
+        LogError( ( "Invalid completion interface: wait and wake functions are required." ) );
+    }
+    else
+    {
+        ( void ) memset( pQueue, 0x00, sizeof( MQTTAgentCompletionQueue_t ) );
+        pQueue->completionInterface = *pCompletionInterface;
+        pQueue->getTime = getTimeFunction;
+        pQueue->pEntries = pEntries;
+        pQueue->entryCount = entryCount;
+        statusResult = MQTTSuccess;
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MQTTAgentCompletionQueue_Reap( MQTTAgentCompletionQueue_t * pQueue,
+                                            MQTTAgentCompletionEntry_t * pEntries,
+                                            size_t maxEntries,
+                                            uint32_t timeoutMs,
+                                            size_t * pEntryCount )
+{
+    MQTTStatus_t statusResult = MQTTBadParameter;
+    uint32_t startTimeMs;
+    uint32_t elapsedMs = 0U;
+    uint32_t postedCount;
+    bool timedOut = false;
+
+    if( ( pQueue == NULL ) || ( pEntries == NULL ) || ( maxEntries == 0U ) || ( pEntryCount == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pQueue=%p, pEntries=%p, maxEntries=%lu, pEntryCount=%p.",
+                    ( void * ) pQueue,
+                    ( void * ) pEntries,
+                    ( unsigned long ) maxEntries,
+                    ( void * ) pEntryCount ) );
+    }
+    else
+    {
+        statusResult = MQTTNoDataAvailable;
+        *pEntryCount = 0U;
+        startTimeMs = pQueue->getTime();
+
+        do
+        {
+            postedCount = pQueue->postedCount;
+
+            if( postedCount != pQueue->reapedCount )
+            {
+                *pEntryCount = reapCompletions( pQueue, postedCount, pEntries, maxEntries );
+                statusResult = MQTTSuccess;
+            }
+            else if( elapsedMs >= timeoutMs )
+            {
+                timedOut = true;
+            }
+            else
+            {
+                pQueue->completionInterface.wait( pQueue->completionInterface.pEventCtx,
+                                                  &( pQueue->postedCount ),
+                                                  postedCount,
+                                                  timeoutMs - elapsedMs );
+
+                /* Unsigned subtraction is correct across a wrap of the time. */
+                elapsedMs = pQueue->getTime() - startTimeMs;
+            }
+        } while( ( statusResult != MQTTSuccess ) && !timedOut );
+    }
+
+    return statusResult;
+}
+
+/*-----------------------------------------------------------*/
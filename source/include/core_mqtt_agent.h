@@ -60,6 +60,15 @@ typedef enum MQTTCommandType
     NUM_COMMANDS /**< @brief The number of command types handled by the agent. */
 } MQTTAgentCommandType_t;
 
+/**
+ * @brief The maximum number of application commands that can be registered
+ * with MQTTAgent_RegisterCommands().
+ *
+ * Application commands take the command types above #NUM_COMMANDS, which are
+ * limited so that every command type fits in one byte.
+ */
+#define MQTT_AGENT_MAX_CUSTOM_COMMANDS    ( 255U - ( uint32_t ) NUM_COMMANDS )
+
 struct MQTTAgentContext;
 struct MQTTAgentCommandContext;
 
@@ -71,6 +80,7 @@ typedef struct MQTTAgentReturnInfo
 {
     MQTTStatus_t returnCode; /**< Return code of the MQTT command. */
     uint8_t * pSubackCodes;  /**< Array of SUBACK statuses, for a SUBSCRIBE command. */
+    bool superseded;         /**< Set if a publish was not sent because a newer publish to the same topic replaced it. */
 } MQTTAgentReturnInfo_t;
 
 /**
@@ -113,6 +123,13 @@ struct MQTTAgentCommand
     void * pArgs;                                        /**< @brief Arguments of command. */
     MQTTAgentCommandCallback_t pCommandCompleteCallback; /**< @brief Callback to invoke upon completion. */
     MQTTAgentCommandContext_t * pCmdContext;             /**< @brief Context for completion callback. */
+    bool callerOwned;                                    /**< @brief Whether the command is storage given by the caller, so is not released to the pool. */
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+        bool conflate;                                   /**< @brief Whether a newer publish to the same topic may supersede this one. */
+    #endif
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+        const void * pSubscriber;                        /**< @brief For a SUBSCRIBE or UNSUBSCRIBE, the task holding its subscriptions. */
+    #endif
 };
 
 /**
@@ -143,6 +160,130 @@ typedef void (* MQTTAgentIncomingPublishCallback_t )( struct MQTTAgentContext *
                                                       uint16_t packetId,
                                                       MQTTPublishInfo_t * pPublishInfo );
 
+/**
+ * @ingroup mqtt_agent_callback_types
+ * @brief Callback function called when an outgoing QoS 1 or QoS 2 publish is
+ * about to be sent, and when it stops waiting for its acknowledgment.
+ *
+ * Set with MQTTAgent_SetSessionCallback(), so that the publishes in flight can
+ * be saved, and given back to MQTTAgent_RestorePublish() after a restart.
+ *
+ * @param[in] pSessionContext Context given to MQTTAgent_SetSessionCallback().
+ * @param[in] packetId The packet ID of the publish.
+ * @param[in] pPublishInfo The publish, once its packet ID is allocated and
+ * before it is sent; or NULL when it stops waiting for its acknowledgment,
+ * because it was acknowledged, because the operation was cancelled, or because
+ * it could not be sent.
+ *
+ * @note The callback MUST NOT block as it runs in the context of the MQTT agent
+ * task. @p pPublishInfo is only valid during the callback.
+ */
+typedef void (* MQTTAgentSessionCallback_t )( void * pSessionContext,
+                                              uint16_t packetId,
+                                              const MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A structure of values and flags expected to be returned
+ * by command functions.
+ */
+typedef struct MQTTAgentCommandFuncReturns
+{
+    uint16_t packetId;      /**< @brief Packet ID of packet sent by command. */
+    bool endLoop;           /**< @brief Flag to indicate command loop should terminate. */
+    bool addAcknowledgment; /**< @brief Flag to indicate an acknowledgment should be tracked. */
+    bool runProcessLoop;    /**< @brief Flag to indicate MQTT_ProcessLoop() should be called after this command. */
+} MQTTAgentCommandFuncReturns_t;
+
+/**
+ * @brief Function prototype for a command.
+ *
+ * @note These functions should only be called from within
+ * #MQTTAgent_CommandLoop.
+ *
+ * @param[in] pMqttAgentContext MQTT Agent context.
+ * @param[in] pArgs Arguments for the command.
+ * @param[out] pFlags Return flags set by the function.
+ *
+ * @return Return code of MQTT call.
+ */
+typedef MQTTStatus_t (* MQTTAgentCommandFunc_t ) ( struct MQTTAgentContext * pMqttAgentContext,
+                                                   void * pArgs,
+                                                   MQTTAgentCommandFuncReturns_t * pFlags );
+
+struct MQTTAgentTimer;
+
+struct MQTTAgentCompletionQueue;
+
+/**
+ * @ingroup mqtt_agent_callback_types
+ * @brief Callback function called when a timer started with
+ * MQTTAgent_StartTimer() expires.
+ *
+ * @param[in] pMqttAgentContext The context of the MQTT agent.
+ * @param[in] pTimer The timer that expired.
+ *
+ * @note The callback runs in the context of the MQTT agent task, so it may
+ * use the coreMQTT context of the agent directly, and may start or stop any
+ * timer, including @p pTimer. It MUST NOT block. If the callback calls any MQTT
+ * Agent API to enqueue a command, the blocking time (blockTimeMs member of
+ * MQTTAgentCommandInfo_t) MUST be zero.
+ */
+typedef void (* MQTTAgentTimerCallback_t )( struct MQTTAgentContext * pMqttAgentContext,
+                                            struct MQTTAgentTimer * pTimer );
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A timer run by the MQTT agent task.
+ *
+ * The application owns the storage of each timer, which must remain valid
+ * while the timer is running. Only `callback` and `pTimerContext` are set by
+ * the application; the other members are managed by the agent.
+ */
+typedef struct MQTTAgentTimer
+{
+    MQTTAgentTimerCallback_t callback; /**< @brief Function to call when the timer expires. */
+    void * pTimerContext;              /**< @brief Application data for the callback. */
+    uint32_t startTimeMs;              /**< @brief Time the current period started. */
+    uint32_t delayMs;                  /**< @brief Time from `startTimeMs` to the next expiry. */
+    uint32_t periodMs;                 /**< @brief Reload period, or zero for a one-shot timer. */
+    struct MQTTAgentTimer * pNext;     /**< @brief Next timer in the list of the agent. */
+} MQTTAgentTimer_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Struct holding arguments for a SUBSCRIBE or UNSUBSCRIBE call.
+ */
+typedef struct MQTTAgentSubscribeArgs
+{
+    MQTTSubscribeInfo_t * pSubscribeInfo; /**< @brief List of MQTT subscriptions. */
+    size_t numSubscriptions;              /**< @brief Number of elements in `pSubscribeInfo`. */
+} MQTTAgentSubscribeArgs_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief An active subscription kept by the agent, see
+ * #MQTT_AGENT_MAX_SUBSCRIPTIONS.
+ */
+typedef struct MQTTAgentSubscription
+{
+    char topicFilter[ MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH ]; /**< @brief Copy of the topic filter. */
+    uint16_t replayPacketId;                                       /**< @brief Packet ID of the SUBSCRIBE sent again by #MQTTAgent_ResumeSession until its SUBACK is received, else 0. */
+    uint16_t refCount;                                             /**< @brief Number of holds of all tasks on the subscription, or 0 while its UNSUBSCRIBE waits for the UNSUBACK. */
+} MQTTAgentSubscription_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief The holds of one task on an active subscription, see
+ * #MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS.
+ */
+typedef struct MQTTAgentSubscriptionHold
+{
+    const void * pSubscriber; /**< @brief Task holding the subscription, as given in #MQTTAgentCommandInfo_t. */
+    size_t subscriptionIndex; /**< @brief Index of the subscription in `subscriptions`. */
+    uint16_t holdCount;       /**< @brief Number of SUBSCRIBE commands of the task holding the subscription. */
+} MQTTAgentSubscriptionHold_t;
+
 /**
  * @ingroup mqtt_agent_struct_types
  * @brief Information used by each MQTT agent. A context will be initialized by
@@ -157,18 +298,30 @@ typedef struct MQTTAgentContext
     MQTTAgentIncomingPublishCallback_t pIncomingCallback;               /**< Callback to invoke for incoming publishes. */
     void * pIncomingCallbackContext;                                    /**< Context for incoming publish callback. */
     bool packetReceivedInLoop;                                          /**< Whether a MQTT_ProcessLoop() call received a packet. */
+    const MQTTAgentCommandFunc_t * pCustomCommandTable;                 /**< Application commands registered with MQTTAgent_RegisterCommands(). */
+    size_t customCommandCount;                                          /**< Number of entries in `pCustomCommandTable`. */
+    MQTTAgentTimer_t * pTimerList;                                      /**< Running timers, earliest expiry first. */
+    MQTTAgentTimer_t * pExpiredTimerList;                               /**< Expired timers whose callbacks have not run yet. */
+    struct MQTTAgentCompletionQueue * pCompletionQueue;                 /**< Queue set with MQTTAgent_SetCompletionQueue(), or NULL. */
+    MQTTAgentSessionCallback_t pSessionCallback;                        /**< Callback set with MQTTAgent_SetSessionCallback(), or NULL. */
+    void * pSessionCallbackContext;                                     /**< Context for the session callback. */
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+        MQTTAgentCommand_t * pStagedCommands[ MQTT_AGENT_CONFLATION_LOOKAHEAD ]; /**< Commands received ahead of the one being processed. */
+        size_t stagedCommandStart;                                             /**< Index of the oldest command in `pStagedCommands`. */
+        size_t stagedCommandCount;                                             /**< Number of commands in `pStagedCommands`. */
+    #endif
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+        MQTTSubscribeInfo_t subscribeInfo[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];                  /**< Active subscriptions, whose topic filters point into `subscriptions`. */
+        MQTTAgentSubscription_t subscriptions[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];              /**< Topic filters and state of the active subscriptions. */
+        size_t subscriptionCount;                                                           /**< Number of active subscriptions. */
+        MQTTSubscribeInfo_t sharedSubscribeInfo[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];            /**< Topic filters of an UNSUBSCRIBE command no other task holds. */
+        MQTTAgentSubscribeArgs_t sharedSubscribeArgs;                                       /**< Arguments to send an UNSUBSCRIBE command with, without the topic filters other tasks hold. */
+        uint8_t sharedSubackCodes[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];                          /**< Status codes of a SUBSCRIBE command completed without sending it. */
+        MQTTAgentSubscriptionHold_t subscriptionHolds[ MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS ]; /**< Holds of each task on the active subscriptions. */
+        size_t subscriptionHoldCount;                                                       /**< Number of entries in `subscriptionHolds`. */
+    #endif
 } MQTTAgentContext_t;
 
-/**
- * @ingroup mqtt_agent_struct_types
- * @brief Struct holding arguments for a SUBSCRIBE or UNSUBSCRIBE call.
- */
-typedef struct MQTTAgentSubscribeArgs
-{
-    MQTTSubscribeInfo_t * pSubscribeInfo; /**< @brief List of MQTT subscriptions. */
-    size_t numSubscriptions;              /**< @brief Number of elements in `pSubscribeInfo`. */
-} MQTTAgentSubscribeArgs_t;
-
 /**
  * @ingroup mqtt_agent_struct_types
  * @brief Struct holding arguments for a CONNECT call.
@@ -184,14 +337,64 @@ typedef struct MQTTAgentConnectArgs
 /**
  * @ingroup mqtt_agent_struct_types
  * @brief Struct holding arguments that are common to every command.
+ *
+ * @note The struct should be zero-initialized, for example with `= { 0 }` or
+ * memset(), before the members used are set, so that members added in later
+ * versions keep their default behavior.
  */
 typedef struct MQTTAgentCommandInfo
 {
     MQTTAgentCommandCallback_t cmdCompleteCallback;          /**< @brief Callback to invoke upon completion. */
     MQTTAgentCommandContext_t * pCmdCompleteCallbackContext; /**< @brief Context for completion callback. */
     uint32_t blockTimeMs;                                    /**< @brief Maximum block time for enqueueing the command. */
+    bool conflate;                                           /**< @brief For a publish, allow a newer publish to the same topic to supersede it. See #MQTT_AGENT_CONFLATION_LOOKAHEAD. */
+    const void * pSubscriber;                                /**< @brief For a SUBSCRIBE or UNSUBSCRIBE, identifies the task holding the subscriptions, such as its task handle. See #MQTT_AGENT_MAX_SUBSCRIPTIONS. */
 } MQTTAgentCommandInfo_t;
 
+struct MQTTAgentProducer;
+
+/**
+ * @ingroup mqtt_agent_callback_types
+ * @brief Callback function called by a producer started with
+ * MQTTAgent_StartProducer() to get the payload of its next publish.
+ *
+ * @param[in] pProducer The producer to publish for.
+ * @param[out] pBuffer Buffer to write the payload to.
+ * @param[in] bufferSize Size of @p pBuffer in bytes.
+ * @param[out] pPayloadLength Number of bytes written to @p pBuffer.
+ *
+ * @return `true` to publish the payload, `false` to publish nothing this
+ * period.
+ *
+ * @note The callback runs in the context of the MQTT agent task and MUST NOT
+ * block. It is only called when the publish can be sent.
+ */
+typedef bool (* MQTTAgentProducerFill_t )( struct MQTTAgentProducer * pProducer,
+                                           uint8_t * pBuffer,
+                                           size_t bufferSize,
+                                           size_t * pPayloadLength );
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A periodic publisher which pulls its payload when the publish is sent.
+ *
+ * The application owns the storage of each producer, and sets `publishInfo`
+ * (except the payload), `fill`, `pProducerContext`, `pPayloadBuffer` and
+ * `payloadBufferSize`. The other members are managed by the agent.
+ */
+typedef struct MQTTAgentProducer
+{
+    MQTTAgentTimer_t timer;         /**< @brief Timer scheduling the publishes. */
+    MQTTPublishInfo_t publishInfo;  /**< @brief Topic, QoS and flags of the publishes. */
+    MQTTAgentProducerFill_t fill;   /**< @brief Function writing the payload. */
+    void * pProducerContext;        /**< @brief Application data for `fill`. */
+    uint8_t * pPayloadBuffer;       /**< @brief Buffer the payload is written to. */
+    size_t payloadBufferSize;       /**< @brief Size of `pPayloadBuffer` in bytes. */
+    uint16_t packetId;              /**< @brief Packet ID of the last QoS 1 or 2 publish. */
+    uint32_t publishCount;          /**< @brief Number of payloads published. */
+    uint32_t skipCount;             /**< @brief Number of periods skipped because the publish could not be sent. */
+} MQTTAgentProducer_t;
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -337,6 +540,65 @@ MQTTStatus_t MQTTAgent_Init( MQTTAgentContext_t * pMqttAgentContext,
 MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext );
 /* @[declare_mqtt_agent_commandloop] */
 
+/**
+ * @brief Process the commands already in the command queue and the data
+ * already received, without waiting, for an agent driven by an external
+ * event loop instead of #MQTTAgent_CommandLoop.
+ *
+ * The callbacks of expired timers are run first. Then commands are received
+ * with a block time of zero and processed until the command queue is empty, or
+ * #MQTT_AGENT_MAX_STEP_COMMANDS commands have been processed, with
+ * MQTT_ProcessLoop() called as in #MQTTAgent_CommandLoop.
+ *
+ * The event loop should call this function again when a command is sent to the
+ * command queue, when the transport has data to receive, or when the time
+ * returned in @p pWaitTimeMs has passed, whichever happens first. How the
+ * command queue and the transport are watched depends on their implementation;
+ * for example, a queue signaling an eventfd and a socket may both be added to
+ * an epoll set.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[out] pWaitTimeMs Time in milliseconds after which this function
+ * must be called again, at most #MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME. It is
+ * zero if commands or received packets may still be waiting, see
+ * #MQTT_AGENT_MAX_STEP_COMMANDS and #MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS.
+ * @param[out] pEndLoop Set to true on receiving a terminate command, undergoing
+ * network disconnection OR encountering an error, when
+ * #MQTTAgent_CommandLoop would return. The agent should then no longer be
+ * stepped.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else the same
+ * as #MQTTAgent_CommandLoop.
+ *
+ * @note This function MUST be called from a single task or thread, as for
+ * #MQTTAgent_CommandLoop. The recv function of the message interface MUST
+ * not block when called with a block time of zero.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTStatus_t status = MQTTSuccess;
+ * MQTTAgentContext_t mqttAgentContext;
+ * uint32_t waitTimeMs;
+ * bool endLoop = false;
+ *
+ * while( ( status == MQTTSuccess ) && !endLoop )
+ * {
+ *     status = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+ *
+ *     // Wait until the command queue or the socket is ready, or waitTimeMs
+ *     // has passed, while serving other event sources.
+ *     waitForEvents( waitTimeMs );
+ * }
+ * @endcode
+ */
+/* @[declare_mqtt_agent_step] */
+MQTTStatus_t MQTTAgent_Step( MQTTAgentContext_t * pMqttAgentContext,
+                             uint32_t * pWaitTimeMs,
+                             bool * pEndLoop );
+/* @[declare_mqtt_agent_step] */
+
 /**
  * @brief Resume a session by resending publishes if a session is present in
  * the broker, or clear state information if not.
@@ -344,11 +606,19 @@ MQTTStatus_t MQTTAgent_CommandLoop( MQTTAgentContext_t * pMqttAgentContext );
  * @param[in] pMqttAgentContext The MQTT agent to use.
  * @param[in] sessionPresent The session present flag from the broker.
  *
+ * When #MQTT_AGENT_MAX_SUBSCRIPTIONS is not zero, the subscriptions kept by
+ * the agent are sent again in as few SUBSCRIBE packets as fit in the network
+ * buffer if no session is present, and those not yet acknowledged since the
+ * previous call are sent again if a session is present.
+ *
+ * A publish that cannot be resent is not completed; it stays pending and is
+ * resent when the session is next resumed.
+ *
  * @note This function is NOT thread-safe and should only be called
  * from the context of the task responsible for #MQTTAgent_CommandLoop.
  *
  * @return #MQTTSuccess if it succeeds in resending publishes, else an
- * appropriate error code from `MQTT_Publish()`
+ * appropriate error code from `MQTT_Publish()` or `MQTT_Subscribe()`
  *
  * <b>Example</b>
  * @code{c}
@@ -379,6 +649,317 @@ MQTTStatus_t MQTTAgent_ResumeSession( MQTTAgentContext_t * pMqttAgentContext,
                                       bool sessionPresent );
 /* @[declare_mqtt_agent_resumesession] */
 
+/**
+ * @brief Register application commands that run on the agent task.
+ *
+ * Entry `i` of @p pCommandTable handles the command type `#NUM_COMMANDS + i`.
+ * A command of that type is processed exactly like a built-in command: the
+ * function is called from #MQTTAgent_CommandLoop with the command arguments,
+ * and the flags it returns decide whether the command waits for an
+ * acknowledgment, runs the process loop or ends the loop.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pCommandTable Functions for the application commands. The table is
+ * not copied, and must remain valid for as long as the agent is used.
+ * @param[in] numCommands Number of entries in @p pCommandTable, at most
+ * #MQTT_AGENT_MAX_CUSTOM_COMMANDS. Zero removes any registered commands.
+ *
+ * @note This function is NOT thread-safe. Call it after MQTTAgent_Init() and
+ * before #MQTTAgent_CommandLoop is started. Commands are then enqueued with
+ * MQTTAgent_CustomCommand().
+ *
+ * @return #MQTTBadParameter if an invalid context or table is given, else
+ * #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Function executed on the agent task for the first application command.
+ * MQTTStatus_t prvFlushCommand( MQTTAgentContext_t * pMqttAgentContext,
+ *                               void * pArgs,
+ *                               MQTTAgentCommandFuncReturns_t * pReturnFlags );
+ *
+ * // Variables used in this example.
+ * static const MQTTAgentCommandFunc_t customCommands[] = { prvFlushCommand };
+ * MQTTStatus_t status;
+ * MQTTAgentContext_t mqttAgentContext;
+ *
+ * // The agent must have been initialized with MQTTAgent_Init().
+ * status = MQTTAgent_RegisterCommands( &mqttAgentContext,
+ *                                      customCommands,
+ *                                      sizeof( customCommands ) / sizeof( customCommands[ 0 ] ) );
+ *
+ * if( status == MQTTSuccess )
+ * {
+ *     status = MQTTAgent_CommandLoop( &mqttAgentContext );
+ * }
+ * @endcode
+ */
+/* @[declare_mqtt_agent_registercommands] */
+MQTTStatus_t MQTTAgent_RegisterCommands( MQTTAgentContext_t * pMqttAgentContext,
+                                         const MQTTAgentCommandFunc_t * pCommandTable,
+                                         size_t numCommands );
+/* @[declare_mqtt_agent_registercommands] */
+
+/**
+ * @brief Set the queue into which the agent posts the completions of commands
+ * enqueued with a completion context but no completion callback.
+ *
+ * Commands with a completion callback still have it invoked from the agent
+ * task. The completions in the queue are reaped by an application task with
+ * MQTTAgentCompletionQueue_Reap(), so that the agent task does not run any
+ * application code for them.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pCompletionQueue Queue initialized with
+ * MQTTAgentCompletionQueue_Init(), or NULL to stop posting completions. The
+ * queue must remain valid for as long as it is set.
+ *
+ * @note This function is NOT thread-safe. Call it after MQTTAgent_Init() and
+ * before #MQTTAgent_CommandLoop is started.
+ *
+ * @return #MQTTBadParameter if an invalid context is given, else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_setcompletionqueue] */
+MQTTStatus_t MQTTAgent_SetCompletionQueue( MQTTAgentContext_t * pMqttAgentContext,
+                                           struct MQTTAgentCompletionQueue * pCompletionQueue );
+/* @[declare_mqtt_agent_setcompletionqueue] */
+
+/**
+ * @brief Set the callback notified when an outgoing QoS 1 or QoS 2 publish is
+ * about to be sent, and when it stops waiting for its acknowledgment.
+ *
+ * Together with MQTTAgent_RestorePublish(), this lets the publishes in flight
+ * outlive a restart of the application: the callback saves each publish before
+ * it is sent and until it completes, and the saved publishes are restored
+ * before the session is resumed with MQTTAgent_ResumeSession(). A publish is
+ * saved before the send, so that one that reached the broker is always saved.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] sessionCallback Function to notify, or NULL to stop notifying.
+ * @param[in] pSessionContext Context passed to @p sessionCallback.
+ *
+ * @note This function is NOT thread-safe. Call it after MQTTAgent_Init() and
+ * before #MQTTAgent_CommandLoop is started.
+ *
+ * @return #MQTTBadParameter if an invalid context is given, else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_setsessioncallback] */
+MQTTStatus_t MQTTAgent_SetSessionCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                           MQTTAgentSessionCallback_t sessionCallback,
+                                           void * pSessionContext );
+/* @[declare_mqtt_agent_setsessioncallback] */
+
+/**
+ * @brief Restore a QoS 1 or QoS 2 publish that was waiting for its
+ * acknowledgment when the application last stopped.
+ *
+ * The publish is added to the operations awaiting acknowledgment as if it had
+ * been sent by this agent, without being sent again. If the broker still has
+ * the session, MQTTAgent_ResumeSession() then resends it with the DUP flag set
+ * if coreMQTT's outgoing publish records show it was not acknowledged, and it
+ * completes when its acknowledgment is received. The restored publish has no
+ * completion callback, since the task that sent it no longer exists.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] packetId The packet ID the publish was sent with.
+ * @param[in] pPublishInfo The publish. It MUST remain in scope until the
+ * publish completes.
+ * @param[in] pCommandStorage Storage for the command of the publish. It MUST
+ * remain in scope, and not be given to another command, until the publish
+ * completes.
+ *
+ * @note This function is NOT thread-safe. Call it after MQTTAgent_Init() and
+ * before #MQTTAgent_CommandLoop is started. coreMQTT's outgoing publish records
+ * must have been restored too, so that the packet ID is known to coreMQTT.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given; #MQTTNoMemory if
+ * there is no space left for operations awaiting acknowledgment;
+ * #MQTTStateCollision if an operation with the same packet ID is already
+ * awaiting acknowledgment; else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_restorepublish] */
+MQTTStatus_t MQTTAgent_RestorePublish( MQTTAgentContext_t * pMqttAgentContext,
+                                       uint16_t packetId,
+                                       MQTTPublishInfo_t * pPublishInfo,
+                                       MQTTAgentCommand_t * pCommandStorage );
+/* @[declare_mqtt_agent_restorepublish] */
+
+/**
+ * @brief Start a timer whose callback runs in the MQTT agent task.
+ *
+ * The callback of @p pTimer is called from #MQTTAgent_CommandLoop once
+ * @p delayMs milliseconds have passed, and then every @p periodMs milliseconds
+ * if @p periodMs is not zero. The command loop waits for commands no longer
+ * than the time until the earliest timer expires, so timers run without an
+ * extra task or any commands being enqueued. Starting a timer that is already
+ * running restarts it.
+ *
+ * A periodic timer is reloaded from its previous expiry time, so it does not
+ * drift. If the agent falls more than a period behind, the missed expiries
+ * are skipped instead of being run back to back.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pTimer The timer to start. The `callback` member must be set.
+ * @param[in] delayMs Time in milliseconds until the first expiry.
+ * @param[in] periodMs Time in milliseconds between later expiries, or zero for
+ * a one-shot timer.
+ *
+ * @note This function is NOT thread-safe and should only be called
+ * from the context of the task responsible for #MQTTAgent_CommandLoop, such as
+ * from a timer callback or a command registered with
+ * MQTTAgent_RegisterCommands(), or before the command loop is started. Other
+ * tasks can start a timer by enqueueing such a command with
+ * MQTTAgent_CustomCommand().
+ *
+ * @return #MQTTBadParameter if an invalid context or timer is given, else
+ * #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTStatus_t status;
+ * MQTTAgentContext_t mqttAgentContext;
+ * static MQTTAgentTimer_t telemetryTimer;
+ *
+ * // Publish a telemetry sample from the agent task.
+ * void telemetryTimerCallback( MQTTAgentContext_t * pMqttAgentContext,
+ *                              MQTTAgentTimer_t * pTimer )
+ * {
+ *     MQTTPublishInfo_t publishInfo = { 0 };
+ *
+ *     // Fill publishInfo with a QoS 0 sample from pTimer->pTimerContext.
+ *     ( void ) MQTT_Publish( &( pMqttAgentContext->mqttContext ), &publishInfo, 0U );
+ * }
+ *
+ * telemetryTimer.callback = telemetryTimerCallback;
+ * telemetryTimer.pTimerContext = &telemetryData;
+ *
+ * // Publish every 5 seconds, starting in 1 second.
+ * status = MQTTAgent_StartTimer( &mqttAgentContext, &telemetryTimer, 1000U, 5000U );
+ * @endcode
+ */
+/* @[declare_mqtt_agent_starttimer] */
+MQTTStatus_t MQTTAgent_StartTimer( MQTTAgentContext_t * pMqttAgentContext,
+                                   MQTTAgentTimer_t * pTimer,
+                                   uint32_t delayMs,
+                                   uint32_t periodMs );
+/* @[declare_mqtt_agent_starttimer] */
+
+/**
+ * @brief Stop a timer started with MQTTAgent_StartTimer().
+ *
+ * The callback of a stopped timer is not called again until the timer is
+ * restarted, even if the timer had already expired. Stopping a timer that is
+ * not running has no effect.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pTimer The timer to stop.
+ *
+ * @note This function is NOT thread-safe and should only be called
+ * from the context of the task responsible for #MQTTAgent_CommandLoop.
+ *
+ * @return #MQTTBadParameter if an invalid context or timer is given, else
+ * #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_stoptimer] */
+MQTTStatus_t MQTTAgent_StopTimer( MQTTAgentContext_t * pMqttAgentContext,
+                                  MQTTAgentTimer_t * pTimer );
+/* @[declare_mqtt_agent_stoptimer] */
+
+/**
+ * @brief Start a producer, which publishes the latest value of some data
+ * every @p periodMs milliseconds from the MQTT agent task.
+ *
+ * Each period, the producer calls its `fill` callback to write the payload
+ * into its payload buffer and publishes it directly, without enqueueing a
+ * command. coreMQTT sends the payload from that buffer without copying it.
+ *
+ * A period is skipped, and `skipCount` incremented, when the publish cannot
+ * be sent: when the agent is not connected, or for QoS 1 and 2 when the
+ * previous publish of the producer is still awaiting its acknowledgment, the
+ * list of pending acknowledgments is full, or no command structure is
+ * available to track the acknowledgment. Skipped samples are never queued,
+ * so the next publish carries the latest value.
+ *
+ * QoS 1 and 2 publishes are tracked like those of MQTTAgent_Publish(), and
+ * resent by MQTTAgent_ResumeSession(). The payload buffer is not written to
+ * while such a publish awaits its acknowledgment.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pProducer The producer to start.
+ * @param[in] periodMs Time in milliseconds between publishes. The first
+ * publish is one period after the producer is started.
+ *
+ * @note This function is NOT thread-safe and should only be called
+ * from the context of the task responsible for #MQTTAgent_CommandLoop, or
+ * before the command loop is started.
+ *
+ * @note The producer MUST remain in scope until it is stopped and any QoS 1 or
+ * 2 publish it sent has been acknowledged or canceled.
+ *
+ * @return #MQTTBadParameter if an invalid context or producer is given, else
+ * #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTStatus_t status;
+ * MQTTAgentContext_t mqttAgentContext;
+ * static MQTTAgentProducer_t temperatureProducer;
+ * static uint8_t temperaturePayload[ 16 ];
+ *
+ * // Write the current temperature as the payload.
+ * bool fillTemperature( MQTTAgentProducer_t * pProducer,
+ *                       uint8_t * pBuffer,
+ *                       size_t bufferSize,
+ *                       size_t * pPayloadLength )
+ * {
+ *     int written = snprintf( ( char * ) pBuffer, bufferSize, "%d", readTemperature() );
+ *
+ *     *pPayloadLength = ( size_t ) written;
+ *     return ( written > 0 ) && ( ( size_t ) written < bufferSize );
+ * }
+ *
+ * temperatureProducer.publishInfo.pTopicName = "sensors/temperature";
+ * temperatureProducer.publishInfo.topicNameLength = strlen( "sensors/temperature" );
+ * temperatureProducer.publishInfo.qos = MQTTQoS0;
+ * temperatureProducer.fill = fillTemperature;
+ * temperatureProducer.pPayloadBuffer = temperaturePayload;
+ * temperatureProducer.payloadBufferSize = sizeof( temperaturePayload );
+ *
+ * // Publish the temperature every 100 milliseconds.
+ * status = MQTTAgent_StartProducer( &mqttAgentContext, &temperatureProducer, 100U );
+ * @endcode
+ */
+/* @[declare_mqtt_agent_startproducer] */
+MQTTStatus_t MQTTAgent_StartProducer( MQTTAgentContext_t * pMqttAgentContext,
+                                      MQTTAgentProducer_t * pProducer,
+                                      uint32_t periodMs );
+/* @[declare_mqtt_agent_startproducer] */
+
+/**
+ * @brief Stop a producer started with MQTTAgent_StartProducer().
+ *
+ * A QoS 1 or 2 publish already sent by the producer is still tracked until it
+ * is acknowledged.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pProducer The producer to stop.
+ *
+ * @note This function is NOT thread-safe and should only be called
+ * from the context of the task responsible for #MQTTAgent_CommandLoop.
+ *
+ * @return #MQTTBadParameter if an invalid context or producer is given, else
+ * #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_stopproducer] */
+MQTTStatus_t MQTTAgent_StopProducer( MQTTAgentContext_t * pMqttAgentContext,
+                                     MQTTAgentProducer_t * pProducer );
+/* @[declare_mqtt_agent_stopproducer] */
+
 /**
  * @brief Cancel all enqueued commands and those awaiting acknowledgment
  * while the command loop is not running.
@@ -598,6 +1179,49 @@ MQTTStatus_t MQTTAgent_Publish( const MQTTAgentContext_t * pMqttAgentContext,
                                 const MQTTAgentCommandInfo_t * pCommandInfo );
 /* @[declare_mqtt_agent_publish] */
 
+/**
+ * @brief Add a command to call MQTT_Publish() for an MQTT connection, built
+ * in storage owned by the caller instead of a command from the command pool.
+ *
+ * The command is never released with #MQTTAgentCommandRelease_t, so the
+ * publish can be enqueued while the pool is empty, and no memory is taken per
+ * publish.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] pPublishInfo MQTT PUBLISH information.
+ * @param[in] pCommandInfo The information pertaining to the command, as for
+ * MQTTAgent_Publish().
+ * @param[in] pCommandStorage Storage for the command. It MUST remain in scope,
+ * and not be given to another command, until the command completes. It may be
+ * reused as soon as the command has completed, or at once if the command could
+ * not be enqueued.
+ *
+ * @return #MQTTSuccess if the command was posted to the MQTT agent's event queue.
+ * Otherwise an enumerated error code.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTAgentContext_t agentContext;
+ * MQTTStatus_t status;
+ * MQTTAgentCommandInfo_t commandInfo = { 0 };
+ * MQTTPublishInfo_t publishInfo = { 0 };
+ * static MQTTAgentCommand_t command;
+ *
+ * // The command information and the publish are filled as for
+ * // MQTTAgent_Publish(). The command storage is not reused before the
+ * // completion callback is invoked.
+ * status = MQTTAgent_PublishWithStorage( &agentContext, &publishInfo, &commandInfo, &command );
+ * @endcode
+ */
+/* @[declare_mqtt_agent_publishwithstorage] */
+MQTTStatus_t MQTTAgent_PublishWithStorage( const MQTTAgentContext_t * pMqttAgentContext,
+                                           MQTTPublishInfo_t * pPublishInfo,
+                                           const MQTTAgentCommandInfo_t * pCommandInfo,
+                                           MQTTAgentCommand_t * pCommandStorage );
+/* @[declare_mqtt_agent_publishwithstorage] */
+
 /**
  * @brief Send a message to the MQTT agent purely to trigger an iteration of its loop,
  * which will result in a call to MQTT_ProcessLoop().  This function can be used to
@@ -923,6 +1547,73 @@ MQTTStatus_t MQTTAgent_Terminate( const MQTTAgentContext_t * pMqttAgentContext,
                                   const MQTTAgentCommandInfo_t * pCommandInfo );
 /* @[declare_mqtt_agent_terminate] */
 
+/**
+ * @brief Add a command to run an application command registered with
+ * MQTTAgent_RegisterCommands().
+ *
+ * The command function runs in the MQTT agent task, serialized with every
+ * other command, so it may use the coreMQTT context of the agent directly.
+ * The flags it returns are handled as for a built-in command; for example,
+ * setting `addAcknowledgment` with the packet ID of a packet it sent defers
+ * completion until the acknowledgment is received.
+ *
+ * @param[in] pMqttAgentContext The MQTT agent to use.
+ * @param[in] commandId Index of the command in the table registered with
+ * MQTTAgent_RegisterCommands().
+ * @param[in] pArgs Arguments passed to the command function. May be NULL.
+ * @param[in] pCommandInfo The information pertaining to the command, including:
+ *  - cmdCompleteCallback Optional callback to invoke when the command completes.
+ *  - pCmdCompleteCallbackContext Optional completion callback context.
+ *  - blockTimeMs The maximum amount of time in milliseconds to wait for the
+ *    command to be posted to the MQTT agent, should the agent's event queue
+ *    be full. Tasks wait in the Blocked state so don't use any CPU time.
+ *
+ * @note @p pArgs and the context passed to the callback through
+ * pCmdContext member of @p pCommandInfo parameter MUST remain in scope at
+ * least until the callback has been executed by the agent task.
+ *
+ * @return #MQTTSuccess if the command was posted to the MQTT agent's event queue.
+ * #MQTTBadParameter if @p commandId is not registered. Otherwise an enumerated
+ * error code.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTAgentContext_t agentContext;
+ * MQTTStatus_t status;
+ * MQTTAgentCommandInfo_t commandInfo = { 0 };
+ * StateSnapshot_t snapshot;
+ *
+ * // Index of the snapshot command in the table given to
+ * // MQTTAgent_RegisterCommands().
+ * #define SNAPSHOT_COMMAND_ID    0U
+ *
+ * // Function for command complete callback.
+ * void snapshotCompleteCb( MQTTAgentCommandContext_t * pCmdCallbackContext,
+ *                          MQTTAgentReturnInfo_t * pReturnInfo );
+ *
+ * // Fill the command information.
+ * commandInfo.cmdCompleteCallback = snapshotCompleteCb;
+ * commandInfo.blockTimeMs = 500;
+ *
+ * status = MQTTAgent_CustomCommand( &agentContext, SNAPSHOT_COMMAND_ID, &snapshot, &commandInfo );
+ *
+ * if( status == MQTTSuccess )
+ * {
+ *   // The snapshot command has been queued. snapshotCompleteCb() is called
+ *   // once it has run in the agent task.
+ * }
+ *
+ * @endcode
+ */
+/* @[declare_mqtt_agent_customcommand] */
+MQTTStatus_t MQTTAgent_CustomCommand( const MQTTAgentContext_t * pMqttAgentContext,
+                                      uint32_t commandId,
+                                      void * pArgs,
+                                      const MQTTAgentCommandInfo_t * pCommandInfo );
+/* @[declare_mqtt_agent_customcommand] */
+
 /* *INDENT-OFF* */
 #ifdef __cplusplus
     }
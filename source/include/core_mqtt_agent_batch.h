@@ -0,0 +1,264 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file core_mqtt_agent_batch.h
+ * @brief Batching of small messages to one topic into envelope publishes.
+ *
+ * An envelope is the payload of one publish, holding one or more messages.
+ * Each message is a two byte big-endian length followed by that many bytes.
+ */
+#ifndef CORE_MQTT_AGENT_BATCH_H
+#define CORE_MQTT_AGENT_BATCH_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* MQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Size of the length prefix of each message in an envelope.
+ */
+#define MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE    ( 2U )
+
+/**
+ * @brief Largest message that can be added to a batch.
+ */
+#define MQTT_AGENT_BATCH_MAX_MESSAGE_LENGTH    ( 65535U )
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Completion of one message of an envelope.
+ */
+typedef struct MQTTAgentBatchMessage
+{
+    MQTTAgentCommandCallback_t cmdCompleteCallback;          /**< @brief Callback to invoke when the envelope completes. */
+    MQTTAgentCommandContext_t * pCmdCompleteCallbackContext; /**< @brief Context for the completion callback. */
+} MQTTAgentBatchMessage_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief One envelope publish of a batch.
+ *
+ * @note The members of this struct are managed by the batch functions, and
+ * should not be written by the application.
+ */
+typedef struct MQTTAgentBatchEnvelope
+{
+    MQTTPublishInfo_t publishInfo;                                    /**< @brief Publish of the envelope, with `pBuffer` as the payload. */
+    uint8_t * pBuffer;                                                /**< @brief Half of the batch buffer holding the messages of the envelope. */
+    MQTTAgentBatchMessage_t messages[ MQTT_AGENT_BATCH_MAX_MESSAGES ]; /**< @brief Completion of the messages in the envelope. */
+    size_t messageCount;                                              /**< @brief Number of messages in the envelope while it is sent. */
+    volatile bool inFlight;                                           /**< @brief Set by the batch task when the envelope is sent, cleared by the agent task on completion. */
+} MQTTAgentBatchEnvelope_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A batch of messages to one topic.
+ *
+ * Messages are added to one envelope while the other is being sent, so that
+ * adding messages does not have to wait for the previous envelope to be
+ * acknowledged.
+ *
+ * @note The members of this struct are managed by the batch functions, and
+ * should not be written by the application.
+ */
+typedef struct MQTTAgentBatch
+{
+    const MQTTAgentContext_t * pAgentContext; /**< @brief Agent sending the envelopes. */
+    MQTTAgentBatchEnvelope_t envelopes[ 2 ];  /**< @brief Envelopes, each with half of the batch buffer. */
+    size_t envelopeSize;                      /**< @brief Size of the buffer of each envelope. */
+    size_t fillIndex;                         /**< @brief Index in `envelopes` of the envelope messages are added to. */
+    size_t fillLength;                        /**< @brief Bytes written to the envelope messages are added to. */
+    size_t fillCount;                         /**< @brief Number of messages in the envelope messages are added to. */
+    uint32_t firstMessageTimeMs;              /**< @brief Time the first message was added to the envelope. */
+    uint32_t maxDelayMs;                      /**< @brief Time after the first message was added when the envelope is sent. */
+} MQTTAgentBatch_t;
+
+/**
+ * @brief Initialize a batch of messages to one topic.
+ *
+ * @param[out] pBatch Batch to initialize.
+ * @param[in] pMqttAgentContext The MQTT agent sending the envelopes. Its
+ * coreMQTT context must have been initialized with a time function.
+ * @param[in] pPublishInfo Topic, QoS and retain flag of the envelopes. The
+ * topic name MUST remain in scope as long as the batch is used; the payload
+ * is ignored.
+ * @param[in] pBuffer Buffer for the envelopes, split in two halves.
+ * @param[in] bufferSize Size of @p pBuffer.
+ * @param[in] maxDelayMs Time in milliseconds after the first message was added
+ * to an envelope when it is sent, even if it is not full.
+ *
+ * @note The batch and buffer MUST remain in scope until every envelope sent has
+ * completed.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTStatus_t status;
+ * MQTTAgentContext_t mqttAgentContext;
+ * static MQTTAgentBatch_t readingsBatch;
+ * static uint8_t readingsBuffer[ 2U * 512U ];
+ * MQTTPublishInfo_t publishInfo = { 0 };
+ *
+ * publishInfo.pTopicName = "sensors/readings";
+ * publishInfo.topicNameLength = strlen( "sensors/readings" );
+ * publishInfo.qos = MQTTQoS1;
+ *
+ * // Send envelopes of up to 512 bytes, at most 200 ms after the first
+ * // reading added to them.
+ * status = MQTTAgentBatch_Init( &readingsBatch,
+ *                               &mqttAgentContext,
+ *                               &publishInfo,
+ *                               readingsBuffer,
+ *                               sizeof( readingsBuffer ),
+ *                               200U );
+ * @endcode
+ */
+/* @[declare_mqtt_agent_batch_init] */
+MQTTStatus_t MQTTAgentBatch_Init( MQTTAgentBatch_t * pBatch,
+                                  const MQTTAgentContext_t * pMqttAgentContext,
+                                  const MQTTPublishInfo_t * pPublishInfo,
+                                  uint8_t * pBuffer,
+                                  size_t bufferSize,
+                                  uint32_t maxDelayMs );
+/* @[declare_mqtt_agent_batch_init] */
+
+/**
+ * @brief Add a message to a batch.
+ *
+ * The message is copied into the envelope being filled. The envelope is sent
+ * with MQTTAgent_Publish() first if the message does not fit in it, and after
+ * adding the message if it is due.
+ *
+ * @param[in] pBatch Batch to add to.
+ * @param[in] pMessage Message to add.
+ * @param[in] messageLength Length of @p pMessage.
+ * @param[in] pCommandInfo Completion callback and context of the message,
+ * invoked from the agent task with the return information of its envelope, and
+ * block time used if an envelope is sent.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given or the message can
+ * never fit in an envelope; #MQTTNoMemory if both envelopes are being sent, in
+ * which case the message is not added and may be added again once an envelope
+ * has completed; an error from MQTTAgent_Publish() if an envelope could not be
+ * sent, in which case the message is not added and the envelope is kept to be
+ * sent again; else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_batch_add] */
+MQTTStatus_t MQTTAgentBatch_Add( MQTTAgentBatch_t * pBatch,
+                                 const uint8_t * pMessage,
+                                 size_t messageLength,
+                                 const MQTTAgentCommandInfo_t * pCommandInfo );
+/* @[declare_mqtt_agent_batch_add] */
+
+/**
+ * @brief Send the envelope being filled if it has any message.
+ *
+ * @param[in] pBatch Batch to flush.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue the envelope publish.
+ *
+ * @return #MQTTBadParameter if an invalid batch is given; an error from
+ * MQTTAgent_Publish() if the envelope could not be sent, in which case it is
+ * kept to be sent again; else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_batch_flush] */
+MQTTStatus_t MQTTAgentBatch_Flush( MQTTAgentBatch_t * pBatch,
+                                   uint32_t blockTimeMs );
+/* @[declare_mqtt_agent_batch_flush] */
+
+/**
+ * @brief Send the envelope being filled if the delay given to
+ * MQTTAgentBatch_Init() has passed since its first message was added.
+ *
+ * This should be called periodically by the task adding messages, so that an
+ * envelope is sent on time when no further message is added.
+ *
+ * @param[in] pBatch Batch to flush.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue the envelope publish.
+ *
+ * @return Same as MQTTAgentBatch_Flush().
+ */
+/* @[declare_mqtt_agent_batch_flushifdue] */
+MQTTStatus_t MQTTAgentBatch_FlushIfDue( MQTTAgentBatch_t * pBatch,
+                                        uint32_t blockTimeMs );
+/* @[declare_mqtt_agent_batch_flushifdue] */
+
+/**
+ * @brief Get the next message of a received envelope.
+ *
+ * @param[in] pEnvelope Payload of the envelope publish.
+ * @param[in] envelopeLength Length of @p pEnvelope.
+ * @param[in,out] pOffset Offset of the next message in @p pEnvelope. Must be
+ * 0 for the first message, and is advanced past the message returned.
+ * @param[out] ppMessage Set to the message, which points into @p pEnvelope.
+ * @param[out] pMessageLength Set to the length of the message.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given;
+ * #MQTTNoDataAvailable if all messages have been returned; #MQTTBadResponse
+ * if the envelope is malformed; else #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Incoming publish callback handling envelopes.
+ * void incomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
+ *                               uint16_t packetId,
+ *                               MQTTPublishInfo_t * pPublishInfo )
+ * {
+ *     size_t offset = 0;
+ *     const uint8_t * pMessage;
+ *     size_t messageLength;
+ *
+ *     while( MQTTAgentBatch_GetNextMessage( pPublishInfo->pPayload,
+ *                                           pPublishInfo->payloadLength,
+ *                                           &offset,
+ *                                           &pMessage,
+ *                                           &messageLength ) == MQTTSuccess )
+ *     {
+ *         handleReading( pMessage, messageLength );
+ *     }
+ * }
+ * @endcode
+ */
+/* @[declare_mqtt_agent_batch_getnextmessage] */
+MQTTStatus_t MQTTAgentBatch_GetNextMessage( const void * pEnvelope,
+                                            size_t envelopeLength,
+                                            size_t * pOffset,
+                                            const uint8_t ** ppMessage,
+                                            size_t * pMessageLength );
+/* @[declare_mqtt_agent_batch_getnextmessage] */
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* CORE_MQTT_AGENT_BATCH_H */
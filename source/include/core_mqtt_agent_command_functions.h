@@ -97,37 +97,6 @@
 
 /*-----------------------------------------------------------*/
 
-/**
- * @ingroup mqtt_agent_struct_types
- * @brief A structure of values and flags expected to be returned
- * by command functions.
- */
-typedef struct MQTTAgentCommandFuncReturns
-{
-    uint16_t packetId;      /**< @brief Packet ID of packet sent by command. */
-    bool endLoop;           /**< @brief Flag to indicate command loop should terminate. */
-    bool addAcknowledgment; /**< @brief Flag to indicate an acknowledgment should be tracked. */
-    bool runProcessLoop;    /**< @brief Flag to indicate MQTT_ProcessLoop() should be called after this command. */
-} MQTTAgentCommandFuncReturns_t;
-
-/**
- * @brief Function prototype for a command.
- *
- * @note These functions should only be called from within
- * #MQTTAgent_CommandLoop.
- *
- * @param[in] pMqttAgentContext MQTT Agent context.
- * @param[in] pArgs Arguments for the command.
- * @param[out] pFlags Return flags set by the function.
- *
- * @return Return code of MQTT call.
- */
-typedef MQTTStatus_t (* MQTTAgentCommandFunc_t ) ( MQTTAgentContext_t * pMqttAgentContext,
-                                                   void * pArgs,
-                                                   MQTTAgentCommandFuncReturns_t * pFlags );
-
-/*-----------------------------------------------------------*/
-
 /**
  * @brief Function to execute for a NONE command. This function does not call
  * #MQTT_ProcessLoop itself, but instead sets a flag to indicate it should be called.
@@ -0,0 +1,377 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file core_mqtt_agent_completion.h
+ * @brief Completion handles which can be polled or waited on, as an
+ * alternative to writing a completion callback for each command.
+ *
+ * A completion handle is storage owned by the application, so no memory is
+ * allocated per command. Handles belong to a completion group, and all handles
+ * of a group share the single wait and wake event of the group.
+ *
+ * Alternatively, the agent can post the completions of commands into a
+ * completion queue, from which an application task reaps them in batches.
+ */
+#ifndef CORE_MQTT_AGENT_COMPLETION_H
+#define CORE_MQTT_AGENT_COMPLETION_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* MQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Context of the event with which the agent task wakes a task waiting
+ * for a completion.
+ */
+/* @[define_completioneventctx] */
+typedef struct MQTTAgentCompletionEventContext MQTTAgentCompletionEventContext_t;
+/* @[define_completioneventctx] */
+
+/**
+ * @brief Wait until @p pValue is woken, if it still holds @p expectedValue.
+ *
+ * This has the semantics of a Linux futex wait: it must return immediately if
+ * @p pValue no longer holds @p expectedValue, and may return early for any
+ * reason, as the caller checks again for completion. It may also be
+ * implemented with a binary semaphore which is given by the
+ * #MQTTAgentCompletionWake_t of the same event, ignoring @p pValue.
+ *
+ * @param[in] pEventCtx An #MQTTAgentCompletionEventContext_t.
+ * @param[in] pValue Value written by the agent task before it wakes the event.
+ * @param[in] expectedValue Value of @p pValue read by the caller before waiting.
+ * @param[in] timeoutMs Maximum time to wait.
+ */
+/* @[define_completionwait] */
+typedef void ( * MQTTAgentCompletionWait_t )( MQTTAgentCompletionEventContext_t * pEventCtx,
+                                              const volatile uint32_t * pValue,
+                                              uint32_t expectedValue,
+                                              uint32_t timeoutMs );
+/* @[define_completionwait] */
+
+/**
+ * @brief Wake the task waiting on @p pValue, if any. Called from the agent
+ * task after it changes @p pValue.
+ *
+ * The agent task calls this on every completion. An implementation may
+ * track whether a task is waiting, to skip the system call otherwise.
+ *
+ * @param[in] pEventCtx An #MQTTAgentCompletionEventContext_t.
+ * @param[in] pValue Value changed by the agent task.
+ */
+/* @[define_completionwake] */
+typedef void ( * MQTTAgentCompletionWake_t )( MQTTAgentCompletionEventContext_t * pEventCtx,
+                                              const volatile uint32_t * pValue );
+/* @[define_completionwake] */
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Function pointers and context used to wait for completions.
+ */
+/* @[define_completioninterface] */
+typedef struct MQTTAgentCompletionInterface
+{
+    MQTTAgentCompletionEventContext_t * pEventCtx; /**< Context of the event of a completion group. */
+    MQTTAgentCompletionWait_t wait;                /**< Function for an application task to wait for the event. */
+    MQTTAgentCompletionWake_t wake;                /**< Function for the agent task to wake the event. */
+} MQTTAgentCompletionInterface_t;
+/* @[define_completioninterface] */
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Handles which share one event to wait on.
+ *
+ * @note The members of this struct are managed by the completion functions,
+ * and should not be written by the application.
+ */
+typedef struct MQTTAgentCompletionGroup
+{
+    MQTTAgentCompletionInterface_t completionInterface; /**< @brief Event of the group. */
+    MQTTGetCurrentTimeFunc_t getTime;                   /**< @brief Time function used for wait timeouts. */
+    uint32_t startedCount;                              /**< @brief Number of handles prepared, written only by the waiting task. */
+    volatile uint32_t completedCount;                   /**< @brief Number of handles completed, written only by the agent task. */
+} MQTTAgentCompletionGroup_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Completion handle of one command.
+ *
+ * @note `returnCode` and `superseded` may be read once the handle has
+ * completed. The other members are managed by the completion functions, and
+ * should not be written by the application.
+ */
+typedef struct MQTTAgentCompletion
+{
+    MQTTAgentCompletionGroup_t * pGroup; /**< @brief Group of the handle. */
+    MQTTStatus_t returnCode;             /**< @brief Return code of the command. */
+    bool superseded;                     /**< @brief Whether the command was a publish superseded by a newer one. */
+    volatile bool complete;              /**< @brief Set by the agent task when the command completes. */
+} MQTTAgentCompletion_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Completion of one command in a completion queue.
+ */
+typedef struct MQTTAgentCompletionEntry
+{
+    MQTTAgentCommandContext_t * pCmdCompleteCallbackContext; /**< @brief Completion context the command was enqueued with. */
+    MQTTAgentReturnInfo_t returnInfo;                        /**< @brief Return information of the command. `pSubackCodes` is always NULL, as the codes are only valid during a completion callback. */
+} MQTTAgentCompletionEntry_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Ring of completions posted by the agent task and reaped by one
+ * application task.
+ *
+ * Each count is written by a single task, so the ring needs no lock. Entry
+ * `i` of the ring holds completion `n` when `n % entryCount` equals `i`.
+ *
+ * @note The members of this struct are managed by the agent and the completion
+ * functions, and should not be written by the application.
+ */
+typedef struct MQTTAgentCompletionQueue
+{
+    MQTTAgentCompletionInterface_t completionInterface; /**< @brief Event woken when a completion is posted. */
+    MQTTGetCurrentTimeFunc_t getTime;                   /**< @brief Time function used for reap timeouts. */
+    MQTTAgentCompletionEntry_t * pEntries;              /**< @brief Entries of the ring. */
+    uint32_t entryCount;                                /**< @brief Number of entries of the ring, a power of two. */
+    volatile uint32_t postedCount;                      /**< @brief Number of completions posted, written only by the agent task. */
+    volatile uint32_t reapedCount;                      /**< @brief Number of completions reaped, written only by the reaping task. */
+    volatile uint32_t overflowCount;                    /**< @brief Number of completions dropped as the ring was full, written only by the agent task. */
+} MQTTAgentCompletionQueue_t;
+
+/**
+ * @brief Initialize a completion group.
+ *
+ * @param[out] pGroup Group to initialize.
+ * @param[in] pCompletionInterface Event of the group. Only one task may wait on
+ * the handles of a group at a time.
+ * @param[in] getTimeFunction Function returning the time in milliseconds, used
+ * for wait timeouts.
+ *
+ * @note The group MUST remain in scope until the agent task has completed
+ * every handle prepared with it.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_completiongroup_init] */
+MQTTStatus_t MQTTAgentCompletionGroup_Init( MQTTAgentCompletionGroup_t * pGroup,
+                                            const MQTTAgentCompletionInterface_t * pCompletionInterface,
+                                            MQTTGetCurrentTimeFunc_t getTimeFunction );
+/* @[declare_mqtt_agent_completiongroup_init] */
+
+/**
+ * @brief Prepare a completion handle for a command about to be enqueued.
+ *
+ * Sets the completion callback and context of @p pCommandInfo, which is then
+ * passed to the function enqueuing the command, such as MQTTAgent_Publish().
+ * If that function fails, MQTTAgentCompletion_Abort() must be called.
+ *
+ * @param[out] pCompletion Handle to prepare. It MUST remain in scope until it
+ * has completed, and must not be prepared again before then.
+ * @param[in] pGroup Group of the handle.
+ * @param[out] pCommandInfo Command information to set the completion of.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTStatus_t status;
+ * MQTTAgentContext_t mqttAgentContext;
+ * MQTTAgentCompletionGroup_t group;
+ * MQTTAgentCompletion_t completions[ 100 ];
+ * MQTTPublishInfo_t publishInfo[ 100 ];
+ * MQTTAgentCommandInfo_t commandInfo = { 0 };
+ * size_t i;
+ *
+ * // The group was initialized with MQTTAgentCompletionGroup_Init(), and the
+ * // publishes were filled in.
+ * commandInfo.blockTimeMs = 500U;
+ *
+ * for( i = 0; i < 100; i++ )
+ * {
+ *     ( void ) MQTTAgentCompletion_Prepare( &completions[ i ], &group, &commandInfo );
+ *     status = MQTTAgent_Publish( &mqttAgentContext, &publishInfo[ i ], &commandInfo );
+ *
+ *     if( status != MQTTSuccess )
+ *     {
+ *         ( void ) MQTTAgentCompletion_Abort( &completions[ i ], status );
+ *     }
+ * }
+ *
+ * // Wait up to 5 seconds for all 100 publishes.
+ * if( MQTTAgentCompletionGroup_Wait( &group, 5000U ) == MQTTSuccess )
+ * {
+ *     // The return code of each publish is in completions[ i ].returnCode.
+ * }
+ * @endcode
+ */
+/* @[declare_mqtt_agent_completion_prepare] */
+MQTTStatus_t MQTTAgentCompletion_Prepare( MQTTAgentCompletion_t * pCompletion,
+                                          MQTTAgentCompletionGroup_t * pGroup,
+                                          MQTTAgentCommandInfo_t * pCommandInfo );
+/* @[declare_mqtt_agent_completion_prepare] */
+
+/**
+ * @brief Complete a prepared handle whose command could not be enqueued.
+ *
+ * Must be called by the task which prepared the handle.
+ *
+ * @param[in] pCompletion Handle to complete.
+ * @param[in] returnCode Status returned when enqueuing the command.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_completion_abort] */
+MQTTStatus_t MQTTAgentCompletion_Abort( MQTTAgentCompletion_t * pCompletion,
+                                        MQTTStatus_t returnCode );
+/* @[declare_mqtt_agent_completion_abort] */
+
+/**
+ * @brief Wait for a handle to complete.
+ *
+ * @param[in] pCompletion Handle to wait for.
+ * @param[in] timeoutMs Maximum time to wait. 0 polls the handle without
+ * waiting.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given;
+ * #MQTTNoDataAvailable if the handle has not completed within @p timeoutMs;
+ * else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_completion_wait] */
+MQTTStatus_t MQTTAgentCompletion_Wait( const MQTTAgentCompletion_t * pCompletion,
+                                       uint32_t timeoutMs );
+/* @[declare_mqtt_agent_completion_wait] */
+
+/**
+ * @brief Wait for all prepared handles of a group to complete.
+ *
+ * Must be called by the task which prepared the handles.
+ *
+ * @param[in] pGroup Group to wait for.
+ * @param[in] timeoutMs Maximum time to wait. 0 polls the group without
+ * waiting.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given;
+ * #MQTTNoDataAvailable if a handle has not completed within @p timeoutMs;
+ * else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_completiongroup_wait] */
+MQTTStatus_t MQTTAgentCompletionGroup_Wait( MQTTAgentCompletionGroup_t * pGroup,
+                                            uint32_t timeoutMs );
+/* @[declare_mqtt_agent_completiongroup_wait] */
+
+/**
+ * @brief Initialize a completion queue.
+ *
+ * The queue is then set on an agent with MQTTAgent_SetCompletionQueue().
+ *
+ * @param[out] pQueue Queue to initialize.
+ * @param[in] pEntries Entries of the ring. They MUST remain in scope as long as
+ * the queue is used.
+ * @param[in] entryCount Number of entries in @p pEntries, a power of two. A
+ * completion is dropped and counted in `overflowCount` if the ring is full, so
+ * this should be at least the number of commands that can be outstanding.
+ * @param[in] pCompletionInterface Event woken when a completion is posted.
+ * @param[in] getTimeFunction Function returning the time in milliseconds, used
+ * for reap timeouts.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, else #MQTTSuccess.
+ */
+/* @[declare_mqtt_agent_completionqueue_init] */
+MQTTStatus_t MQTTAgentCompletionQueue_Init( MQTTAgentCompletionQueue_t * pQueue,
+                                            MQTTAgentCompletionEntry_t * pEntries,
+                                            uint32_t entryCount,
+                                            const MQTTAgentCompletionInterface_t * pCompletionInterface,
+                                            MQTTGetCurrentTimeFunc_t getTimeFunction );
+/* @[declare_mqtt_agent_completionqueue_init] */
+
+/**
+ * @brief Reap the completions posted to a queue, waiting for at least one.
+ *
+ * Must only be called by one task at a time.
+ *
+ * @param[in] pQueue Queue to reap from.
+ * @param[out] pEntries Array to copy the completions to, oldest first.
+ * @param[in] maxEntries Number of entries in @p pEntries.
+ * @param[in] timeoutMs Maximum time to wait for a completion. 0 polls the
+ * queue without waiting.
+ * @param[out] pEntryCount Set to the number of completions copied.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given;
+ * #MQTTNoDataAvailable if no completion is posted within @p timeoutMs; else
+ * #MQTTSuccess.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * MQTTAgentContext_t mqttAgentContext;
+ * static MQTTAgentCompletionEntry_t ring[ 64 ];
+ * static MQTTAgentCompletionQueue_t queue;
+ * MQTTAgentCompletionInterface_t completionInterface;
+ * MQTTAgentCompletionEntry_t reaped[ 16 ];
+ * size_t count;
+ * size_t i;
+ *
+ * // Before starting the agent task.
+ * ( void ) MQTTAgentCompletionQueue_Init( &queue, ring, 64U, &completionInterface, getTimeMs );
+ * ( void ) MQTTAgent_SetCompletionQueue( &mqttAgentContext, &queue );
+ *
+ * // In the application task handling completions. Commands are enqueued with
+ * // a completion context and a NULL completion callback.
+ * for( ; ; )
+ * {
+ *     if( MQTTAgentCompletionQueue_Reap( &queue, reaped, 16U, 1000U, &count ) == MQTTSuccess )
+ *     {
+ *         for( i = 0; i < count; i++ )
+ *         {
+ *             handleCompletion( reaped[ i ].pCmdCompleteCallbackContext,
+ *                               reaped[ i ].returnInfo.returnCode );
+ *         }
+ *     }
+ * }
+ * @endcode
+ */
+/* @[declare_mqtt_agent_completionqueue_reap] */
+MQTTStatus_t MQTTAgentCompletionQueue_Reap( MQTTAgentCompletionQueue_t * pQueue,
+                                            MQTTAgentCompletionEntry_t * pEntries,
+                                            size_t maxEntries,
+                                            uint32_t timeoutMs,
+                                            size_t * pEntryCount );
+/* @[declare_mqtt_agent_completionqueue_reap] */
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* CORE_MQTT_AGENT_COMPLETION_H */
@@ -91,6 +91,9 @@
  * MQTT traffic, but calling it too often can take processing time away from
  * lower priority tasks and waste CPU time and power.
  *
+ * The wait is shorter when a timer started with MQTTAgent_StartTimer()
+ * expires sooner.
+ *
  * <b>Possible values:</b> Any positive 32 bit integer. <br>
  * <b>Default value:</b> `1000`
  */
@@ -98,6 +101,46 @@
     #define MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME    ( 1000U )
 #endif
 
+/**
+ * @brief The maximum number of MQTT_ProcessLoop() calls in a row after a
+ * command, while packets keep being received.
+ *
+ * Without a limit, the agent task keeps receiving as long as packets arrive,
+ * so a flood of incoming publishes delays queued commands, including sending
+ * publishes. With a limit, the agent task processes the next queued command
+ * after this many calls, then comes back to receiving without waiting.
+ *
+ * The limit keeps sending and receiving in the agent task rather than giving
+ * each its own task. The coreMQTT context is not thread safe, and
+ * MQTT_ProcessLoop() itself sends acknowledgments and PINGREQs on the
+ * connection publishes are sent on, so a separate sending task would need a
+ * lock around every coreMQTT call. As each MQTT_ProcessLoop() call receives at
+ * most one packet, a queued command instead waits behind at most this many
+ * received packets.
+ *
+ * <b>Possible values:</b> Any non-negative integer. 0 means no limit. <br>
+ * <b>Default value:</b> `0`
+ */
+#ifndef MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS
+    #define MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS    ( 0U )
+#endif
+
+/**
+ * @brief The maximum number of queued commands MQTTAgent_Step() processes
+ * before returning to the event loop calling it.
+ *
+ * Without a limit, MQTTAgent_Step() returns only once the command queue is
+ * empty, so tasks that keep enqueueing commands delay the other event sources
+ * of the loop. With a limit, it returns after this many commands, with a wait
+ * time of zero so that it is called again at once.
+ *
+ * <b>Possible values:</b> Any non-negative integer. 0 means no limit. <br>
+ * <b>Default value:</b> `16`
+ */
+#ifndef MQTT_AGENT_MAX_STEP_COMMANDS
+    #define MQTT_AGENT_MAX_STEP_COMMANDS    ( 16U )
+#endif
+
 /**
  * @brief Whether the agent should configure the coreMQTT library to be used with publishes
  * greater than QoS0. Setting this to 0 will disallow the coreMQTT library to send publishes
@@ -110,6 +153,146 @@
     #define MQTT_AGENT_USE_QOS_1_2_PUBLISH    ( 1 )
 #endif
 
+/**
+ * @brief The number of commands the MQTT agent task may receive ahead of the
+ * one it is processing, to find publishes that supersede it.
+ *
+ * When the agent task receives a publish enqueued with the `conflate` member of
+ * #MQTTAgentCommandInfo_t set, it receives up to this many more commands
+ * without blocking. If one of them is also a publish to the same topic with
+ * `conflate` set, the older publish is completed without being sent, with the
+ * `superseded` member of #MQTTAgentReturnInfo_t set. Commands received ahead
+ * are still processed in order.
+ *
+ * @note Each command received ahead takes a pointer in #MQTTAgentContext_t.
+ * Setting this to 0 disables conflation, and `conflate` is then ignored.
+ *
+ * <b>Possible values:</b> Any non-negative integer. <br>
+ * <b>Default value:</b> `0`
+ */
+#ifndef MQTT_AGENT_CONFLATION_LOOKAHEAD
+    #define MQTT_AGENT_CONFLATION_LOOKAHEAD    ( 0U )
+#endif
+
+/**
+ * @brief The maximum number of active subscriptions the MQTT agent keeps, to
+ * subscribe to them again after reconnecting without a session.
+ *
+ * The agent adds each topic filter accepted in a SUBACK to its subscriptions,
+ * and removes it on its UNSUBACK. After MQTTAgent_ResumeSession() is called
+ * without a session present, it subscribes to all of them again, in as few
+ * SUBSCRIBE packets as fit in the network buffer, so application tasks do not
+ * need to subscribe again.
+ *
+ * The subscriptions are also shared by the tasks subscribing to the same topic
+ * filter: only the first SUBSCRIBE and the last UNSUBSCRIBE of a topic filter
+ * are sent to the broker, and the others are completed by the agent. The holds
+ * of each task are counted separately, see
+ * #MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS.
+ *
+ * @note Each subscription takes a copy of its topic filter of
+ * #MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH bytes in #MQTTAgentContext_t.
+ * Setting this to 0 disables keeping subscriptions.
+ *
+ * <b>Possible values:</b> Any non-negative integer. <br>
+ * <b>Default value:</b> `0`
+ */
+#ifndef MQTT_AGENT_MAX_SUBSCRIPTIONS
+    #define MQTT_AGENT_MAX_SUBSCRIPTIONS    ( 0U )
+#endif
+
+/**
+ * @brief The maximum number of holds of tasks on the subscriptions kept with
+ * #MQTT_AGENT_MAX_SUBSCRIPTIONS.
+ *
+ * Each task subscribing to a kept topic filter, identified by the
+ * `pSubscriber` member of #MQTTAgentCommandInfo_t, takes one hold on it, which
+ * counts how many of its SUBSCRIBE commands hold the subscription. A task can
+ * only unsubscribe from the subscriptions it holds. A SUBSCRIBE command that
+ * would need more kept subscriptions or holds than are left, counting those
+ * of the SUBSCRIBE commands waiting for their SUBACK, fails with
+ * #MQTTNoMemory.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> Twice #MQTT_AGENT_MAX_SUBSCRIPTIONS
+ */
+#ifndef MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS
+    #define MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS    ( MQTT_AGENT_MAX_SUBSCRIPTIONS * 2U )
+#endif
+
+/**
+ * @brief The maximum length of a topic filter kept with
+ * #MQTT_AGENT_MAX_SUBSCRIPTIONS. Longer topic filters are not subscribed to
+ * again after reconnecting.
+ *
+ * <b>Possible values:</b> Any positive integer up to 65535. <br>
+ * <b>Default value:</b> `128`
+ */
+#ifndef MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH
+    #define MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH    ( 128U )
+#endif
+
+/**
+ * @brief The maximum number of messages in one envelope of a batch created with
+ * MQTTAgentBatch_Init().
+ *
+ * An envelope is also sent when it has this many messages, even if its buffer
+ * is not full. Each message takes a completion callback and context in each of
+ * the two envelopes of #MQTTAgentBatch_t.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `16`
+ */
+#ifndef MQTT_AGENT_BATCH_MAX_MESSAGES
+    #define MQTT_AGENT_BATCH_MAX_MESSAGES    ( 16U )
+#endif
+
+/**
+ * @brief Memory fences ordering data handed between tasks through a flag,
+ * such as an envelope of a batch created with MQTTAgentBatch_Init(), the
+ * return code of a completion handle, or the entries of a completion queue.
+ *
+ * The task handing the data over writes it, calls #MQTT_AGENT_RELEASE_FENCE,
+ * then writes the flag. The task taking the data reads the flag, calls
+ * #MQTT_AGENT_ACQUIRE_FENCE, then reads the data. A `volatile` flag alone does
+ * not keep the compiler, or a CPU with weakly ordered memory such as an ARM
+ * Cortex-A, from moving the data accesses across the flag.
+ *
+ * The defaults use the GCC and clang builtins, or C11 atomics. With other
+ * compilers, such as IAR, armcc or MSVC in C90 mode, the macros are left
+ * undefined: core_mqtt_agent_batch.c and core_mqtt_agent_completion.c then do
+ * not compile until both are defined, and core_mqtt_agent.c falls back to a
+ * compiler barrier, which is only enough on a single core.
+ *
+ * <b>Default value:</b> `__atomic_thread_fence( __ATOMIC_RELEASE )` with GCC
+ * or clang, else `atomic_thread_fence( memory_order_release )` with C11 atomics,
+ * else undefined.
+ */
+#ifndef MQTT_AGENT_RELEASE_FENCE
+    #if defined( __GNUC__ )
+        #define MQTT_AGENT_RELEASE_FENCE()    __atomic_thread_fence( __ATOMIC_RELEASE )
+    #elif defined( __STDC_VERSION__ ) && ( __STDC_VERSION__ >= 201112L ) && !defined( __STDC_NO_ATOMICS__ )
+        #include <stdatomic.h>
+        #define MQTT_AGENT_RELEASE_FENCE()    atomic_thread_fence( memory_order_release )
+    #endif
+#endif
+
+/**
+ * @brief The acquire fence paired with #MQTT_AGENT_RELEASE_FENCE.
+ *
+ * <b>Default value:</b> `__atomic_thread_fence( __ATOMIC_ACQUIRE )` with GCC
+ * or clang, else `atomic_thread_fence( memory_order_acquire )` with C11 atomics,
+ * else undefined.
+ */
+#ifndef MQTT_AGENT_ACQUIRE_FENCE
+    #if defined( __GNUC__ )
+        #define MQTT_AGENT_ACQUIRE_FENCE()    __atomic_thread_fence( __ATOMIC_ACQUIRE )
+    #elif defined( __STDC_VERSION__ ) && ( __STDC_VERSION__ >= 201112L ) && !defined( __STDC_NO_ATOMICS__ )
+        #include <stdatomic.h>
+        #define MQTT_AGENT_ACQUIRE_FENCE()    atomic_thread_fence( memory_order_acquire )
+    #endif
+#endif
+
 /* *INDENT-OFF* */
 #ifdef __cplusplus
     }
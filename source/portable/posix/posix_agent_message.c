@@ -0,0 +1,409 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_agent_message.c
+ * @brief Implements the message interface of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/* Header include. */
+#include "posix_agent_message.h"
+
+/* Port includes. */
+#include "posix_clock.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Take the next command from the queue, if any.
+ *
+ * The eventfd is cleared when the queue becomes empty, and a sender waiting
+ * for space is woken.
+ *
+ * @param[in] pMsgCtx Queue to receive from.
+ * @param[out] pReceivedCommand Set to the received command.
+ * @param[out] pMoreQueued Set to whether further commands are queued.
+ *
+ * @return `true` if a command was received, else `false`.
+ */
+static bool dequeueCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            bool * pMoreQueued );
+
+/**
+ * @brief Wait for the eventfd or the socket of the watched connection to
+ * become readable.
+ *
+ * @param[in] pMsgCtx Queue to wait on.
+ * @param[in] timeoutMs Maximum time to wait.
+ * @param[out] pCommandQueued Set to whether the eventfd is readable, that is
+ * whether a command is queued.
+ * @param[out] pSocketReadable Set to whether the watched socket is readable.
+ */
+static void waitForEvent( const MQTTAgentMessageContext_t * pMsgCtx,
+                          uint32_t timeoutMs,
+                          bool * pCommandQueued,
+                          bool * pSocketReadable );
+
+/**
+ * @brief Check for a command or received data without sleeping, for at most
+ * the spin time of the queue.
+ *
+ * @param[in] pMsgCtx Queue to receive from.
+ * @param[out] pReceivedCommand Set to the received command.
+ * @param[out] pMoreQueued Set to whether further commands are queued.
+ * @param[out] pSocketReadable Set to whether the watched socket is readable.
+ *
+ * @return `true` if a command was received, else `false`.
+ */
+static bool spinForEvent( MQTTAgentMessageContext_t * pMsgCtx,
+                          MQTTAgentCommand_t ** pReceivedCommand,
+                          bool * pMoreQueued,
+                          bool * pSocketReadable );
+
+/*-----------------------------------------------------------*/
+
+static bool dequeueCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            bool * pMoreQueued )
+{
+    bool received = false;
+    eventfd_t eventValue;
+
+    ( void ) pthread_mutex_lock( &( pMsgCtx->mutex ) );
+
+    if( pMsgCtx->count > 0U )
+    {
+        *pReceivedCommand = pMsgCtx->pCommands[ pMsgCtx->head ];
+        pMsgCtx->head = ( pMsgCtx->head + 1U ) % pMsgCtx->queueLength;
+
+        pMsgCtx->count--;
+        ( void ) pthread_cond_signal( &( pMsgCtx->notFull ) );
+
+        if( pMsgCtx->count == 0U )
+        {
+            /* The eventfd is readable only while the queue is not empty. It
+             * is written and read with the mutex held, so it cannot be cleared
+             * after a new command was queued. */
+            ( void ) eventfd_read( pMsgCtx->eventFd, &eventValue );
+        }
+
+        received = true;
+    }
+
+    *pMoreQueued = ( pMsgCtx->count > 0U );
+
+    ( void ) pthread_mutex_unlock( &( pMsgCtx->mutex ) );
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+static void waitForEvent( const MQTTAgentMessageContext_t * pMsgCtx,
+                          uint32_t timeoutMs,
+                          bool * pCommandQueued,
+                          bool * pSocketReadable )
+{
+    struct pollfd pollFds[ 2 ];
+    int pollResult;
+
+    pollFds[ 0 ].fd = pMsgCtx->eventFd;
+    pollFds[ 0 ].events = POLLIN;
+    pollFds[ 0 ].revents = 0;
+
+    /* A negative descriptor is ignored by poll(). */
+    pollFds[ 1 ].fd = ( pMsgCtx->pConnection != NULL ) ? pMsgCtx->pConnection->socketFd : -1;
+    pollFds[ 1 ].events = POLLIN;
+    pollFds[ 1 ].revents = 0;
+
+    pollResult = poll( pollFds, 2U, ( int ) timeoutMs );
+
+    *pCommandQueued = ( pollResult > 0 ) && ( pollFds[ 0 ].revents != 0 );
+    *pSocketReadable = ( pollResult > 0 ) && ( pollFds[ 1 ].revents != 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool spinForEvent( MQTTAgentMessageContext_t * pMsgCtx,
+                          MQTTAgentCommand_t ** pReceivedCommand,
+                          bool * pMoreQueued,
+                          bool * pSocketReadable )
+{
+    bool received = false;
+    bool commandQueued = false;
+    struct timespec startTime;
+    struct timespec currentTime;
+    long elapsedUs = 0L;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &startTime );
+
+    while( !received && !( *pSocketReadable ) && ( elapsedUs < ( long ) pMsgCtx->spinTimeUs ) )
+    {
+        /* The eventfd is readable while the queue is not empty, so one poll
+         * checks for both events, and the mutex is only taken once a command
+         * is queued. */
+        waitForEvent( pMsgCtx, 0U, &commandQueued, pSocketReadable );
+
+        if( commandQueued )
+        {
+            received = dequeueCommand( pMsgCtx, pReceivedCommand, pMoreQueued );
+        }
+
+        ( void ) clock_gettime( CLOCK_MONOTONIC, &currentTime );
+        elapsedUs = ( ( long ) ( currentTime.tv_sec - startTime.tv_sec ) * 1000000L ) +
+                    ( ( currentTime.tv_nsec - startTime.tv_nsec ) / 1000L );
+    }
+
+    /* The counters are only written by the agent task, but may be read by any
+     * task. */
+    if( received || *pSocketReadable )
+    {
+        __atomic_store_n( &( pMsgCtx->spinHits ), pMsgCtx->spinHits + 1U, __ATOMIC_RELAXED );
+    }
+    else
+    {
+        __atomic_store_n( &( pMsgCtx->spinMisses ), pMsgCtx->spinMisses + 1U, __ATOMIC_RELAXED );
+    }
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixAgentMessage_Init( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t ** pQueueStorage,
+                             size_t queueLength )
+{
+    bool initialized = false;
+    pthread_condattr_t condAttributes;
+
+    if( ( pMsgCtx == NULL ) || ( pQueueStorage == NULL ) || ( queueLength == 0U ) )
+    {
+        LogError( ( "Invalid parameter: pMsgCtx=%p, pQueueStorage=%p, queueLength=%lu.",
+                    ( void * ) pMsgCtx,
+                    ( void * ) pQueueStorage,
+                    ( unsigned long ) queueLength ) );
+    }
+    else
+    {
+        ( void ) memset( pMsgCtx, 0x00, sizeof( MQTTAgentMessageContext_t ) );
+        pMsgCtx->pCommands = pQueueStorage;
+        pMsgCtx->queueLength = queueLength;
+        pMsgCtx->eventFd = eventfd( 0U, EFD_NONBLOCK | EFD_CLOEXEC );
+
+        if( pMsgCtx->eventFd < 0 )
+        {
+            LogError( ( "Failed to create eventfd: %s.", strerror( errno ) ) );
+        }
+        else
+        {
+            /* Waits for space use the monotonic clock, so they are not
+             * affected by changes to the wall clock. */
+            ( void ) pthread_condattr_init( &condAttributes );
+            ( void ) pthread_condattr_setclock( &condAttributes, CLOCK_MONOTONIC );
+            ( void ) pthread_cond_init( &( pMsgCtx->notFull ), &condAttributes );
+            ( void ) pthread_condattr_destroy( &condAttributes );
+            ( void ) pthread_mutex_init( &( pMsgCtx->mutex ), NULL );
+            initialized = true;
+        }
+    }
+
+    return initialized;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixAgentMessage_Cleanup( MQTTAgentMessageContext_t * pMsgCtx )
+{
+    if( ( pMsgCtx != NULL ) && ( pMsgCtx->eventFd >= 0 ) )
+    {
+        ( void ) close( pMsgCtx->eventFd );
+        pMsgCtx->eventFd = -1;
+        ( void ) pthread_cond_destroy( &( pMsgCtx->notFull ) );
+        ( void ) pthread_mutex_destroy( &( pMsgCtx->mutex ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixAgentMessage_WatchConnection( MQTTAgentMessageContext_t * pMsgCtx,
+                                        NetworkContext_t * pNetworkContext )
+{
+    if( pMsgCtx != NULL )
+    {
+        if( pMsgCtx->pConnection != NULL )
+        {
+            /* The previous connection must not keep holding packets back. */
+            pMsgCtx->pConnection->holdSends = false;
+            ( void ) PosixTransport_Flush( pMsgCtx->pConnection );
+        }
+
+        pMsgCtx->pConnection = pNetworkContext;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixAgentMessage_SetSpinTime( MQTTAgentMessageContext_t * pMsgCtx,
+                                    uint32_t spinTimeUs )
+{
+    if( pMsgCtx != NULL )
+    {
+        pMsgCtx->spinTimeUs = spinTimeUs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixAgentMessage_GetSpinCounts( const MQTTAgentMessageContext_t * pMsgCtx,
+                                      uint32_t * pSpinHits,
+                                      uint32_t * pSpinMisses )
+{
+    if( ( pMsgCtx != NULL ) && ( pSpinHits != NULL ) && ( pSpinMisses != NULL ) )
+    {
+        *pSpinHits = __atomic_load_n( &( pMsgCtx->spinHits ), __ATOMIC_RELAXED );
+        *pSpinMisses = __atomic_load_n( &( pMsgCtx->spinMisses ), __ATOMIC_RELAXED );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixAgentMessage_Send( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t * const * pCommandToSend,
+                             uint32_t blockTimeMs )
+{
+    bool sent = false;
+    struct timespec deadline;
+    int waitResult = 0;
+    size_t tail;
+
+    assert( pMsgCtx != NULL );
+    assert( pCommandToSend != NULL );
+
+    ( void ) pthread_mutex_lock( &( pMsgCtx->mutex ) );
+
+    if( ( pMsgCtx->count == pMsgCtx->queueLength ) && ( blockTimeMs > 0U ) )
+    {
+        PosixClock_GetDeadline( &deadline, blockTimeMs );
+
+        while( ( pMsgCtx->count == pMsgCtx->queueLength ) && ( waitResult == 0 ) )
+        {
+            waitResult = pthread_cond_timedwait( &( pMsgCtx->notFull ), &( pMsgCtx->mutex ), &deadline );
+        }
+    }
+
+    if( pMsgCtx->count < pMsgCtx->queueLength )
+    {
+        tail = ( pMsgCtx->head + pMsgCtx->count ) % pMsgCtx->queueLength;
+        pMsgCtx->pCommands[ tail ] = *pCommandToSend;
+        pMsgCtx->count++;
+
+        if( pMsgCtx->count == 1U )
+        {
+            /* Wake the agent only when the queue stops being empty. */
+            ( void ) eventfd_write( pMsgCtx->eventFd, 1U );
+        }
+
+        sent = true;
+    }
+
+    ( void ) pthread_mutex_unlock( &( pMsgCtx->mutex ) );
+
+    return sent;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixAgentMessage_Recv( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t ** pReceivedCommand,
+                             uint32_t blockTimeMs )
+{
+    bool received = false;
+    bool moreQueued = false;
+    bool commandQueued = false;
+    bool socketReadable = false;
+    uint32_t startTimeMs;
+    uint32_t elapsedMs = 0U;
+
+    assert( pMsgCtx != NULL );
+    assert( pReceivedCommand != NULL );
+
+    startTimeMs = PosixClock_GetTimeMs();
+    received = dequeueCommand( pMsgCtx, pReceivedCommand, &moreQueued );
+
+    if( !received && ( pMsgCtx->pConnection != NULL ) && ( pMsgCtx->pConnection->heldLength > 0U ) )
+    {
+        /* Nothing is held back while the agent waits. */
+        ( void ) PosixTransport_Flush( pMsgCtx->pConnection );
+    }
+
+    if( !received && ( blockTimeMs > 0U ) && ( pMsgCtx->spinTimeUs > 0U ) )
+    {
+        received = spinForEvent( pMsgCtx, pReceivedCommand, &moreQueued, &socketReadable );
+        elapsedMs = PosixClock_GetTimeMs() - startTimeMs;
+    }
+
+    while( !received && !socketReadable && ( elapsedMs < blockTimeMs ) )
+    {
+        waitForEvent( pMsgCtx, blockTimeMs - elapsedMs, &commandQueued, &socketReadable );
+
+        if( commandQueued )
+        {
+            received = dequeueCommand( pMsgCtx, pReceivedCommand, &moreQueued );
+        }
+
+        elapsedMs = PosixClock_GetTimeMs() - startTimeMs;
+    }
+
+    if( pMsgCtx->pConnection != NULL )
+    {
+        /* The packets of the command received are held back only if another
+         * command follows, so that they are sent with those of the last
+         * queued command. */
+        pMsgCtx->pConnection->holdSends = moreQueued;
+    }
+
+    return received;
+}
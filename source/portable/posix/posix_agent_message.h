@@ -0,0 +1,201 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_agent_message.h
+ * @brief Message interface of the POSIX port: a queue of commands that
+ * signals an eventfd while it is not empty.
+ *
+ * The eventfd can be watched by an event loop calling MQTTAgent_Step(). When
+ * the agent runs MQTTAgent_CommandLoop() instead, the receive function also
+ * returns as soon as the socket of a watched connection becomes readable, so
+ * that received packets are processed without waiting for a command or a
+ * timeout.
+ *
+ * While further commands are queued, the packets of the watched connection are
+ * held back in its send buffer, if it has one, and sent together once the
+ * queue is empty.
+ *
+ * For the lowest latency, the receive function can spin, checking for a
+ * command or received data without sleeping, for a set time before it waits.
+ * This uses a CPU for as long as it spins, so it is off by default, and the
+ * counts of the spins that ended with an event and of those that did not show
+ * whether the time is well chosen.
+ */
+#ifndef POSIX_AGENT_MESSAGE_H
+#define POSIX_AGENT_MESSAGE_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* POSIX includes. */
+#include <pthread.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent_message_interface.h"
+
+/* Port include. */
+#include "posix_transport.h"
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Queue of commands of the POSIX port.
+ *
+ * @note The members of this struct are managed by the functions of the port,
+ * and should not be written by the application.
+ */
+struct MQTTAgentMessageContext
+{
+    pthread_mutex_t mutex;           /**< @brief Protects the queue. */
+    pthread_cond_t notFull;          /**< @brief Signaled when a command is received. */
+    MQTTAgentCommand_t ** pCommands; /**< @brief Ring of queued commands. */
+    size_t queueLength;              /**< @brief Number of entries of `pCommands`. */
+    size_t head;                     /**< @brief Index in `pCommands` of the next command to receive. */
+    size_t count;                    /**< @brief Number of queued commands. */
+    int eventFd;                     /**< @brief Readable while the queue is not empty. */
+    NetworkContext_t * pConnection;  /**< @brief Connection whose socket ends a wait to receive when readable, or NULL. */
+    uint32_t spinTimeUs;             /**< @brief Time in microseconds to spin before waiting, or 0 not to spin. */
+    uint32_t spinHits;               /**< @brief Number of spins that ended with a command or received data. */
+    uint32_t spinMisses;             /**< @brief Number of spins that ended without an event, followed by a wait. */
+};
+
+/**
+ * @brief Initialize a queue of commands.
+ *
+ * @param[out] pMsgCtx Queue to initialize.
+ * @param[in] pQueueStorage Storage for the pointers to the queued commands.
+ * It MUST remain in scope until PosixAgentMessage_Cleanup() is called.
+ * @param[in] queueLength Number of entries in @p pQueueStorage.
+ *
+ * @return `true` if the queue was initialized, else `false`.
+ */
+bool PosixAgentMessage_Init( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t ** pQueueStorage,
+                             size_t queueLength );
+
+/**
+ * @brief Release the resources of a queue of commands.
+ *
+ * @param[in] pMsgCtx Queue to clean up.
+ */
+void PosixAgentMessage_Cleanup( MQTTAgentMessageContext_t * pMsgCtx );
+
+/**
+ * @brief Set the connection of the POSIX transport whose socket ends a wait in
+ * PosixAgentMessage_Recv() when it becomes readable.
+ *
+ * This should be the network context of the agent's connection. The socket is
+ * read from it on each wait, so the connection may be closed and made again
+ * without watching it again. While a command is received with further commands
+ * queued, the connection holds back the packets sent, if it has a send buffer.
+ * The packets are sent once a receive finds the queue empty.
+ *
+ * This must be called from the agent task, or before it is started.
+ *
+ * @param[in] pMsgCtx Queue of the agent.
+ * @param[in] pNetworkContext Connection to watch, or NULL to watch none.
+ */
+void PosixAgentMessage_WatchConnection( MQTTAgentMessageContext_t * pMsgCtx,
+                                        NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Set the time that PosixAgentMessage_Recv() spins before waiting, when
+ * a command is not already queued and the block time is not zero.
+ *
+ * A spin that sees neither a command nor received data for @p spinTimeUs is
+ * followed by a wait for the rest of the block time, during which the CPU is
+ * free for other threads. Spinning is only useful when the agent thread has a
+ * CPU of its own.
+ *
+ * This must be called from the agent task, or before it is started.
+ *
+ * @param[in] pMsgCtx Queue of the agent.
+ * @param[in] spinTimeUs Time in microseconds to spin, or 0 not to spin.
+ */
+void PosixAgentMessage_SetSpinTime( MQTTAgentMessageContext_t * pMsgCtx,
+                                    uint32_t spinTimeUs );
+
+/**
+ * @brief Get the number of spins of PosixAgentMessage_Recv() that ended with
+ * an event, and of those that did not.
+ *
+ * This may be called from any task. The counts wrap around at 2^32.
+ *
+ * @param[in] pMsgCtx Queue of the agent.
+ * @param[out] pSpinHits Set to the number of spins that ended with a command
+ * or received data.
+ * @param[out] pSpinMisses Set to the number of spins that ended without an
+ * event, and were followed by a wait.
+ */
+void PosixAgentMessage_GetSpinCounts( const MQTTAgentMessageContext_t * pMsgCtx,
+                                      uint32_t * pSpinHits,
+                                      uint32_t * pSpinMisses );
+
+/**
+ * @brief Send a command to the queue, waiting for space if it is full.
+ *
+ * This is the #MQTTAgentMessageSend_t of the message interface.
+ *
+ * @param[in] pMsgCtx Queue to send to.
+ * @param[in] pCommandToSend Pointer to the command to send.
+ * @param[in] blockTimeMs Maximum time to wait for space in the queue.
+ *
+ * @return `true` if the command was queued, else `false`.
+ */
+bool PosixAgentMessage_Send( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t * const * pCommandToSend,
+                             uint32_t blockTimeMs );
+
+/**
+ * @brief Receive a command from the queue, waiting for one if it is empty.
+ *
+ * This is the #MQTTAgentMessageRecv_t of the message interface. The packets
+ * held back by the watched connection are sent before waiting, and the wait
+ * ends early, without a command, when its socket becomes readable. The wait
+ * starts with a spin if a spin time is set.
+ *
+ * @param[in] pMsgCtx Queue to receive from.
+ * @param[out] pReceivedCommand Set to the received command.
+ * @param[in] blockTimeMs Maximum time to wait for a command. A block time of
+ * zero does not wait.
+ *
+ * @return `true` if a command was received, else `false`.
+ */
+bool PosixAgentMessage_Recv( MQTTAgentMessageContext_t * pMsgCtx,
+                             MQTTAgentCommand_t ** pReceivedCommand,
+                             uint32_t blockTimeMs );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_AGENT_MESSAGE_H */
@@ -0,0 +1,295 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_agent_thread.c
+ * @brief Implements the start of the agent thread of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+/* Header include. */
+#include "posix_agent_thread.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Write each page of a buffer with the value it already has, so that
+ * the pages are present without changing the buffer.
+ *
+ * @param[in] pBuffer Buffer to write.
+ * @param[in] bufferSize Size of @p pBuffer.
+ */
+static void prefaultBuffer( volatile uint8_t * pBuffer,
+                            size_t bufferSize );
+
+/**
+ * @brief Write the pages of the stack below the caller.
+ *
+ * This is called through a volatile pointer, so that it is not inlined and
+ * its stack frame is reused by the functions called after it.
+ */
+static void prefaultStack( void );
+
+/**
+ * @brief Entry of the agent thread.
+ *
+ * @param[in] pArgument The #PosixAgentThread_t of the thread.
+ *
+ * @return The value returned by the function of the thread.
+ */
+static void * runAgentThread( void * pArgument );
+
+/**
+ * @brief Entry of the agent thread when pre-faulting is enabled.
+ *
+ * @param[in] pArgument The #PosixAgentThread_t of the thread.
+ *
+ * @return The value returned by the function of the thread.
+ */
+static void * runPrefaultedAgentThread( void * pArgument );
+
+/**
+ * @brief Set the options of the agent thread in its attributes.
+ *
+ * @param[in] pAttributes Attributes to set.
+ * @param[in] pConfig Options of the agent thread.
+ *
+ * @return `true` if the options were set, else `false`.
+ */
+static bool setThreadAttributes( pthread_attr_t * pAttributes,
+                                 const PosixAgentThreadConfig_t * pConfig );
+
+/*-----------------------------------------------------------*/
+
+static void prefaultBuffer( volatile uint8_t * pBuffer,
+                            size_t bufferSize )
+{
+    long pageSize = sysconf( _SC_PAGESIZE );
+    size_t step = ( pageSize > 0L ) ? ( size_t ) pageSize : 4096U;
+    size_t offset;
+
+    for( offset = 0U; offset < bufferSize; offset += step )
+    {
+        pBuffer[ offset ] = pBuffer[ offset ];
+    }
+
+    if( bufferSize > 0U )
+    {
+        /* The last page may not have been written if the buffer does not
+         * start on a page boundary. */
+        pBuffer[ bufferSize - 1U ] = pBuffer[ bufferSize - 1U ];
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prefaultStack( void )
+{
+    volatile uint8_t stackPages[ MQTT_AGENT_POSIX_PREFAULT_STACK_SIZE ];
+    size_t offset;
+
+    /* The step is smaller than any page size. */
+    for( offset = 0U; offset < sizeof( stackPages ); offset += 256U )
+    {
+        stackPages[ offset ] = 0U;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void * runAgentThread( void * pArgument )
+{
+    const PosixAgentThread_t * pAgentThread = ( const PosixAgentThread_t * ) pArgument;
+    void * pResult = NULL;
+    MQTTStatus_t status;
+
+    if( pAgentThread->threadFunction != NULL )
+    {
+        pResult = pAgentThread->threadFunction( pAgentThread->pArgument );
+    }
+    else
+    {
+        status = MQTTAgent_CommandLoop( pAgentThread->pAgentContext );
+
+        if( status != MQTTSuccess )
+        {
+            LogError( ( "MQTT agent command loop failed: %s.", MQTT_Status_strerror( status ) ) );
+        }
+    }
+
+    return pResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void * runPrefaultedAgentThread( void * pArgument )
+{
+    void ( * volatile prefault )( void ) = prefaultStack;
+
+    prefault();
+
+    return runAgentThread( pArgument );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool setThreadAttributes( pthread_attr_t * pAttributes,
+                                 const PosixAgentThreadConfig_t * pConfig )
+{
+    int result = 0;
+    cpu_set_t cpuSet;
+    struct sched_param schedulingParameters;
+
+    if( pConfig->cpu >= 0 )
+    {
+        CPU_ZERO( &cpuSet );
+        CPU_SET( ( size_t ) pConfig->cpu, &cpuSet );
+        result = pthread_attr_setaffinity_np( pAttributes, sizeof( cpuSet ), &cpuSet );
+    }
+
+    if( ( result == 0 ) && ( pConfig->priority > 0 ) )
+    {
+        ( void ) memset( &schedulingParameters, 0x00, sizeof( schedulingParameters ) );
+        schedulingParameters.sched_priority = pConfig->priority;
+
+        /* Without this, the thread takes the policy of the calling thread. */
+        result = pthread_attr_setinheritsched( pAttributes, PTHREAD_EXPLICIT_SCHED );
+
+        if( result == 0 )
+        {
+            result = pthread_attr_setschedpolicy( pAttributes, SCHED_FIFO );
+        }
+
+        if( result == 0 )
+        {
+            result = pthread_attr_setschedparam( pAttributes, &schedulingParameters );
+        }
+    }
+
+    if( result != 0 )
+    {
+        LogError( ( "Failed to set agent thread attributes: %s.", strerror( result ) ) );
+    }
+
+    return ( result == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixAgentThread_Start( PosixAgentThread_t * pAgentThread,
+                             const PosixAgentThreadConfig_t * pConfig,
+                             MQTTAgentContext_t * pMqttAgentContext,
+                             PosixAgentThreadFunction_t threadFunction,
+                             void * pArgument )
+{
+    bool started = false;
+    bool valid = true;
+    pthread_attr_t attributes;
+    int result;
+
+    if( ( pAgentThread == NULL ) || ( pConfig == NULL ) || ( pMqttAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pAgentThread=%p, pConfig=%p, pMqttAgentContext=%p.",
+                    ( void * ) pAgentThread,
+                    ( const void * ) pConfig,
+                    ( void * ) pMqttAgentContext ) );
+        valid = false;
+    }
+    else if( ( pConfig->cpu >= CPU_SETSIZE ) ||
+             ( ( pConfig->priority != 0 ) &&
+               ( ( pConfig->priority < sched_get_priority_min( SCHED_FIFO ) ) ||
+                 ( pConfig->priority > sched_get_priority_max( SCHED_FIFO ) ) ) ) )
+    {
+        LogError( ( "Invalid agent thread options: cpu=%d, priority=%d.",
+                    pConfig->cpu,
+                    pConfig->priority ) );
+        valid = false;
+    }
+    else if( pConfig->lockMemory && ( mlockall( MCL_CURRENT | MCL_FUTURE ) != 0 ) )
+    {
+        LogError( ( "Failed to lock memory: %s.", strerror( errno ) ) );
+        valid = false;
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    if( valid )
+    {
+        pAgentThread->pAgentContext = pMqttAgentContext;
+        pAgentThread->threadFunction = threadFunction;
+        pAgentThread->pArgument = pArgument;
+
+        if( pConfig->prefault && ( pMqttAgentContext->mqttContext.networkBuffer.pBuffer != NULL ) )
+        {
+            prefaultBuffer( pMqttAgentContext->mqttContext.networkBuffer.pBuffer,
+                            pMqttAgentContext->mqttContext.networkBuffer.size );
+        }
+
+        ( void ) pthread_attr_init( &attributes );
+
+        if( setThreadAttributes( &attributes, pConfig ) )
+        {
+            result = pthread_create( &( pAgentThread->thread ),
+                                     &attributes,
+                                     pConfig->prefault ? runPrefaultedAgentThread : runAgentThread,
+                                     pAgentThread );
+
+            if( result == 0 )
+            {
+                started = true;
+            }
+            else
+            {
+                LogError( ( "Failed to create agent thread: %s.", strerror( result ) ) );
+            }
+        }
+
+        ( void ) pthread_attr_destroy( &attributes );
+
+        /* The lock outlives this call only for a running agent thread. */
+        if( !started && pConfig->lockMemory )
+        {
+            ( void ) munlockall();
+        }
+    }
+
+    return started;
+}
@@ -0,0 +1,157 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_agent_thread.h
+ * @brief Start of the agent thread of the POSIX port with real-time options.
+ *
+ * The agent thread can be pinned to a CPU and given a `SCHED_FIFO` priority,
+ * the memory of the process can be locked, and the network buffer and the
+ * stack of the agent thread can be written before the agent runs, so that the
+ * agent does not wait for other threads, page faults or swapping.
+ */
+#ifndef POSIX_AGENT_THREAD_H
+#define POSIX_AGENT_THREAD_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdbool.h>
+
+/* POSIX includes. */
+#include <pthread.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Size of the start of the stack of the agent thread that is written
+ * before the agent runs, when pre-faulting is enabled.
+ *
+ * <b>Possible values:</b> Any positive integer smaller than the stack size of
+ * the agent thread. <br>
+ * <b>Default value:</b> `16384`
+ */
+#ifndef MQTT_AGENT_POSIX_PREFAULT_STACK_SIZE
+    #define MQTT_AGENT_POSIX_PREFAULT_STACK_SIZE    ( 16384U )
+#endif
+
+/**
+ * @brief Function run by the agent thread, as for `pthread_create()`.
+ */
+typedef void * ( * PosixAgentThreadFunction_t )( void * pArgument );
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Options of the agent thread.
+ */
+typedef struct PosixAgentThreadConfig
+{
+    int cpu;         /**< @brief CPU the agent thread runs on, or -1 to let it run on any CPU. */
+    int priority;    /**< @brief `SCHED_FIFO` priority of the agent thread, or 0 to keep the default scheduling policy. */
+    bool lockMemory; /**< @brief Whether to lock the current and future pages of the process in memory with `mlockall()`. */
+    bool prefault;   /**< @brief Whether to write the network buffer and the start of the stack of the agent thread before the agent runs. */
+} PosixAgentThreadConfig_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief An agent thread started by PosixAgentThread_Start().
+ *
+ * @note The members of this struct other than `thread` are managed by
+ * PosixAgentThread_Start(), and should not be written by the application.
+ */
+typedef struct PosixAgentThread
+{
+    pthread_t thread;                          /**< @brief The agent thread, which may be joined with `pthread_join()`. */
+    MQTTAgentContext_t * pAgentContext;        /**< @brief Agent run by the thread. */
+    PosixAgentThreadFunction_t threadFunction; /**< @brief Function run by the thread, or NULL to run MQTTAgent_CommandLoop(). */
+    void * pArgument;                          /**< @brief Argument of `threadFunction`. */
+} PosixAgentThread_t;
+
+/**
+ * @brief Start the agent thread with real-time options.
+ *
+ * Each option is applied before the thread is created, and the thread is not
+ * created if an option cannot be applied. Setting a `SCHED_FIFO` priority or
+ * locking more memory than `RLIMIT_MEMLOCK` requires the `CAP_SYS_NICE` or
+ * `CAP_IPC_LOCK` capability, or a suitable resource limit.
+ *
+ * Locking memory applies to the whole process, not only the agent thread, and
+ * stays in effect after the thread ends. It also makes every page of the
+ * process present, including the stacks of threads created later. If the
+ * thread cannot be created once memory is locked, the memory of the process is
+ * unlocked with `munlockall()`, which also undoes earlier locks made by the
+ * application. Without locking, pre-faulting writes each page
+ * of the network buffer of the agent, and of the first
+ * #MQTT_AGENT_POSIX_PREFAULT_STACK_SIZE bytes of the stack of the agent
+ * thread. The commands of the command pool of the port are written by
+ * PosixCommandPool_Init().
+ *
+ * @param[out] pAgentThread Agent thread to start. It MUST remain in scope
+ * until the thread ends.
+ * @param[in] pConfig Options of the agent thread.
+ * @param[in] pMqttAgentContext Initialized MQTT agent to run.
+ * @param[in] threadFunction Function run by the agent thread, which should
+ * call MQTTAgent_CommandLoop() and, for example, reconnect when it returns. If
+ * NULL, the thread runs MQTTAgent_CommandLoop() once.
+ * @param[in] pArgument Argument of @p threadFunction.
+ *
+ * @return `true` if the agent thread was started, else `false`.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * static PosixAgentThread_t agentThread;
+ * PosixAgentThreadConfig_t threadConfig = { 0 };
+ *
+ * // Run the agent on CPU 3, above the default scheduling policy, with all
+ * // memory locked.
+ * threadConfig.cpu = 3;
+ * threadConfig.priority = 50;
+ * threadConfig.lockMemory = true;
+ * threadConfig.prefault = true;
+ *
+ * if( PosixAgentThread_Start( &agentThread, &threadConfig, &mqttAgentContext, agentTask, NULL ) )
+ * {
+ *     ( void ) pthread_join( agentThread.thread, NULL );
+ * }
+ * @endcode
+ */
+bool PosixAgentThread_Start( PosixAgentThread_t * pAgentThread,
+                             const PosixAgentThreadConfig_t * pConfig,
+                             MQTTAgentContext_t * pMqttAgentContext,
+                             PosixAgentThreadFunction_t threadFunction,
+                             void * pArgument );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_AGENT_THREAD_H */
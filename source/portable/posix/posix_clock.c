@@ -0,0 +1,92 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_clock.c
+ * @brief Implements the time functions of the POSIX port.
+ */
+
+/* Enable the POSIX declarations used by the port. */
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE    200809L
+#endif
+
+/* Standard includes. */
+#include <stddef.h>
+#include <assert.h>
+
+/* Header include. */
+#include "posix_clock.h"
+
+/**
+ * @brief Milliseconds per second.
+ */
+#define MILLISECONDS_PER_SECOND          ( 1000U )
+
+/**
+ * @brief Nanoseconds per millisecond.
+ */
+#define NANOSECONDS_PER_MILLISECOND      ( 1000000L )
+
+/**
+ * @brief Nanoseconds per second.
+ */
+#define NANOSECONDS_PER_SECOND           ( 1000000000L )
+
+/*-----------------------------------------------------------*/
+
+uint32_t PosixClock_GetTimeMs( void )
+{
+    struct timespec timeSpec = { 0 };
+    int result;
+
+    result = clock_gettime( CLOCK_MONOTONIC, &timeSpec );
+    assert( result == 0 );
+    ( void ) result;
+
+    /* The multiplication wraps around, which is expected by coreMQTT. */
+    return ( ( uint32_t ) timeSpec.tv_sec * MILLISECONDS_PER_SECOND ) +
+           ( uint32_t ) ( timeSpec.tv_nsec / NANOSECONDS_PER_MILLISECOND );
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixClock_GetDeadline( struct timespec * pDeadline,
+                             uint32_t timeoutMs )
+{
+    int result;
+
+    assert( pDeadline != NULL );
+
+    result = clock_gettime( CLOCK_MONOTONIC, pDeadline );
+    assert( result == 0 );
+    ( void ) result;
+
+    pDeadline->tv_sec += ( time_t ) ( timeoutMs / MILLISECONDS_PER_SECOND );
+    pDeadline->tv_nsec += ( long ) ( timeoutMs % MILLISECONDS_PER_SECOND ) * NANOSECONDS_PER_MILLISECOND;
+
+    if( pDeadline->tv_nsec >= NANOSECONDS_PER_SECOND )
+    {
+        pDeadline->tv_sec++;
+        pDeadline->tv_nsec -= NANOSECONDS_PER_SECOND;
+    }
+}
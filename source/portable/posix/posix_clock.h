@@ -0,0 +1,67 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_clock.h
+ * @brief Time functions of the POSIX port, based on `CLOCK_MONOTONIC`.
+ */
+#ifndef POSIX_CLOCK_H
+#define POSIX_CLOCK_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Get the time in milliseconds from `CLOCK_MONOTONIC`.
+ *
+ * The time does not jump when the wall clock is changed, and wraps around
+ * every 2^32 milliseconds, as expected by coreMQTT. It can be given as the
+ * #MQTTGetCurrentTimeFunc_t of MQTTAgent_Init().
+ *
+ * @return The time in milliseconds.
+ */
+uint32_t PosixClock_GetTimeMs( void );
+
+/**
+ * @brief Get the `CLOCK_MONOTONIC` time at which a timeout expires, for
+ * waits on a condition variable using that clock.
+ *
+ * @param[out] pDeadline Set to the time @p timeoutMs from now.
+ * @param[in] timeoutMs Timeout in milliseconds.
+ */
+void PosixClock_GetDeadline( struct timespec * pDeadline,
+                             uint32_t timeoutMs );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_CLOCK_H */
@@ -0,0 +1,174 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_command_pool.c
+ * @brief Implements the pool of commands of the POSIX port.
+ */
+
+/* Enable the POSIX declarations used by the port. */
+#ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE    200809L
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <pthread.h>
+#include <time.h>
+
+/* Header include. */
+#include "posix_command_pool.h"
+
+/* Port includes. */
+#include "posix_clock.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/**
+ * @brief Commands of the pool.
+ */
+static MQTTAgentCommand_t commands[ MQTT_AGENT_POSIX_COMMAND_POOL_SIZE ];
+
+/**
+ * @brief Stack of the free commands of the pool.
+ */
+static MQTTAgentCommand_t * pFreeCommands[ MQTT_AGENT_POSIX_COMMAND_POOL_SIZE ];
+
+/**
+ * @brief Number of commands in #pFreeCommands.
+ */
+static size_t freeCount = 0U;
+
+/**
+ * @brief Protects #pFreeCommands.
+ */
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Signaled when a command is given back to the pool.
+ */
+static pthread_cond_t commandFreed;
+
+/*-----------------------------------------------------------*/
+
+bool PosixCommandPool_Init( void )
+{
+    pthread_condattr_t condAttributes;
+    size_t i;
+
+    ( void ) pthread_condattr_init( &condAttributes );
+    ( void ) pthread_condattr_setclock( &condAttributes, CLOCK_MONOTONIC );
+    ( void ) pthread_cond_init( &commandFreed, &condAttributes );
+    ( void ) pthread_condattr_destroy( &condAttributes );
+
+    ( void ) pthread_mutex_lock( &poolMutex );
+
+    /* The commands are written here, rather than on first use by the agent,
+     * so that their pages are present before it runs. */
+    ( void ) memset( commands, 0x00, sizeof( commands ) );
+
+    for( i = 0U; i < MQTT_AGENT_POSIX_COMMAND_POOL_SIZE; i++ )
+    {
+        pFreeCommands[ i ] = &( commands[ i ] );
+    }
+
+    freeCount = MQTT_AGENT_POSIX_COMMAND_POOL_SIZE;
+
+    ( void ) pthread_mutex_unlock( &poolMutex );
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTAgentCommand_t * PosixCommandPool_GetCommand( uint32_t blockTimeMs )
+{
+    MQTTAgentCommand_t * pCommand = NULL;
+    struct timespec deadline;
+    int waitResult = 0;
+
+    ( void ) pthread_mutex_lock( &poolMutex );
+
+    if( ( freeCount == 0U ) && ( blockTimeMs > 0U ) )
+    {
+        PosixClock_GetDeadline( &deadline, blockTimeMs );
+
+        while( ( freeCount == 0U ) && ( waitResult == 0 ) )
+        {
+            waitResult = pthread_cond_timedwait( &commandFreed, &poolMutex, &deadline );
+        }
+    }
+
+    if( freeCount > 0U )
+    {
+        freeCount--;
+        pCommand = pFreeCommands[ freeCount ];
+    }
+
+    ( void ) pthread_mutex_unlock( &poolMutex );
+
+    if( pCommand == NULL )
+    {
+        LogDebug( ( "No command is free in the pool." ) );
+    }
+
+    return pCommand;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixCommandPool_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease )
+{
+    bool released = false;
+    size_t index;
+
+    /* Only commands of the pool can be given back. */
+    if( ( pCommandToRelease != NULL ) &&
+        ( pCommandToRelease >= &( commands[ 0 ] ) ) &&
+        ( pCommandToRelease < &( commands[ MQTT_AGENT_POSIX_COMMAND_POOL_SIZE ] ) ) )
+    {
+        index = ( size_t ) ( pCommandToRelease - &( commands[ 0 ] ) );
+        ( void ) memset( &( commands[ index ] ), 0x00, sizeof( MQTTAgentCommand_t ) );
+
+        ( void ) pthread_mutex_lock( &poolMutex );
+
+        assert( freeCount < MQTT_AGENT_POSIX_COMMAND_POOL_SIZE );
+        pFreeCommands[ freeCount ] = &( commands[ index ] );
+        freeCount++;
+
+        ( void ) pthread_cond_signal( &commandFreed );
+
+        ( void ) pthread_mutex_unlock( &poolMutex );
+
+        released = true;
+    }
+    else
+    {
+        LogError( ( "Command %p is not a command of the pool.", ( void * ) pCommandToRelease ) );
+    }
+
+    return released;
+}
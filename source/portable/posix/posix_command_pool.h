@@ -0,0 +1,95 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_command_pool.h
+ * @brief Pool of commands of the POSIX port.
+ */
+#ifndef POSIX_COMMAND_POOL_H
+#define POSIX_COMMAND_POOL_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdint.h>
+#include <stdbool.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Number of commands in the pool.
+ *
+ * This bounds the number of commands that can be queued or awaiting an
+ * acknowledgment at the same time.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `32`
+ */
+#ifndef MQTT_AGENT_POSIX_COMMAND_POOL_SIZE
+    #define MQTT_AGENT_POSIX_COMMAND_POOL_SIZE    ( 32U )
+#endif
+
+/**
+ * @brief Initialize the pool of commands.
+ *
+ * Must be called once, before any command is taken from the pool.
+ *
+ * @return `true` if the pool was initialized, else `false`.
+ */
+bool PosixCommandPool_Init( void );
+
+/**
+ * @brief Take a command from the pool, waiting for one if the pool is empty.
+ *
+ * This is the #MQTTAgentCommandGet_t of the message interface.
+ *
+ * @param[in] blockTimeMs Maximum time to wait for a command.
+ *
+ * @return A command, or NULL if none became free within @p blockTimeMs.
+ */
+MQTTAgentCommand_t * PosixCommandPool_GetCommand( uint32_t blockTimeMs );
+
+/**
+ * @brief Give a command back to the pool.
+ *
+ * This is the #MQTTAgentCommandRelease_t of the message interface.
+ *
+ * @param[in] pCommandToRelease Command taken with
+ * PosixCommandPool_GetCommand().
+ *
+ * @return `true` if the command was given back, `false` if it is not a
+ * command of the pool.
+ */
+bool PosixCommandPool_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_COMMAND_POOL_H */
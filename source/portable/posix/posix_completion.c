@@ -0,0 +1,111 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_completion.c
+ * @brief Implements the completion event of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stddef.h>
+#include <limits.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Header include. */
+#include "posix_completion.h"
+
+/**
+ * @brief Milliseconds per second.
+ */
+#define MILLISECONDS_PER_SECOND        ( 1000U )
+
+/**
+ * @brief Nanoseconds per millisecond.
+ */
+#define NANOSECONDS_PER_MILLISECOND    ( 1000000L )
+
+/*-----------------------------------------------------------*/
+
+void PosixCompletion_Init( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           MQTTAgentCompletionInterface_t * pCompletionInterface )
+{
+    assert( pEventCtx != NULL );
+    assert( pCompletionInterface != NULL );
+
+    pEventCtx->waiterCount = 0U;
+    pCompletionInterface->pEventCtx = pEventCtx;
+    pCompletionInterface->wait = PosixCompletion_Wait;
+    pCompletionInterface->wake = PosixCompletion_Wake;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixCompletion_Wait( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           const volatile uint32_t * pValue,
+                           uint32_t expectedValue,
+                           uint32_t timeoutMs )
+{
+    struct timespec timeout;
+
+    assert( pEventCtx != NULL );
+    assert( pValue != NULL );
+
+    timeout.tv_sec = ( time_t ) ( timeoutMs / MILLISECONDS_PER_SECOND );
+    timeout.tv_nsec = ( long ) ( timeoutMs % MILLISECONDS_PER_SECOND ) * NANOSECONDS_PER_MILLISECOND;
+
+    /* The waiter is counted before the kernel compares the word, and the
+     * agent thread changes the word before it reads the count, so either the
+     * comparison sees the change or the agent thread sees the waiter. A
+     * change, a wake or a signal all end the wait, and the caller checks the
+     * word again. */
+    ( void ) __atomic_add_fetch( &( pEventCtx->waiterCount ), 1U, __ATOMIC_SEQ_CST );
+    ( void ) syscall( SYS_futex, pValue, FUTEX_WAIT_PRIVATE, expectedValue, &timeout, NULL, 0 );
+    ( void ) __atomic_sub_fetch( &( pEventCtx->waiterCount ), 1U, __ATOMIC_SEQ_CST );
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixCompletion_Wake( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           const volatile uint32_t * pValue )
+{
+    assert( pEventCtx != NULL );
+    assert( pValue != NULL );
+
+    /* Orders the change of the word before the read of the count. */
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    if( __atomic_load_n( &( pEventCtx->waiterCount ), __ATOMIC_RELAXED ) != 0U )
+    {
+        ( void ) syscall( SYS_futex, pValue, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 );
+    }
+}
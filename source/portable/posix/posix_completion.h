@@ -0,0 +1,109 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_completion.h
+ * @brief Completion event of the POSIX port, waiting on the completed count of
+ * a completion group or the posted count of a completion queue with a futex.
+ *
+ * The agent thread calls the wake function on every completion. It only makes
+ * the system call while a thread is waiting on the event, so completions
+ * nobody waits for cost no more than an atomic read.
+ */
+#ifndef POSIX_COMPLETION_H
+#define POSIX_COMPLETION_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stdint.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent_completion.h"
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Completion event of the POSIX port.
+ *
+ * One event may be shared by several completion groups and queues. Its
+ * threads must all belong to the same process, as the futex is private.
+ *
+ * @note The members of this struct are managed by the functions of the port,
+ * and should not be written by the application.
+ */
+struct MQTTAgentCompletionEventContext
+{
+    uint32_t waiterCount; /**< @brief Number of threads waiting on the event. */
+};
+
+/**
+ * @brief Initialize a completion event, and the completion interface using it.
+ *
+ * The interface is then given to MQTTAgentCompletionGroup_Init() or
+ * MQTTAgentCompletionQueue_Init().
+ *
+ * @param[out] pEventCtx Event to initialize. It MUST remain in scope as long as
+ * the groups and queues using it.
+ * @param[out] pCompletionInterface Set to the functions of the port and
+ * @p pEventCtx.
+ */
+void PosixCompletion_Init( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           MQTTAgentCompletionInterface_t * pCompletionInterface );
+
+/**
+ * @brief Wait with `FUTEX_WAIT` until @p pValue is woken, if it still holds
+ * @p expectedValue.
+ *
+ * This is the #MQTTAgentCompletionWait_t of the completion interface.
+ *
+ * @param[in] pEventCtx Event to wait on.
+ * @param[in] pValue Futex word written by the agent thread.
+ * @param[in] expectedValue Value of @p pValue read before waiting.
+ * @param[in] timeoutMs Maximum time to wait.
+ */
+void PosixCompletion_Wait( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           const volatile uint32_t * pValue,
+                           uint32_t expectedValue,
+                           uint32_t timeoutMs );
+
+/**
+ * @brief Wake the threads waiting on @p pValue with `FUTEX_WAKE`, if any.
+ *
+ * This is the #MQTTAgentCompletionWake_t of the completion interface.
+ *
+ * @param[in] pEventCtx Event to wake.
+ * @param[in] pValue Futex word changed by the agent thread.
+ */
+void PosixCompletion_Wake( MQTTAgentCompletionEventContext_t * pEventCtx,
+                           const volatile uint32_t * pValue );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_COMPLETION_H */
@@ -0,0 +1,562 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_session_store.c
+ * @brief Implements the session store of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Header include. */
+#include "posix_session_store.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/**
+ * @brief Value of the `magic` member of a session file once it is initialized.
+ */
+#define SESSION_FILE_MAGIC    ( 0x4D515353UL )
+
+/**
+ * @brief A publish awaiting its acknowledgment.
+ */
+typedef struct SessionSlot
+{
+    uint16_t packetId;                                  /**< @brief Packet ID of the publish, or 0 if the slot is free. Written last. */
+    uint16_t topicLength;                               /**< @brief Length of the topic at the start of `data`. */
+    uint32_t payloadLength;                             /**< @brief Length of the payload following the topic. */
+    uint8_t qos;                                        /**< @brief QoS of the publish. */
+    uint8_t retain;                                     /**< @brief Retain flag of the publish. */
+    uint8_t data[ MQTT_AGENT_POSIX_SESSION_SLOT_SIZE ]; /**< @brief Topic followed by payload. */
+} SessionSlot_t;
+
+/**
+ * @brief Layout of a session file.
+ */
+struct PosixSessionFile
+{
+    uint32_t magic;                                                      /**< @brief #SESSION_FILE_MAGIC once initialized. */
+    uint32_t recordCount;                                                /**< @brief #MQTT_AGENT_MAX_OUTSTANDING_ACKS of the writer. */
+    uint32_t recordSize;                                                 /**< @brief Size of a coreMQTT publish record of the writer. */
+    uint32_t slotSize;                                                   /**< @brief #MQTT_AGENT_POSIX_SESSION_SLOT_SIZE of the writer. */
+    uint16_t nextPacketId;                                               /**< @brief Next packet ID of coreMQTT when a publish was last saved. */
+    MQTTPubAckInfo_t outgoingRecords[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ]; /**< @brief coreMQTT's outgoing publish records. */
+    MQTTPubAckInfo_t incomingRecords[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ]; /**< @brief coreMQTT's incoming publish records. */
+    SessionSlot_t slots[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ];              /**< @brief Publishes awaiting their acknowledgment. */
+};
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Map a session file, resizing it to the layout of this build.
+ *
+ * @param[in] fileDescriptor Descriptor of the session file.
+ * @param[in] pPath Path of the session file, for logging.
+ *
+ * @return The mapped file, or NULL on failure.
+ */
+static PosixSessionFile_t * mapFile( int fileDescriptor,
+                                     const char * pPath );
+
+/**
+ * @brief Initialize a session file unless it was written by a build with the
+ * same layout.
+ *
+ * @param[in] pFile Mapped session file.
+ */
+static void initFile( PosixSessionFile_t * pFile );
+
+/**
+ * @brief Find the outgoing publish record of a packet ID.
+ *
+ * @param[in] pFile Mapped session file.
+ * @param[in] packetId Packet ID to find.
+ *
+ * @return The record, or NULL if there is none.
+ */
+static MQTTPubAckInfo_t * findOutgoingRecord( PosixSessionFile_t * pFile,
+                                              uint16_t packetId );
+
+/**
+ * @brief Restore a saved publish into the agent, or free its slot if it can
+ * no longer be resent.
+ *
+ * @param[in] pStore Store of the slot.
+ * @param[in] slotIndex Index of the slot in the file.
+ */
+static void restoreSlot( PosixSessionStore_t * pStore,
+                         size_t slotIndex );
+
+/**
+ * @brief Remove the outgoing publish records still to be acknowledged that
+ * have no saved publish, because it did not fit in a slot. They could not be
+ * resent.
+ *
+ * @param[in] pFile Mapped session file.
+ */
+static void removeUnsavedRecords( PosixSessionFile_t * pFile );
+
+/**
+ * @brief Save a publish to a free slot.
+ *
+ * @param[in] pStore Store to save to.
+ * @param[in] packetId Packet ID of the publish.
+ * @param[in] pPublishInfo The publish.
+ */
+static void savePublish( PosixSessionStore_t * pStore,
+                         uint16_t packetId,
+                         const MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief Session callback of the agent, which saves a publish before it is
+ * sent and frees its slot when it stops waiting for its acknowledgment.
+ *
+ * @param[in] pSessionContext Store of the agent.
+ * @param[in] packetId Packet ID of the publish.
+ * @param[in] pPublishInfo The publish, or NULL when it stops waiting or could
+ * not be sent.
+ */
+static void sessionCallback( void * pSessionContext,
+                             uint16_t packetId,
+                             const MQTTPublishInfo_t * pPublishInfo );
+
+/*-----------------------------------------------------------*/
+
+static PosixSessionFile_t * mapFile( int fileDescriptor,
+                                     const char * pPath )
+{
+    struct stat fileStatus;
+    void * pMapping;
+    PosixSessionFile_t * pFile = NULL;
+    bool sized = false;
+
+    /* The path is only used for logging. */
+    ( void ) pPath;
+
+    if( fstat( fileDescriptor, &fileStatus ) != 0 )
+    {
+        LogError( ( "Failed to get size of session file %s: %s.", pPath, strerror( errno ) ) );
+    }
+    else if( fileStatus.st_size == ( off_t ) sizeof( PosixSessionFile_t ) )
+    {
+        sized = true;
+    }
+    else
+    {
+        /* A file of another size is from a build with another layout, so it
+         * is emptied before it is resized. */
+        if( fileStatus.st_size != 0 )
+        {
+            LogWarn( ( "Discarding session file %s written with another configuration.", pPath ) );
+        }
+
+        sized = ( ftruncate( fileDescriptor, 0 ) == 0 ) &&
+                ( ftruncate( fileDescriptor, ( off_t ) sizeof( PosixSessionFile_t ) ) == 0 );
+
+        if( !sized )
+        {
+            LogError( ( "Failed to size session file %s: %s.", pPath, strerror( errno ) ) );
+        }
+    }
+
+    if( sized )
+    {
+        pMapping = mmap( NULL,
+                         sizeof( PosixSessionFile_t ),
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         fileDescriptor,
+                         0 );
+
+        if( pMapping == MAP_FAILED )
+        {
+            LogError( ( "Failed to map session file %s: %s.", pPath, strerror( errno ) ) );
+        }
+        else
+        {
+            pFile = ( PosixSessionFile_t * ) pMapping;
+        }
+    }
+
+    return pFile;
+}
+
+/*-----------------------------------------------------------*/
+
+static void initFile( PosixSessionFile_t * pFile )
+{
+    if( ( pFile->magic != SESSION_FILE_MAGIC ) ||
+        ( pFile->recordCount != MQTT_AGENT_MAX_OUTSTANDING_ACKS ) ||
+        ( pFile->recordSize != sizeof( MQTTPubAckInfo_t ) ) ||
+        ( pFile->slotSize != MQTT_AGENT_POSIX_SESSION_SLOT_SIZE ) )
+    {
+        ( void ) memset( pFile, 0x00, sizeof( PosixSessionFile_t ) );
+        pFile->recordCount = MQTT_AGENT_MAX_OUTSTANDING_ACKS;
+        pFile->recordSize = ( uint32_t ) sizeof( MQTTPubAckInfo_t );
+        pFile->slotSize = MQTT_AGENT_POSIX_SESSION_SLOT_SIZE;
+
+        /* The magic is written last, so a file whose initialization was
+         * interrupted is initialized again. */
+        __atomic_store_n( &( pFile->magic ), SESSION_FILE_MAGIC, __ATOMIC_RELEASE );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTPubAckInfo_t * findOutgoingRecord( PosixSessionFile_t * pFile,
+                                              uint16_t packetId )
+{
+    MQTTPubAckInfo_t * pRecord = NULL;
+    size_t i;
+
+    for( i = 0U; ( i < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( pRecord == NULL ); i++ )
+    {
+        if( pFile->outgoingRecords[ i ].packetId == packetId )
+        {
+            pRecord = &( pFile->outgoingRecords[ i ] );
+        }
+    }
+
+    return pRecord;
+}
+
+/*-----------------------------------------------------------*/
+
+static void restoreSlot( PosixSessionStore_t * pStore,
+                         size_t slotIndex )
+{
+    SessionSlot_t * pSlot = &( pStore->pFile->slots[ slotIndex ] );
+    MQTTPublishInfo_t * pPublishInfo = &( pStore->publishes[ slotIndex ] );
+    MQTTPubAckInfo_t * pRecord;
+    MQTTStatus_t status = MQTTBadParameter;
+
+    pRecord = findOutgoingRecord( pStore->pFile, pSlot->packetId );
+
+    if( pRecord == NULL )
+    {
+        /* coreMQTT removes the record before the agent completes the publish,
+         * so the publish was acknowledged just before the process stopped, or
+         * the process stopped before coreMQTT reserved the record, and the
+         * publish was never sent. */
+        LogDebug( ( "Saved publish %hu was acknowledged.", ( unsigned short ) pSlot->packetId ) );
+    }
+    else if( ( pSlot->topicLength == 0U ) ||
+             ( ( ( size_t ) pSlot->topicLength + ( size_t ) pSlot->payloadLength ) > MQTT_AGENT_POSIX_SESSION_SLOT_SIZE ) ||
+             ( ( pSlot->qos != ( uint8_t ) MQTTQoS1 ) && ( pSlot->qos != ( uint8_t ) MQTTQoS2 ) ) )
+    {
+        LogError( ( "Invalid saved publish %hu: topicLength=%hu, payloadLength=%lu, qos=%u.",
+                    ( unsigned short ) pSlot->packetId,
+                    ( unsigned short ) pSlot->topicLength,
+                    ( unsigned long ) pSlot->payloadLength,
+                    ( unsigned int ) pSlot->qos ) );
+    }
+    else
+    {
+        ( void ) memset( pPublishInfo, 0x00, sizeof( MQTTPublishInfo_t ) );
+        pPublishInfo->pTopicName = ( const char * ) pSlot->data;
+        pPublishInfo->topicNameLength = pSlot->topicLength;
+        pPublishInfo->pPayload = &( pSlot->data[ pSlot->topicLength ] );
+        pPublishInfo->payloadLength = pSlot->payloadLength;
+        pPublishInfo->qos = ( MQTTQoS_t ) pSlot->qos;
+        pPublishInfo->retain = ( pSlot->retain != 0U );
+
+        status = MQTTAgent_RestorePublish( pStore->pAgentContext,
+                                           pSlot->packetId,
+                                           pPublishInfo,
+                                           &( pStore->commands[ slotIndex ] ) );
+
+        if( status == MQTTSuccess )
+        {
+            /* A publish saved while it was being sent may not have reached the
+             * broker, so it is resent like one awaiting its acknowledgment. */
+            if( pRecord->publishState == MQTTPublishSend )
+            {
+                pRecord->publishState = ( pPublishInfo->qos == MQTTQoS1 ) ? MQTTPubAckPending : MQTTPubRecPending;
+            }
+
+            pStore->restoredCount++;
+        }
+        else
+        {
+            LogError( ( "Failed to restore saved publish %hu: %s.",
+                        ( unsigned short ) pSlot->packetId,
+                        MQTT_Status_strerror( status ) ) );
+        }
+    }
+
+    if( status != MQTTSuccess )
+    {
+        __atomic_store_n( &( pSlot->packetId ), MQTT_PACKET_ID_INVALID, __ATOMIC_RELEASE );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void removeUnsavedRecords( PosixSessionFile_t * pFile )
+{
+    MQTTPubAckInfo_t * pRecord;
+    bool saved;
+    size_t i, j;
+
+    for( i = 0U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+    {
+        pRecord = &( pFile->outgoingRecords[ i ] );
+
+        /* Records waiting for a PUBREL to be sent or a PUBCOMP to be received
+         * need no payload, so coreMQTT completes them without a saved
+         * publish. */
+        if( ( pRecord->packetId != MQTT_PACKET_ID_INVALID ) &&
+            ( ( pRecord->publishState == MQTTPublishSend ) ||
+              ( pRecord->publishState == MQTTPubAckPending ) ||
+              ( pRecord->publishState == MQTTPubRecPending ) ) )
+        {
+            saved = false;
+
+            for( j = 0U; ( j < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( !saved ); j++ )
+            {
+                saved = ( pFile->slots[ j ].packetId == pRecord->packetId );
+            }
+
+            if( !saved )
+            {
+                LogWarn( ( "Publish %hu was not saved and is not resent.",
+                           ( unsigned short ) pRecord->packetId ) );
+                ( void ) memset( pRecord, 0x00, sizeof( MQTTPubAckInfo_t ) );
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void savePublish( PosixSessionStore_t * pStore,
+                         uint16_t packetId,
+                         const MQTTPublishInfo_t * pPublishInfo )
+{
+    SessionSlot_t * pSlot = NULL;
+    size_t i;
+
+    for( i = 0U; ( i < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) && ( pSlot == NULL ); i++ )
+    {
+        if( pStore->pFile->slots[ i ].packetId == MQTT_PACKET_ID_INVALID )
+        {
+            pSlot = &( pStore->pFile->slots[ i ] );
+        }
+    }
+
+    /* There is a slot for each operation awaiting acknowledgment, so one is
+     * free unless the publish does not fit, or so many are awaiting their
+     * acknowledgment that this one will fail to be sent or added to them. */
+    if( ( pSlot == NULL ) ||
+        ( ( ( size_t ) pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) > MQTT_AGENT_POSIX_SESSION_SLOT_SIZE ) )
+    {
+        LogWarn( ( "Publish %hu of %lu bytes is not saved.",
+                   ( unsigned short ) packetId,
+                   ( unsigned long ) ( pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) ) );
+        pStore->unsavedCount++;
+    }
+    else
+    {
+        pSlot->topicLength = pPublishInfo->topicNameLength;
+        pSlot->payloadLength = ( uint32_t ) pPublishInfo->payloadLength;
+        pSlot->qos = ( uint8_t ) pPublishInfo->qos;
+        pSlot->retain = ( pPublishInfo->retain ) ? 1U : 0U;
+        ( void ) memcpy( pSlot->data, pPublishInfo->pTopicName, pPublishInfo->topicNameLength );
+
+        if( pPublishInfo->payloadLength > 0U )
+        {
+            ( void ) memcpy( &( pSlot->data[ pPublishInfo->topicNameLength ] ),
+                             pPublishInfo->pPayload,
+                             pPublishInfo->payloadLength );
+        }
+
+        pStore->pFile->nextPacketId = pStore->pAgentContext->mqttContext.nextPacketId;
+
+        /* The packet ID is written last, so a slot whose write was interrupted
+         * by the process stopping is still free. */
+        __atomic_store_n( &( pSlot->packetId ), packetId, __ATOMIC_RELEASE );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void sessionCallback( void * pSessionContext,
+                             uint16_t packetId,
+                             const MQTTPublishInfo_t * pPublishInfo )
+{
+    PosixSessionStore_t * pStore = ( PosixSessionStore_t * ) pSessionContext;
+    size_t i;
+
+    assert( pStore != NULL );
+    assert( pStore->pFile != NULL );
+
+    if( pPublishInfo != NULL )
+    {
+        savePublish( pStore, packetId, pPublishInfo );
+    }
+    else
+    {
+        for( i = 0U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+        {
+            if( pStore->pFile->slots[ i ].packetId == packetId )
+            {
+                __atomic_store_n( &( pStore->pFile->slots[ i ].packetId ), MQTT_PACKET_ID_INVALID, __ATOMIC_RELEASE );
+                break;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSessionStore_Open( PosixSessionStore_t * pStore,
+                             const char * pPath,
+                             MQTTAgentContext_t * pMqttAgentContext )
+{
+    MQTTStatus_t status = MQTTBadParameter;
+    int fileDescriptor = -1;
+    size_t i;
+
+    if( ( pStore == NULL ) || ( pPath == NULL ) || ( pMqttAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pStore=%p, pPath=%p, pMqttAgentContext=%p.",
+                    ( void * ) pStore,
+                    ( const void * ) pPath,
+                    ( void * ) pMqttAgentContext ) );
+    }
+    else
+    {
+        ( void ) memset( pStore, 0x00, sizeof( PosixSessionStore_t ) );
+        fileDescriptor = open( pPath, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR );
+
+        if( fileDescriptor < 0 )
+        {
+            LogError( ( "Failed to open session file %s: %s.", pPath, strerror( errno ) ) );
+        }
+        else
+        {
+            /* The mapping stays valid once the descriptor is closed. */
+            pStore->pFile = mapFile( fileDescriptor, pPath );
+            ( void ) close( fileDescriptor );
+        }
+    }
+
+    if( ( pStore != NULL ) && ( pStore->pFile != NULL ) )
+    {
+        initFile( pStore->pFile );
+        pStore->pAgentContext = pMqttAgentContext;
+
+        /* coreMQTT only keeps pointers to its records, so it updates them in
+         * the file from now on. */
+        status = MQTT_InitStatefulQoS( &( pMqttAgentContext->mqttContext ),
+                                       pStore->pFile->outgoingRecords,
+                                       MQTT_AGENT_MAX_OUTSTANDING_ACKS,
+                                       pStore->pFile->incomingRecords,
+                                       MQTT_AGENT_MAX_OUTSTANDING_ACKS );
+
+        if( status != MQTTSuccess )
+        {
+            LogError( ( "Failed to use the publish records of the session file: %s.",
+                        MQTT_Status_strerror( status ) ) );
+            ( void ) munmap( pStore->pFile, sizeof( PosixSessionFile_t ) );
+            pStore->pFile = NULL;
+        }
+    }
+
+    if( status == MQTTSuccess )
+    {
+        for( i = 0U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+        {
+            if( pStore->pFile->slots[ i ].packetId != MQTT_PACKET_ID_INVALID )
+            {
+                restoreSlot( pStore, i );
+            }
+        }
+
+        removeUnsavedRecords( pStore->pFile );
+
+        /* Packet IDs of the restored publishes are not given to new
+         * operations. */
+        if( pStore->pFile->nextPacketId != MQTT_PACKET_ID_INVALID )
+        {
+            pMqttAgentContext->mqttContext.nextPacketId = pStore->pFile->nextPacketId;
+        }
+
+        ( void ) MQTTAgent_SetSessionCallback( pMqttAgentContext, sessionCallback, pStore );
+
+        LogInfo( ( "Restored %lu publishes from session file %s.",
+                   ( unsigned long ) pStore->restoredCount,
+                   pPath ) );
+    }
+
+    return( status == MQTTSuccess );
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSessionStore_Sync( const PosixSessionStore_t * pStore )
+{
+    bool synced = false;
+
+    if( ( pStore == NULL ) || ( pStore->pFile == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pStore=%p.", ( const void * ) pStore ) );
+    }
+    else if( msync( pStore->pFile, sizeof( PosixSessionFile_t ), MS_SYNC ) != 0 )
+    {
+        LogError( ( "Failed to write session file: %s.", strerror( errno ) ) );
+    }
+    else
+    {
+        synced = true;
+    }
+
+    return synced;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSessionStore_Close( PosixSessionStore_t * pStore )
+{
+    if( ( pStore != NULL ) && ( pStore->pFile != NULL ) )
+    {
+        ( void ) MQTTAgent_SetSessionCallback( pStore->pAgentContext, NULL, NULL );
+        ( void ) munmap( pStore->pFile, sizeof( PosixSessionFile_t ) );
+        pStore->pFile = NULL;
+    }
+}
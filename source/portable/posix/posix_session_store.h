@@ -0,0 +1,164 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_session_store.h
+ * @brief Session store of the POSIX port, which saves the publishes in flight
+ * to a memory-mapped file so that they survive a restart of the process.
+ *
+ * The file holds coreMQTT's outgoing and incoming publish records, which
+ * coreMQTT updates in place, and a copy of the topic and payload of each QoS 1
+ * and QoS 2 publish awaiting its acknowledgment, which is written before the
+ * publish is sent and cleared when it completes or its send fails. When the process restarts,
+ * the saved publishes are restored into the agent, so that
+ * MQTTAgent_ResumeSession() resends those the broker has not acknowledged.
+ *
+ * The file is written through the page cache, so it survives a crash of the
+ * process. PosixSessionStore_Sync() also writes it to storage, to survive a
+ * crash of the system.
+ */
+#ifndef POSIX_SESSION_STORE_H
+#define POSIX_SESSION_STORE_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Size of the data of a slot of a session file, which bounds the
+ * combined length of the topic and payload of a publish that can be saved.
+ *
+ * A publish that does not fit is still sent, but is not saved, so it is lost
+ * if the process restarts before it is acknowledged.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `1024`
+ */
+#ifndef MQTT_AGENT_POSIX_SESSION_SLOT_SIZE
+    #define MQTT_AGENT_POSIX_SESSION_SLOT_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Layout of a session file, defined in posix_session_store.c.
+ */
+typedef struct PosixSessionFile PosixSessionFile_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Session store of an agent.
+ *
+ * @note The members of this struct are managed by the session store functions,
+ * and should not be written by the application.
+ */
+typedef struct PosixSessionStore
+{
+    PosixSessionFile_t * pFile;                                     /**< @brief Mapped session file. */
+    MQTTAgentContext_t * pAgentContext;                             /**< @brief Agent whose session is saved. */
+    MQTTAgentCommand_t commands[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ]; /**< @brief Storage of the commands of the restored publishes. */
+    MQTTPublishInfo_t publishes[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ]; /**< @brief Restored publishes, pointing into the slots of the file. */
+    size_t restoredCount;                                           /**< @brief Number of publishes restored when the file was opened. */
+    size_t unsavedCount;                                            /**< @brief Number of publishes that did not fit in a slot. */
+} PosixSessionStore_t;
+
+/**
+ * @brief Open the session file of an agent, restore the publishes it holds
+ * into the agent, and save the publishes the agent sends from now on.
+ *
+ * The file is created if it does not exist. A file written by a build with a
+ * different #MQTT_AGENT_MAX_OUTSTANDING_ACKS or
+ * #MQTT_AGENT_POSIX_SESSION_SLOT_SIZE is discarded. coreMQTT's publish
+ * records are moved into the file, and a saved publish is restored with
+ * MQTTAgent_RestorePublish(), unless its record shows it was acknowledged.
+ *
+ * @param[out] pStore Store to open.
+ * @param[in] pPath Path of the session file.
+ * @param[in] pMqttAgentContext The MQTT agent, initialized with
+ * MQTTAgent_Init().
+ *
+ * @note Call this before #MQTTAgent_CommandLoop is started and before the agent
+ * connects. Connect with a clean session flag of `false`, and pass the session
+ * present flag of the CONNACK to MQTTAgent_ResumeSession(). If the broker has
+ * not kept the session, the restored publishes complete with an error and are
+ * removed from the file.
+ *
+ * @return `true` if the file was opened, else `false`.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * static PosixSessionStore_t sessionStore;
+ * MQTTAgentContext_t mqttAgentContext;
+ *
+ * // The agent must have been initialized with MQTTAgent_Init().
+ * if( PosixSessionStore_Open( &sessionStore, "/var/lib/sensor/mqtt-session", &mqttAgentContext ) )
+ * {
+ *     // Connect with cleanSession set to false, then call
+ *     // MQTTAgent_ResumeSession( &mqttAgentContext, sessionPresent ) to
+ *     // resend the publishes the broker did not acknowledge.
+ * }
+ * @endcode
+ */
+bool PosixSessionStore_Open( PosixSessionStore_t * pStore,
+                             const char * pPath,
+                             MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Write the session file to storage.
+ *
+ * This may be called from any task, for example periodically, to bound what is
+ * lost if the system crashes.
+ *
+ * @param[in] pStore Store to write.
+ *
+ * @return `true` if the file was written, else `false`.
+ */
+bool PosixSessionStore_Sync( const PosixSessionStore_t * pStore );
+
+/**
+ * @brief Stop saving the session of an agent and unmap its file, which is kept
+ * to restore the session the next time the process starts.
+ *
+ * @param[in] pStore Store to close.
+ *
+ * @note coreMQTT's publish records are in the file, so the agent MUST NOT be
+ * used once its store is closed.
+ */
+void PosixSessionStore_Close( PosixSessionStore_t * pStore );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_SESSION_STORE_H */
@@ -0,0 +1,933 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_shared_queue.c
+ * @brief Implements the shared memory queue of publishes of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Header include. */
+#include "posix_shared_queue.h"
+
+/* Port includes. */
+#include "posix_clock.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/**
+ * @brief Value of the `magic` member of a queue once it is initialized.
+ */
+#define SHARED_QUEUE_MAGIC        ( 0x4D514153UL )
+
+/**
+ * @brief Longest time a process waits for a free slot before looking again for
+ * slots of processes that no longer run.
+ */
+#define RECLAIM_INTERVAL_MS       ( 100U )
+
+/**
+ * @brief States of a slot.
+ *
+ * The state word of a slot holds the state in its low bits and the ID of the
+ * process that claimed the slot above them, so that the slot is claimed and
+ * its owner recorded with one atomic operation. It is also the futex word on
+ * which the process that submitted the publish of the slot waits.
+ */
+#define SLOT_STATE_FREE           ( 0U ) /**< @brief The slot may be claimed. */
+#define SLOT_STATE_CLAIMED        ( 1U ) /**< @brief A process is writing a publish to the slot. */
+#define SLOT_STATE_SUBMITTED      ( 2U ) /**< @brief The publish is waiting for the agent's process. */
+#define SLOT_STATE_QUEUED         ( 3U ) /**< @brief The publish command was given to the agent. */
+#define SLOT_STATE_COMPLETE       ( 4U ) /**< @brief The publish completed with the return code of the slot. */
+#define SLOT_STATE_ABANDONED      ( 5U ) /**< @brief The submitting process stopped waiting; the slot is freed on completion. */
+
+/**
+ * @brief Mask of the state in the state word of a slot.
+ */
+#define SLOT_STATE_MASK           ( 0x7U )
+
+/**
+ * @brief Position of the process ID of the owner in the state word of a
+ * slot. Process IDs of Linux are below 2^22, so they fit above the state.
+ */
+#define SLOT_OWNER_SHIFT          ( 3U )
+
+/**
+ * @brief State word of a slot in a state, owned by a process.
+ */
+#define SLOT_WORD( state, ownerPid )    ( ( ( uint32_t ) ( ownerPid ) << SLOT_OWNER_SHIFT ) | ( state ) )
+
+/**
+ * @brief State of a slot from its state word.
+ */
+#define SLOT_STATE( word )              ( ( word ) & SLOT_STATE_MASK )
+
+/**
+ * @brief Process ID of the owner of a slot from its state word, 0 if none.
+ */
+#define SLOT_OWNER( word )              ( ( pid_t ) ( ( word ) >> SLOT_OWNER_SHIFT ) )
+
+/**
+ * @brief One publish of a shared queue.
+ */
+typedef struct SharedSlot
+{
+    uint32_t state;                                    /**< @brief State word: one of the `SLOT_STATE_` values, and the owner. */
+    int32_t returnCode;                                /**< @brief Return code of the publish once complete. */
+    uint32_t topicLength;                              /**< @brief Length of the topic at the start of `data`. */
+    uint32_t payloadLength;                            /**< @brief Length of the payload following the topic. */
+    uint32_t qos;                                      /**< @brief QoS of the publish. */
+    uint32_t retain;                                   /**< @brief Retain flag of the publish. */
+    uint8_t data[ MQTT_AGENT_POSIX_SHARED_SLOT_SIZE ]; /**< @brief Topic followed by payload. */
+} SharedSlot_t;
+
+/**
+ * @brief Layout of the shared memory of a queue.
+ */
+struct PosixSharedQueueRegion
+{
+    uint32_t magic;                                             /**< @brief #SHARED_QUEUE_MAGIC once initialized. */
+    uint32_t serverPid;                                         /**< @brief Process ID of the agent's process; at the same offset for any configuration. */
+    uint32_t queueLength;                                       /**< @brief #MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH of the creator. */
+    uint32_t slotSize;                                          /**< @brief #MQTT_AGENT_POSIX_SHARED_SLOT_SIZE of the creator. */
+    uint32_t submitSequence;                                    /**< @brief Incremented when a publish is submitted; futex word of the agent's process. */
+    uint32_t serverWaiting;                                     /**< @brief Set while the agent's process waits on `submitSequence`. */
+    uint32_t freeSequence;                                      /**< @brief Incremented when a slot is freed; futex word of processes waiting for a slot. */
+    uint32_t freeWaiters;                                       /**< @brief Number of processes waiting on `freeSequence`. */
+    SharedSlot_t slots[ MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH ]; /**< @brief Slots of the queue. */
+};
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait on a futex word of the shared memory while it has a value.
+ *
+ * @param[in] pWord Futex word.
+ * @param[in] expectedValue Value of the word for which to wait.
+ * @param[in] timeoutMs Maximum time to wait.
+ */
+static void futexWait( uint32_t * pWord,
+                       uint32_t expectedValue,
+                       uint32_t timeoutMs );
+
+/**
+ * @brief Wake processes waiting on a futex word of the shared memory.
+ *
+ * @param[in] pWord Futex word.
+ * @param[in] count Largest number of processes to wake.
+ */
+static void futexWake( uint32_t * pWord,
+                       int count );
+
+/**
+ * @brief Check whether a process exists.
+ *
+ * @param[in] processId ID of the process.
+ *
+ * @return `false` if no process has this ID, else `true`.
+ */
+static bool isProcessAlive( pid_t processId );
+
+/**
+ * @brief Remove the shared memory object of a queue left by an agent's process
+ * that no longer runs.
+ *
+ * @param[in] pName Name of the shared memory object.
+ *
+ * @return `true` if the object was stale and was removed, else `false`.
+ */
+static bool removeStaleQueue( const char * pName );
+
+/**
+ * @brief Map the shared memory of a queue.
+ *
+ * @param[in] fileDescriptor Descriptor of the shared memory object.
+ *
+ * @return The mapped queue, or NULL on failure.
+ */
+static PosixSharedQueueRegion_t * mapRegion( int fileDescriptor );
+
+/**
+ * @brief Free a slot and wake the processes waiting for one.
+ *
+ * @param[in] pRegion Queue of the slot.
+ * @param[in] pSlot Slot to free.
+ */
+static void freeSlot( PosixSharedQueueRegion_t * pRegion,
+                      SharedSlot_t * pSlot );
+
+/**
+ * @brief Complete the publish of a slot, waking the process that submitted it,
+ * or free the slot if that process stopped waiting.
+ *
+ * @param[in] pEntry State of the slot in the agent's process.
+ * @param[in] returnCode Return code of the publish.
+ */
+static void completeSlot( const PosixSharedQueueEntry_t * pEntry,
+                          MQTTStatus_t returnCode );
+
+/**
+ * @brief Completion callback of the publish commands of a queue.
+ *
+ * @param[in] pCmdCallbackContext State of the slot of the publish.
+ * @param[in] pReturnInfo Return information of the publish.
+ */
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Enqueue a publish command for the publish of a submitted slot.
+ *
+ * @param[in] pServer Queue of the slot.
+ * @param[in] pEntry State of the slot in the agent's process.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue the command.
+ */
+static void enqueueSlot( const PosixSharedQueueServer_t * pServer,
+                         PosixSharedQueueEntry_t * pEntry,
+                         uint32_t blockTimeMs );
+
+/**
+ * @brief Enqueue a publish command for each submitted slot.
+ *
+ * @param[in] pServer Queue to serve.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue each command.
+ *
+ * @return The number of submitted slots.
+ */
+static size_t enqueueSubmittedSlots( PosixSharedQueueServer_t * pServer,
+                                     uint32_t blockTimeMs );
+
+/**
+ * @brief Give back the slots owned by processes that no longer run.
+ *
+ * A slot whose publish was given to the agent is abandoned, so that it is
+ * freed when the publish completes. Any other slot is freed at once.
+ *
+ * @param[in] pRegion Queue to reclaim slots of.
+ *
+ * @return `true` if a slot was freed, else `false`.
+ */
+static bool reclaimSlots( PosixSharedQueueRegion_t * pRegion );
+
+/**
+ * @brief Claim a free slot, waiting for one to be freed if there is none.
+ *
+ * @param[in] pRegion Queue to claim a slot of.
+ * @param[in] startTimeMs Time the wait started.
+ * @param[in] timeoutMs Maximum time to wait from @p startTimeMs.
+ *
+ * @return The claimed slot, or NULL if none became free in time.
+ */
+static SharedSlot_t * claimSlot( PosixSharedQueueRegion_t * pRegion,
+                                 uint32_t startTimeMs,
+                                 uint32_t timeoutMs );
+
+/**
+ * @brief Wait for the publish of a slot to complete, and free the slot.
+ *
+ * @param[in] pRegion Queue of the slot.
+ * @param[in] pSlot Slot of the publish.
+ * @param[in] startTimeMs Time the wait started.
+ * @param[in] timeoutMs Maximum time to wait from @p startTimeMs.
+ *
+ * @return The return code of the publish, or #MQTTNoDataAvailable if it did
+ * not complete in time.
+ */
+static MQTTStatus_t waitForSlot( PosixSharedQueueRegion_t * pRegion,
+                                 SharedSlot_t * pSlot,
+                                 uint32_t startTimeMs,
+                                 uint32_t timeoutMs );
+
+/*-----------------------------------------------------------*/
+
+static void futexWait( uint32_t * pWord,
+                       uint32_t expectedValue,
+                       uint32_t timeoutMs )
+{
+    struct timespec timeout;
+
+    timeout.tv_sec = ( time_t ) ( timeoutMs / 1000U );
+    timeout.tv_nsec = ( long ) ( timeoutMs % 1000U ) * 1000000L;
+
+    /* The word is shared between processes, so the futex is not private. A
+     * change of the word before the wait, a wake or a signal all end the wait,
+     * and the caller checks the word again. */
+    ( void ) syscall( SYS_futex, pWord, FUTEX_WAIT, expectedValue, &timeout, NULL, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void futexWake( uint32_t * pWord,
+                       int count )
+{
+    ( void ) syscall( SYS_futex, pWord, FUTEX_WAKE, count, NULL, NULL, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isProcessAlive( pid_t processId )
+{
+    /* A process of another user exists, but cannot be signaled. */
+    return ( kill( processId, 0 ) == 0 ) || ( errno != ESRCH );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool removeStaleQueue( const char * pName )
+{
+    bool stale = false;
+    int fileDescriptor;
+    uint32_t header[ 2 ] = { 0U, 0U };
+
+    fileDescriptor = shm_open( pName, O_RDONLY | O_CLOEXEC, 0 );
+
+    if( fileDescriptor >= 0 )
+    {
+        /* The process ID of the agent's process follows the magic at the start
+         * of the object for any configuration, and is written before it. */
+        if( ( pread( fileDescriptor, header, sizeof( header ), 0 ) != ( ssize_t ) sizeof( header ) ) ||
+            ( header[ 1 ] == 0U ) ||
+            !isProcessAlive( ( pid_t ) header[ 1 ] ) )
+        {
+            stale = true;
+        }
+
+        ( void ) close( fileDescriptor );
+    }
+
+    if( stale )
+    {
+        LogWarn( ( "Removing shared queue %s left by a process that no longer runs.", pName ) );
+        stale = ( shm_unlink( pName ) == 0 );
+    }
+
+    return stale;
+}
+
+/*-----------------------------------------------------------*/
+
+static PosixSharedQueueRegion_t * mapRegion( int fileDescriptor )
+{
+    void * pMapping;
+    PosixSharedQueueRegion_t * pRegion = NULL;
+
+    pMapping = mmap( NULL,
+                     sizeof( PosixSharedQueueRegion_t ),
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED,
+                     fileDescriptor,
+                     0 );
+
+    if( pMapping == MAP_FAILED )
+    {
+        LogError( ( "Failed to map shared queue: %s.", strerror( errno ) ) );
+    }
+    else
+    {
+        pRegion = ( PosixSharedQueueRegion_t * ) pMapping;
+    }
+
+    return pRegion;
+}
+
+/*-----------------------------------------------------------*/
+
+static void freeSlot( PosixSharedQueueRegion_t * pRegion,
+                      SharedSlot_t * pSlot )
+{
+    __atomic_store_n( &( pSlot->state ), SLOT_STATE_FREE, __ATOMIC_SEQ_CST );
+    ( void ) __atomic_add_fetch( &( pRegion->freeSequence ), 1U, __ATOMIC_SEQ_CST );
+
+    if( __atomic_load_n( &( pRegion->freeWaiters ), __ATOMIC_SEQ_CST ) > 0U )
+    {
+        futexWake( &( pRegion->freeSequence ), INT_MAX );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void completeSlot( const PosixSharedQueueEntry_t * pEntry,
+                          MQTTStatus_t returnCode )
+{
+    SharedSlot_t * pSlot = &( pEntry->pRegion->slots[ pEntry->slotIndex ] );
+    uint32_t word;
+
+    pSlot->returnCode = ( int32_t ) returnCode;
+    word = __atomic_load_n( &( pSlot->state ), __ATOMIC_SEQ_CST );
+
+    if( ( SLOT_STATE( word ) == SLOT_STATE_QUEUED ) &&
+        __atomic_compare_exchange_n( &( pSlot->state ), &word, ( word & ~SLOT_STATE_MASK ) | SLOT_STATE_COMPLETE,
+                                     false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+    {
+        futexWake( &( pSlot->state ), INT_MAX );
+    }
+    else
+    {
+        /* The submitting process stopped waiting, or stopped running, so no
+         * process will read the return code. */
+        freeSlot( pEntry->pRegion, pSlot );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    const PosixSharedQueueEntry_t * pEntry = ( const PosixSharedQueueEntry_t * ) ( void * ) pCmdCallbackContext;
+
+    assert( pEntry != NULL );
+    assert( pReturnInfo != NULL );
+
+    completeSlot( pEntry, pReturnInfo->returnCode );
+}
+
+/*-----------------------------------------------------------*/
+
+static void enqueueSlot( const PosixSharedQueueServer_t * pServer,
+                         PosixSharedQueueEntry_t * pEntry,
+                         uint32_t blockTimeMs )
+{
+    const SharedSlot_t * pSlot = &( pEntry->pRegion->slots[ pEntry->slotIndex ] );
+    MQTTAgentCommandInfo_t commandInfo;
+    MQTTStatus_t status = MQTTBadParameter;
+    uint32_t topicLength;
+    uint32_t payloadLength;
+    uint32_t qos;
+
+    /* The slot is written by another process, so its lengths are read once
+     * and checked before they are used. */
+    topicLength = __atomic_load_n( &( pSlot->topicLength ), __ATOMIC_RELAXED );
+    payloadLength = __atomic_load_n( &( pSlot->payloadLength ), __ATOMIC_RELAXED );
+    qos = __atomic_load_n( &( pSlot->qos ), __ATOMIC_RELAXED );
+
+    if( ( topicLength == 0U ) ||
+        ( topicLength > UINT16_MAX ) ||
+        ( topicLength > MQTT_AGENT_POSIX_SHARED_SLOT_SIZE ) ||
+        ( payloadLength > ( MQTT_AGENT_POSIX_SHARED_SLOT_SIZE - topicLength ) ) ||
+        ( qos > ( uint32_t ) MQTTQoS2 ) )
+    {
+        LogError( ( "Invalid publish in shared queue slot %lu: topicLength=%lu, payloadLength=%lu, qos=%lu.",
+                    ( unsigned long ) pEntry->slotIndex,
+                    ( unsigned long ) topicLength,
+                    ( unsigned long ) payloadLength,
+                    ( unsigned long ) qos ) );
+    }
+    else
+    {
+        ( void ) memset( &( pEntry->publishInfo ), 0x00, sizeof( MQTTPublishInfo_t ) );
+        pEntry->publishInfo.pTopicName = ( const char * ) pSlot->data;
+        pEntry->publishInfo.topicNameLength = ( uint16_t ) topicLength;
+        pEntry->publishInfo.pPayload = &( pSlot->data[ topicLength ] );
+        pEntry->publishInfo.payloadLength = payloadLength;
+        pEntry->publishInfo.qos = ( MQTTQoS_t ) qos;
+        pEntry->publishInfo.retain = ( pSlot->retain != 0U );
+
+        ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+        commandInfo.cmdCompleteCallback = publishCompleteCallback;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) ( void * ) pEntry;
+        commandInfo.blockTimeMs = blockTimeMs;
+
+        status = MQTTAgent_PublishWithStorage( pServer->pAgentContext,
+                                               &( pEntry->publishInfo ),
+                                               &commandInfo,
+                                               &( pEntry->command ) );
+    }
+
+    if( status != MQTTSuccess )
+    {
+        completeSlot( pEntry, status );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t enqueueSubmittedSlots( PosixSharedQueueServer_t * pServer,
+                                     uint32_t blockTimeMs )
+{
+    size_t submittedCount = 0U;
+    size_t i;
+    uint32_t word;
+
+    for( i = 0U; i < MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH; i++ )
+    {
+        word = __atomic_load_n( &( pServer->pRegion->slots[ i ].state ), __ATOMIC_SEQ_CST );
+
+        /* The slot is taken before it is read, so the submitting process can
+         * no longer abandon it without waiting for its completion. */
+        if( ( SLOT_STATE( word ) == SLOT_STATE_SUBMITTED ) &&
+            __atomic_compare_exchange_n( &( pServer->pRegion->slots[ i ].state ), &word, ( word & ~SLOT_STATE_MASK ) | SLOT_STATE_QUEUED,
+                                         false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+        {
+            enqueueSlot( pServer, &( pServer->entries[ i ] ), blockTimeMs );
+            submittedCount++;
+        }
+    }
+
+    return submittedCount;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool reclaimSlots( PosixSharedQueueRegion_t * pRegion )
+{
+    bool freed = false;
+    uint32_t word;
+    pid_t ownerPid;
+    size_t i;
+
+    for( i = 0U; i < MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH; i++ )
+    {
+        word = __atomic_load_n( &( pRegion->slots[ i ].state ), __ATOMIC_SEQ_CST );
+        ownerPid = SLOT_OWNER( word );
+
+        if( ( ownerPid == 0 ) || isProcessAlive( ownerPid ) )
+        {
+            /* The slot is free, abandoned, or owned by a running process. */
+        }
+        else if( SLOT_STATE( word ) == SLOT_STATE_QUEUED )
+        {
+            /* The agent may still read the publish, so the slot is only freed
+             * once the publish completes. */
+            ( void ) __atomic_compare_exchange_n( &( pRegion->slots[ i ].state ), &word, SLOT_STATE_ABANDONED,
+                                                  false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+        }
+        else if( __atomic_compare_exchange_n( &( pRegion->slots[ i ].state ), &word, SLOT_WORD( SLOT_STATE_CLAIMED, getpid() ),
+                                              false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+        {
+            /* A slot being written or submitted is taken before the agent's
+             * process takes it, and a complete slot is no longer read. */
+            LogWarn( ( "Reclaiming shared queue slot %lu of process %ld, which no longer runs.",
+                       ( unsigned long ) i,
+                       ( long ) ownerPid ) );
+            freeSlot( pRegion, &( pRegion->slots[ i ] ) );
+            freed = true;
+        }
+        else
+        {
+            /* The slot changed state; it is checked again on the next call. */
+        }
+    }
+
+    return freed;
+}
+
+/*-----------------------------------------------------------*/
+
+static SharedSlot_t * claimSlot( PosixSharedQueueRegion_t * pRegion,
+                                 uint32_t startTimeMs,
+                                 uint32_t timeoutMs )
+{
+    SharedSlot_t * pSlot = NULL;
+    uint32_t ownWord = SLOT_WORD( SLOT_STATE_CLAIMED, getpid() );
+    uint32_t observedSequence;
+    uint32_t expectedState;
+    uint32_t elapsedMs = 0U;
+    uint32_t waitMs;
+    size_t i;
+
+    for( ; ; )
+    {
+        /* Read the sequence before looking for a free slot, so that a slot
+         * freed after the search changes the sequence and the wait returns at
+         * once. */
+        observedSequence = __atomic_load_n( &( pRegion->freeSequence ), __ATOMIC_SEQ_CST );
+
+        for( i = 0U; ( i < MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH ) && ( pSlot == NULL ); i++ )
+        {
+            expectedState = SLOT_STATE_FREE;
+
+            if( __atomic_compare_exchange_n( &( pRegion->slots[ i ].state ), &expectedState, ownWord,
+                                             false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+            {
+                pSlot = &( pRegion->slots[ i ] );
+            }
+        }
+
+        /* Slots left by processes that stopped while publishing are only
+         * looked for when the queue is full, and then at least every
+         * #RECLAIM_INTERVAL_MS, as no process frees them. */
+        if( ( pSlot != NULL ) || ( !reclaimSlots( pRegion ) && ( elapsedMs >= timeoutMs ) ) )
+        {
+            break;
+        }
+
+        if( __atomic_load_n( &( pRegion->freeSequence ), __ATOMIC_SEQ_CST ) == observedSequence )
+        {
+            waitMs = timeoutMs - elapsedMs;
+
+            if( waitMs > RECLAIM_INTERVAL_MS )
+            {
+                waitMs = RECLAIM_INTERVAL_MS;
+            }
+
+            ( void ) __atomic_add_fetch( &( pRegion->freeWaiters ), 1U, __ATOMIC_SEQ_CST );
+            futexWait( &( pRegion->freeSequence ), observedSequence, waitMs );
+            ( void ) __atomic_sub_fetch( &( pRegion->freeWaiters ), 1U, __ATOMIC_SEQ_CST );
+        }
+
+        elapsedMs = PosixClock_GetTimeMs() - startTimeMs;
+    }
+
+    return pSlot;
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t waitForSlot( PosixSharedQueueRegion_t * pRegion,
+                                 SharedSlot_t * pSlot,
+                                 uint32_t startTimeMs,
+                                 uint32_t timeoutMs )
+{
+    MQTTStatus_t status = MQTTNoDataAvailable;
+    uint32_t word;
+    uint32_t elapsedMs;
+    bool waiting = true;
+
+    while( waiting )
+    {
+        word = __atomic_load_n( &( pSlot->state ), __ATOMIC_SEQ_CST );
+        elapsedMs = PosixClock_GetTimeMs() - startTimeMs;
+
+        if( SLOT_STATE( word ) == SLOT_STATE_COMPLETE )
+        {
+            status = ( MQTTStatus_t ) pSlot->returnCode;
+            freeSlot( pRegion, pSlot );
+            waiting = false;
+        }
+        else if( elapsedMs < timeoutMs )
+        {
+            futexWait( &( pSlot->state ), word, timeoutMs - elapsedMs );
+        }
+        else if( SLOT_STATE( word ) == SLOT_STATE_SUBMITTED )
+        {
+            /* The agent's process has not taken the publish, so it is
+             * withdrawn, unless it is taken first. */
+            if( __atomic_compare_exchange_n( &( pSlot->state ), &word, ( word & ~SLOT_STATE_MASK ) | SLOT_STATE_CLAIMED,
+                                             false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+            {
+                freeSlot( pRegion, pSlot );
+                waiting = false;
+            }
+        }
+        else
+        {
+            /* The slot is freed by the agent's process when the publish
+             * completes, unless it completes first. */
+            if( __atomic_compare_exchange_n( &( pSlot->state ), &word, SLOT_STATE_ABANDONED,
+                                             false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) )
+            {
+                waiting = false;
+            }
+        }
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSharedQueue_Create( PosixSharedQueueServer_t * pServer,
+                              const char * pName,
+                              mode_t mode,
+                              MQTTAgentContext_t * pMqttAgentContext )
+{
+    bool created = false;
+    int fileDescriptor = -1;
+    size_t i;
+
+    if( ( pServer == NULL ) || ( pName == NULL ) || ( pMqttAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pServer=%p, pName=%p, pMqttAgentContext=%p.",
+                    ( void * ) pServer,
+                    ( const void * ) pName,
+                    ( void * ) pMqttAgentContext ) );
+    }
+    else
+    {
+        ( void ) memset( pServer, 0x00, sizeof( PosixSharedQueueServer_t ) );
+        fileDescriptor = shm_open( pName, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode );
+
+        if( ( fileDescriptor < 0 ) && ( errno == EEXIST ) && removeStaleQueue( pName ) )
+        {
+            fileDescriptor = shm_open( pName, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, mode );
+        }
+
+        if( fileDescriptor < 0 )
+        {
+            LogError( ( "Failed to create shared queue %s: %s.", pName, strerror( errno ) ) );
+        }
+        else if( ftruncate( fileDescriptor, ( off_t ) sizeof( PosixSharedQueueRegion_t ) ) != 0 )
+        {
+            LogError( ( "Failed to size shared queue %s: %s.", pName, strerror( errno ) ) );
+        }
+        else
+        {
+            /* The object is zero filled, so all slots are free. */
+            pServer->pRegion = mapRegion( fileDescriptor );
+        }
+    }
+
+    if( ( pServer != NULL ) && ( pServer->pRegion != NULL ) )
+    {
+        pServer->pAgentContext = pMqttAgentContext;
+        pServer->pName = pName;
+
+        for( i = 0U; i < MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH; i++ )
+        {
+            pServer->entries[ i ].pRegion = pServer->pRegion;
+            pServer->entries[ i ].slotIndex = i;
+        }
+
+        pServer->pRegion->serverPid = ( uint32_t ) getpid();
+        pServer->pRegion->queueLength = MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH;
+        pServer->pRegion->slotSize = MQTT_AGENT_POSIX_SHARED_SLOT_SIZE;
+
+        /* Processes opening the queue check the magic last. */
+        __atomic_store_n( &( pServer->pRegion->magic ), SHARED_QUEUE_MAGIC, __ATOMIC_SEQ_CST );
+        created = true;
+    }
+    else if( fileDescriptor >= 0 )
+    {
+        ( void ) shm_unlink( pName );
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    if( fileDescriptor >= 0 )
+    {
+        ( void ) close( fileDescriptor );
+    }
+
+    return created;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSharedQueue_Destroy( PosixSharedQueueServer_t * pServer )
+{
+    if( ( pServer != NULL ) && ( pServer->pRegion != NULL ) )
+    {
+        ( void ) munmap( pServer->pRegion, sizeof( PosixSharedQueueRegion_t ) );
+        ( void ) shm_unlink( pServer->pName );
+        pServer->pRegion = NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t PosixSharedQueue_Serve( PosixSharedQueueServer_t * pServer,
+                               uint32_t blockTimeMs )
+{
+    size_t submittedCount = 0U;
+    uint32_t observedSequence;
+
+    assert( pServer != NULL );
+    assert( pServer->pRegion != NULL );
+
+    /* Read the sequence before looking for submitted slots, so that a publish
+     * submitted after the search changes the sequence and the wait returns at
+     * once. */
+    observedSequence = __atomic_load_n( &( pServer->pRegion->submitSequence ), __ATOMIC_SEQ_CST );
+    submittedCount = enqueueSubmittedSlots( pServer, blockTimeMs );
+
+    if( ( submittedCount == 0U ) && ( blockTimeMs > 0U ) )
+    {
+        /* A submitting process reads the flag after incrementing the
+         * sequence, so either it wakes this process or the sequence has
+         * already changed when the wait starts. */
+        __atomic_store_n( &( pServer->pRegion->serverWaiting ), 1U, __ATOMIC_SEQ_CST );
+        futexWait( &( pServer->pRegion->submitSequence ), observedSequence, blockTimeMs );
+        __atomic_store_n( &( pServer->pRegion->serverWaiting ), 0U, __ATOMIC_SEQ_CST );
+
+        submittedCount = enqueueSubmittedSlots( pServer, blockTimeMs );
+    }
+
+    return submittedCount;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSharedQueue_Open( PosixSharedQueueClient_t * pClient,
+                            const char * pName )
+{
+    bool opened = false;
+    int fileDescriptor;
+    struct stat objectStatus;
+
+    if( ( pClient == NULL ) || ( pName == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pClient=%p, pName=%p.",
+                    ( void * ) pClient,
+                    ( const void * ) pName ) );
+    }
+    else
+    {
+        pClient->pRegion = NULL;
+        fileDescriptor = shm_open( pName, O_RDWR | O_CLOEXEC, 0 );
+
+        if( fileDescriptor < 0 )
+        {
+            LogError( ( "Failed to open shared queue %s: %s.", pName, strerror( errno ) ) );
+        }
+        else
+        {
+            /* A smaller object was created with a different configuration, and
+             * cannot be mapped whole. */
+            if( ( fstat( fileDescriptor, &objectStatus ) == 0 ) &&
+                ( objectStatus.st_size == ( off_t ) sizeof( PosixSharedQueueRegion_t ) ) )
+            {
+                pClient->pRegion = mapRegion( fileDescriptor );
+            }
+            else
+            {
+                LogError( ( "Shared queue %s has a different configuration.", pName ) );
+            }
+
+            ( void ) close( fileDescriptor );
+        }
+    }
+
+    if( ( pClient != NULL ) && ( pClient->pRegion != NULL ) )
+    {
+        if( ( __atomic_load_n( &( pClient->pRegion->magic ), __ATOMIC_SEQ_CST ) == SHARED_QUEUE_MAGIC ) &&
+            ( pClient->pRegion->queueLength == MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH ) &&
+            ( pClient->pRegion->slotSize == MQTT_AGENT_POSIX_SHARED_SLOT_SIZE ) )
+        {
+            opened = true;
+        }
+        else
+        {
+            LogError( ( "Shared queue %s is not initialized or has a different configuration.", pName ) );
+            PosixSharedQueue_Close( pClient );
+        }
+    }
+
+    return opened;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSharedQueue_Close( PosixSharedQueueClient_t * pClient )
+{
+    if( ( pClient != NULL ) && ( pClient->pRegion != NULL ) )
+    {
+        ( void ) munmap( pClient->pRegion, sizeof( PosixSharedQueueRegion_t ) );
+        pClient->pRegion = NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t PosixSharedQueue_Publish( PosixSharedQueueClient_t * pClient,
+                                       const MQTTPublishInfo_t * pPublishInfo,
+                                       uint32_t timeoutMs )
+{
+    MQTTStatus_t status = MQTTSuccess;
+    SharedSlot_t * pSlot = NULL;
+    PosixSharedQueueRegion_t * pRegion;
+    uint32_t startTimeMs;
+
+    if( ( pClient == NULL ) || ( pClient->pRegion == NULL ) || ( pPublishInfo == NULL ) ||
+        ( pPublishInfo->pTopicName == NULL ) || ( pPublishInfo->topicNameLength == 0U ) ||
+        ( ( pPublishInfo->pPayload == NULL ) && ( pPublishInfo->payloadLength > 0U ) ) )
+    {
+        LogError( ( "Invalid parameter: pClient=%p, pPublishInfo=%p.",
+                    ( void * ) pClient,
+                    ( const void * ) pPublishInfo ) );
+        status = MQTTBadParameter;
+    }
+    else if( ( pPublishInfo->topicNameLength > MQTT_AGENT_POSIX_SHARED_SLOT_SIZE ) ||
+             ( pPublishInfo->payloadLength > ( MQTT_AGENT_POSIX_SHARED_SLOT_SIZE - pPublishInfo->topicNameLength ) ) )
+    {
+        LogError( ( "Topic and payload of %lu bytes do not fit in a slot of %lu bytes.",
+                    ( unsigned long ) ( pPublishInfo->topicNameLength + pPublishInfo->payloadLength ),
+                    ( unsigned long ) MQTT_AGENT_POSIX_SHARED_SLOT_SIZE ) );
+        status = MQTTBadParameter;
+    }
+    else
+    {
+        pRegion = pClient->pRegion;
+        startTimeMs = PosixClock_GetTimeMs();
+        pSlot = claimSlot( pRegion, startTimeMs, timeoutMs );
+
+        if( pSlot == NULL )
+        {
+            status = MQTTNoMemory;
+        }
+    }
+
+    if( pSlot != NULL )
+    {
+        ( void ) memcpy( pSlot->data, pPublishInfo->pTopicName, pPublishInfo->topicNameLength );
+
+        if( pPublishInfo->payloadLength > 0U )
+        {
+            ( void ) memcpy( &( pSlot->data[ pPublishInfo->topicNameLength ] ),
+                             pPublishInfo->pPayload,
+                             pPublishInfo->payloadLength );
+        }
+
+        pSlot->topicLength = pPublishInfo->topicNameLength;
+        pSlot->payloadLength = ( uint32_t ) pPublishInfo->payloadLength;
+        pSlot->qos = ( uint32_t ) pPublishInfo->qos;
+        pSlot->retain = pPublishInfo->retain ? 1U : 0U;
+
+        /* The agent's process reads the slot only once it is submitted. It
+         * reads the flag before waiting for the sequence to change, so either
+         * it sees the new sequence or it is woken. */
+        __atomic_store_n( &( pSlot->state ), SLOT_WORD( SLOT_STATE_SUBMITTED, getpid() ), __ATOMIC_SEQ_CST );
+        ( void ) __atomic_add_fetch( &( pRegion->submitSequence ), 1U, __ATOMIC_SEQ_CST );
+
+        if( __atomic_load_n( &( pRegion->serverWaiting ), __ATOMIC_SEQ_CST ) != 0U )
+        {
+            futexWake( &( pRegion->submitSequence ), 1 );
+        }
+
+        status = waitForSlot( pRegion, pSlot, startTimeMs, timeoutMs );
+    }
+
+    return status;
+}
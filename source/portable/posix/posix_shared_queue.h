@@ -0,0 +1,254 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_shared_queue.h
+ * @brief Shared memory queue through which other processes publish with the
+ * connection of the agent.
+ *
+ * The agent's process creates the queue and serves it from a task of its own,
+ * which enqueues a publish command for each publish submitted by another
+ * process. Each slot of the queue holds the topic and payload of one publish,
+ * and its status once it completes, so the slots together are the payload
+ * arena of the queue. Processes wait for each other with futexes on the shared
+ * memory, and a process is only woken when it is waiting.
+ *
+ * Each slot records the process that claimed it. When the queue is full, the
+ * slots of processes that no longer run are given back, so a process killed
+ * while publishing does not leak its slot.
+ *
+ * All processes using a queue must be built with the same
+ * #MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH and #MQTT_AGENT_POSIX_SHARED_SLOT_SIZE,
+ * and must share a PID namespace. If the ID of a process that stopped is
+ * reused before its slots are given back, they are only given back once the
+ * new process stops.
+ */
+#ifndef POSIX_SHARED_QUEUE_H
+#define POSIX_SHARED_QUEUE_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* POSIX includes. */
+#include <sys/types.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Number of slots of a shared queue.
+ *
+ * This bounds the number of publishes submitted by other processes that can be
+ * queued or awaiting an acknowledgment at the same time.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `16`
+ */
+#ifndef MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH
+    #define MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH    ( 16U )
+#endif
+
+/**
+ * @brief Size of the data of a slot of a shared queue, which bounds the
+ * combined length of the topic and payload of a publish.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `1024`
+ */
+#ifndef MQTT_AGENT_POSIX_SHARED_SLOT_SIZE
+    #define MQTT_AGENT_POSIX_SHARED_SLOT_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Layout of the shared memory of a queue, defined in
+ * posix_shared_queue.c.
+ */
+typedef struct PosixSharedQueueRegion PosixSharedQueueRegion_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief State kept by the agent's process for a slot of a shared queue.
+ */
+typedef struct PosixSharedQueueEntry
+{
+    MQTTAgentCommand_t command;         /**< @brief Storage of the publish command of the slot. */
+    MQTTPublishInfo_t publishInfo;      /**< @brief Publish of the slot, pointing into its data. */
+    PosixSharedQueueRegion_t * pRegion; /**< @brief Shared memory of the queue. */
+    size_t slotIndex;                   /**< @brief Index of the slot in the queue. */
+} PosixSharedQueueEntry_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief The agent's side of a shared queue.
+ *
+ * @note The members of this struct are managed by the shared queue functions,
+ * and should not be written by the application.
+ */
+typedef struct PosixSharedQueueServer
+{
+    PosixSharedQueueRegion_t * pRegion;                                      /**< @brief Shared memory of the queue. */
+    MQTTAgentContext_t * pAgentContext;                                      /**< @brief Agent publishing the submitted publishes. */
+    const char * pName;                                                      /**< @brief Name of the shared memory object. */
+    PosixSharedQueueEntry_t entries[ MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH ]; /**< @brief State of each slot. */
+} PosixSharedQueueServer_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief The side of a shared queue of a process submitting publishes.
+ *
+ * @note The members of this struct are managed by the shared queue functions,
+ * and should not be written by the application.
+ */
+typedef struct PosixSharedQueueClient
+{
+    PosixSharedQueueRegion_t * pRegion; /**< @brief Shared memory of the queue. */
+} PosixSharedQueueClient_t;
+
+/**
+ * @brief Create a shared queue in the agent's process.
+ *
+ * @param[out] pServer Queue to create.
+ * @param[in] pName Name of the shared memory object, as for `shm_open()`. It
+ * MUST remain in scope until PosixSharedQueue_Destroy() is called. Creation
+ * fails if a queue of this name was created by a process that still runs. An
+ * object left by a process that stopped without destroying its queue is
+ * removed and created again.
+ * @param[in] mode Permissions of the shared memory object, which determine the
+ * users whose processes may publish.
+ * @param[in] pMqttAgentContext The MQTT agent publishing the submitted
+ * publishes.
+ *
+ * @return `true` if the queue was created, else `false`.
+ */
+bool PosixSharedQueue_Create( PosixSharedQueueServer_t * pServer,
+                              const char * pName,
+                              mode_t mode,
+                              MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Remove a shared queue created by PosixSharedQueue_Create().
+ *
+ * This must only be called once every publish enqueued by
+ * PosixSharedQueue_Serve() has completed, for example after the agent has
+ * stopped and its pending commands have been cancelled. Processes that opened
+ * the queue keep their mapping until they close it.
+ *
+ * @param[in] pServer Queue to destroy.
+ */
+void PosixSharedQueue_Destroy( PosixSharedQueueServer_t * pServer );
+
+/**
+ * @brief Enqueue a publish command for each publish submitted to a shared
+ * queue, waiting for one if none has been submitted.
+ *
+ * This should be called in a loop by a task of the agent's process other than
+ * the agent task. A publish that cannot be enqueued, or whose slot does not
+ * hold a valid publish, is completed at once with the error.
+ *
+ * @param[in] pServer Queue to serve.
+ * @param[in] blockTimeMs Maximum time to wait for a publish to be submitted,
+ * and to enqueue each publish command.
+ *
+ * @return The number of submitted publishes taken from the queue.
+ */
+size_t PosixSharedQueue_Serve( PosixSharedQueueServer_t * pServer,
+                               uint32_t blockTimeMs );
+
+/**
+ * @brief Open a shared queue from a process submitting publishes.
+ *
+ * @param[out] pClient Queue to open.
+ * @param[in] pName Name given to PosixSharedQueue_Create().
+ *
+ * @return `true` if the queue was opened, else `false`, including if it was
+ * created with a different #MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH or
+ * #MQTT_AGENT_POSIX_SHARED_SLOT_SIZE.
+ */
+bool PosixSharedQueue_Open( PosixSharedQueueClient_t * pClient,
+                            const char * pName );
+
+/**
+ * @brief Close a shared queue opened by PosixSharedQueue_Open().
+ *
+ * @param[in] pClient Queue to close.
+ */
+void PosixSharedQueue_Close( PosixSharedQueueClient_t * pClient );
+
+/**
+ * @brief Publish with the connection of the agent serving a shared queue, and
+ * wait for the publish to complete.
+ *
+ * The topic and payload are copied into a free slot of the queue, so they may
+ * be reused as soon as this returns. Any number of threads of any number of
+ * processes may publish to the same queue.
+ *
+ * @param[in] pClient Queue to publish to.
+ * @param[in] pPublishInfo Topic, payload, QoS and retain flag of the publish.
+ * @param[in] timeoutMs Maximum time to wait for a free slot and for the publish
+ * to complete.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, or the topic and
+ * payload do not fit in a slot; #MQTTNoMemory if no slot became free within
+ * @p timeoutMs; #MQTTNoDataAvailable if the publish did not complete within
+ * @p timeoutMs, in which case it may still be sent; else the return code of the
+ * publish command, or the error with which it could not be enqueued.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * PosixSharedQueueClient_t sharedQueue;
+ * MQTTPublishInfo_t publishInfo = { 0 };
+ * MQTTStatus_t status;
+ *
+ * publishInfo.pTopicName = "sensors/temperature";
+ * publishInfo.topicNameLength = strlen( "sensors/temperature" );
+ * publishInfo.pPayload = "21.5";
+ * publishInfo.payloadLength = strlen( "21.5" );
+ * publishInfo.qos = MQTTQoS1;
+ *
+ * if( PosixSharedQueue_Open( &sharedQueue, "/mqtt-agent" ) )
+ * {
+ *     status = PosixSharedQueue_Publish( &sharedQueue, &publishInfo, 5000U );
+ *     PosixSharedQueue_Close( &sharedQueue );
+ * }
+ * @endcode
+ */
+MQTTStatus_t PosixSharedQueue_Publish( PosixSharedQueueClient_t * pClient,
+                                       const MQTTPublishInfo_t * pPublishInfo,
+                                       uint32_t timeoutMs );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_SHARED_QUEUE_H */
@@ -0,0 +1,1285 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_spool.c
+ * @brief Implements the store-and-forward spool of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Header include. */
+#include "posix_spool.h"
+
+/* Port includes. */
+#include "posix_clock.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/**
+ * @brief Value of the `magic` member of a segment file once it is created.
+ */
+#define SEGMENT_MAGIC               ( 0x4D515350UL )
+
+/**
+ * @brief Prefix of the names of segment files, followed by the sequence
+ * number of the segment in 8 hexadecimal digits and #SEGMENT_FILE_SUFFIX.
+ */
+#define SEGMENT_FILE_PREFIX         "spool-"
+
+/**
+ * @brief Suffix of the names of segment files.
+ */
+#define SEGMENT_FILE_SUFFIX         ".seg"
+
+/**
+ * @brief Length of the names of segment files.
+ */
+#define SEGMENT_FILE_NAME_LENGTH    ( sizeof( SEGMENT_FILE_PREFIX ) - 1U + 8U + sizeof( SEGMENT_FILE_SUFFIX ) - 1U )
+
+/**
+ * @brief Offset of the first record of a segment.
+ */
+#define SEGMENT_DATA_OFFSET         ( ( uint32_t ) sizeof( PosixSpoolSegmentHeader_t ) )
+
+/**
+ * @brief Alignment of the records of a segment.
+ */
+#define RECORD_ALIGNMENT            ( 8U )
+
+/**
+ * @brief State of a record whose publish is not yet acknowledged.
+ */
+#define RECORD_STATE_PENDING        ( 1U )
+
+/**
+ * @brief State of a record whose publish is acknowledged.
+ */
+#define RECORD_STATE_ACKED          ( 2U )
+
+/**
+ * @brief Whole publishes held by the drain rate limiter when it is full, in
+ * thousandths.
+ */
+#define DRAIN_TOKENS_MAX            ( MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT * 1000U )
+
+/**
+ * @brief Returned by getSendDelay() when a publish can only be sent after a
+ * change signaled to the drain task.
+ */
+#define SEND_DELAY_NONE             ( UINT32_MAX )
+
+/**
+ * @brief Layout of the start of a segment file.
+ */
+struct PosixSpoolSegmentHeader
+{
+    uint32_t magic;       /**< @brief #SEGMENT_MAGIC once created. */
+    uint32_t segmentSize; /**< @brief #MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE of the writer. */
+    uint32_t writeOffset; /**< @brief Offset of the end of the last record. Written after the record. */
+    uint32_t reserved;    /**< @brief Aligns the first record. */
+};
+
+/**
+ * @brief A spooled publish, followed by its topic and payload.
+ */
+typedef struct SpoolRecord
+{
+    uint32_t length;        /**< @brief Length of the record, a multiple of #RECORD_ALIGNMENT. */
+    uint32_t state;         /**< @brief #RECORD_STATE_PENDING or #RECORD_STATE_ACKED. */
+    uint32_t payloadLength; /**< @brief Length of the payload following the topic. */
+    uint16_t topicLength;   /**< @brief Length of the topic following the record. */
+    uint8_t qos;            /**< @brief QoS of the publish. */
+    uint8_t retain;         /**< @brief Retain flag of the publish. */
+} SpoolRecord_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get a segment by its position from the oldest segment.
+ *
+ * @param[in] pSpool Spool of the segment.
+ * @param[in] position Position of the segment.
+ *
+ * @return The segment.
+ */
+static PosixSpoolSegment_t * getSegment( PosixSpool_t * pSpool,
+                                         size_t position );
+
+/**
+ * @brief Get a record of a segment.
+ *
+ * @param[in] pSegment Segment of the record.
+ * @param[in] offset Offset of the record.
+ *
+ * @return The record.
+ */
+static SpoolRecord_t * getRecord( const PosixSpoolSegment_t * pSegment,
+                                  uint32_t offset );
+
+/**
+ * @brief Get the path of a segment file.
+ *
+ * @param[in] pSpool Spool of the segment.
+ * @param[in] sequence Sequence number of the segment.
+ * @param[out] pPath Buffer of `PATH_MAX` bytes for the path.
+ *
+ * @return `true` if the path fits in the buffer, else `false`.
+ */
+static bool getSegmentPath( const PosixSpool_t * pSpool,
+                            uint32_t sequence,
+                            char * pPath );
+
+/**
+ * @brief Get the sequence number in the name of a segment file.
+ *
+ * @param[in] pName Name of a file of the spool directory.
+ * @param[out] pSequence Sequence number of the segment.
+ *
+ * @return `true` if the file is a segment file, else `false`.
+ */
+static bool parseSegmentName( const char * pName,
+                              uint32_t * pSequence );
+
+/**
+ * @brief Count the publishes not yet acknowledged of a segment read from disk,
+ * dropping the records after the first invalid one.
+ *
+ * @param[in] pSegment Segment to scan.
+ */
+static void scanSegment( PosixSpoolSegment_t * pSegment );
+
+/**
+ * @brief Map a segment file left in the spool directory, after the other
+ * segments.
+ *
+ * A file left by a process that stopped while creating it is deleted.
+ *
+ * @param[in] pSpool Spool of the segment.
+ * @param[in] sequence Sequence number of the segment.
+ *
+ * @return `false` if the file could not be read or was written with another
+ * #MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE, else `true`.
+ */
+static bool loadSegment( PosixSpool_t * pSpool,
+                         uint32_t sequence );
+
+/**
+ * @brief Create a segment file after the other segments.
+ *
+ * @param[in] pSpool Spool of the segment.
+ *
+ * @return The segment, or NULL on failure.
+ */
+static PosixSpoolSegment_t * createSegment( PosixSpool_t * pSpool );
+
+/**
+ * @brief Delete the oldest segments while all their publishes are
+ * acknowledged, and start the only remaining segment over once all its
+ * publishes are.
+ *
+ * This is only called by the drain task, which owns the read position.
+ *
+ * @param[in] pSpool Spool to compact.
+ */
+static void retireSegments( PosixSpool_t * pSpool );
+
+/**
+ * @brief Append a publish to the newest segment, creating a new segment when it
+ * is full.
+ *
+ * @param[in] pSpool Spool to append to.
+ * @param[in] pPublishInfo The publish.
+ *
+ * @return #MQTTSuccess, #MQTTBadParameter or #MQTTNoMemory.
+ */
+static MQTTStatus_t appendRecord( PosixSpool_t * pSpool,
+                                  const MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief Find the next publish to send from the read position, moving the
+ * read position past the acknowledged ones.
+ *
+ * @param[in] pSpool Spool to read.
+ *
+ * @return The record of the publish, or NULL if there is none.
+ */
+static SpoolRecord_t * findNextRecord( PosixSpool_t * pSpool );
+
+/**
+ * @brief Refill the drain rate limiter for the time elapsed since it was last
+ * refilled.
+ *
+ * @param[in] pSpool Spool to refill.
+ */
+static void refillTokens( PosixSpool_t * pSpool );
+
+/**
+ * @brief Get the time until the next spooled publish may be sent.
+ *
+ * @param[in] pSpool Spool to drain.
+ *
+ * @return 0 if a publish may be sent now, the time in milliseconds until the
+ * drain rate allows one, or #SEND_DELAY_NONE if a publish can only be sent
+ * after a change signaled to the drain task.
+ */
+static uint32_t getSendDelay( PosixSpool_t * pSpool );
+
+/**
+ * @brief Send the next spooled publish, releasing the mutex of the spool while
+ * its command is enqueued.
+ *
+ * @param[in] pSpool Spool to drain.
+ * @param[in] blockTimeMs Maximum time to wait to enqueue the command.
+ *
+ * @return `true` if the publish was sent, else `false`.
+ */
+static bool sendNextRecord( PosixSpool_t * pSpool,
+                            uint32_t blockTimeMs );
+
+/**
+ * @brief Completion callback of a spooled publish, which marks it acknowledged
+ * or makes the drain task send it again.
+ *
+ * @param[in] pCmdCallbackContext Entry of the publish.
+ * @param[in] pReturnInfo Result of the publish.
+ */
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo );
+
+/*-----------------------------------------------------------*/
+
+static PosixSpoolSegment_t * getSegment( PosixSpool_t * pSpool,
+                                         size_t position )
+{
+    return &( pSpool->segments[ ( pSpool->firstSegment + position ) % MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS ] );
+}
+
+/*-----------------------------------------------------------*/
+
+static SpoolRecord_t * getRecord( const PosixSpoolSegment_t * pSegment,
+                                  uint32_t offset )
+{
+    return ( SpoolRecord_t * ) ( void * ) &( ( ( uint8_t * ) pSegment->pHeader )[ offset ] );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool getSegmentPath( const PosixSpool_t * pSpool,
+                            uint32_t sequence,
+                            char * pPath )
+{
+    int length;
+
+    length = snprintf( pPath,
+                       PATH_MAX,
+                       "%s/" SEGMENT_FILE_PREFIX "%08lx" SEGMENT_FILE_SUFFIX,
+                       pSpool->pDirectory,
+                       ( unsigned long ) sequence );
+
+    if( ( length < 0 ) || ( length >= PATH_MAX ) )
+    {
+        LogError( ( "Spool directory path %s is too long.", pSpool->pDirectory ) );
+    }
+
+    return( ( length >= 0 ) && ( length < PATH_MAX ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool parseSegmentName( const char * pName,
+                              uint32_t * pSequence )
+{
+    const size_t prefixLength = sizeof( SEGMENT_FILE_PREFIX ) - 1U;
+    bool parsed = false;
+    size_t i;
+
+    if( ( strlen( pName ) == SEGMENT_FILE_NAME_LENGTH ) &&
+        ( strncmp( pName, SEGMENT_FILE_PREFIX, prefixLength ) == 0 ) &&
+        ( strcmp( &( pName[ prefixLength + 8U ] ), SEGMENT_FILE_SUFFIX ) == 0 ) )
+    {
+        parsed = true;
+
+        for( i = prefixLength; ( i < ( prefixLength + 8U ) ) && parsed; i++ )
+        {
+            parsed = ( strchr( "0123456789abcdef", pName[ i ] ) != NULL );
+        }
+    }
+
+    if( parsed )
+    {
+        /* The suffix stops the conversion. */
+        *pSequence = ( uint32_t ) strtoul( &( pName[ prefixLength ] ), NULL, 16 );
+    }
+
+    return parsed;
+}
+
+/*-----------------------------------------------------------*/
+
+static void scanSegment( PosixSpoolSegment_t * pSegment )
+{
+    PosixSpoolSegmentHeader_t * pHeader = pSegment->pHeader;
+    const SpoolRecord_t * pRecord;
+    uint32_t offset = SEGMENT_DATA_OFFSET;
+    bool valid = true;
+
+    pSegment->pendingCount = 0U;
+
+    if( ( pHeader->writeOffset < SEGMENT_DATA_OFFSET ) ||
+        ( pHeader->writeOffset > MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE ) )
+    {
+        valid = false;
+    }
+
+    while( valid && ( offset < pHeader->writeOffset ) )
+    {
+        pRecord = getRecord( pSegment, offset );
+
+        /* The write offset is only moved past complete records, so an invalid
+         * record means the file was damaged. */
+        if( ( pRecord->length < sizeof( SpoolRecord_t ) ) ||
+            ( ( pRecord->length % RECORD_ALIGNMENT ) != 0U ) ||
+            ( pRecord->length > ( pHeader->writeOffset - offset ) ) ||
+            ( ( sizeof( SpoolRecord_t ) + pRecord->topicLength + ( size_t ) pRecord->payloadLength ) > pRecord->length ) ||
+            ( pRecord->topicLength == 0U ) ||
+            ( ( pRecord->qos != ( uint8_t ) MQTTQoS1 ) && ( pRecord->qos != ( uint8_t ) MQTTQoS2 ) ) ||
+            ( ( pRecord->state != RECORD_STATE_PENDING ) && ( pRecord->state != RECORD_STATE_ACKED ) ) )
+        {
+            valid = false;
+        }
+        else
+        {
+            if( pRecord->state == RECORD_STATE_PENDING )
+            {
+                pSegment->pendingCount++;
+            }
+
+            offset += pRecord->length;
+        }
+    }
+
+    if( !valid )
+    {
+        LogError( ( "Dropping the publishes of spool segment %08lx from offset %lu, which are invalid.",
+                    ( unsigned long ) pSegment->sequence,
+                    ( unsigned long ) offset ) );
+        pHeader->writeOffset = offset;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool loadSegment( PosixSpool_t * pSpool,
+                         uint32_t sequence )
+{
+    char path[ PATH_MAX ];
+    struct stat fileStatus;
+    PosixSpoolSegmentHeader_t header;
+    PosixSpoolSegment_t * pSegment;
+    void * pMapping = MAP_FAILED;
+    int fileDescriptor = -1;
+    bool loaded = false;
+    bool incomplete = false;
+
+    if( getSegmentPath( pSpool, sequence, path ) )
+    {
+        fileDescriptor = open( path, O_RDWR | O_CLOEXEC );
+    }
+
+    if( fileDescriptor < 0 )
+    {
+        LogError( ( "Failed to open spool segment %08lx: %s.", ( unsigned long ) sequence, strerror( errno ) ) );
+    }
+    else if( fstat( fileDescriptor, &fileStatus ) != 0 )
+    {
+        LogError( ( "Failed to get size of spool segment %08lx: %s.", ( unsigned long ) sequence, strerror( errno ) ) );
+    }
+    else if( fileStatus.st_size != ( off_t ) MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE )
+    {
+        /* Segments are sized before their header is written, so a segment of
+         * another size with a header is from another configuration. */
+        if( ( pread( fileDescriptor, &header, sizeof( header ), 0 ) == ( ssize_t ) sizeof( header ) ) &&
+            ( header.magic == SEGMENT_MAGIC ) )
+        {
+            LogError( ( "Spool segment %08lx was written with a segment size of %lu.",
+                        ( unsigned long ) sequence,
+                        ( unsigned long ) header.segmentSize ) );
+        }
+        else
+        {
+            incomplete = true;
+        }
+    }
+    else
+    {
+        pMapping = mmap( NULL,
+                         MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         fileDescriptor,
+                         0 );
+
+        if( pMapping == MAP_FAILED )
+        {
+            LogError( ( "Failed to map spool segment %08lx: %s.", ( unsigned long ) sequence, strerror( errno ) ) );
+        }
+        else if( ( ( PosixSpoolSegmentHeader_t * ) pMapping )->magic != SEGMENT_MAGIC )
+        {
+            ( void ) munmap( pMapping, MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE );
+            incomplete = true;
+        }
+        else
+        {
+            pSegment = getSegment( pSpool, pSpool->segmentCount );
+            pSegment->pHeader = ( PosixSpoolSegmentHeader_t * ) pMapping;
+            pSegment->sequence = sequence;
+            scanSegment( pSegment );
+            pSpool->pendingCount += pSegment->pendingCount;
+            pSpool->segmentCount++;
+            loaded = true;
+        }
+    }
+
+    if( fileDescriptor >= 0 )
+    {
+        ( void ) close( fileDescriptor );
+    }
+
+    if( incomplete )
+    {
+        LogWarn( ( "Deleting spool segment %08lx, whose creation was interrupted.", ( unsigned long ) sequence ) );
+        ( void ) unlink( path );
+    }
+
+    return( loaded || incomplete );
+}
+
+/*-----------------------------------------------------------*/
+
+static PosixSpoolSegment_t * createSegment( PosixSpool_t * pSpool )
+{
+    char path[ PATH_MAX ];
+    PosixSpoolSegment_t * pSegment = NULL;
+    PosixSpoolSegmentHeader_t * pHeader;
+    void * pMapping = MAP_FAILED;
+    int fileDescriptor = -1;
+    int result;
+
+    if( getSegmentPath( pSpool, pSpool->nextSequence, path ) )
+    {
+        fileDescriptor = open( path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR );
+    }
+
+    if( fileDescriptor < 0 )
+    {
+        LogError( ( "Failed to create spool segment %08lx: %s.", ( unsigned long ) pSpool->nextSequence, strerror( errno ) ) );
+    }
+    else
+    {
+        /* The blocks are allocated up front, so a full disk fails here rather
+         * than when a publish is written to the mapping. */
+        result = posix_fallocate( fileDescriptor, 0, ( off_t ) MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE );
+
+        if( result != 0 )
+        {
+            LogError( ( "Failed to allocate spool segment %08lx: %s.", ( unsigned long ) pSpool->nextSequence, strerror( result ) ) );
+        }
+        else
+        {
+            pMapping = mmap( NULL,
+                             MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED,
+                             fileDescriptor,
+                             0 );
+
+            if( pMapping == MAP_FAILED )
+            {
+                LogError( ( "Failed to map spool segment %08lx: %s.", ( unsigned long ) pSpool->nextSequence, strerror( errno ) ) );
+            }
+        }
+
+        ( void ) close( fileDescriptor );
+
+        if( pMapping == MAP_FAILED )
+        {
+            ( void ) unlink( path );
+        }
+    }
+
+    if( pMapping != MAP_FAILED )
+    {
+        pHeader = ( PosixSpoolSegmentHeader_t * ) pMapping;
+        pHeader->segmentSize = MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE;
+        pHeader->writeOffset = SEGMENT_DATA_OFFSET;
+
+        /* The magic is written last, so a segment whose creation was
+         * interrupted is deleted when the spool is opened. */
+        __atomic_store_n( &( pHeader->magic ), SEGMENT_MAGIC, __ATOMIC_RELEASE );
+
+        pSegment = getSegment( pSpool, pSpool->segmentCount );
+        pSegment->pHeader = pHeader;
+        pSegment->sequence = pSpool->nextSequence;
+        pSegment->pendingCount = 0U;
+        pSpool->segmentCount++;
+        pSpool->nextSequence++;
+    }
+
+    return pSegment;
+}
+
+/*-----------------------------------------------------------*/
+
+static void retireSegments( PosixSpool_t * pSpool )
+{
+    char path[ PATH_MAX ];
+    PosixSpoolSegment_t * pSegment;
+
+    while( ( pSpool->segmentCount > 1U ) && ( pSpool->segments[ pSpool->firstSegment ].pendingCount == 0U ) )
+    {
+        pSegment = &( pSpool->segments[ pSpool->firstSegment ] );
+        ( void ) munmap( pSegment->pHeader, MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE );
+        pSegment->pHeader = NULL;
+
+        if( getSegmentPath( pSpool, pSegment->sequence, path ) && ( unlink( path ) != 0 ) )
+        {
+            LogWarn( ( "Failed to delete spool segment %08lx: %s.", ( unsigned long ) pSegment->sequence, strerror( errno ) ) );
+        }
+
+        pSpool->firstSegment = ( pSpool->firstSegment + 1U ) % MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS;
+        pSpool->segmentCount--;
+
+        /* The read position is never before a publish not yet acknowledged,
+         * so it is at most at the start of the next segment. */
+        if( pSpool->readSegment > 0U )
+        {
+            pSpool->readSegment--;
+        }
+        else
+        {
+            pSpool->readOffset = SEGMENT_DATA_OFFSET;
+        }
+    }
+
+    /* Starting the only segment over keeps a spool that is drained as fast
+     * as it is filled in one file, which is never deleted. */
+    if( ( pSpool->segmentCount == 1U ) &&
+        ( pSpool->pendingCount == 0U ) &&
+        ( pSpool->segments[ pSpool->firstSegment ].pHeader->writeOffset > SEGMENT_DATA_OFFSET ) )
+    {
+        pSpool->segments[ pSpool->firstSegment ].pHeader->writeOffset = SEGMENT_DATA_OFFSET;
+        pSpool->readSegment = 0U;
+        pSpool->readOffset = SEGMENT_DATA_OFFSET;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t appendRecord( PosixSpool_t * pSpool,
+                                  const MQTTPublishInfo_t * pPublishInfo )
+{
+    MQTTStatus_t status = MQTTSuccess;
+    PosixSpoolSegment_t * pSegment = NULL;
+    SpoolRecord_t * pRecord;
+    uint8_t * pData;
+    size_t recordLength = 0U;
+
+    if( ( pPublishInfo->pTopicName == NULL ) ||
+        ( pPublishInfo->topicNameLength == 0U ) ||
+        ( ( pPublishInfo->pPayload == NULL ) && ( pPublishInfo->payloadLength > 0U ) ) ||
+        ( pPublishInfo->payloadLength > MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE ) )
+    {
+        status = MQTTBadParameter;
+    }
+    else
+    {
+        recordLength = sizeof( SpoolRecord_t ) + pPublishInfo->topicNameLength + pPublishInfo->payloadLength;
+        recordLength = ( recordLength + RECORD_ALIGNMENT - 1U ) & ~( ( size_t ) RECORD_ALIGNMENT - 1U );
+
+        if( recordLength > ( MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE - SEGMENT_DATA_OFFSET ) )
+        {
+            status = MQTTBadParameter;
+        }
+    }
+
+    if( status == MQTTBadParameter )
+    {
+        LogError( ( "Publish of topicNameLength=%hu and payloadLength=%lu cannot be spooled.",
+                    ( unsigned short ) pPublishInfo->topicNameLength,
+                    ( unsigned long ) pPublishInfo->payloadLength ) );
+    }
+    else
+    {
+        if( pSpool->segmentCount > 0U )
+        {
+            pSegment = getSegment( pSpool, pSpool->segmentCount - 1U );
+
+            if( ( pSegment->pHeader->writeOffset + recordLength ) > MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE )
+            {
+                pSegment = NULL;
+            }
+        }
+
+        if( pSegment != NULL )
+        {
+            /* Empty else MISRA 15.7 */
+        }
+        else if( pSpool->segmentCount == MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS )
+        {
+            LogWarn( ( "Spool is full with %lu publishes not yet acknowledged.", ( unsigned long ) pSpool->pendingCount ) );
+        }
+        else
+        {
+            pSegment = createSegment( pSpool );
+        }
+
+        if( pSegment == NULL )
+        {
+            status = MQTTNoMemory;
+        }
+    }
+
+    if( status == MQTTSuccess )
+    {
+        pRecord = getRecord( pSegment, pSegment->pHeader->writeOffset );
+        pRecord->length = ( uint32_t ) recordLength;
+        pRecord->state = RECORD_STATE_PENDING;
+        pRecord->payloadLength = ( uint32_t ) pPublishInfo->payloadLength;
+        pRecord->topicLength = pPublishInfo->topicNameLength;
+        pRecord->qos = ( uint8_t ) pPublishInfo->qos;
+        pRecord->retain = ( pPublishInfo->retain ) ? 1U : 0U;
+
+        pData = ( uint8_t * ) &( pRecord[ 1 ] );
+        ( void ) memcpy( pData, pPublishInfo->pTopicName, pPublishInfo->topicNameLength );
+
+        if( pPublishInfo->payloadLength > 0U )
+        {
+            ( void ) memcpy( &( pData[ pPublishInfo->topicNameLength ] ),
+                             pPublishInfo->pPayload,
+                             pPublishInfo->payloadLength );
+        }
+
+        /* The write offset is moved last, so a record whose write was
+         * interrupted by the process stopping is not read back. */
+        __atomic_store_n( &( pSegment->pHeader->writeOffset ),
+                          pSegment->pHeader->writeOffset + ( uint32_t ) recordLength,
+                          __ATOMIC_RELEASE );
+
+        pSegment->pendingCount++;
+        pSpool->pendingCount++;
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+static SpoolRecord_t * findNextRecord( PosixSpool_t * pSpool )
+{
+    SpoolRecord_t * pRecord = NULL;
+    const SpoolRecord_t * pAckedRecord;
+    PosixSpoolSegment_t * pSegment;
+    bool searching = true;
+
+    while( searching && ( pSpool->readSegment < pSpool->segmentCount ) )
+    {
+        pSegment = getSegment( pSpool, pSpool->readSegment );
+
+        if( pSpool->readOffset >= pSegment->pHeader->writeOffset )
+        {
+            if( ( pSpool->readSegment + 1U ) < pSpool->segmentCount )
+            {
+                pSpool->readSegment++;
+                pSpool->readOffset = SEGMENT_DATA_OFFSET;
+            }
+            else
+            {
+                searching = false;
+            }
+        }
+        else if( getRecord( pSegment, pSpool->readOffset )->state == RECORD_STATE_PENDING )
+        {
+            pRecord = getRecord( pSegment, pSpool->readOffset );
+            searching = false;
+        }
+        else
+        {
+            pAckedRecord = getRecord( pSegment, pSpool->readOffset );
+            pSpool->readOffset += pAckedRecord->length;
+        }
+    }
+
+    return pRecord;
+}
+
+/*-----------------------------------------------------------*/
+
+static void refillTokens( PosixSpool_t * pSpool )
+{
+    uint32_t nowMs = PosixClock_GetTimeMs();
+    uint32_t elapsedMs = nowMs - pSpool->lastRefillTimeMs;
+
+    pSpool->lastRefillTimeMs = nowMs;
+
+    /* Comparing before multiplying keeps the product within the maximum. */
+    if( elapsedMs > ( DRAIN_TOKENS_MAX / pSpool->drainRate ) )
+    {
+        pSpool->drainTokens = DRAIN_TOKENS_MAX;
+    }
+    else
+    {
+        pSpool->drainTokens += elapsedMs * pSpool->drainRate;
+
+        if( pSpool->drainTokens > DRAIN_TOKENS_MAX )
+        {
+            pSpool->drainTokens = DRAIN_TOKENS_MAX;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getSendDelay( PosixSpool_t * pSpool )
+{
+    uint32_t delayMs = 0U;
+
+    if( ( !pSpool->online ) || ( pSpool->inFlightCount == MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ) )
+    {
+        delayMs = SEND_DELAY_NONE;
+    }
+    else if( pSpool->rewind && ( pSpool->inFlightCount > 0U ) )
+    {
+        /* Sending restarts from the oldest publish not acknowledged only once
+         * no publish is in flight, so none is sent twice at once. */
+        delayMs = SEND_DELAY_NONE;
+    }
+    else
+    {
+        if( pSpool->rewind )
+        {
+            pSpool->rewind = false;
+            pSpool->readSegment = 0U;
+            pSpool->readOffset = SEGMENT_DATA_OFFSET;
+        }
+
+        if( findNextRecord( pSpool ) == NULL )
+        {
+            delayMs = SEND_DELAY_NONE;
+        }
+        else if( pSpool->drainRate > 0U )
+        {
+            refillTokens( pSpool );
+
+            if( pSpool->drainTokens < 1000U )
+            {
+                delayMs = ( ( 1000U - pSpool->drainTokens ) / pSpool->drainRate ) + 1U;
+            }
+        }
+        else
+        {
+            /* Empty else MISRA 15.7 */
+        }
+    }
+
+    return delayMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool sendNextRecord( PosixSpool_t * pSpool,
+                            uint32_t blockTimeMs )
+{
+    PosixSpoolEntry_t * pEntry = NULL;
+    SpoolRecord_t * pRecord;
+    const uint8_t * pData;
+    MQTTAgentCommandInfo_t commandInfo;
+    MQTTStatus_t status = MQTTIllegalState;
+    size_t readSegment = pSpool->readSegment;
+    uint32_t readOffset = pSpool->readOffset;
+    size_t i;
+
+    pRecord = findNextRecord( pSpool );
+
+    for( i = 0U; ( i < MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ) && ( pEntry == NULL ); i++ )
+    {
+        if( !pSpool->entries[ i ].inFlight )
+        {
+            pEntry = &( pSpool->entries[ i ] );
+        }
+    }
+
+    /* getSendDelay() found a publish to send, and fewer than the maximum are
+     * in flight, so there is a free entry. */
+    assert( pRecord != NULL );
+    assert( pEntry != NULL );
+
+    if( ( pRecord != NULL ) && ( pEntry != NULL ) )
+    {
+        pData = ( const uint8_t * ) &( pRecord[ 1 ] );
+        ( void ) memset( &( pEntry->publishInfo ), 0x00, sizeof( MQTTPublishInfo_t ) );
+        pEntry->publishInfo.pTopicName = ( const char * ) pData;
+        pEntry->publishInfo.topicNameLength = pRecord->topicLength;
+        pEntry->publishInfo.pPayload = &( pData[ pRecord->topicLength ] );
+        pEntry->publishInfo.payloadLength = pRecord->payloadLength;
+        pEntry->publishInfo.qos = ( MQTTQoS_t ) pRecord->qos;
+        pEntry->publishInfo.retain = ( pRecord->retain != 0U );
+        pEntry->pSpool = pSpool;
+        pEntry->pSegment = getSegment( pSpool, pSpool->readSegment );
+        pEntry->recordOffset = pSpool->readOffset;
+        pEntry->inFlight = true;
+        pSpool->inFlightCount++;
+        pSpool->readOffset += pRecord->length;
+
+        if( pSpool->drainRate > 0U )
+        {
+            pSpool->drainTokens -= 1000U;
+        }
+
+        ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+        commandInfo.cmdCompleteCallback = publishCompleteCallback;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) ( void * ) pEntry;
+        commandInfo.blockTimeMs = blockTimeMs;
+
+        /* The segment of the publish is not deleted while it is in flight, and
+         * only this task moves the read position, so the mutex is not held
+         * while the command is enqueued. */
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+        status = MQTTAgent_PublishWithStorage( pSpool->pAgentContext,
+                                               &( pEntry->publishInfo ),
+                                               &commandInfo,
+                                               &( pEntry->command ) );
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+
+        if( status != MQTTSuccess )
+        {
+            LogWarn( ( "Failed to send spooled publish: %s.", MQTT_Status_strerror( status ) ) );
+            pEntry->inFlight = false;
+            pSpool->inFlightCount--;
+            pSpool->readSegment = readSegment;
+            pSpool->readOffset = readOffset;
+
+            if( pSpool->drainRate > 0U )
+            {
+                pSpool->drainTokens += 1000U;
+            }
+        }
+    }
+
+    return( status == MQTTSuccess );
+}
+
+/*-----------------------------------------------------------*/
+
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    PosixSpoolEntry_t * pEntry = ( PosixSpoolEntry_t * ) ( void * ) pCmdCallbackContext;
+    PosixSpool_t * pSpool;
+
+    assert( pEntry != NULL );
+    assert( pReturnInfo != NULL );
+
+    pSpool = pEntry->pSpool;
+    ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+
+    if( pReturnInfo->returnCode == MQTTSuccess )
+    {
+        getRecord( pEntry->pSegment, pEntry->recordOffset )->state = RECORD_STATE_ACKED;
+        pEntry->pSegment->pendingCount--;
+        pSpool->pendingCount--;
+    }
+    else
+    {
+        LogWarn( ( "Spooled publish failed and is sent again: %s.",
+                   MQTT_Status_strerror( pReturnInfo->returnCode ) ) );
+        pSpool->rewind = true;
+    }
+
+    pEntry->inFlight = false;
+    pSpool->inFlightCount--;
+    ( void ) pthread_cond_signal( &( pSpool->changed ) );
+    ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSpool_Open( PosixSpool_t * pSpool,
+                      const char * pDirectory,
+                      MQTTAgentContext_t * pMqttAgentContext )
+{
+    uint32_t sequences[ MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS ];
+    pthread_condattr_t condAttributes;
+    DIR * pDir = NULL;
+    const struct dirent * pDirEntry;
+    uint32_t sequence;
+    size_t sequenceCount = 0U;
+    size_t i;
+    bool listed = false;
+    bool opened = false;
+
+    if( ( pSpool == NULL ) || ( pDirectory == NULL ) || ( pMqttAgentContext == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p, pDirectory=%p, pMqttAgentContext=%p.",
+                    ( void * ) pSpool,
+                    ( const void * ) pDirectory,
+                    ( void * ) pMqttAgentContext ) );
+    }
+    else
+    {
+        ( void ) memset( pSpool, 0x00, sizeof( PosixSpool_t ) );
+        pSpool->pAgentContext = pMqttAgentContext;
+        pSpool->pDirectory = pDirectory;
+        pSpool->readOffset = SEGMENT_DATA_OFFSET;
+        pDir = opendir( pDirectory );
+
+        if( pDir == NULL )
+        {
+            LogError( ( "Failed to open spool directory %s: %s.", pDirectory, strerror( errno ) ) );
+        }
+        else
+        {
+            listed = true;
+            opened = true;
+        }
+    }
+
+    if( listed )
+    {
+        for( pDirEntry = readdir( pDir ); ( pDirEntry != NULL ) && opened; pDirEntry = readdir( pDir ) )
+        {
+            if( !parseSegmentName( pDirEntry->d_name, &sequence ) )
+            {
+                /* Empty else MISRA 15.7 */
+            }
+            else if( sequenceCount == MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS )
+            {
+                LogError( ( "Spool directory %s has more than %lu segments.",
+                            pDirectory,
+                            ( unsigned long ) MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS ) );
+                opened = false;
+            }
+            else
+            {
+                /* Insert in order, as the directory is not sorted. */
+                for( i = sequenceCount; ( i > 0U ) && ( sequences[ i - 1U ] > sequence ); i-- )
+                {
+                    sequences[ i ] = sequences[ i - 1U ];
+                }
+
+                sequences[ i ] = sequence;
+                sequenceCount++;
+                pSpool->nextSequence = sequences[ sequenceCount - 1U ] + 1U;
+            }
+        }
+
+        ( void ) closedir( pDir );
+    }
+
+    for( i = 0U; ( i < sequenceCount ) && opened; i++ )
+    {
+        opened = loadSegment( pSpool, sequences[ i ] );
+    }
+
+    if( opened )
+    {
+        /* Waits for changes use the monotonic clock, so they are not affected
+         * by changes to the wall clock. */
+        ( void ) pthread_condattr_init( &condAttributes );
+        ( void ) pthread_condattr_setclock( &condAttributes, CLOCK_MONOTONIC );
+        ( void ) pthread_cond_init( &( pSpool->changed ), &condAttributes );
+        ( void ) pthread_condattr_destroy( &condAttributes );
+        ( void ) pthread_mutex_init( &( pSpool->mutex ), NULL );
+
+        retireSegments( pSpool );
+
+        LogInfo( ( "Opened spool %s with %lu publishes in %lu segments.",
+                   pDirectory,
+                   ( unsigned long ) pSpool->pendingCount,
+                   ( unsigned long ) pSpool->segmentCount ) );
+    }
+    else if( listed )
+    {
+        for( i = 0U; i < pSpool->segmentCount; i++ )
+        {
+            ( void ) munmap( getSegment( pSpool, i )->pHeader, MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE );
+        }
+
+        pSpool->segmentCount = 0U;
+        pSpool->pAgentContext = NULL;
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    return opened;
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSpool_Close( PosixSpool_t * pSpool )
+{
+    size_t i;
+
+    if( ( pSpool != NULL ) && ( pSpool->pAgentContext != NULL ) )
+    {
+        assert( pSpool->inFlightCount == 0U );
+
+        for( i = 0U; i < pSpool->segmentCount; i++ )
+        {
+            ( void ) munmap( getSegment( pSpool, i )->pHeader, MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE );
+        }
+
+        pSpool->segmentCount = 0U;
+        pSpool->pAgentContext = NULL;
+        ( void ) pthread_cond_destroy( &( pSpool->changed ) );
+        ( void ) pthread_mutex_destroy( &( pSpool->mutex ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSpool_SetOnline( PosixSpool_t * pSpool,
+                           bool online )
+{
+    if( pSpool == NULL )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p.", ( void * ) pSpool ) );
+    }
+    else
+    {
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+        pSpool->online = online;
+        ( void ) pthread_cond_signal( &( pSpool->changed ) );
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void PosixSpool_SetDrainRate( PosixSpool_t * pSpool,
+                              uint32_t publishesPerSecond )
+{
+    if( pSpool == NULL )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p.", ( void * ) pSpool ) );
+    }
+    else
+    {
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+        pSpool->drainRate = publishesPerSecond;
+        pSpool->drainTokens = DRAIN_TOKENS_MAX;
+        pSpool->lastRefillTimeMs = PosixClock_GetTimeMs();
+        ( void ) pthread_cond_signal( &( pSpool->changed ) );
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t PosixSpool_Publish( PosixSpool_t * pSpool,
+                                 MQTTPublishInfo_t * pPublishInfo,
+                                 const MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    MQTTStatus_t status = MQTTBadParameter;
+    bool spooled = false;
+
+    if( ( pSpool == NULL ) || ( pPublishInfo == NULL ) || ( pCommandInfo == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p, pPublishInfo=%p, pCommandInfo=%p.",
+                    ( void * ) pSpool,
+                    ( void * ) pPublishInfo,
+                    ( const void * ) pCommandInfo ) );
+    }
+    else if( ( pPublishInfo->qos != MQTTQoS0 ) && ( pCommandInfo->cmdCompleteCallback != NULL ) )
+    {
+        /* Whether a publish is spooled depends on the state of the connection,
+         * and a spooled publish may complete after a restart, so a completion
+         * callback could not always be invoked. */
+        LogError( ( "A QoS 1 or QoS 2 publish through a spool cannot have a completion callback." ) );
+    }
+    else
+    {
+        if( pPublishInfo->qos != MQTTQoS0 )
+        {
+            ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+
+            /* Publishes follow those already spooled, so they are sent in
+             * order. */
+            spooled = ( !pSpool->online ) || ( pSpool->pendingCount > 0U );
+
+            if( spooled )
+            {
+                status = appendRecord( pSpool, pPublishInfo );
+                ( void ) pthread_cond_signal( &( pSpool->changed ) );
+            }
+
+            ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+        }
+
+        if( !spooled )
+        {
+            status = MQTTAgent_Publish( pSpool->pAgentContext, pPublishInfo, pCommandInfo );
+        }
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t PosixSpool_Drain( PosixSpool_t * pSpool,
+                         uint32_t blockTimeMs )
+{
+    struct timespec deadline;
+    size_t sentCount = 0U;
+    uint32_t startTimeMs;
+    uint32_t elapsedMs;
+    uint32_t delayMs;
+    bool draining = true;
+
+    if( pSpool == NULL )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p.", ( void * ) pSpool ) );
+        draining = false;
+    }
+    else
+    {
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+        startTimeMs = PosixClock_GetTimeMs();
+
+        while( draining )
+        {
+            retireSegments( pSpool );
+            delayMs = getSendDelay( pSpool );
+
+            if( delayMs == 0U )
+            {
+                if( sendNextRecord( pSpool, blockTimeMs ) )
+                {
+                    sentCount++;
+                }
+                else
+                {
+                    /* The agent's queue stayed full for the block time. */
+                    draining = false;
+                }
+            }
+            else
+            {
+                elapsedMs = PosixClock_GetTimeMs() - startTimeMs;
+
+                if( ( sentCount > 0U ) || ( elapsedMs >= blockTimeMs ) )
+                {
+                    draining = false;
+                }
+                else
+                {
+                    if( delayMs > ( blockTimeMs - elapsedMs ) )
+                    {
+                        delayMs = blockTimeMs - elapsedMs;
+                    }
+
+                    PosixClock_GetDeadline( &deadline, delayMs );
+                    ( void ) pthread_cond_timedwait( &( pSpool->changed ), &( pSpool->mutex ), &deadline );
+                }
+            }
+        }
+
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+    }
+
+    return sentCount;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t PosixSpool_GetPendingCount( PosixSpool_t * pSpool )
+{
+    size_t pendingCount = 0U;
+
+    if( pSpool == NULL )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p.", ( void * ) pSpool ) );
+    }
+    else
+    {
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+        pendingCount = pSpool->pendingCount;
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+    }
+
+    return pendingCount;
+}
+
+/*-----------------------------------------------------------*/
+
+bool PosixSpool_Sync( PosixSpool_t * pSpool )
+{
+    bool synced = false;
+    size_t i;
+
+    if( pSpool == NULL )
+    {
+        LogError( ( "Invalid parameter: pSpool=%p.", ( void * ) pSpool ) );
+    }
+    else
+    {
+        ( void ) pthread_mutex_lock( &( pSpool->mutex ) );
+        synced = true;
+
+        for( i = 0U; ( i < pSpool->segmentCount ) && synced; i++ )
+        {
+            if( msync( getSegment( pSpool, i )->pHeader, MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE, MS_SYNC ) != 0 )
+            {
+                LogError( ( "Failed to write spool segment %08lx: %s.",
+                            ( unsigned long ) getSegment( pSpool, i )->sequence,
+                            strerror( errno ) ) );
+                synced = false;
+            }
+        }
+
+        ( void ) pthread_mutex_unlock( &( pSpool->mutex ) );
+    }
+
+    return synced;
+}
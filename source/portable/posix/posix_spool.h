@@ -0,0 +1,317 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_spool.h
+ * @brief Store-and-forward spool of the POSIX port, which keeps QoS 1 and
+ * QoS 2 publishes on disk while the agent is offline and sends them once it is
+ * back online.
+ *
+ * The spool is a directory of segment files of
+ * #MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE bytes, each mapped into memory.
+ * Publishes are appended to the newest segment, and a new segment is started
+ * when it is full, so the files are only ever written sequentially. A drain
+ * task sends the spooled publishes in order at a set rate, and marks each one
+ * acknowledged in place when its publish completes. The spool is compacted by
+ * deleting the oldest segment once all its publishes are acknowledged, and by
+ * starting the only segment over once it is empty, so publishes are never
+ * copied.
+ *
+ * The segments are written through the page cache, so they survive a crash of
+ * the process, and the publishes not yet acknowledged are sent when the spool
+ * is opened again. A publish that was sent but not acknowledged before the
+ * crash is sent again, as a new publish.
+ */
+#ifndef POSIX_SPOOL_H
+#define POSIX_SPOOL_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* POSIX includes. */
+#include <pthread.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Size of each segment file of a spool, which bounds the combined
+ * length of the topic and payload of a spooled publish.
+ *
+ * <b>Possible values:</b> Any multiple of 8 of at least 64. <br>
+ * <b>Default value:</b> `1048576`
+ */
+#ifndef MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE
+    #define MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE    ( 1048576U )
+#endif
+
+/**
+ * @brief Maximum number of segment files of a spool, which bounds the size of
+ * the spool on disk.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `64`
+ */
+#ifndef MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS
+    #define MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS    ( 64U )
+#endif
+
+/**
+ * @brief Maximum number of spooled publishes sent and not yet completed.
+ *
+ * This should not exceed #MQTT_AGENT_MAX_OUTSTANDING_ACKS, less the
+ * publishes and subscriptions of the application awaiting acknowledgment at
+ * the same time.
+ *
+ * <b>Possible values:</b> Any positive integer. <br>
+ * <b>Default value:</b> `8`
+ */
+#ifndef MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT
+    #define MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT    ( 8U )
+#endif
+
+/**
+ * @brief Layout of the start of a segment file, defined in posix_spool.c.
+ */
+typedef struct PosixSpoolSegmentHeader PosixSpoolSegmentHeader_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A mapped segment file of a spool.
+ */
+typedef struct PosixSpoolSegment
+{
+    PosixSpoolSegmentHeader_t * pHeader; /**< @brief Mapped segment file. */
+    uint32_t sequence;                   /**< @brief Sequence number of the segment, in the name of its file. */
+    size_t pendingCount;                 /**< @brief Number of publishes of the segment not yet acknowledged. */
+} PosixSpoolSegment_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A spooled publish sent by the drain task.
+ */
+typedef struct PosixSpoolEntry
+{
+    MQTTAgentCommand_t command;     /**< @brief Storage of the publish command. */
+    MQTTPublishInfo_t publishInfo;  /**< @brief The publish, pointing into its segment. */
+    struct PosixSpool * pSpool;     /**< @brief Spool of the publish. */
+    PosixSpoolSegment_t * pSegment; /**< @brief Segment of the publish. */
+    uint32_t recordOffset;          /**< @brief Offset of the publish in its segment. */
+    bool inFlight;                  /**< @brief Whether the entry holds a publish that has not completed. */
+} PosixSpoolEntry_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief A store-and-forward spool.
+ *
+ * @note The members of this struct are managed by the spool functions, and
+ * should not be written by the application.
+ */
+typedef struct PosixSpool
+{
+    pthread_mutex_t mutex;                                               /**< @brief Protects the spool. */
+    pthread_cond_t changed;                                              /**< @brief Signaled when the drain task may have publishes to send. */
+    MQTTAgentContext_t * pAgentContext;                                  /**< @brief Agent sending the spooled publishes. */
+    const char * pDirectory;                                             /**< @brief Directory of the segment files. */
+    PosixSpoolSegment_t segments[ MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS ]; /**< @brief Ring of segments, oldest first. */
+    size_t firstSegment;                                                 /**< @brief Index in `segments` of the oldest segment. */
+    size_t segmentCount;                                                 /**< @brief Number of segments. */
+    uint32_t nextSequence;                                               /**< @brief Sequence number of the next segment created. */
+    size_t readSegment;                                                  /**< @brief Position from the oldest segment of the segment of the next publish to send. */
+    uint32_t readOffset;                                                 /**< @brief Offset in that segment of the next publish to send. */
+    size_t pendingCount;                                                 /**< @brief Number of spooled publishes not yet acknowledged. */
+    PosixSpoolEntry_t entries[ MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ];   /**< @brief Spooled publishes sent. */
+    size_t inFlightCount;                                                /**< @brief Number of entries in flight. */
+    bool online;                                                         /**< @brief Set with PosixSpool_SetOnline(). */
+    bool rewind;                                                         /**< @brief Set when a spooled publish failed, so sending restarts from the oldest one. */
+    uint32_t drainRate;                                                  /**< @brief Publishes sent per second, or 0 for no limit. */
+    uint32_t drainTokens;                                                /**< @brief Publishes that may be sent now, in thousandths. */
+    uint32_t lastRefillTimeMs;                                           /**< @brief Time `drainTokens` was last refilled. */
+} PosixSpool_t;
+
+/**
+ * @brief Open a spool, mapping the segment files left in its directory.
+ *
+ * The spool starts offline, with no limit on the drain rate.
+ *
+ * @param[out] pSpool Spool to open.
+ * @param[in] pDirectory Directory of the segment files, which must exist. It
+ * MUST remain in scope until PosixSpool_Close() is called.
+ * @param[in] pMqttAgentContext The MQTT agent sending the spooled publishes.
+ *
+ * @return `true` if the spool was opened, else `false`, including if the
+ * directory holds segment files of a different
+ * #MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE, or more than
+ * #MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS of them.
+ */
+bool PosixSpool_Open( PosixSpool_t * pSpool,
+                      const char * pDirectory,
+                      MQTTAgentContext_t * pMqttAgentContext );
+
+/**
+ * @brief Unmap the segment files of a spool, which are kept to send their
+ * publishes the next time the spool is opened.
+ *
+ * This must only be called once the drain task has stopped and every spooled
+ * publish it sent has completed, for example after the agent has stopped and
+ * its pending commands have been cancelled.
+ *
+ * @param[in] pSpool Spool to close.
+ */
+void PosixSpool_Close( PosixSpool_t * pSpool );
+
+/**
+ * @brief Set whether the agent is connected, so that spooled publishes may be
+ * sent.
+ *
+ * Set the spool online once MQTTAgent_ResumeSession() has returned after a
+ * connection, and offline as soon as the connection is lost.
+ *
+ * @param[in] pSpool Spool of the agent.
+ * @param[in] online Whether the agent is connected.
+ */
+void PosixSpool_SetOnline( PosixSpool_t * pSpool,
+                           bool online );
+
+/**
+ * @brief Limit the rate at which spooled publishes are sent, so that a spool
+ * filled during a long disconnection does not flood the connection or the
+ * broker once it is back.
+ *
+ * Up to #MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT publishes may be sent at once
+ * after an idle period.
+ *
+ * @param[in] pSpool Spool to limit.
+ * @param[in] publishesPerSecond Publishes sent per second, or 0 for no limit.
+ */
+void PosixSpool_SetDrainRate( PosixSpool_t * pSpool,
+                              uint32_t publishesPerSecond );
+
+/**
+ * @brief Publish through a spool.
+ *
+ * A QoS 1 or QoS 2 publish is appended to the spool if the spool is offline,
+ * or if publishes spooled earlier have not all been acknowledged, so that
+ * publishes are sent in order. Otherwise, and for a QoS 0 publish, this is the
+ * same as MQTTAgent_Publish(). This may be called from any application task.
+ *
+ * @param[in] pSpool Spool of the agent.
+ * @param[in] pPublishInfo The publish. If it is spooled, its topic and payload
+ * are copied, so it may be reused as soon as this returns.
+ * @param[in] pCommandInfo Completion callback and block time of the publish,
+ * used if it is not spooled. A QoS 1 or QoS 2 publish may be spooled, and a
+ * spooled publish completes without a callback, so its completion callback
+ * MUST be NULL; spooled publishes can be followed with
+ * PosixSpool_GetPendingCount() instead.
+ *
+ * @return #MQTTBadParameter if an invalid parameter is given, including a
+ * completion callback for a QoS 1 or QoS 2 publish, or the publish does not
+ * fit in a segment; #MQTTNoMemory if the spool is full; #MQTTSuccess if the
+ * publish was spooled; else the return code of MQTTAgent_Publish().
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * static PosixSpool_t spool;
+ * MQTTAgentContext_t mqttAgentContext;
+ * MQTTAgentCommandInfo_t commandInfo = { 0 };
+ * MQTTPublishInfo_t publishInfo = { 0 };
+ * MQTTStatus_t status;
+ *
+ * // In the application task, publish whether or not the agent is connected.
+ * publishInfo.pTopicName = "sensors/temperature";
+ * publishInfo.topicNameLength = strlen( "sensors/temperature" );
+ * publishInfo.pPayload = "21.5";
+ * publishInfo.payloadLength = strlen( "21.5" );
+ * publishInfo.qos = MQTTQoS1;
+ *
+ * status = PosixSpool_Publish( &spool, &publishInfo, &commandInfo );
+ *
+ * // In the drain task, send spooled publishes at up to 500 per second.
+ * PosixSpool_SetDrainRate( &spool, 500U );
+ *
+ * for( ; ; )
+ * {
+ *     ( void ) PosixSpool_Drain( &spool, 1000U );
+ * }
+ * @endcode
+ */
+MQTTStatus_t PosixSpool_Publish( PosixSpool_t * pSpool,
+                                 MQTTPublishInfo_t * pPublishInfo,
+                                 const MQTTAgentCommandInfo_t * pCommandInfo );
+
+/**
+ * @brief Send spooled publishes while the spool is online, within the drain
+ * rate and #MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT, waiting for one to be ready
+ * if none is.
+ *
+ * This should be called in a loop by a single task other than the agent task.
+ * It also deletes the segment files whose publishes have all been
+ * acknowledged. When a spooled publish fails, sending restarts from the oldest
+ * publish not acknowledged once the publishes in flight have completed.
+ *
+ * @param[in] pSpool Spool to drain.
+ * @param[in] blockTimeMs Maximum time to wait for a publish to be ready, and
+ * to enqueue each publish command.
+ *
+ * @return The number of spooled publishes sent.
+ */
+size_t PosixSpool_Drain( PosixSpool_t * pSpool,
+                         uint32_t blockTimeMs );
+
+/**
+ * @brief Get the number of spooled publishes not yet acknowledged.
+ *
+ * @param[in] pSpool Spool to query.
+ *
+ * @return The number of publishes.
+ */
+size_t PosixSpool_GetPendingCount( PosixSpool_t * pSpool );
+
+/**
+ * @brief Write the segment files of a spool to storage.
+ *
+ * This may be called from any task, for example periodically, to bound what is
+ * lost if the system crashes.
+ *
+ * @param[in] pSpool Spool to write.
+ *
+ * @return `true` if the files were written, else `false`.
+ */
+bool PosixSpool_Sync( PosixSpool_t * pSpool );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_SPOOL_H */
@@ -0,0 +1,615 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_transport.c
+ * @brief Implements the non-blocking TCP transport of the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/* Header include. */
+#include "posix_transport.h"
+
+/* MQTT Agent default logging configuration include. */
+#include "core_mqtt_agent_default_logging.h"
+
+/**
+ * @brief Length of the decimal string of a TCP port, with its terminator.
+ */
+#define PORT_STRING_LENGTH    ( 6U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait for events on a socket.
+ *
+ * @param[in] socketFd Socket to wait on.
+ * @param[in] events Events to wait for, as for poll().
+ * @param[in] timeoutMs Maximum time to wait.
+ *
+ * @return `true` if one of the events occurred, else `false`.
+ */
+static bool waitForSocket( int socketFd,
+                           short events,
+                           uint32_t timeoutMs );
+
+/**
+ * @brief Connect a non-blocking socket to one address.
+ *
+ * @param[in] pAddress Address to connect to.
+ * @param[in] timeoutMs Maximum time to wait for the connection.
+ *
+ * @return The connected socket, or -1 on failure.
+ */
+static int connectToAddress( const struct addrinfo * pAddress,
+                             uint32_t timeoutMs );
+
+/**
+ * @brief Send a message on the socket of a connection, waiting for the socket
+ * to become writable for at most its send timeout.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] pMessage Message with the vectors to send.
+ *
+ * @return Same as PosixTransport_Send().
+ */
+static int32_t sendMessage( const NetworkContext_t * pNetworkContext,
+                            const struct msghdr * pMessage );
+
+/**
+ * @brief Hold back vectors of data, or send them after the data already held
+ * back with one system call.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] pIoVectors Vectors to send, from index 1. Index 0 is used for the
+ * data held back.
+ * @param[in] vectorCount Number of vectors to send, not counting index 0.
+ * @param[in] totalLength Total length of the vectors to send.
+ *
+ * @return The number of bytes of the vectors sent or held back, 0 if none
+ * were, or a negative value if the connection failed.
+ */
+static int32_t sendOrHold( NetworkContext_t * pNetworkContext,
+                           struct iovec * pIoVectors,
+                           size_t vectorCount,
+                           size_t totalLength );
+
+/**
+ * @brief Remove the bytes that were sent from the data held back.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] bytesSent Number of bytes sent, starting with the data held back.
+ *
+ * @return The number of bytes sent beyond the data held back.
+ */
+static size_t removeHeldBytes( NetworkContext_t * pNetworkContext,
+                               size_t bytesSent );
+
+/*-----------------------------------------------------------*/
+
+static bool waitForSocket( int socketFd,
+                           short events,
+                           uint32_t timeoutMs )
+{
+    struct pollfd pollFd;
+    int pollResult;
+
+    pollFd.fd = socketFd;
+    pollFd.events = events;
+    pollFd.revents = 0;
+
+    do
+    {
+        pollResult = poll( &pollFd, 1, ( int ) timeoutMs );
+    } while( ( pollResult < 0 ) && ( errno == EINTR ) );
+
+    /* Errors and hang-ups are reported as ready, so that the following call
+     * on the socket returns the error. */
+    return ( pollResult > 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static int connectToAddress( const struct addrinfo * pAddress,
+                             uint32_t timeoutMs )
+{
+    int socketFd;
+    int socketError = 0;
+    socklen_t optionLength = ( socklen_t ) sizeof( socketError );
+    int connectResult;
+
+    socketFd = socket( pAddress->ai_family,
+                       pAddress->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       pAddress->ai_protocol );
+
+    if( socketFd >= 0 )
+    {
+        connectResult = connect( socketFd, pAddress->ai_addr, pAddress->ai_addrlen );
+
+        if( ( connectResult != 0 ) && ( errno == EINPROGRESS ) )
+        {
+            if( waitForSocket( socketFd, POLLOUT, timeoutMs ) &&
+                ( getsockopt( socketFd, SOL_SOCKET, SO_ERROR, &socketError, &optionLength ) == 0 ) &&
+                ( socketError == 0 ) )
+            {
+                connectResult = 0;
+            }
+            else
+            {
+                errno = ( socketError != 0 ) ? socketError : ETIMEDOUT;
+            }
+        }
+
+        if( connectResult != 0 )
+        {
+            LogDebug( ( "Connection attempt failed: %s.", strerror( errno ) ) );
+            ( void ) close( socketFd );
+            socketFd = -1;
+        }
+    }
+
+    return socketFd;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t sendMessage( const NetworkContext_t * pNetworkContext,
+                            const struct msghdr * pMessage )
+{
+    ssize_t bytesSent;
+    int32_t result = -1;
+
+    bytesSent = sendmsg( pNetworkContext->socketFd, pMessage, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+    if( ( bytesSent < 0 ) &&
+        ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) ) &&
+        waitForSocket( pNetworkContext->socketFd, POLLOUT, pNetworkContext->sendTimeoutMs ) )
+    {
+        bytesSent = sendmsg( pNetworkContext->socketFd, pMessage, MSG_NOSIGNAL | MSG_DONTWAIT );
+    }
+
+    if( bytesSent >= 0 )
+    {
+        result = ( int32_t ) bytesSent;
+    }
+    else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+    {
+        /* coreMQTT calls again until its send timeout. */
+        result = 0;
+    }
+    else
+    {
+        LogError( ( "Failed to send on socket %d: %s.",
+                    pNetworkContext->socketFd,
+                    strerror( errno ) ) );
+    }
+
+    return result;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t sendOrHold( NetworkContext_t * pNetworkContext,
+                           struct iovec * pIoVectors,
+                           size_t vectorCount,
+                           size_t totalLength )
+{
+    struct msghdr message;
+    int32_t result;
+    size_t i;
+
+    if( pNetworkContext->holdSends &&
+        ( pNetworkContext->pSendBuffer != NULL ) &&
+        ( ( pNetworkContext->sendBufferSize - pNetworkContext->heldLength ) >= totalLength ) )
+    {
+        for( i = 1U; i <= vectorCount; i++ )
+        {
+            ( void ) memcpy( &( pNetworkContext->pSendBuffer[ pNetworkContext->heldLength ] ),
+                             pIoVectors[ i ].iov_base,
+                             pIoVectors[ i ].iov_len );
+            pNetworkContext->heldLength += pIoVectors[ i ].iov_len;
+        }
+
+        pNetworkContext->recvSkipped = false;
+        result = ( int32_t ) totalLength;
+    }
+    else
+    {
+        ( void ) memset( &message, 0x00, sizeof( message ) );
+
+        if( pNetworkContext->heldLength > 0U )
+        {
+            pIoVectors[ 0 ].iov_base = pNetworkContext->pSendBuffer;
+            pIoVectors[ 0 ].iov_len = pNetworkContext->heldLength;
+            message.msg_iov = pIoVectors;
+            message.msg_iovlen = vectorCount + 1U;
+        }
+        else
+        {
+            message.msg_iov = &( pIoVectors[ 1 ] );
+            message.msg_iovlen = vectorCount;
+        }
+
+        result = sendMessage( pNetworkContext, &message );
+
+        if( result > 0 )
+        {
+            result = ( int32_t ) removeHeldBytes( pNetworkContext, ( size_t ) result );
+        }
+    }
+
+    return result;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t removeHeldBytes( NetworkContext_t * pNetworkContext,
+                               size_t bytesSent )
+{
+    size_t bytesBeyond = 0U;
+
+    if( bytesSent >= pNetworkContext->heldLength )
+    {
+        bytesBeyond = bytesSent - pNetworkContext->heldLength;
+        pNetworkContext->heldLength = 0U;
+    }
+    else
+    {
+        pNetworkContext->heldLength -= bytesSent;
+        ( void ) memmove( pNetworkContext->pSendBuffer,
+                          &( pNetworkContext->pSendBuffer[ bytesSent ] ),
+                          pNetworkContext->heldLength );
+    }
+
+    return bytesBeyond;
+}
+
+/*-----------------------------------------------------------*/
+
+PosixTransportStatus_t PosixTransport_Connect( NetworkContext_t * pNetworkContext,
+                                               const char * pHostName,
+                                               uint16_t port,
+                                               uint32_t timeoutMs )
+{
+    PosixTransportStatus_t status = POSIX_TRANSPORT_SUCCESS;
+    struct addrinfo hints;
+    struct addrinfo * pAddresses = NULL;
+    const struct addrinfo * pAddress;
+    char portString[ PORT_STRING_LENGTH ];
+    int socketFd = -1;
+    int noDelay = 1;
+    int resolveResult;
+
+    if( ( pNetworkContext == NULL ) || ( pHostName == NULL ) )
+    {
+        LogError( ( "Invalid parameter: pNetworkContext=%p, pHostName=%p.",
+                    ( void * ) pNetworkContext,
+                    ( const void * ) pHostName ) );
+        status = POSIX_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        ( void ) memset( pNetworkContext, 0x00, sizeof( NetworkContext_t ) );
+        pNetworkContext->socketFd = -1;
+
+        ( void ) memset( &hints, 0x00, sizeof( hints ) );
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+        ( void ) snprintf( portString, sizeof( portString ), "%u", ( unsigned int ) port );
+
+        resolveResult = getaddrinfo( pHostName, portString, &hints, &pAddresses );
+
+        if( resolveResult != 0 )
+        {
+            LogError( ( "Failed to resolve %s: %s.", pHostName, gai_strerror( resolveResult ) ) );
+            status = POSIX_TRANSPORT_DNS_FAILURE;
+        }
+    }
+
+    if( status == POSIX_TRANSPORT_SUCCESS )
+    {
+        for( pAddress = pAddresses; ( pAddress != NULL ) && ( socketFd < 0 ); pAddress = pAddress->ai_next )
+        {
+            socketFd = connectToAddress( pAddress, timeoutMs );
+        }
+
+        freeaddrinfo( pAddresses );
+
+        if( socketFd < 0 )
+        {
+            LogError( ( "Failed to connect to %s:%u.", pHostName, ( unsigned int ) port ) );
+            status = POSIX_TRANSPORT_CONNECT_FAILURE;
+        }
+    }
+
+    if( status == POSIX_TRANSPORT_SUCCESS )
+    {
+        /* Packets are written whole, so there is nothing to gain from
+         * delaying them. */
+        if( setsockopt( socketFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, ( socklen_t ) sizeof( noDelay ) ) != 0 )
+        {
+            LogWarn( ( "Failed to set TCP_NODELAY: %s.", strerror( errno ) ) );
+        }
+
+        pNetworkContext->socketFd = socketFd;
+        pNetworkContext->sendTimeoutMs = POSIX_TRANSPORT_DEFAULT_SEND_TIMEOUT_MS;
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+PosixTransportStatus_t PosixTransport_SetSendBuffer( NetworkContext_t * pNetworkContext,
+                                                     uint8_t * pSendBuffer,
+                                                     size_t sendBufferSize )
+{
+    PosixTransportStatus_t status;
+
+    if( ( pNetworkContext == NULL ) ||
+        ( ( pSendBuffer != NULL ) && ( ( sendBufferSize == 0U ) || ( sendBufferSize > ( size_t ) INT32_MAX ) ) ) )
+    {
+        LogError( ( "Invalid parameter: pNetworkContext=%p, pSendBuffer=%p, sendBufferSize=%lu.",
+                    ( void * ) pNetworkContext,
+                    ( void * ) pSendBuffer,
+                    ( unsigned long ) sendBufferSize ) );
+        status = POSIX_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        status = PosixTransport_Flush( pNetworkContext );
+    }
+
+    if( status == POSIX_TRANSPORT_SUCCESS )
+    {
+        pNetworkContext->pSendBuffer = pSendBuffer;
+        pNetworkContext->sendBufferSize = ( pSendBuffer != NULL ) ? sendBufferSize : 0U;
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+PosixTransportStatus_t PosixTransport_Flush( NetworkContext_t * pNetworkContext )
+{
+    PosixTransportStatus_t status = POSIX_TRANSPORT_SUCCESS;
+    struct iovec ioVector;
+    struct msghdr message;
+    int32_t bytesSent;
+
+    if( pNetworkContext == NULL )
+    {
+        LogError( ( "pNetworkContext cannot be NULL." ) );
+        status = POSIX_TRANSPORT_INVALID_PARAMETER;
+    }
+
+    while( ( status == POSIX_TRANSPORT_SUCCESS ) && ( pNetworkContext->heldLength > 0U ) )
+    {
+        ioVector.iov_base = pNetworkContext->pSendBuffer;
+        ioVector.iov_len = pNetworkContext->heldLength;
+
+        ( void ) memset( &message, 0x00, sizeof( message ) );
+        message.msg_iov = &ioVector;
+        message.msg_iovlen = 1U;
+
+        bytesSent = sendMessage( pNetworkContext, &message );
+
+        if( bytesSent > 0 )
+        {
+            ( void ) removeHeldBytes( pNetworkContext, ( size_t ) bytesSent );
+        }
+        else
+        {
+            LogError( ( "Failed to send %lu bytes held back on socket %d.",
+                        ( unsigned long ) pNetworkContext->heldLength,
+                        pNetworkContext->socketFd ) );
+            status = POSIX_TRANSPORT_SEND_FAILURE;
+        }
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+PosixTransportStatus_t PosixTransport_Disconnect( NetworkContext_t * pNetworkContext )
+{
+    PosixTransportStatus_t status = POSIX_TRANSPORT_SUCCESS;
+
+    if( pNetworkContext == NULL )
+    {
+        LogError( ( "pNetworkContext cannot be NULL." ) );
+        status = POSIX_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( pNetworkContext->socketFd >= 0 )
+    {
+        /* The packets held back, such as a DISCONNECT, are sent before the
+         * connection is closed. */
+        ( void ) PosixTransport_Flush( pNetworkContext );
+        pNetworkContext->heldLength = 0U;
+        pNetworkContext->holdSends = false;
+
+        ( void ) shutdown( pNetworkContext->socketFd, SHUT_RDWR );
+        ( void ) close( pNetworkContext->socketFd );
+        pNetworkContext->socketFd = -1;
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    return status;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t PosixTransport_Recv( NetworkContext_t * pNetworkContext,
+                             void * pBuffer,
+                             size_t bytesToRecv )
+{
+    ssize_t bytesReceived;
+    int32_t result = -1;
+    size_t recvLength = bytesToRecv;
+
+    assert( pNetworkContext != NULL );
+    assert( pBuffer != NULL );
+
+    if( recvLength > ( size_t ) INT32_MAX )
+    {
+        recvLength = ( size_t ) INT32_MAX;
+    }
+
+    if( pNetworkContext->holdSends &&
+        ( pNetworkContext->heldLength > 0U ) &&
+        !pNetworkContext->recvSkipped )
+    {
+        /* This is the receive made by the process loop after a held send.
+         * Any response is received after the last queued command is
+         * processed, without a system call for each command. A further
+         * receive, such as coreMQTT waiting for a CONNACK, is not skipped. */
+        pNetworkContext->recvSkipped = true;
+        result = 0;
+    }
+    else
+    {
+        if( pNetworkContext->heldLength > 0U )
+        {
+            /* A response may only come once the data held back is sent. A
+             * failure is reported by the following send or receive. */
+            ( void ) PosixTransport_Flush( pNetworkContext );
+        }
+
+        bytesReceived = recv( pNetworkContext->socketFd, pBuffer, recvLength, MSG_DONTWAIT );
+
+        if( bytesReceived > 0 )
+        {
+            result = ( int32_t ) bytesReceived;
+        }
+        else if( bytesReceived == 0 )
+        {
+            /* coreMQTT takes 0 to mean that no data is available. */
+            LogInfo( ( "Connection on socket %d closed by peer.", pNetworkContext->socketFd ) );
+        }
+        else if( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+        {
+            result = 0;
+        }
+        else
+        {
+            LogError( ( "Failed to receive on socket %d: %s.",
+                        pNetworkContext->socketFd,
+                        strerror( errno ) ) );
+        }
+    }
+
+    return result;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t PosixTransport_Send( NetworkContext_t * pNetworkContext,
+                             const void * pBuffer,
+                             size_t bytesToSend )
+{
+    struct iovec ioVectors[ 2 ];
+    size_t maxLength;
+
+    assert( pNetworkContext != NULL );
+    assert( pBuffer != NULL );
+
+    /* The number of bytes sent after the data held back must fit in the
+     * return value of sendmsg(). */
+    maxLength = ( size_t ) INT32_MAX - pNetworkContext->heldLength;
+
+    ioVectors[ 1 ].iov_base = ( void * ) pBuffer;
+    ioVectors[ 1 ].iov_len = ( bytesToSend > maxLength ) ? maxLength : bytesToSend;
+
+    return sendOrHold( pNetworkContext, ioVectors, 1U, ioVectors[ 1 ].iov_len );
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t PosixTransport_Writev( NetworkContext_t * pNetworkContext,
+                               TransportOutVector_t * pIoVec,
+                               size_t ioVecCount )
+{
+    /* Index 0 is used for the data held back. */
+    struct iovec ioVectors[ POSIX_TRANSPORT_MAX_IO_VECTORS + 1U ];
+    size_t vectorCount = ioVecCount;
+    size_t totalLength = 0U;
+    size_t maxLength;
+    size_t i;
+
+    assert( pNetworkContext != NULL );
+    assert( pIoVec != NULL );
+
+    if( vectorCount > POSIX_TRANSPORT_MAX_IO_VECTORS )
+    {
+        vectorCount = POSIX_TRANSPORT_MAX_IO_VECTORS;
+    }
+
+    /* The number of bytes sent after the data held back must fit in the
+     * return value of sendmsg(). */
+    maxLength = ( size_t ) INT32_MAX - pNetworkContext->heldLength;
+
+    for( i = 0U; i < vectorCount; i++ )
+    {
+        ioVectors[ i + 1U ].iov_base = ( void * ) pIoVec[ i ].iov_base;
+        ioVectors[ i + 1U ].iov_len = pIoVec[ i ].iov_len;
+        totalLength += pIoVec[ i ].iov_len;
+
+        if( totalLength > maxLength )
+        {
+            ioVectors[ i + 1U ].iov_len -= totalLength - maxLength;
+            totalLength = maxLength;
+            vectorCount = i + 1U;
+        }
+    }
+
+    return sendOrHold( pNetworkContext, ioVectors, vectorCount, totalLength );
+}
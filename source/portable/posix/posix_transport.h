@@ -0,0 +1,244 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_transport.h
+ * @brief Non-blocking TCP transport of the POSIX port.
+ *
+ * The receive function does not block, so that MQTT_ProcessLoop() returns as
+ * soon as the data received so far has been processed. The send functions
+ * wait for the socket to become writable for at most the send timeout of the
+ * connection, and vectored sends are written with one system call.
+ *
+ * A send buffer can be given to a connection so that, while the agent has
+ * further commands queued, the packets of the commands are held back and
+ * written together with one system call once the last queued command is
+ * processed. The receive that coreMQTT makes after each of these commands is
+ * skipped, as its data is received after the last one. See
+ * PosixTransport_SetSendBuffer().
+ */
+#ifndef POSIX_TRANSPORT_H
+#define POSIX_TRANSPORT_H
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Transport interface include. */
+#include "transport_interface.h"
+
+/**
+ * @brief Default time in milliseconds that a send waits for the socket to
+ * become writable.
+ */
+#define POSIX_TRANSPORT_DEFAULT_SEND_TIMEOUT_MS    ( 1000U )
+
+/**
+ * @brief Largest number of vectors written by one call to
+ * PosixTransport_Writev(). Any further vectors are written by the following
+ * calls made by coreMQTT.
+ */
+#define POSIX_TRANSPORT_MAX_IO_VECTORS             ( 16U )
+
+/**
+ * @ingroup mqtt_agent_enum_types
+ * @brief Return codes of the POSIX transport connection functions.
+ */
+typedef enum PosixTransportStatus
+{
+    POSIX_TRANSPORT_SUCCESS = 0,       /**< @brief The function was successful. */
+    POSIX_TRANSPORT_INVALID_PARAMETER, /**< @brief A parameter was invalid. */
+    POSIX_TRANSPORT_DNS_FAILURE,       /**< @brief The host name could not be resolved. */
+    POSIX_TRANSPORT_CONNECT_FAILURE,   /**< @brief No address of the host could be connected to. */
+    POSIX_TRANSPORT_SEND_FAILURE       /**< @brief Data held back could not be sent. */
+} PosixTransportStatus_t;
+
+/**
+ * @ingroup mqtt_agent_struct_types
+ * @brief Network context of a connection made by PosixTransport_Connect().
+ *
+ * @note The socket may be watched by an event loop for readability, for
+ * example to call MQTTAgent_Step(), but must only be read and written through
+ * the transport functions.
+ */
+struct NetworkContext
+{
+    int socketFd;           /**< @brief Non-blocking socket of the connection, or -1 when not connected. */
+    uint32_t sendTimeoutMs; /**< @brief Maximum time a send waits for the socket to become writable. */
+    uint8_t * pSendBuffer;  /**< @brief Buffer of the data held back, or NULL to send all data at once. */
+    size_t sendBufferSize;  /**< @brief Size of `pSendBuffer`. */
+    size_t heldLength;      /**< @brief Number of bytes held back in `pSendBuffer`. */
+    bool holdSends;         /**< @brief Set by the message interface of the port while further commands are queued. */
+    bool recvSkipped;       /**< @brief Whether a receive was skipped since data was last held back. */
+};
+
+/**
+ * @brief Connect a non-blocking TCP socket to a host.
+ *
+ * Each address of the host is tried in turn. `TCP_NODELAY` is set on the
+ * socket, since coreMQTT writes each packet in one call, and the send timeout
+ * is set to #POSIX_TRANSPORT_DEFAULT_SEND_TIMEOUT_MS. The connection has no
+ * send buffer.
+ *
+ * @param[out] pNetworkContext Network context to connect.
+ * @param[in] pHostName Host name or address of the broker.
+ * @param[in] port TCP port of the broker.
+ * @param[in] timeoutMs Maximum time to wait for the connection to each
+ * address.
+ *
+ * @return #POSIX_TRANSPORT_SUCCESS if the socket is connected, else an error
+ * code.
+ */
+PosixTransportStatus_t PosixTransport_Connect( NetworkContext_t * pNetworkContext,
+                                               const char * pHostName,
+                                               uint16_t port,
+                                               uint32_t timeoutMs );
+
+/**
+ * @brief Set the buffer holding back the packets of the commands processed
+ * while further commands are queued.
+ *
+ * Data is held back only while the message interface of the port is used by
+ * the agent, with the connection given to PosixAgentMessage_WatchConnection().
+ * It is sent before the agent waits for a command, before data is received
+ * other than by the first receive after a held send, and when the buffer is
+ * full. A buffer the size of the network buffer of the coreMQTT context lets
+ * several small packets be sent together.
+ *
+ * This must be called after PosixTransport_Connect(), from the agent task or
+ * before it is started. Any data held back in the previous buffer is sent
+ * first.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] pSendBuffer Buffer to hold data back in, or NULL to send all
+ * data at once. It MUST remain in scope until the connection is closed or
+ * another buffer is set.
+ * @param[in] sendBufferSize Size of @p pSendBuffer.
+ *
+ * @return #POSIX_TRANSPORT_INVALID_PARAMETER if an invalid parameter is
+ * given; #POSIX_TRANSPORT_SEND_FAILURE if the data held back in the previous
+ * buffer could not be sent, in which case the buffer is not changed; else
+ * #POSIX_TRANSPORT_SUCCESS.
+ *
+ * <b>Example</b>
+ * @code{c}
+ *
+ * // Variables used in this example.
+ * NetworkContext_t networkContext;
+ * static uint8_t sendBuffer[ 4096U ];
+ *
+ * if( PosixTransport_Connect( &networkContext, "broker.example.com", 1883U, 5000U ) == POSIX_TRANSPORT_SUCCESS )
+ * {
+ *     ( void ) PosixTransport_SetSendBuffer( &networkContext, sendBuffer, sizeof( sendBuffer ) );
+ * }
+ * @endcode
+ */
+PosixTransportStatus_t PosixTransport_SetSendBuffer( NetworkContext_t * pNetworkContext,
+                                                     uint8_t * pSendBuffer,
+                                                     size_t sendBufferSize );
+
+/**
+ * @brief Send the data held back on a connection.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ *
+ * @return #POSIX_TRANSPORT_INVALID_PARAMETER if an invalid parameter is
+ * given; #POSIX_TRANSPORT_SEND_FAILURE if the data could not be sent within
+ * the send timeout of the connection, in which case the rest is kept held
+ * back; else #POSIX_TRANSPORT_SUCCESS.
+ */
+PosixTransportStatus_t PosixTransport_Flush( NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Close the socket of a connection, after sending any data held back.
+ *
+ * @param[in] pNetworkContext Network context to disconnect.
+ *
+ * @return #POSIX_TRANSPORT_INVALID_PARAMETER if an invalid parameter is
+ * given, else #POSIX_TRANSPORT_SUCCESS.
+ */
+PosixTransportStatus_t PosixTransport_Disconnect( NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Receive the data available on the socket, without waiting.
+ *
+ * This is the #TransportRecv_t of the transport interface.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[out] pBuffer Buffer to receive into.
+ * @param[in] bytesToRecv Size of @p pBuffer.
+ *
+ * @return The number of bytes received, 0 if no data is available or the
+ * receive was skipped after a held send, or a negative value if the connection
+ * was closed or failed.
+ */
+int32_t PosixTransport_Recv( NetworkContext_t * pNetworkContext,
+                             void * pBuffer,
+                             size_t bytesToRecv );
+
+/**
+ * @brief Send data on the socket.
+ *
+ * This is the #TransportSend_t of the transport interface.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] pBuffer Data to send.
+ * @param[in] bytesToSend Length of @p pBuffer.
+ *
+ * @return The number of bytes sent or held back, 0 if the socket did not
+ * become writable within the send timeout, or a negative value if the
+ * connection failed.
+ */
+int32_t PosixTransport_Send( NetworkContext_t * pNetworkContext,
+                             const void * pBuffer,
+                             size_t bytesToSend );
+
+/**
+ * @brief Send the data of several vectors on the socket with one system call.
+ *
+ * This is the #TransportWritev_t of the transport interface.
+ *
+ * @param[in] pNetworkContext Network context of the connection.
+ * @param[in] pIoVec Vectors to send.
+ * @param[in] ioVecCount Number of vectors in @p pIoVec. At most
+ * #POSIX_TRANSPORT_MAX_IO_VECTORS are sent in one call.
+ *
+ * @return Same as PosixTransport_Send().
+ */
+int32_t PosixTransport_Writev( NetworkContext_t * pNetworkContext,
+                               TransportOutVector_t * pIoVec,
+                               size_t ioVecCount );
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif /* POSIX_TRANSPORT_H */
@@ -84,6 +84,7 @@ bool isValidMqttAgentContext( const MQTTAgentContext_t * pContext );
  *  - MQTTAgent_Publish
  *  - MQTTAgent_ProcessLoop
  *  - MQTTAgent_Terminate
+ *  - MQTTAgent_CustomCommand
  *
  * @param[in] mqttStatus MQTT status to check if it is a valid MQTTAgent_Connect
  * status.
@@ -117,4 +118,13 @@ void addPendingAcks( MQTTAgentContext_t * pContext );
  */
 MQTTAgentSubscribeArgs_t * allocateSubscribeArgs( MQTTAgentSubscribeArgs_t * pSubscribeArgs );
 
+/**
+ * @brief Allocate a #MQTTAgentCommandInfo_t object.
+ *
+ * @param[in] pCommandInfo #MQTTAgentCommandInfo_t object information.
+ *
+ * @return NULL or allocated #MQTTAgentCommandInfo_t memory.
+ */
+MQTTAgentCommandInfo_t * allocateCommandInfo( MQTTAgentCommandInfo_t * pCommandInfo );
+
 #endif /* ifndef MQTT_AGENT_CBMC_STATE_H_ */
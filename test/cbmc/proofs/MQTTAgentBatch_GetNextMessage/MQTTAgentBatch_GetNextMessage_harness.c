@@ -0,0 +1,68 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* MQTT agent batch include. */
+#include "core_mqtt_agent_batch.h"
+
+void harness()
+{
+    uint8_t * pEnvelope;
+    size_t envelopeLength;
+    size_t * pOffset;
+    const uint8_t ** ppMessage;
+    size_t * pMessageLength;
+    size_t offset;
+    MQTTStatus_t mqttStatus;
+
+    __CPROVER_assume( envelopeLength <= ENVELOPE_MAX_LENGTH );
+    pEnvelope = malloc( envelopeLength );
+    pOffset = malloc( sizeof( size_t ) );
+    ppMessage = malloc( sizeof( const uint8_t * ) );
+    pMessageLength = malloc( sizeof( size_t ) );
+
+    if( pOffset != NULL )
+    {
+        offset = *pOffset;
+    }
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( pEnvelope,
+                                                envelopeLength,
+                                                pOffset,
+                                                ppMessage,
+                                                pMessageLength );
+
+    __CPROVER_assert( ( mqttStatus == MQTTSuccess ) ||
+                      ( mqttStatus == MQTTBadParameter ) ||
+                      ( mqttStatus == MQTTNoDataAvailable ) ||
+                      ( mqttStatus == MQTTBadResponse ),
+                      "The return value is a MQTTAgentBatch_GetNextMessage status." );
+
+    if( mqttStatus == MQTTSuccess )
+    {
+        /* The message returned lies within the envelope, after the offset. */
+        __CPROVER_assert( *ppMessage >= &( pEnvelope[ offset ] ), "The message is after the offset." );
+        __CPROVER_assert( ( size_t ) ( *ppMessage - pEnvelope ) + *pMessageLength <= envelopeLength,
+                          "The message is within the envelope." );
+        __CPROVER_assert( *pOffset <= envelopeLength, "The offset is within the envelope." );
+    }
+}
@@ -37,7 +37,7 @@ void harness()
     __CPROVER_assume( isValidMqttAgentContext( pMqttAgentContext ) );
 
     pConnectArgs = malloc( sizeof( MQTTAgentConnectArgs_t ) );
-    pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    pCommandInfo = allocateCommandInfo( NULL );
 
     mqttStatus = MQTTAgent_Connect( pMqttAgentContext,
                                     pConnectArgs,
@@ -33,7 +33,7 @@ void harness()
     pMqttAgentContext = allocateMqttAgentContext( NULL );
     __CPROVER_assume( isValidMqttAgentContext( pMqttAgentContext ) );
 
-    pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    pCommandInfo = allocateCommandInfo( NULL );
 
     MQTTAgent_Disconnect( pMqttAgentContext,
                           pCommandInfo );
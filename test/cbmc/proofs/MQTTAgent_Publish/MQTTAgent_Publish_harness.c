@@ -40,11 +40,19 @@ void harness()
      * members of MQTTAgentCommandInfo_t and MQTTPublishInfo_t type will be
      * sufficient for this proof.*/
     pPublishInfo = malloc( sizeof( MQTTPublishInfo_t ) );
-    pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    pCommandInfo = allocateCommandInfo( NULL );
 
     mqttStatus = MQTTAgent_Publish( pMqttAgentContext,
                                     pPublishInfo,
                                     pCommandInfo );
 
     __CPROVER_assert( isAgentSendCommandFunctionStatus( mqttStatus ), "The return value is a MQTTStatus_t." );
+
+    /* The command storage is either NULL or a valid command. */
+    mqttStatus = MQTTAgent_PublishWithStorage( pMqttAgentContext,
+                                               pPublishInfo,
+                                               pCommandInfo,
+                                               malloc( sizeof( MQTTAgentCommand_t ) ) );
+
+    __CPROVER_assert( isAgentSendCommandFunctionStatus( mqttStatus ), "The return value is a MQTTStatus_t." );
 }
@@ -40,7 +40,7 @@ void harness()
      * of MQTTAgentCommandInfo_t and MQTTAgentSubscribeArgs_t type will be sufficient
      * for this proof.*/
     pSubscriptionArgs = malloc( sizeof( MQTTAgentSubscribeArgs_t ) );
-    pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    pCommandInfo = allocateCommandInfo( NULL );
 
     mqttStatus = MQTTAgent_Subscribe( pMqttAgentContext,
                                       pSubscriptionArgs,
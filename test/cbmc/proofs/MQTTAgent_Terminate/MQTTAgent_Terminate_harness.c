@@ -38,7 +38,7 @@ void harness()
     /* MQTTAgentCommandInfo is only added to Queue in MQTTAgent_Terminate and
      * non deterministic values for the members of MQTTAgentCommandInfo_t type
      * will be sufficient for this proof.*/
-    pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    pCommandInfo = allocateCommandInfo( NULL );
 
     mqttStatus = MQTTAgent_Terminate( pMqttAgentContext,
                                       pCommandInfo );
@@ -214,3 +214,13 @@ MQTTAgentSubscribeArgs_t * allocateSubscribeArgs( MQTTAgentSubscribeArgs_t * pSu
 
     return pSubscribeArgs;
 }
+
+MQTTAgentCommandInfo_t * allocateCommandInfo( MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    if( pCommandInfo == NULL )
+    {
+        pCommandInfo = malloc( sizeof( MQTTAgentCommandInfo_t ) );
+    }
+
+    return pCommandInfo;
+}
@@ -0,0 +1,718 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file mqtt_agent_fuzz.c
+ * @brief Fuzz harness feeding untrusted broker bytes through MQTTAgent_CommandLoop().
+ *
+ * A single cursor walks the fuzz input. Each time the agent waits for a
+ * command, one byte selects the next API call to make; each time coreMQTT
+ * reads from the transport, one byte selects how many of the following bytes
+ * the "broker" returns, or that the connection drops. Commands and incoming
+ * packets therefore interleave in an order that is itself driven by the input.
+ * Whenever the command loop fails, one byte selects whether the session is
+ * resumed as present or not before the loop runs again. Once the input is
+ * exhausted the agent is terminated and the harness checks that every command
+ * taken from the pool was released exactly once.
+ *
+ * The fuzz build also compiles the harness with the optional features
+ * enabled (kept subscriptions, conflation and the process loop limit), so
+ * their paths get fuzzed too.
+ *
+ * Built with MQTT_AGENT_FUZZ_STANDALONE defined, the file provides its own
+ * main() that replays a corpus or random inputs and reports executions per
+ * second, so the packet handling path can be profiled without libFuzzer.
+ */
+
+#if defined( MQTT_AGENT_FUZZ_STANDALONE )
+    #define _POSIX_C_SOURCE    200809L
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core_mqtt_agent.h"
+
+#if defined( MQTT_AGENT_FUZZ_STANDALONE )
+    #include <stdio.h>
+    #include <time.h>
+#endif
+
+/**
+ * @brief Number of commands in the harness's command pool.
+ */
+#define FUZZ_COMMAND_POOL_SIZE      ( MQTT_AGENT_MAX_OUTSTANDING_ACKS + 4U )
+
+/**
+ * @brief Depth of the harness's command queue.
+ */
+#define FUZZ_COMMAND_QUEUE_SIZE     ( FUZZ_COMMAND_POOL_SIZE )
+
+/**
+ * @brief Size of the network buffer given to coreMQTT.
+ */
+#define FUZZ_NETWORK_BUFFER_SIZE    ( 1024U )
+
+/**
+ * @brief Transport chunk selector that drops the connection.
+ */
+#define FUZZ_CHUNK_DROP             ( 0xFFU )
+
+/**
+ * @brief Topic used by every outgoing publish.
+ */
+#define FUZZ_TOPIC                  "fuzz/agent"
+
+/**
+ * @brief Topic filters used by every subscribe and unsubscribe.
+ */
+#define FUZZ_FILTER_0               "fuzz/#"
+#define FUZZ_FILTER_1               "fuzz/+/status"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The harness's command queue. It is only ever accessed from the
+ * thread running the command loop, so it needs no locking.
+ */
+struct MQTTAgentMessageContext
+{
+    MQTTAgentCommand_t * pQueue[ FUZZ_COMMAND_QUEUE_SIZE ];
+    size_t head;
+    size_t count;
+};
+
+/**
+ * @brief The transport has no state of its own; bytes come from the input.
+ */
+struct NetworkContext
+{
+    uint8_t unused;
+};
+
+/**
+ * @brief Completion context handed to every command.
+ */
+struct MQTTAgentCommandContext
+{
+    size_t subscriptionCount;
+};
+
+/*-----------------------------------------------------------*/
+
+static const uint8_t * pFuzzData;
+static size_t fuzzDataLength;
+static size_t fuzzCursor;
+static bool generateCommands;
+
+static MQTTAgentContext_t agentContext;
+static MQTTAgentMessageContext_t messageContext;
+static NetworkContext_t networkContext;
+static uint8_t networkBuffer[ FUZZ_NETWORK_BUFFER_SIZE ];
+static MQTTAgentCommand_t commandPool[ FUZZ_COMMAND_POOL_SIZE ];
+static bool commandInUse[ FUZZ_COMMAND_POOL_SIZE ];
+static uint32_t fakeTimeMs;
+
+static MQTTPublishInfo_t publishInfo[ 3 ];
+static MQTTSubscribeInfo_t subscribeInfo[ 2 ];
+static MQTTAgentSubscribeArgs_t subscribeArgs;
+static MQTTAgentCommandContext_t subscribeContext;
+static MQTTAgentCommandContext_t otherContext;
+
+/**
+ * @brief Sink for bytes read from broker-owned buffers so they cannot be
+ * optimized away before the sanitizers see the access.
+ */
+static volatile uint8_t readSink;
+
+/*-----------------------------------------------------------*/
+
+static bool fuzzNextByte( uint8_t * pByte )
+{
+    bool available = ( fuzzCursor < fuzzDataLength );
+
+    if( available )
+    {
+        *pByte = pFuzzData[ fuzzCursor ];
+        fuzzCursor++;
+    }
+
+    return available;
+}
+
+/*-----------------------------------------------------------*/
+
+static void touchBytes( const void * pBuffer,
+                        size_t length )
+{
+    const uint8_t * pBytes = ( const uint8_t * ) pBuffer;
+    size_t i;
+
+    for( i = 0; i < length; i++ )
+    {
+        readSink ^= pBytes[ i ];
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t transportRecv( NetworkContext_t * pNetworkContext,
+                              void * pBuffer,
+                              size_t bytesToRecv )
+{
+    uint8_t chunk = 0U;
+    int32_t bytesReceived = 0;
+
+    ( void ) pNetworkContext;
+
+    if( fuzzNextByte( &chunk ) && ( chunk == FUZZ_CHUNK_DROP ) )
+    {
+        bytesReceived = -1;
+    }
+    else if( chunk > 0U )
+    {
+        size_t chunkLength = ( size_t ) chunk;
+
+        if( chunkLength > bytesToRecv )
+        {
+            chunkLength = bytesToRecv;
+        }
+
+        if( chunkLength > ( fuzzDataLength - fuzzCursor ) )
+        {
+            chunkLength = fuzzDataLength - fuzzCursor;
+        }
+
+        ( void ) memcpy( pBuffer, &( pFuzzData[ fuzzCursor ] ), chunkLength );
+        fuzzCursor += chunkLength;
+        bytesReceived = ( int32_t ) chunkLength;
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    return bytesReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t transportSend( NetworkContext_t * pNetworkContext,
+                              const void * pBuffer,
+                              size_t bytesToSend )
+{
+    ( void ) pNetworkContext;
+
+    touchBytes( pBuffer, bytesToSend );
+
+    return ( int32_t ) bytesToSend;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getTimeMs( void )
+{
+    fakeTimeMs++;
+
+    return fakeTimeMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentCommand_t * getCommand( uint32_t blockTimeMs )
+{
+    MQTTAgentCommand_t * pCommand = NULL;
+    size_t i;
+
+    ( void ) blockTimeMs;
+
+    for( i = 0; i < FUZZ_COMMAND_POOL_SIZE; i++ )
+    {
+        if( !commandInUse[ i ] )
+        {
+            commandInUse[ i ] = true;
+            pCommand = &( commandPool[ i ] );
+            break;
+        }
+    }
+
+    return pCommand;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool releaseCommand( MQTTAgentCommand_t * pCommandToRelease )
+{
+    size_t index = ( size_t ) ( pCommandToRelease - commandPool );
+
+    /* Releasing a command twice, or one that was never taken from the pool,
+     * is a bug in the agent. */
+    if( ( index >= FUZZ_COMMAND_POOL_SIZE ) || !commandInUse[ index ] )
+    {
+        abort();
+    }
+
+    commandInUse[ index ] = false;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool sendCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                         MQTTAgentCommand_t * const * pCommandToSend,
+                         uint32_t blockTimeMs )
+{
+    bool sent = false;
+
+    ( void ) blockTimeMs;
+
+    if( pMsgCtx->count < FUZZ_COMMAND_QUEUE_SIZE )
+    {
+        pMsgCtx->pQueue[ ( pMsgCtx->head + pMsgCtx->count ) % FUZZ_COMMAND_QUEUE_SIZE ] = *pCommandToSend;
+        pMsgCtx->count++;
+        sent = true;
+    }
+
+    return sent;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get the number of status codes in the SUBACK being handled.
+ *
+ * coreMQTT calls back for a packet while it is at the start of the network
+ * buffer, so the count comes from its remaining length. A broker may send
+ * fewer codes than there were subscriptions in the request.
+ *
+ * @param[in] pSubackCodes Status codes handed to the completion callback.
+ * @param[out] pCodeCount Number of status codes in the packet.
+ *
+ * @return true if @p pSubackCodes points at the codes of the SUBACK in the
+ * network buffer, false if they are held elsewhere, as the agent does for a
+ * subscribe completed without sending one.
+ */
+static bool getSubackCodeCount( const uint8_t * pSubackCodes,
+                                size_t * pCodeCount )
+{
+    size_t remainingLength = 0U, multiplier = 1U, i = 1U;
+    bool inPacket = false;
+
+    do
+    {
+        remainingLength += ( size_t ) ( networkBuffer[ i ] & 0x7FU ) * multiplier;
+        multiplier *= 128U;
+        i++;
+    } while( ( i < 5U ) && ( ( networkBuffer[ i - 1U ] & 0x80U ) != 0U ) );
+
+    /* The remaining data starts with the two byte packet ID. */
+    if( ( pSubackCodes == &( networkBuffer[ i + 2U ] ) ) && ( remainingLength >= 2U ) )
+    {
+        *pCodeCount = remainingLength - 2U;
+        inPacket = true;
+    }
+
+    return inPacket;
+}
+
+/*-----------------------------------------------------------*/
+
+static void commandComplete( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                             MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    size_t codeCount = 0U;
+
+    /* Status codes handed out for a SUBACK must be readable for every
+     * subscription in the request, but no further than the end of the
+     * packet they came in. */
+    if( ( pCmdCallbackContext != NULL ) && ( pReturnInfo->pSubackCodes != NULL ) )
+    {
+        if( !getSubackCodeCount( pReturnInfo->pSubackCodes, &codeCount ) ||
+            ( codeCount > pCmdCallbackContext->subscriptionCount ) )
+        {
+            codeCount = pCmdCallbackContext->subscriptionCount;
+        }
+
+        touchBytes( pReturnInfo->pSubackCodes, codeCount );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void incomingPublish( MQTTAgentContext_t * pMqttAgentContext,
+                             uint16_t packetId,
+                             MQTTPublishInfo_t * pPublishInfo )
+{
+    ( void ) pMqttAgentContext;
+    ( void ) packetId;
+
+    touchBytes( pPublishInfo->pTopicName, pPublishInfo->topicNameLength );
+    touchBytes( pPublishInfo->pPayload, pPublishInfo->payloadLength );
+}
+
+/*-----------------------------------------------------------*/
+
+static void issueCommand( uint8_t selector )
+{
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+
+    commandInfo.cmdCompleteCallback = commandComplete;
+    commandInfo.pCmdCompleteCallbackContext = &otherContext;
+
+    switch( selector % 7U )
+    {
+        case 0U:
+        case 1U:
+        case 2U:
+            commandInfo.conflate = ( selector >= 16U );
+            ( void ) MQTTAgent_Publish( &agentContext, &( publishInfo[ selector % 7U ] ), &commandInfo );
+            break;
+
+        case 3U:
+            commandInfo.pCmdCompleteCallbackContext = &subscribeContext;
+            ( void ) MQTTAgent_Subscribe( &agentContext, &subscribeArgs, &commandInfo );
+            break;
+
+        case 4U:
+            ( void ) MQTTAgent_Unsubscribe( &agentContext, &subscribeArgs, &commandInfo );
+            break;
+
+        case 5U:
+            ( void ) MQTTAgent_Ping( &agentContext, &commandInfo );
+            break;
+
+        default:
+            ( void ) MQTTAgent_ProcessLoop( &agentContext, &commandInfo );
+            break;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool receiveCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs )
+{
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    bool received = false;
+    uint8_t selector = 0U;
+
+    ( void ) blockTimeMs;
+
+    /* An empty queue stands in for the time the agent would otherwise block,
+     * during which application tasks submit more work. */
+    if( ( pMsgCtx->count == 0U ) && generateCommands )
+    {
+        if( fuzzNextByte( &selector ) )
+        {
+            /* Every eighth selector leaves the queue empty to exercise the
+             * timeout path of the command loop. */
+            if( ( selector & 0x07U ) != 0x07U )
+            {
+                issueCommand( ( uint8_t ) ( selector >> 3 ) );
+            }
+        }
+        else
+        {
+            generateCommands = false;
+            ( void ) MQTTAgent_Terminate( &agentContext, &commandInfo );
+        }
+    }
+
+    if( pMsgCtx->count > 0U )
+    {
+        *pReceivedCommand = pMsgCtx->pQueue[ pMsgCtx->head ];
+        pMsgCtx->head = ( pMsgCtx->head + 1U ) % FUZZ_COMMAND_QUEUE_SIZE;
+        pMsgCtx->count--;
+        received = true;
+    }
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+static void setUpArguments( void )
+{
+    size_t i;
+
+    for( i = 0; i < 3U; i++ )
+    {
+        ( void ) memset( &( publishInfo[ i ] ), 0x00, sizeof( MQTTPublishInfo_t ) );
+        publishInfo[ i ].qos = ( MQTTQoS_t ) i;
+        publishInfo[ i ].pTopicName = FUZZ_TOPIC;
+        publishInfo[ i ].topicNameLength = ( uint16_t ) ( sizeof( FUZZ_TOPIC ) - 1U );
+        publishInfo[ i ].pPayload = FUZZ_TOPIC;
+        publishInfo[ i ].payloadLength = sizeof( FUZZ_TOPIC ) - 1U;
+    }
+
+    subscribeInfo[ 0 ].qos = MQTTQoS1;
+    subscribeInfo[ 0 ].pTopicFilter = FUZZ_FILTER_0;
+    subscribeInfo[ 0 ].topicFilterLength = ( uint16_t ) ( sizeof( FUZZ_FILTER_0 ) - 1U );
+    subscribeInfo[ 1 ].qos = MQTTQoS2;
+    subscribeInfo[ 1 ].pTopicFilter = FUZZ_FILTER_1;
+    subscribeInfo[ 1 ].topicFilterLength = ( uint16_t ) ( sizeof( FUZZ_FILTER_1 ) - 1U );
+    subscribeArgs.pSubscribeInfo = subscribeInfo;
+    subscribeArgs.numSubscriptions = 2U;
+    subscribeContext.subscriptionCount = 2U;
+    otherContext.subscriptionCount = 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+int LLVMFuzzerTestOneInput( const uint8_t * pData,
+                            size_t size );
+
+int LLVMFuzzerTestOneInput( const uint8_t * pData,
+                            size_t size )
+{
+    MQTTAgentMessageInterface_t messageInterface = { 0 };
+    TransportInterface_t transport = { 0 };
+    MQTTFixedBuffer_t fixedBuffer = { 0 };
+    MQTTStatus_t status;
+    bool resume;
+    uint8_t selector = 0U;
+    size_t i;
+
+    pFuzzData = pData;
+    fuzzDataLength = size;
+    fuzzCursor = 0U;
+    generateCommands = true;
+    fakeTimeMs = 0U;
+    ( void ) memset( &messageContext, 0x00, sizeof( messageContext ) );
+    ( void ) memset( commandInUse, 0x00, sizeof( commandInUse ) );
+    setUpArguments();
+
+    messageInterface.pMsgCtx = &messageContext;
+    messageInterface.send = sendCommand;
+    messageInterface.recv = receiveCommand;
+    messageInterface.getCommand = getCommand;
+    messageInterface.releaseCommand = releaseCommand;
+
+    transport.pNetworkContext = &networkContext;
+    transport.send = transportSend;
+    transport.recv = transportRecv;
+    transport.writev = NULL;
+
+    fixedBuffer.pBuffer = networkBuffer;
+    fixedBuffer.size = sizeof( networkBuffer );
+
+    status = MQTTAgent_Init( &agentContext,
+                             &messageInterface,
+                             &fixedBuffer,
+                             &transport,
+                             getTimeMs,
+                             incomingPublish,
+                             NULL );
+
+    if( status == MQTTSuccess )
+    {
+        /* Skip the CONNECT handshake; it only guards the loop below, and the
+         * broker side of the session is entirely fuzz input anyway. */
+        agentContext.mqttContext.connectStatus = MQTTConnected;
+
+        do
+        {
+            status = MQTTAgent_CommandLoop( &agentContext );
+            resume = ( status != MQTTSuccess ) && generateCommands && fuzzNextByte( &selector );
+
+            if( resume )
+            {
+                /* Resume as after a reconnect. MQTT_Connect() would discard
+                 * what was left of the last packet, and the state records
+                 * too unless the broker kept the session. */
+                agentContext.mqttContext.index = 0U;
+
+                if( ( selector & 0x01U ) == 0U )
+                {
+                    ( void ) memset( agentContext.mqttContext.outgoingPublishRecords,
+                                     0x00,
+                                     agentContext.mqttContext.outgoingPublishRecordMaxCount * sizeof( MQTTPubAckInfo_t ) );
+                    ( void ) memset( agentContext.mqttContext.incomingPublishRecords,
+                                     0x00,
+                                     agentContext.mqttContext.incomingPublishRecordMaxCount * sizeof( MQTTPubAckInfo_t ) );
+                }
+
+                ( void ) MQTTAgent_ResumeSession( &agentContext, ( selector & 0x01U ) != 0U );
+            }
+        } while( resume );
+
+        /* At the end the application is expected to cancel everything, so do
+         * the same here. */
+        generateCommands = false;
+        ( void ) MQTTAgent_CancelAll( &agentContext );
+
+        ( void ) status;
+
+        for( i = 0; i < FUZZ_COMMAND_POOL_SIZE; i++ )
+        {
+            if( commandInUse[ i ] )
+            {
+                /* A command was neither completed nor cancelled. */
+                abort();
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+#if defined( MQTT_AGENT_FUZZ_STANDALONE )
+
+/**
+ * @brief Largest input generated in random throughput mode.
+ */
+    #define FUZZ_MAX_RANDOM_INPUT    ( 4096U )
+
+    static uint8_t * readFile( const char * pPath,
+                               size_t * pLength )
+    {
+        FILE * pFile = fopen( pPath, "rb" );
+        uint8_t * pContents = NULL;
+        long fileLength;
+
+        if( pFile != NULL )
+        {
+            if( ( fseek( pFile, 0L, SEEK_END ) == 0 ) &&
+                ( ( fileLength = ftell( pFile ) ) >= 0L ) &&
+                ( fseek( pFile, 0L, SEEK_SET ) == 0 ) )
+            {
+                pContents = malloc( ( size_t ) fileLength + 1U );
+
+                if( pContents != NULL )
+                {
+                    *pLength = fread( pContents, 1U, ( size_t ) fileLength, pFile );
+                }
+            }
+
+            ( void ) fclose( pFile );
+        }
+
+        return pContents;
+    }
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Throughput mode.
+ *
+ * Usage: mqtt_agent_fuzz_throughput [iterations] [corpus files...]
+ *
+ * With corpus files the inputs are replayed round robin, otherwise inputs are
+ * drawn from a fixed seed pseudo-random generator so runs are comparable.
+ */
+    int main( int argc,
+              char ** argv )
+    {
+        static uint8_t randomInput[ FUZZ_MAX_RANDOM_INPUT ];
+        uint8_t ** ppInputs = NULL;
+        size_t * pLengths = NULL;
+        size_t inputCount = 0U, bytesProcessed = 0U, i, j;
+        unsigned long iterations = 100000UL, n;
+        uint32_t seed = 1U;
+        struct timespec start, end;
+        double elapsed;
+
+        if( argc > 1 )
+        {
+            iterations = strtoul( argv[ 1 ], NULL, 10 );
+        }
+
+        if( argc > 2 )
+        {
+            inputCount = ( size_t ) argc - 2U;
+            ppInputs = calloc( inputCount, sizeof( uint8_t * ) );
+            pLengths = calloc( inputCount, sizeof( size_t ) );
+
+            if( ( ppInputs == NULL ) || ( pLengths == NULL ) )
+            {
+                return 1;
+            }
+
+            for( i = 0; i < inputCount; i++ )
+            {
+                ppInputs[ i ] = readFile( argv[ i + 2U ], &( pLengths[ i ] ) );
+
+                if( ppInputs[ i ] == NULL )
+                {
+                    ( void ) fprintf( stderr, "Cannot read %s\n", argv[ i + 2U ] );
+                    return 1;
+                }
+            }
+        }
+
+        ( void ) clock_gettime( CLOCK_MONOTONIC, &start );
+
+        for( n = 0; n < iterations; n++ )
+        {
+            if( inputCount > 0U )
+            {
+                i = ( size_t ) ( n % inputCount );
+                ( void ) LLVMFuzzerTestOneInput( ppInputs[ i ], pLengths[ i ] );
+                bytesProcessed += pLengths[ i ];
+            }
+            else
+            {
+                seed = ( seed * 1103515245U ) + 12345U;
+                j = ( size_t ) ( ( seed >> 16 ) % FUZZ_MAX_RANDOM_INPUT );
+
+                for( i = 0; i < j; i++ )
+                {
+                    seed = ( seed * 1103515245U ) + 12345U;
+                    randomInput[ i ] = ( uint8_t ) ( seed >> 16 );
+                }
+
+                ( void ) LLVMFuzzerTestOneInput( randomInput, j );
+                bytesProcessed += j;
+            }
+        }
+
+        ( void ) clock_gettime( CLOCK_MONOTONIC, &end );
+
+        elapsed = ( double ) ( end.tv_sec - start.tv_sec ) +
+                  ( ( double ) ( end.tv_nsec - start.tv_nsec ) / 1e9 );
+
+        ( void ) printf( "%lu executions, %lu bytes in %.3f s: %.0f exec/s, %.2f MB/s\n",
+                         iterations,
+                         ( unsigned long ) bytesProcessed,
+                         elapsed,
+                         ( elapsed > 0.0 ) ? ( ( double ) iterations / elapsed ) : 0.0,
+                         ( elapsed > 0.0 ) ? ( ( double ) bytesProcessed / elapsed / 1e6 ) : 0.0 );
+
+        for( i = 0; i < inputCount; i++ )
+        {
+            free( ppInputs[ i ] );
+        }
+
+        free( ppInputs );
+        free( pLengths );
+
+        return 0;
+    }
+
+#endif /* if defined( MQTT_AGENT_FUZZ_STANDALONE ) */
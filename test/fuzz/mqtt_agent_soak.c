@@ -0,0 +1,1342 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file mqtt_agent_soak.c
+ * @brief Soak benchmark running the agent and coreMQTT over a faulty link.
+ *
+ * The agent drives the real coreMQTT library, whose transport is a
+ * fault-injecting decorator around an in-process broker emulator. The
+ * decorator injects partial sends and receives, EAGAIN storms (calls moving
+ * no bytes), added latency, a bandwidth cap and abrupt disconnects, following
+ * a schedule of fault profiles that repeats for the length of the run. Every
+ * disconnect goes through coreMQTT's own state machine: the command loop fails,
+ * the harness reconnects with MQTT_Connect() and resumes the session with
+ * MQTTAgent_ResumeSession().
+ *
+ * Time is virtual. It only advances when the transport has nothing to move,
+ * so hours of traffic run in seconds and the run is reproducible for a seed.
+ * The harness keeps a window of QoS 1 and QoS 2 publishes in flight, each
+ * carrying a sequence number, and re-issues any that complete with an error.
+ * It reports throughput and reconnect time per fault profile, and fails if
+ *
+ * - a sequence number is never delivered to the broker,
+ * - a QoS 2 sequence number is delivered more often than it was published,
+ * - a command completes twice or is never released,
+ * - an acknowledgment outlives its command, in the agent or in coreMQTT.
+ *
+ * Usage: mqtt_agent_soak [virtual minutes] [seed]
+ */
+
+#define _POSIX_C_SOURCE    200809L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Number of publishes the harness keeps in flight.
+ */
+#define SOAK_WINDOW                    ( MQTT_AGENT_MAX_OUTSTANDING_ACKS - 2U )
+
+/**
+ * @brief Number of commands in the harness's command pool.
+ */
+#define SOAK_COMMAND_POOL_SIZE         ( MQTT_AGENT_MAX_OUTSTANDING_ACKS + 4U )
+
+/**
+ * @brief Size of the network buffer given to coreMQTT.
+ */
+#define SOAK_NETWORK_BUFFER_SIZE       ( 1024U )
+
+/**
+ * @brief Size of the broker's receive and send buffers, and of the
+ * decorator's buffer of delayed bytes.
+ */
+#define SOAK_LINK_BUFFER_SIZE          ( 4096U )
+
+/**
+ * @brief Interval between subscribe or unsubscribe commands, in virtual ms.
+ */
+#define SOAK_SUBSCRIBE_INTERVAL_MS     ( 10000U )
+
+/**
+ * @brief Longest burst the bandwidth cap allows, in ms of budget.
+ */
+#define SOAK_BANDWIDTH_BURST_MS        ( 4U )
+
+/**
+ * @brief Run length when none is given, in virtual minutes.
+ */
+#define SOAK_DEFAULT_MINUTES           ( 60UL )
+
+/**
+ * @brief Topic of the QoS 1 and QoS 2 publishes, and the filter subscribed to.
+ */
+#define SOAK_TOPIC_QOS1                "soak/qos1"
+#define SOAK_TOPIC_QOS2                "soak/qos2"
+#define SOAK_FILTER                    "soak/#"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Faults injected by the transport decorator while a profile is active.
+ */
+typedef struct SoakFaults
+{
+    const char * pName;          /**< @brief Name printed in the report. */
+    uint32_t durationMs;         /**< @brief Virtual time the profile is active for. */
+    uint32_t partialPercent;     /**< @brief Chance that a call moves only part of the bytes. */
+    uint32_t stormPercent;       /**< @brief Chance that a call starts an EAGAIN storm. */
+    uint32_t stormMaxCalls;      /**< @brief Longest EAGAIN storm, in calls. */
+    uint32_t latencyMs;          /**< @brief Delay before received bytes can be read. */
+    uint32_t bytesPerMs;         /**< @brief Send bandwidth cap, or 0 for none. */
+    uint32_t dropPerMillion;     /**< @brief Chance per call that the connection drops. */
+    uint32_t sessionLossPercent; /**< @brief Chance the broker forgets the session on reconnect. */
+} SoakFaults_t;
+
+/**
+ * @brief Measurements for one fault profile.
+ */
+typedef struct SoakStats
+{
+    uint32_t virtualMs;       /**< @brief Virtual time spent in the profile. */
+    uint32_t completed;       /**< @brief Publishes acknowledged. */
+    uint32_t failed;          /**< @brief Publishes completed with an error and re-issued. */
+    uint32_t drops;           /**< @brief Connections dropped. */
+    uint32_t reconnects;      /**< @brief Sessions resumed. */
+    double reconnectMsTotal;  /**< @brief Sum of virtual ms from drop to resumed session. */
+    uint32_t reconnectMsMax;  /**< @brief Longest time from drop to resumed session. */
+    uint32_t pendingAcksMax;  /**< @brief Most acknowledgments pending after a resume. */
+} SoakStats_t;
+
+/**
+ * @brief The fault-injecting transport decorator. It forwards to an inner
+ * transport, here the broker emulator, which has no context of its own.
+ */
+struct NetworkContext
+{
+    const TransportInterface_t * pInner;        /**< @brief Transport the calls are forwarded to. */
+    const SoakFaults_t * pFaults;               /**< @brief Faults to inject. */
+    uint32_t randomState;                         /**< @brief State of the fault generator. */
+    bool connected;                             /**< @brief False from a drop until the next connect. */
+    uint32_t dropTimeMs;                        /**< @brief Virtual time of the last drop. */
+    uint32_t drops;                             /**< @brief Number of drops injected. */
+    uint32_t stormCallsLeft;                    /**< @brief Calls left in the current EAGAIN storm. */
+    uint32_t sendBudget;                        /**< @brief Bytes that may be sent before the cap applies. */
+    uint32_t budgetTimeMs;                      /**< @brief Virtual time the budget was last topped up. */
+    uint8_t delayed[ SOAK_LINK_BUFFER_SIZE ];   /**< @brief Received bytes not yet visible to coreMQTT. */
+    uint32_t delayedAt[ SOAK_LINK_BUFFER_SIZE ]; /**< @brief Virtual time each delayed byte arrived. */
+    size_t delayedHead;                         /**< @brief Index of the oldest delayed byte. */
+    size_t delayedCount;                        /**< @brief Number of delayed bytes. */
+};
+
+/**
+ * @brief The harness's command queue. It is only ever accessed from the
+ * thread running the command loop, so it needs no locking.
+ */
+struct MQTTAgentMessageContext
+{
+    MQTTAgentCommand_t * pQueue[ SOAK_COMMAND_POOL_SIZE ];
+    size_t head;
+    size_t count;
+};
+
+/**
+ * @brief Completion context of a command: the publish slot it belongs to, or
+ * none for a subscribe or unsubscribe.
+ */
+struct MQTTAgentCommandContext
+{
+    size_t slot;
+    bool isPublish;
+};
+
+/**
+ * @brief A publish kept in flight by the harness.
+ */
+typedef struct SoakSlot
+{
+    MQTTPublishInfo_t publishInfo;
+    MQTTAgentCommandContext_t context;
+    uint8_t payload[ 4 ];
+    uint32_t sequence;
+    bool inFlight;
+    bool reissue;
+} SoakSlot_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fault profiles. All but the last are applied in turn for their
+ * duration and then repeated; the last drains the publishes left at the end of
+ * the run over a clean link.
+ */
+static const SoakFaults_t faultSchedule[] =
+{
+    /* name       duration  partial% storm% storm calls latency B/ms drop ppm session loss% */
+    { "clean",    300000U,  0U,      0U,    0U,         1U,     0U,  0U,      0U  },
+    { "partial",  300000U,  50U,     0U,    0U,         5U,     0U,  20U,     0U  },
+    { "eagain",   300000U,  0U,      2U,    40U,        5U,     0U,  20U,     0U  },
+    { "slow",     300000U,  10U,     0U,    0U,         80U,    16U, 50U,     0U  },
+    { "flaky",    300000U,  20U,     1U,    20U,        20U,    64U, 500U,    12U },
+    { "drain",    0U,       0U,      0U,    0U,         1U,     0U,  0U,      0U  }
+};
+
+#define SOAK_PROFILE_COUNT    ( sizeof( faultSchedule ) / sizeof( faultSchedule[ 0 ] ) )
+#define SOAK_DRAIN_PROFILE    ( SOAK_PROFILE_COUNT - 1U )
+
+static uint32_t virtualTimeMs;
+
+static MQTTAgentContext_t agentContext;
+static MQTTAgentMessageContext_t messageContext;
+static NetworkContext_t networkContext;
+static TransportInterface_t brokerTransport;
+static uint8_t networkBuffer[ SOAK_NETWORK_BUFFER_SIZE ];
+static MQTTAgentCommand_t commandPool[ SOAK_COMMAND_POOL_SIZE ];
+static bool commandInUse[ SOAK_COMMAND_POOL_SIZE ];
+
+static SoakSlot_t slots[ SOAK_WINDOW ];
+static uint32_t nextSequence;
+static uint8_t * pIssues;
+static uint8_t * pDeliveries;
+static uint32_t sequenceCapacity;
+static bool issueNew;
+static bool terminating;
+static uint32_t nextSubscribeMs;
+static bool subscribeNext;
+static MQTTSubscribeInfo_t subscribeInfo;
+static MQTTAgentSubscribeArgs_t subscribeArgs;
+static MQTTAgentCommandContext_t subscribeContext;
+static SoakStats_t stats[ SOAK_PROFILE_COUNT ];
+static size_t currentProfile;
+static uint32_t profileStartMs;
+static uint32_t profileDropsStart;
+static uint32_t runEndMs;
+
+/* Broker emulator state. */
+static uint8_t brokerIn[ SOAK_LINK_BUFFER_SIZE ];
+static size_t brokerInLength;
+static uint8_t brokerOut[ SOAK_LINK_BUFFER_SIZE ];
+static size_t brokerOutHead;
+static size_t brokerOutCount;
+static bool brokerConnected;
+static bool brokerHasSession;
+static uint8_t brokerQoS2Pending[ 65536U / 8U ];
+static uint32_t brokerProtocolErrors;
+static uint32_t brokerRandom = 7U;
+
+/*-----------------------------------------------------------*/
+
+static uint32_t randomNext( uint32_t * pState )
+{
+    *pState = ( *pState * 1103515245U ) + 12345U;
+
+    return ( *pState >> 16 ) & 0x7FFFU;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool randomChance( uint32_t * pState,
+                        uint32_t perMillion )
+{
+    uint32_t roll = ( randomNext( pState ) << 15 ) | randomNext( pState );
+
+    return ( roll % 1000000U ) < perMillion;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getTimeMs( void )
+{
+    return virtualTimeMs;
+}
+
+/*-----------------------------------------------------------*/
+
+static void fail( const char * pMessage,
+                  uint32_t value )
+{
+    ( void ) fprintf( stderr, "soak: %s (%lu) at %lu ms\n",
+                      pMessage, ( unsigned long ) value, ( unsigned long ) virtualTimeMs );
+    exit( 1 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* The broker emulator. It implements just enough of an MQTT 3.1.1 server to
+ * acknowledge what the agent sends, and records every publish it accepts. */
+
+static void brokerWrite( const uint8_t * pBytes,
+                         size_t length )
+{
+    size_t i;
+
+    if( ( brokerOutCount + length ) > SOAK_LINK_BUFFER_SIZE )
+    {
+        fail( "broker send buffer overflow", ( uint32_t ) length );
+    }
+
+    for( i = 0; i < length; i++ )
+    {
+        brokerOut[ ( brokerOutHead + brokerOutCount ) % SOAK_LINK_BUFFER_SIZE ] = pBytes[ i ];
+        brokerOutCount++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerAck( uint8_t type,
+                       uint16_t packetId )
+{
+    uint8_t ack[ 4 ];
+
+    ack[ 0 ] = type;
+    ack[ 1 ] = 2U;
+    ack[ 2 ] = ( uint8_t ) ( packetId >> 8 );
+    ack[ 3 ] = ( uint8_t ) packetId;
+    brokerWrite( ack, sizeof( ack ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerDeliver( const uint8_t * pPayload,
+                           size_t payloadLength )
+{
+    uint32_t sequence;
+
+    if( payloadLength != 4U )
+    {
+        brokerProtocolErrors++;
+    }
+    else
+    {
+        sequence = ( ( uint32_t ) pPayload[ 0 ] << 24 ) | ( ( uint32_t ) pPayload[ 1 ] << 16 ) |
+                   ( ( uint32_t ) pPayload[ 2 ] << 8 ) | ( uint32_t ) pPayload[ 3 ];
+
+        if( sequence >= nextSequence )
+        {
+            fail( "broker received a sequence number never published", sequence );
+        }
+
+        if( pDeliveries[ sequence ] < UINT8_MAX )
+        {
+            pDeliveries[ sequence ]++;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerForgetInFlight( void )
+{
+    size_t i;
+
+    /* A broker that loses the session may deliver a QoS 2 publish again, for
+     * instance when its CONNACK is lost and the client resends the publish
+     * after the next CONNACK reports the new, empty session as present. Only
+     * check exactly once delivery for publishes sent after the loss. */
+    for( i = 0; i < SOAK_WINDOW; i++ )
+    {
+        if( slots[ i ].inFlight || slots[ i ].reissue )
+        {
+            pIssues[ slots[ i ].sequence ] = UINT8_MAX;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerConnect( const uint8_t * pData,
+                           size_t length )
+{
+    uint8_t connack[ 4 ] = { 0x20U, 2U, 0U, 0U };
+    bool cleanSession;
+
+    if( ( length < 10U ) || ( memcmp( &( pData[ 2 ] ), "MQTT", 4U ) != 0 ) )
+    {
+        brokerProtocolErrors++;
+    }
+    else
+    {
+        cleanSession = ( ( pData[ 7 ] & 0x02U ) != 0U );
+
+        if( cleanSession ||
+            ( ( randomNext( &brokerRandom ) % 100U ) < networkContext.pFaults->sessionLossPercent ) )
+        {
+            brokerHasSession = false;
+        }
+
+        if( !brokerHasSession )
+        {
+            ( void ) memset( brokerQoS2Pending, 0x00, sizeof( brokerQoS2Pending ) );
+            brokerForgetInFlight();
+        }
+
+        connack[ 2 ] = brokerHasSession ? 1U : 0U;
+        brokerHasSession = !cleanSession;
+        brokerConnected = true;
+        brokerWrite( connack, sizeof( connack ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerPublish( uint8_t header,
+                           const uint8_t * pData,
+                           size_t length )
+{
+    uint8_t qos = ( uint8_t ) ( ( header >> 1 ) & 0x03U );
+    size_t offset;
+    uint16_t packetId = 0U;
+
+    offset = ( length >= 2U ) ? ( 2U + ( ( ( size_t ) pData[ 0 ] << 8 ) | pData[ 1 ] ) ) : length + 1U;
+
+    if( ( qos > 0U ) && ( offset + 2U <= length ) )
+    {
+        packetId = ( uint16_t ) ( ( pData[ offset ] << 8 ) | pData[ offset + 1U ] );
+        offset += 2U;
+    }
+
+    if( ( offset > length ) || ( qos == 3U ) || ( ( qos > 0U ) && ( packetId == 0U ) ) )
+    {
+        brokerProtocolErrors++;
+    }
+    else if( qos == 2U )
+    {
+        /* Deliver once per packet ID until the PUBREL releases it. */
+        if( ( brokerQoS2Pending[ packetId / 8U ] & ( 1U << ( packetId % 8U ) ) ) == 0U )
+        {
+            brokerQoS2Pending[ packetId / 8U ] |= ( uint8_t ) ( 1U << ( packetId % 8U ) );
+            brokerDeliver( &( pData[ offset ] ), length - offset );
+        }
+
+        brokerAck( 0x50U, packetId );
+    }
+    else
+    {
+        brokerDeliver( &( pData[ offset ] ), length - offset );
+
+        if( qos == 1U )
+        {
+            brokerAck( 0x40U, packetId );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerPacket( uint8_t header,
+                          const uint8_t * pData,
+                          size_t length )
+{
+    uint8_t suback[ 5 ] = { 0x90U, 3U, 0U, 0U, 1U };
+    uint8_t pingResponse[ 2 ] = { 0xD0U, 0U };
+    uint16_t packetId = 0U;
+
+    if( length >= 2U )
+    {
+        packetId = ( uint16_t ) ( ( pData[ 0 ] << 8 ) | pData[ 1 ] );
+    }
+
+    if( !brokerConnected && ( header != 0x10U ) )
+    {
+        brokerProtocolErrors++;
+    }
+    else
+    {
+        switch( header & 0xF0U )
+        {
+            case 0x10U:
+                brokerConnect( pData, length );
+                break;
+
+            case 0x30U:
+                brokerPublish( header, pData, length );
+                break;
+
+            case 0x60U:
+                brokerQoS2Pending[ packetId / 8U ] &= ( uint8_t ) ~( 1U << ( packetId % 8U ) );
+                brokerAck( 0x70U, packetId );
+                break;
+
+            case 0x80U:
+                /* The harness always subscribes to a single filter. */
+                suback[ 2 ] = pData[ 0 ];
+                suback[ 3 ] = pData[ 1 ];
+                brokerWrite( suback, sizeof( suback ) );
+                break;
+
+            case 0xA0U:
+                brokerAck( 0xB0U, packetId );
+                break;
+
+            case 0xC0U:
+                brokerWrite( pingResponse, sizeof( pingResponse ) );
+                break;
+
+            case 0xE0U:
+                brokerConnected = false;
+                break;
+
+            default:
+                brokerProtocolErrors++;
+                break;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t brokerRecv( NetworkContext_t * pNetworkContext,
+                           void * pBuffer,
+                           size_t bytesToRecv )
+{
+    uint8_t * pBytes = ( uint8_t * ) pBuffer;
+    size_t i;
+
+    ( void ) pNetworkContext;
+
+    for( i = 0; ( i < bytesToRecv ) && ( brokerOutCount > 0U ); i++ )
+    {
+        pBytes[ i ] = brokerOut[ brokerOutHead ];
+        brokerOutHead = ( brokerOutHead + 1U ) % SOAK_LINK_BUFFER_SIZE;
+        brokerOutCount--;
+    }
+
+    return ( int32_t ) i;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t brokerSend( NetworkContext_t * pNetworkContext,
+                           const void * pBuffer,
+                           size_t bytesToSend )
+{
+    size_t remainingLength, multiplier, lengthBytes, packetLength;
+    bool complete = true;
+
+    ( void ) pNetworkContext;
+
+    if( ( brokerInLength + bytesToSend ) > SOAK_LINK_BUFFER_SIZE )
+    {
+        fail( "broker receive buffer overflow", ( uint32_t ) bytesToSend );
+    }
+
+    ( void ) memcpy( &( brokerIn[ brokerInLength ] ), pBuffer, bytesToSend );
+    brokerInLength += bytesToSend;
+
+    /* Handle every complete packet received so far. */
+    while( complete && ( brokerInLength >= 2U ) )
+    {
+        remainingLength = 0U;
+        multiplier = 1U;
+        lengthBytes = 0U;
+        complete = false;
+
+        while( ( lengthBytes < 4U ) && ( ( 1U + lengthBytes ) < brokerInLength ) )
+        {
+            remainingLength += ( size_t ) ( brokerIn[ 1U + lengthBytes ] & 0x7FU ) * multiplier;
+            multiplier *= 128U;
+            lengthBytes++;
+
+            if( ( brokerIn[ lengthBytes ] & 0x80U ) == 0U )
+            {
+                complete = true;
+                break;
+            }
+        }
+
+        packetLength = 1U + lengthBytes + remainingLength;
+
+        if( complete && ( packetLength <= brokerInLength ) )
+        {
+            brokerPacket( brokerIn[ 0 ], &( brokerIn[ 1U + lengthBytes ] ), remainingLength );
+            ( void ) memmove( brokerIn, &( brokerIn[ packetLength ] ), brokerInLength - packetLength );
+            brokerInLength -= packetLength;
+        }
+        else
+        {
+            complete = false;
+        }
+    }
+
+    return ( int32_t ) bytesToSend;
+}
+
+/*-----------------------------------------------------------*/
+
+static void brokerAccept( void )
+{
+    /* Bytes in flight when the connection dropped are lost. */
+    brokerInLength = 0U;
+    brokerOutHead = 0U;
+    brokerOutCount = 0U;
+    brokerConnected = false;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The fault-injecting transport decorator. Whenever a call moves no bytes,
+ * virtual time advances by a millisecond, as if the call had waited. */
+
+static bool faultTransportInterfere( NetworkContext_t * pNetworkContext,
+                                     size_t * pBytes )
+{
+    const SoakFaults_t * pFaults = pNetworkContext->pFaults;
+    bool proceed = true;
+
+    if( pNetworkContext->connected && randomChance( &( pNetworkContext->randomState ), pFaults->dropPerMillion ) )
+    {
+        pNetworkContext->connected = false;
+        pNetworkContext->dropTimeMs = virtualTimeMs;
+        pNetworkContext->drops++;
+    }
+
+    if( !pNetworkContext->connected )
+    {
+        proceed = false;
+    }
+    else if( pNetworkContext->stormCallsLeft > 0U )
+    {
+        pNetworkContext->stormCallsLeft--;
+        *pBytes = 0U;
+    }
+    else if( ( pFaults->stormMaxCalls > 0U ) &&
+             ( ( randomNext( &( pNetworkContext->randomState ) ) % 100U ) < pFaults->stormPercent ) )
+    {
+        pNetworkContext->stormCallsLeft = randomNext( &( pNetworkContext->randomState ) ) % pFaults->stormMaxCalls;
+        *pBytes = 0U;
+    }
+    else if( ( *pBytes > 1U ) &&
+             ( ( randomNext( &( pNetworkContext->randomState ) ) % 100U ) < pFaults->partialPercent ) )
+    {
+        *pBytes = 1U + ( ( size_t ) randomNext( &( pNetworkContext->randomState ) ) % ( *pBytes - 1U ) );
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    return proceed;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t faultTransportSend( NetworkContext_t * pNetworkContext,
+                                   const void * pBuffer,
+                                   size_t bytesToSend )
+{
+    const SoakFaults_t * pFaults = pNetworkContext->pFaults;
+    size_t bytes = bytesToSend;
+    uint32_t budget;
+    int32_t result = -1;
+
+    if( faultTransportInterfere( pNetworkContext, &bytes ) )
+    {
+        if( pFaults->bytesPerMs > 0U )
+        {
+            budget = pNetworkContext->sendBudget +
+                     ( ( virtualTimeMs - pNetworkContext->budgetTimeMs ) * pFaults->bytesPerMs );
+
+            if( budget > ( pFaults->bytesPerMs * SOAK_BANDWIDTH_BURST_MS ) )
+            {
+                budget = pFaults->bytesPerMs * SOAK_BANDWIDTH_BURST_MS;
+            }
+
+            if( bytes > budget )
+            {
+                bytes = budget;
+            }
+
+            pNetworkContext->sendBudget = budget - ( uint32_t ) bytes;
+            pNetworkContext->budgetTimeMs = virtualTimeMs;
+        }
+
+        if( bytes > 0U )
+        {
+            result = pNetworkContext->pInner->send( pNetworkContext->pInner->pNetworkContext, pBuffer, bytes );
+        }
+        else
+        {
+            virtualTimeMs++;
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t faultTransportRecv( NetworkContext_t * pNetworkContext,
+                                   void * pBuffer,
+                                   size_t bytesToRecv )
+{
+    uint8_t * pBytes = ( uint8_t * ) pBuffer;
+    uint8_t incoming[ SOAK_LINK_BUFFER_SIZE ];
+    size_t bytes = bytesToRecv, received = 0U, i, tail;
+    int32_t innerResult;
+    int32_t result = -1;
+
+    if( faultTransportInterfere( pNetworkContext, &bytes ) )
+    {
+        /* Move everything the peer sent into the delay line. */
+        innerResult = pNetworkContext->pInner->recv( pNetworkContext->pInner->pNetworkContext,
+                                                     incoming,
+                                                     SOAK_LINK_BUFFER_SIZE - pNetworkContext->delayedCount );
+
+        for( i = 0; i < ( size_t ) innerResult; i++ )
+        {
+            tail = ( pNetworkContext->delayedHead + pNetworkContext->delayedCount ) % SOAK_LINK_BUFFER_SIZE;
+            pNetworkContext->delayed[ tail ] = incoming[ i ];
+            pNetworkContext->delayedAt[ tail ] = virtualTimeMs;
+            pNetworkContext->delayedCount++;
+        }
+
+        /* Hand out the bytes that have been in it for long enough. */
+        while( ( received < bytes ) &&
+               ( pNetworkContext->delayedCount > 0U ) &&
+               ( ( virtualTimeMs - pNetworkContext->delayedAt[ pNetworkContext->delayedHead ] ) >=
+                 pNetworkContext->pFaults->latencyMs ) )
+        {
+            pBytes[ received ] = pNetworkContext->delayed[ pNetworkContext->delayedHead ];
+            pNetworkContext->delayedHead = ( pNetworkContext->delayedHead + 1U ) % SOAK_LINK_BUFFER_SIZE;
+            pNetworkContext->delayedCount--;
+            received++;
+        }
+
+        if( received == 0U )
+        {
+            virtualTimeMs++;
+        }
+
+        result = ( int32_t ) received;
+    }
+
+    return result;
+}
+
+/*-----------------------------------------------------------*/
+
+static void faultTransportConnect( NetworkContext_t * pNetworkContext )
+{
+    pNetworkContext->connected = true;
+    pNetworkContext->stormCallsLeft = 0U;
+    pNetworkContext->delayedHead = 0U;
+    pNetworkContext->delayedCount = 0U;
+    pNetworkContext->sendBudget = 0U;
+    pNetworkContext->budgetTimeMs = virtualTimeMs;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The command pool and queue, as in the fuzz harness. */
+
+static MQTTAgentCommand_t * getCommand( uint32_t blockTimeMs )
+{
+    MQTTAgentCommand_t * pCommand = NULL;
+    size_t i;
+
+    ( void ) blockTimeMs;
+
+    for( i = 0; i < SOAK_COMMAND_POOL_SIZE; i++ )
+    {
+        if( !commandInUse[ i ] )
+        {
+            commandInUse[ i ] = true;
+            pCommand = &( commandPool[ i ] );
+            break;
+        }
+    }
+
+    return pCommand;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool releaseCommand( MQTTAgentCommand_t * pCommandToRelease )
+{
+    size_t index = ( size_t ) ( pCommandToRelease - commandPool );
+
+    if( ( index >= SOAK_COMMAND_POOL_SIZE ) || !commandInUse[ index ] )
+    {
+        fail( "command released twice", ( uint32_t ) index );
+    }
+
+    commandInUse[ index ] = false;
+
+    return true;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool sendCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                         MQTTAgentCommand_t * const * pCommandToSend,
+                         uint32_t blockTimeMs )
+{
+    bool sent = false;
+
+    ( void ) blockTimeMs;
+
+    if( pMsgCtx->count < SOAK_COMMAND_POOL_SIZE )
+    {
+        pMsgCtx->pQueue[ ( pMsgCtx->head + pMsgCtx->count ) % SOAK_COMMAND_POOL_SIZE ] = *pCommandToSend;
+        pMsgCtx->count++;
+        sent = true;
+    }
+
+    return sent;
+}
+
+/*-----------------------------------------------------------*/
+
+static void commandComplete( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                             MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    SoakSlot_t * pSlot;
+
+    if( pCmdCallbackContext->isPublish )
+    {
+        pSlot = &( slots[ pCmdCallbackContext->slot ] );
+
+        if( !pSlot->inFlight )
+        {
+            fail( "publish completed twice", pSlot->sequence );
+        }
+
+        pSlot->inFlight = false;
+
+        if( pReturnInfo->returnCode == MQTTSuccess )
+        {
+            stats[ currentProfile ].completed++;
+        }
+        else
+        {
+            stats[ currentProfile ].failed++;
+            pSlot->reissue = true;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void incomingPublish( MQTTAgentContext_t * pMqttAgentContext,
+                             uint16_t packetId,
+                             MQTTPublishInfo_t * pPublishInfo )
+{
+    ( void ) pMqttAgentContext;
+    ( void ) packetId;
+    ( void ) pPublishInfo;
+}
+
+/*-----------------------------------------------------------*/
+
+static void issuePublish( SoakSlot_t * pSlot )
+{
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    uint8_t * pGrown;
+    uint32_t sequence;
+
+    if( !pSlot->reissue )
+    {
+        if( nextSequence == sequenceCapacity )
+        {
+            sequenceCapacity = ( sequenceCapacity == 0U ) ? 65536U : ( sequenceCapacity * 2U );
+            pGrown = realloc( pIssues, sequenceCapacity );
+            pIssues = ( pGrown != NULL ) ? pGrown : pIssues;
+            pGrown = ( pGrown != NULL ) ? realloc( pDeliveries, sequenceCapacity ) : NULL;
+
+            if( pGrown == NULL )
+            {
+                fail( "out of memory", sequenceCapacity );
+            }
+
+            pDeliveries = pGrown;
+            ( void ) memset( &( pIssues[ nextSequence ] ), 0x00, sequenceCapacity - nextSequence );
+            ( void ) memset( &( pDeliveries[ nextSequence ] ), 0x00, sequenceCapacity - nextSequence );
+        }
+
+        pSlot->sequence = nextSequence;
+        nextSequence++;
+    }
+
+    sequence = pSlot->sequence;
+    pSlot->payload[ 0 ] = ( uint8_t ) ( sequence >> 24 );
+    pSlot->payload[ 1 ] = ( uint8_t ) ( sequence >> 16 );
+    pSlot->payload[ 2 ] = ( uint8_t ) ( sequence >> 8 );
+    pSlot->payload[ 3 ] = ( uint8_t ) sequence;
+
+    ( void ) memset( &( pSlot->publishInfo ), 0x00, sizeof( MQTTPublishInfo_t ) );
+    pSlot->publishInfo.qos = ( ( sequence & 1U ) != 0U ) ? MQTTQoS2 : MQTTQoS1;
+    pSlot->publishInfo.pTopicName = ( pSlot->publishInfo.qos == MQTTQoS2 ) ? SOAK_TOPIC_QOS2 : SOAK_TOPIC_QOS1;
+    pSlot->publishInfo.topicNameLength = ( uint16_t ) ( sizeof( SOAK_TOPIC_QOS1 ) - 1U );
+    pSlot->publishInfo.pPayload = pSlot->payload;
+    pSlot->publishInfo.payloadLength = sizeof( pSlot->payload );
+
+    commandInfo.cmdCompleteCallback = commandComplete;
+    commandInfo.pCmdCompleteCallbackContext = &( pSlot->context );
+
+    if( MQTTAgent_Publish( &agentContext, &( pSlot->publishInfo ), &commandInfo ) == MQTTSuccess )
+    {
+        pSlot->inFlight = true;
+        pSlot->reissue = false;
+
+        if( pIssues[ sequence ] < UINT8_MAX )
+        {
+            pIssues[ sequence ]++;
+        }
+    }
+    else if( !pSlot->reissue )
+    {
+        /* Try the same sequence number again next time. */
+        pSlot->reissue = true;
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Move to the next fault profile once the current one has run for its
+ * duration, and to the drain profile at the end of the run.
+ */
+static void advanceSchedule( void )
+{
+    SoakStats_t * pStats = &( stats[ currentProfile ] );
+
+    if( ( currentProfile != SOAK_DRAIN_PROFILE ) &&
+        ( ( virtualTimeMs - profileStartMs ) >= faultSchedule[ currentProfile ].durationMs ) )
+    {
+        pStats->virtualMs += virtualTimeMs - profileStartMs;
+        pStats->drops += networkContext.drops - profileDropsStart;
+        profileStartMs = virtualTimeMs;
+        profileDropsStart = networkContext.drops;
+
+        if( virtualTimeMs >= runEndMs )
+        {
+            /* Stop publishing and drain what is left. */
+            currentProfile = SOAK_DRAIN_PROFILE;
+            issueNew = false;
+        }
+        else
+        {
+            currentProfile = ( currentProfile + 1U ) % SOAK_DRAIN_PROFILE;
+        }
+
+        networkContext.pFaults = &( faultSchedule[ currentProfile ] );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void issueCommands( void )
+{
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    bool idle = true;
+    size_t i;
+
+    for( i = 0; i < SOAK_WINDOW; i++ )
+    {
+        if( !slots[ i ].inFlight && ( slots[ i ].reissue || issueNew ) )
+        {
+            issuePublish( &( slots[ i ] ) );
+        }
+
+        idle = idle && !slots[ i ].inFlight && !slots[ i ].reissue;
+    }
+
+    commandInfo.pCmdCompleteCallbackContext = &subscribeContext;
+
+    if( issueNew && ( ( int32_t ) ( virtualTimeMs - nextSubscribeMs ) >= 0 ) )
+    {
+        /* Subscriptions are not re-issued; a failure just leaves the filter
+         * in whatever state the broker has. */
+        if( subscribeNext )
+        {
+            ( void ) MQTTAgent_Subscribe( &agentContext, &subscribeArgs, &commandInfo );
+        }
+        else
+        {
+            ( void ) MQTTAgent_Unsubscribe( &agentContext, &subscribeArgs, &commandInfo );
+        }
+
+        subscribeNext = !subscribeNext;
+        nextSubscribeMs = virtualTimeMs + SOAK_SUBSCRIBE_INTERVAL_MS;
+    }
+
+    if( !issueNew && idle && !terminating )
+    {
+        terminating = ( MQTTAgent_Terminate( &agentContext, &commandInfo ) == MQTTSuccess );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool receiveCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs )
+{
+    bool received = false;
+
+    ( void ) blockTimeMs;
+
+    if( pMsgCtx->count == 0U )
+    {
+        advanceSchedule();
+        issueCommands();
+    }
+
+    if( pMsgCtx->count > 0U )
+    {
+        *pReceivedCommand = pMsgCtx->pQueue[ pMsgCtx->head ];
+        pMsgCtx->head = ( pMsgCtx->head + 1U ) % SOAK_COMMAND_POOL_SIZE;
+        pMsgCtx->count--;
+        received = true;
+    }
+
+    return received;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check that every acknowledgment the agent and coreMQTT wait for
+ * belongs to a command that has not completed.
+ */
+static void checkPendingAcks( void )
+{
+    const MQTTContext_t * pMqttContext = &( agentContext.mqttContext );
+    uint32_t pending = 0U, queued = 0U, inFlight = 0U;
+    bool found;
+    size_t i, j;
+
+    for( i = 0; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+    {
+        if( agentContext.pPendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID )
+        {
+            if( agentContext.pPendingAcks[ i ].pOriginalCommand->commandType == PUBLISH )
+            {
+                pending++;
+            }
+        }
+    }
+
+    for( i = 0; i < messageContext.count; i++ )
+    {
+        if( messageContext.pQueue[ ( messageContext.head + i ) % SOAK_COMMAND_POOL_SIZE ]->commandType == PUBLISH )
+        {
+            queued++;
+        }
+    }
+
+    for( i = 0; i < SOAK_WINDOW; i++ )
+    {
+        inFlight += slots[ i ].inFlight ? 1U : 0U;
+    }
+
+    if( ( pending + queued ) != inFlight )
+    {
+        fail( "pending publishes do not match publishes in flight", pending + queued );
+    }
+
+    /* A publish record in coreMQTT without a command waiting for it can
+     * never be completed, and takes a slot from every later publish. */
+    for( i = 0; i < pMqttContext->outgoingPublishRecordMaxCount; i++ )
+    {
+        if( pMqttContext->outgoingPublishRecords[ i ].packetId != MQTT_PACKET_ID_INVALID )
+        {
+            found = false;
+
+            for( j = 0; j < MQTT_AGENT_MAX_OUTSTANDING_ACKS; j++ )
+            {
+                found = found || ( agentContext.pPendingAcks[ j ].packetId ==
+                                   pMqttContext->outgoingPublishRecords[ i ].packetId );
+            }
+
+            if( !found )
+            {
+                fail( "coreMQTT publish record outlived its command",
+                      pMqttContext->outgoingPublishRecords[ i ].packetId );
+            }
+        }
+    }
+
+    if( pending > stats[ currentProfile ].pendingAcksMax )
+    {
+        stats[ currentProfile ].pendingAcksMax = pending;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Reconnect after a drop and resume the session, retrying until both
+ * succeed on the faulty link.
+ */
+static void reconnect( void )
+{
+    MQTTConnectInfo_t connectInfo = { 0 };
+    bool sessionPresent = false;
+    bool resumed = false;
+    uint32_t elapsedMs;
+    MQTTStatus_t status;
+
+    connectInfo.cleanSession = false;
+    connectInfo.keepAliveIntervalSec = 60U;
+    connectInfo.pClientIdentifier = "soak";
+    connectInfo.clientIdentifierLength = 4U;
+
+    while( !resumed )
+    {
+        /* Back off for a while before reconnecting. */
+        virtualTimeMs += 10U;
+        agentContext.mqttContext.connectStatus = MQTTNotConnected;
+        brokerAccept();
+        faultTransportConnect( &networkContext );
+
+        status = MQTT_Connect( &( agentContext.mqttContext ), &connectInfo, NULL, 1000U, &sessionPresent );
+
+        if( status == MQTTSuccess )
+        {
+            status = MQTTAgent_ResumeSession( &agentContext, sessionPresent );
+        }
+
+        if( status == MQTTSuccess )
+        {
+            resumed = true;
+        }
+        else if( networkContext.connected )
+        {
+            /* Anything but a dropped connection is a bug. */
+            fail( "reconnect failed without a drop", ( uint32_t ) status );
+        }
+        else
+        {
+            /* Empty else MISRA 15.7 */
+        }
+    }
+
+    elapsedMs = virtualTimeMs - networkContext.dropTimeMs;
+    stats[ currentProfile ].reconnects++;
+    stats[ currentProfile ].reconnectMsTotal += ( double ) elapsedMs;
+
+    if( elapsedMs > stats[ currentProfile ].reconnectMsMax )
+    {
+        stats[ currentProfile ].reconnectMsMax = elapsedMs;
+    }
+
+    checkPendingAcks();
+}
+
+/*-----------------------------------------------------------*/
+
+static void checkDeliveries( void )
+{
+    uint32_t sequence;
+    size_t i;
+
+    for( sequence = 0U; sequence < nextSequence; sequence++ )
+    {
+        if( pDeliveries[ sequence ] == 0U )
+        {
+            fail( "publish never delivered", sequence );
+        }
+
+        if( ( ( sequence & 1U ) != 0U ) && ( pDeliveries[ sequence ] > pIssues[ sequence ] ) )
+        {
+            fail( "QoS 2 publish delivered more often than it was published", sequence );
+        }
+    }
+
+    for( i = 0; i < SOAK_COMMAND_POOL_SIZE; i++ )
+    {
+        if( commandInUse[ i ] )
+        {
+            fail( "command never released", ( uint32_t ) i );
+        }
+    }
+
+    for( i = 0; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+    {
+        if( agentContext.pPendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID )
+        {
+            fail( "acknowledgment left pending", agentContext.pPendingAcks[ i ].packetId );
+        }
+    }
+
+    if( brokerProtocolErrors > 0U )
+    {
+        fail( "malformed packets sent to the broker", brokerProtocolErrors );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void printReport( double wallSeconds )
+{
+    uint32_t completed = 0U;
+    size_t i;
+
+    ( void ) printf( "%-8s %10s %10s %8s %8s %6s %12s %8s %8s\n",
+                     "profile", "virtual s", "publishes", "pub/s", "reissued", "drops", "reconnect ms", "max ms", "max acks" );
+
+    for( i = 0; i < SOAK_PROFILE_COUNT; i++ )
+    {
+        completed += stats[ i ].completed;
+        ( void ) printf( "%-8s %10.1f %10lu %8.0f %8lu %6lu %12.1f %8lu %8lu\n",
+                         faultSchedule[ i ].pName,
+                         ( double ) stats[ i ].virtualMs / 1000.0,
+                         ( unsigned long ) stats[ i ].completed,
+                         ( stats[ i ].virtualMs > 0U ) ? ( ( double ) stats[ i ].completed * 1000.0 / ( double ) stats[ i ].virtualMs ) : 0.0,
+                         ( unsigned long ) stats[ i ].failed,
+                         ( unsigned long ) stats[ i ].drops,
+                         ( stats[ i ].reconnects > 0U ) ? ( stats[ i ].reconnectMsTotal / ( double ) stats[ i ].reconnects ) : 0.0,
+                         ( unsigned long ) stats[ i ].reconnectMsMax,
+                         ( unsigned long ) stats[ i ].pendingAcksMax );
+    }
+
+    ( void ) printf( "%lu publishes (%lu sequence numbers) in %.3f s wall clock: %.0f publishes/s\n",
+                     ( unsigned long ) completed,
+                     ( unsigned long ) nextSequence,
+                     wallSeconds,
+                     ( wallSeconds > 0.0 ) ? ( ( double ) completed / wallSeconds ) : 0.0 );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    MQTTAgentMessageInterface_t messageInterface = { 0 };
+    TransportInterface_t transport = { 0 };
+    MQTTFixedBuffer_t fixedBuffer = { 0 };
+    unsigned long minutes = SOAK_DEFAULT_MINUTES;
+    struct timespec start, end;
+    MQTTStatus_t status;
+    size_t i;
+
+    networkContext.randomState = 1U;
+
+    if( argc > 1 )
+    {
+        minutes = strtoul( argv[ 1 ], NULL, 10 );
+    }
+
+    if( argc > 2 )
+    {
+        networkContext.randomState = ( uint32_t ) strtoul( argv[ 2 ], NULL, 10 );
+    }
+
+    messageInterface.pMsgCtx = &messageContext;
+    messageInterface.send = sendCommand;
+    messageInterface.recv = receiveCommand;
+    messageInterface.getCommand = getCommand;
+    messageInterface.releaseCommand = releaseCommand;
+
+    brokerTransport.pNetworkContext = NULL;
+    brokerTransport.send = brokerSend;
+    brokerTransport.recv = brokerRecv;
+    networkContext.pInner = &brokerTransport;
+    networkContext.pFaults = &( faultSchedule[ 0 ] );
+
+    transport.pNetworkContext = &networkContext;
+    transport.send = faultTransportSend;
+    transport.recv = faultTransportRecv;
+    transport.writev = NULL;
+
+    fixedBuffer.pBuffer = networkBuffer;
+    fixedBuffer.size = sizeof( networkBuffer );
+
+    for( i = 0; i < SOAK_WINDOW; i++ )
+    {
+        slots[ i ].context.slot = i;
+        slots[ i ].context.isPublish = true;
+    }
+
+    subscribeInfo.qos = MQTTQoS1;
+    subscribeInfo.pTopicFilter = SOAK_FILTER;
+    subscribeInfo.topicFilterLength = ( uint16_t ) ( sizeof( SOAK_FILTER ) - 1U );
+    subscribeArgs.pSubscribeInfo = &subscribeInfo;
+    subscribeArgs.numSubscriptions = 1U;
+    subscribeContext.isPublish = false;
+    subscribeNext = true;
+
+    status = MQTTAgent_Init( &agentContext,
+                             &messageInterface,
+                             &fixedBuffer,
+                             &transport,
+                             getTimeMs,
+                             incomingPublish,
+                             NULL );
+
+    if( status != MQTTSuccess )
+    {
+        fail( "MQTTAgent_Init failed", ( uint32_t ) status );
+    }
+
+    runEndMs = ( uint32_t ) ( minutes * 60000UL );
+    issueNew = true;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &start );
+
+    /* The first connection is not a reconnect. */
+    reconnect();
+    ( void ) memset( &( stats[ 0 ] ), 0x00, sizeof( stats[ 0 ] ) );
+
+    /* The command loop only returns once the connection drops, or after the
+     * run is drained and the agent terminated. */
+    for( status = MQTTAgent_CommandLoop( &agentContext );
+         !( ( status == MQTTSuccess ) && terminating );
+         status = MQTTAgent_CommandLoop( &agentContext ) )
+    {
+        if( networkContext.connected )
+        {
+            fail( "command loop failed without a drop", ( uint32_t ) status );
+        }
+
+        reconnect();
+    }
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &end );
+
+    stats[ currentProfile ].virtualMs += virtualTimeMs - profileStartMs;
+    stats[ currentProfile ].drops += networkContext.drops - profileDropsStart;
+
+    checkDeliveries();
+    printReport( ( double ) ( end.tv_sec - start.tv_sec ) +
+                 ( ( double ) ( end.tv_nsec - start.tv_nsec ) / 1e9 ) );
+
+    free( pIssues );
+    free( pDeliveries );
+
+    return 0;
+}
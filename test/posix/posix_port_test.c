@@ -0,0 +1,1612 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file posix_port_test.c
+ * @brief Tests of the POSIX port against the real system calls.
+ *
+ * The port is a thin layer over eventfd, poll and sendmsg, so its behavior
+ * depends on those calls rather than on logic that can be mocked. These tests
+ * run it on a connected pair of local stream sockets, and check
+ *
+ * - that the eventfd of the command queue is readable exactly while the queue
+ *   is not empty, and that a full queue blocks and wakes senders,
+ * - that partial writes by the kernel are reported, and that the bytes of the
+ *   stream arrive in order however they are split, including data held back,
+ * - that packets are held back while further commands are queued, and sent
+ *   with one write once the last of them is received,
+ * - that the slots of a shared queue held by a process that was killed are
+ *   given back, and that a queue left by a process that stopped is replaced,
+ * - that threads waiting on completion groups sharing a futex event sleep
+ *   until the last of their handles completes, and that a wait times out,
+ * - that the publishes saved by a process that was killed are restored from
+ *   its session file, and resent with the DUP flag set unless they were
+ *   acknowledged or did not fit in a slot,
+ * - that a spool keeps publishes while offline and sends them in order, again
+ *   from the oldest one not acknowledged after a failure, at the drain rate,
+ *   that a full spool rejects publishes until its oldest segment is deleted,
+ *   and that the publishes of a process that was killed are sent once the
+ *   spool is opened again.
+ *
+ * Usage: posix_port_test
+ */
+
+/* Enable the POSIX and Linux declarations used by the port. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "core_mqtt_agent.h"
+#include "posix_agent_message.h"
+#include "posix_transport.h"
+#include "posix_shared_queue.h"
+#include "posix_completion.h"
+#include "posix_command_pool.h"
+#include "posix_session_store.h"
+#include "posix_spool.h"
+#include "posix_clock.h"
+
+/**
+ * @brief Number of entries of the command queue under test.
+ */
+#define TEST_QUEUE_LENGTH        ( 2U )
+
+/**
+ * @brief Length of the stream sent to check partial writes. It is far larger
+ * than the socket buffers, so the kernel must split it.
+ */
+#define TEST_STREAM_LENGTH       ( 1024U * 1024U )
+
+/**
+ * @brief Socket buffer size requested on both ends of the pair.
+ */
+#define TEST_SOCKET_BUFFER       ( 4096 )
+
+/**
+ * @brief Size of the buffer data is held back in.
+ */
+#define TEST_SEND_BUFFER_SIZE    ( 64U )
+
+/**
+ * @brief Topic of the publishes to the shared queue.
+ */
+#define TEST_SHARED_TOPIC        "test/shared"
+
+/**
+ * @brief Number of handles of each completion group waited on.
+ */
+#define TEST_COMPLETION_COUNT    ( 64U )
+
+/**
+ * @brief Number of threads waiting on completion groups sharing one event.
+ */
+#define TEST_WAITER_COUNT        ( 2U )
+
+/**
+ * @brief Length of the command queue of the agents set up by the tests.
+ */
+#define TEST_AGENT_QUEUE_LENGTH       ( 16U )
+
+/**
+ * @brief Number of publishes sent by the process whose session is saved.
+ * Publish `i` is sent with packet ID `i + 1`.
+ */
+#define TEST_SESSION_PUBLISH_COUNT    ( 5U )
+
+/**
+ * @brief Length of the payload of the publish that does not fit in a slot of
+ * the session file.
+ */
+#define TEST_SESSION_LARGE_PAYLOAD    ( MQTT_AGENT_POSIX_SESSION_SLOT_SIZE + 64U )
+
+/**
+ * @brief Topic of the publishes to the spools.
+ */
+#define TEST_SPOOL_TOPIC              "test/spool"
+
+/**
+ * @brief Publishes per second sent by a spool whose drain rate is limited.
+ */
+#define TEST_SPOOL_DRAIN_RATE         ( 10U )
+
+/**
+ * @brief Fail the test run if a condition does not hold.
+ */
+#define CHECK( condition )                                                     \
+    do                                                                         \
+    {                                                                          \
+        if( !( condition ) )                                                   \
+        {                                                                      \
+            ( void ) fprintf( stderr, "posix_port_test: %s:%d: CHECK( %s ) failed\n", \
+                              __FILE__, __LINE__, # condition );               \
+            exit( EXIT_FAILURE );                                              \
+        }                                                                      \
+    } while( 0 )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Arguments of a thread sending to a full queue.
+ */
+typedef struct BlockedSend
+{
+    MQTTAgentMessageContext_t * pMsgCtx; /**< @brief Queue to send to. */
+    MQTTAgentCommand_t * pCommand;       /**< @brief Command to send. */
+    bool sent;                           /**< @brief Result of the send. */
+} BlockedSend_t;
+
+/**
+ * @brief A thread waiting for all handles of its completion group.
+ */
+typedef struct CompletionWaiter
+{
+    MQTTAgentCompletionGroup_t group;                             /**< @brief Group of the handles. */
+    MQTTAgentCompletion_t completions[ TEST_COMPLETION_COUNT ];   /**< @brief Handles of the group. */
+    MQTTAgentCommandInfo_t commandInfos[ TEST_COMPLETION_COUNT ]; /**< @brief Completions of the handles, as set by MQTTAgentCompletion_Prepare(). */
+    const MQTTAgentCompletionInterface_t * pCompletionInterface;  /**< @brief Event shared by the groups. */
+    bool prepared;                                                /**< @brief Set once the handles are prepared. */
+    MQTTStatus_t waitStatus;                                      /**< @brief Result of the wait for the group. */
+} CompletionWaiter_t;
+
+/**
+ * @brief An agent connected to a peer that plays the broker. The spool tests
+ * take the commands from its queue and complete them in place of the agent
+ * task.
+ */
+typedef struct TestAgent
+{
+    MQTTAgentContext_t agentContext;                                /**< @brief The agent. */
+    MQTTAgentMessageContext_t messageContext;                       /**< @brief Command queue of the agent. */
+    MQTTAgentCommand_t * queueStorage[ TEST_AGENT_QUEUE_LENGTH ]; /**< @brief Storage of the command queue. */
+    NetworkContext_t networkContext;                                /**< @brief Connection to the peer. */
+    uint8_t networkBuffer[ 256 ];                                   /**< @brief Network buffer of the agent. */
+    PosixSessionStore_t store;                                      /**< @brief Session store of the agent. */
+    int peerFd;                                                     /**< @brief Socket of the peer. */
+} TestAgent_t;
+
+/**
+ * @brief Commands queued by the tests. Only their addresses are used.
+ */
+static MQTTAgentCommand_t commands[ TEST_QUEUE_LENGTH + 1U ];
+
+/**
+ * @brief Pattern of the stream sent to check partial writes.
+ */
+static uint8_t streamOut[ TEST_STREAM_LENGTH ];
+
+/**
+ * @brief Bytes of the stream received by the peer.
+ */
+static uint8_t streamIn[ TEST_STREAM_LENGTH ];
+
+/**
+ * @brief Publishes sent by the process whose session is saved.
+ */
+static MQTTPublishInfo_t sessionPublishes[ TEST_SESSION_PUBLISH_COUNT ];
+
+/**
+ * @brief Payload of the publish that does not fit in a slot.
+ */
+static uint8_t largePayload[ TEST_SESSION_LARGE_PAYLOAD ];
+
+/**
+ * @brief Set to stop the process on the next send, as if it crashed while a
+ * publish was being sent.
+ */
+static bool crashOnSend = false;
+
+/**
+ * @brief Session callback of the store, called by keepAckedSlot().
+ */
+static MQTTAgentSessionCallback_t storeCallback = NULL;
+
+/**
+ * @brief Packet ID of the publish whose slot is not freed when it is
+ * acknowledged, as if the process stopped just before.
+ */
+static uint16_t keptPacketId = MQTT_PACKET_ID_INVALID;
+
+/**
+ * @brief Set once the slot of #keptPacketId was kept.
+ */
+static bool slotKept = false;
+
+/**
+ * @brief Payload of a publish that does not fit in a spool segment.
+ */
+static uint8_t spoolLargePayload[ MQTT_AGENT_POSIX_SPOOL_SEGMENT_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Whether a descriptor is readable, without waiting.
+ */
+static bool isReadable( int fd )
+{
+    struct pollfd pollFd;
+
+    pollFd.fd = fd;
+    pollFd.events = POLLIN;
+    pollFd.revents = 0;
+
+    return ( poll( &pollFd, 1, 0 ) == 1 ) && ( ( pollFd.revents & POLLIN ) != 0 );
+}
+
+/**
+ * @brief Connect a pair of non-blocking local stream sockets with small
+ * buffers, and set up a network context on the first.
+ */
+static void connectPair( NetworkContext_t * pNetworkContext,
+                         int * pPeerFd )
+{
+    int fds[ 2 ];
+    int bufferSize = TEST_SOCKET_BUFFER;
+
+    CHECK( socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds ) == 0 );
+    CHECK( setsockopt( fds[ 0 ], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof( bufferSize ) ) == 0 );
+    CHECK( setsockopt( fds[ 1 ], SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof( bufferSize ) ) == 0 );
+
+    ( void ) memset( pNetworkContext, 0x00, sizeof( NetworkContext_t ) );
+    pNetworkContext->socketFd = fds[ 0 ];
+    pNetworkContext->sendTimeoutMs = 10U;
+    *pPeerFd = fds[ 1 ];
+}
+
+/**
+ * @brief Read everything available on the peer, appending it to a buffer.
+ *
+ * @return The number of bytes read.
+ */
+static size_t drainPeer( int peerFd,
+                         uint8_t * pBuffer,
+                         size_t bufferSize )
+{
+    size_t total = 0U;
+    ssize_t bytesRead = 1;
+
+    while( ( bytesRead > 0 ) && ( total < bufferSize ) )
+    {
+        bytesRead = recv( peerFd, &( pBuffer[ total ] ), bufferSize - total, MSG_DONTWAIT );
+
+        if( bytesRead > 0 )
+        {
+            total += ( size_t ) bytesRead;
+        }
+    }
+
+    CHECK( ( bytesRead >= 0 ) || ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) );
+
+    return total;
+}
+
+/**
+ * @brief Send to a full queue, waiting for space.
+ */
+static void * sendBlocked( void * pArgument )
+{
+    BlockedSend_t * pSend = ( BlockedSend_t * ) pArgument;
+
+    pSend->sent = PosixAgentMessage_Send( pSend->pMsgCtx, &( pSend->pCommand ), 5000U );
+
+    return NULL;
+}
+
+/**
+ * @brief Incoming publish callback of the agents set up by the tests, which
+ * receive none.
+ */
+static void ignorePublish( MQTTAgentContext_t * pMqttAgentContext,
+                           uint16_t packetId,
+                           MQTTPublishInfo_t * pPublishInfo )
+{
+    ( void ) pMqttAgentContext;
+    ( void ) packetId;
+    ( void ) pPublishInfo;
+}
+
+/**
+ * @brief Send of the transport, which stops the process once #crashOnSend is
+ * set.
+ */
+static int32_t sendOrCrash( NetworkContext_t * pNetworkContext,
+                            const void * pBuffer,
+                            size_t bytesToSend )
+{
+    if( crashOnSend )
+    {
+        abort();
+    }
+
+    return PosixTransport_Send( pNetworkContext, pBuffer, bytesToSend );
+}
+
+/**
+ * @brief Writev of the transport, which stops the process once #crashOnSend is
+ * set.
+ */
+static int32_t writevOrCrash( NetworkContext_t * pNetworkContext,
+                              TransportOutVector_t * pIoVec,
+                              size_t ioVecCount )
+{
+    if( crashOnSend )
+    {
+        abort();
+    }
+
+    return PosixTransport_Writev( pNetworkContext, pIoVec, ioVecCount );
+}
+
+/**
+ * @brief Session callback passing everything to the store, except that the
+ * slot of #keptPacketId is not freed.
+ */
+static void keepAckedSlot( void * pSessionContext,
+                           uint16_t packetId,
+                           const MQTTPublishInfo_t * pPublishInfo )
+{
+    if( ( pPublishInfo == NULL ) && ( packetId == keptPacketId ) )
+    {
+        slotKept = true;
+    }
+    else
+    {
+        storeCallback( pSessionContext, packetId, pPublishInfo );
+    }
+}
+
+/**
+ * @brief Set up an agent on a connected pair of sockets. Its commands are
+ * taken from the command pool.
+ */
+static void initTestAgent( TestAgent_t * pAgent )
+{
+    MQTTAgentMessageInterface_t messageInterface;
+    TransportInterface_t transport;
+    MQTTFixedBuffer_t fixedBuffer;
+    int bufferSize = TEST_SOCKET_BUFFER * 16;
+
+    ( void ) memset( pAgent, 0x00, sizeof( TestAgent_t ) );
+    ( void ) memset( &transport, 0x00, sizeof( transport ) );
+
+    /* The publishes of a resumed session are sent before the peer reads any
+     * of them, and each write takes far more of the send buffer than its
+     * length, so the buffer is enlarged. */
+    connectPair( &( pAgent->networkContext ), &( pAgent->peerFd ) );
+    CHECK( setsockopt( pAgent->networkContext.socketFd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof( bufferSize ) ) == 0 );
+    CHECK( PosixAgentMessage_Init( &( pAgent->messageContext ), pAgent->queueStorage, TEST_AGENT_QUEUE_LENGTH ) );
+
+    messageInterface.pMsgCtx = &( pAgent->messageContext );
+    messageInterface.send = PosixAgentMessage_Send;
+    messageInterface.recv = PosixAgentMessage_Recv;
+    messageInterface.getCommand = PosixCommandPool_GetCommand;
+    messageInterface.releaseCommand = PosixCommandPool_ReleaseCommand;
+
+    transport.pNetworkContext = &( pAgent->networkContext );
+    transport.send = sendOrCrash;
+    transport.recv = PosixTransport_Recv;
+    transport.writev = writevOrCrash;
+
+    fixedBuffer.pBuffer = pAgent->networkBuffer;
+    fixedBuffer.size = sizeof( pAgent->networkBuffer );
+
+    CHECK( MQTTAgent_Init( &( pAgent->agentContext ),
+                           &messageInterface,
+                           &fixedBuffer,
+                           &transport,
+                           PosixClock_GetTimeMs,
+                           ignorePublish,
+                           NULL ) == MQTTSuccess );
+}
+
+/**
+ * @brief Close the sockets and command queue of an agent.
+ */
+static void cleanupTestAgent( TestAgent_t * pAgent )
+{
+    PosixAgentMessage_Cleanup( &( pAgent->messageContext ) );
+    ( void ) close( pAgent->networkContext.socketFd );
+    ( void ) close( pAgent->peerFd );
+}
+
+/**
+ * @brief Set up an agent, open its session file, and connect it to the peer
+ * with a clean session flag of `false`.
+ */
+static void openSessionAgent( TestAgent_t * pAgent,
+                              const char * pPath,
+                              bool sessionPresent )
+{
+    MQTTConnectInfo_t connectInfo;
+    uint8_t connAck[ 4 ] = { 0x20U, 0x02U, 0x00U, 0x00U };
+    uint8_t peerBuffer[ 64 ];
+    bool present = !sessionPresent;
+
+    initTestAgent( pAgent );
+    CHECK( PosixSessionStore_Open( &( pAgent->store ), pPath, &( pAgent->agentContext ) ) );
+
+    /* The peer answers the CONNECT before it is sent. */
+    connAck[ 2 ] = sessionPresent ? 0x01U : 0x00U;
+    CHECK( send( pAgent->peerFd, connAck, sizeof( connAck ), MSG_NOSIGNAL ) == ( ssize_t ) sizeof( connAck ) );
+
+    ( void ) memset( &connectInfo, 0x00, sizeof( connectInfo ) );
+    connectInfo.cleanSession = false;
+    connectInfo.pClientIdentifier = "session";
+    connectInfo.clientIdentifierLength = ( uint16_t ) ( sizeof( "session" ) - 1U );
+    CHECK( MQTT_Connect( &( pAgent->agentContext.mqttContext ), &connectInfo, NULL, 1000U, &present ) == MQTTSuccess );
+    CHECK( present == sessionPresent );
+    CHECK( drainPeer( pAgent->peerFd, peerBuffer, sizeof( peerBuffer ) ) > 0U );
+}
+
+/**
+ * @brief Step an agent whose session is saved once, and drain what it sent.
+ *
+ * @return The number of bytes the peer received.
+ */
+static size_t stepSessionAgent( TestAgent_t * pAgent,
+                                uint8_t * pPeerBuffer,
+                                size_t peerBufferSize )
+{
+    uint32_t waitTimeMs = 0U;
+    bool endLoop = false;
+
+    CHECK( MQTTAgent_Step( &( pAgent->agentContext ), &waitTimeMs, &endLoop ) == MQTTSuccess );
+    CHECK( !endLoop );
+
+    return drainPeer( pAgent->peerFd, pPeerBuffer, peerBufferSize );
+}
+
+/**
+ * @brief Publish from an agent whose session is saved, and wait until it was
+ * sent.
+ */
+static void publishSaved( TestAgent_t * pAgent,
+                          size_t publishIndex )
+{
+    static uint8_t peerBuffer[ TEST_SESSION_LARGE_PAYLOAD + 64U ];
+    MQTTAgentCommandInfo_t commandInfo;
+    size_t received = 0U;
+    size_t i;
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    CHECK( MQTTAgent_Publish( &( pAgent->agentContext ), &( sessionPublishes[ publishIndex ] ), &commandInfo ) == MQTTSuccess );
+
+    for( i = 0U; ( i < 1000U ) && ( received == 0U ); i++ )
+    {
+        received = stepSessionAgent( pAgent, peerBuffer, sizeof( peerBuffer ) );
+    }
+
+    CHECK( received > sessionPublishes[ publishIndex ].payloadLength );
+}
+
+/**
+ * @brief Count the segment files in a spool directory.
+ */
+static size_t countSegmentFiles( const char * pDirectory )
+{
+    DIR * pDir;
+    const struct dirent * pDirEntry;
+    size_t count = 0U;
+
+    pDir = opendir( pDirectory );
+    CHECK( pDir != NULL );
+
+    for( pDirEntry = readdir( pDir ); pDirEntry != NULL; pDirEntry = readdir( pDir ) )
+    {
+        if( strncmp( pDirEntry->d_name, "spool-", 6U ) == 0 )
+        {
+            count++;
+        }
+    }
+
+    ( void ) closedir( pDir );
+
+    return count;
+}
+
+/**
+ * @brief Delete a spool directory and the files in it.
+ */
+static void removeSpoolDirectory( const char * pDirectory )
+{
+    DIR * pDir;
+    const struct dirent * pDirEntry;
+
+    pDir = opendir( pDirectory );
+    CHECK( pDir != NULL );
+
+    for( pDirEntry = readdir( pDir ); pDirEntry != NULL; pDirEntry = readdir( pDir ) )
+    {
+        if( pDirEntry->d_name[ 0 ] != '.' )
+        {
+            CHECK( unlinkat( dirfd( pDir ), pDirEntry->d_name, 0 ) == 0 );
+        }
+    }
+
+    ( void ) closedir( pDir );
+    CHECK( rmdir( pDirectory ) == 0 );
+}
+
+/**
+ * @brief Publish through a spool a QoS 1 publish whose payload is its number.
+ * The publish does not outlive the call, so it must be spooled.
+ */
+static MQTTStatus_t spoolPublish( PosixSpool_t * pSpool,
+                                  size_t number )
+{
+    MQTTAgentCommandInfo_t commandInfo;
+    MQTTPublishInfo_t publishInfo;
+    char payload[ 16 ];
+
+    ( void ) snprintf( payload, sizeof( payload ), "%08lx", ( unsigned long ) number );
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS1;
+    publishInfo.pTopicName = TEST_SPOOL_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( TEST_SPOOL_TOPIC ) - 1U );
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = strlen( payload );
+
+    return PosixSpool_Publish( pSpool, &publishInfo, &commandInfo );
+}
+
+/**
+ * @brief Take the next command from the queue of an agent, in place of the
+ * agent task, and check that it sends the spooled publish of a number.
+ */
+static MQTTAgentCommand_t * takeSpooledPublish( TestAgent_t * pAgent,
+                                                size_t number )
+{
+    MQTTAgentCommand_t * pCommand = NULL;
+    const MQTTPublishInfo_t * pPublishInfo;
+    char payload[ 16 ];
+
+    ( void ) snprintf( payload, sizeof( payload ), "%08lx", ( unsigned long ) number );
+
+    CHECK( PosixAgentMessage_Recv( &( pAgent->messageContext ), &pCommand, 0U ) );
+    CHECK( pCommand->commandType == PUBLISH );
+    CHECK( pCommand->callerOwned );
+
+    pPublishInfo = ( const MQTTPublishInfo_t * ) pCommand->pArgs;
+    CHECK( pPublishInfo->qos == MQTTQoS1 );
+    CHECK( pPublishInfo->topicNameLength == ( sizeof( TEST_SPOOL_TOPIC ) - 1U ) );
+    CHECK( memcmp( pPublishInfo->pTopicName, TEST_SPOOL_TOPIC, pPublishInfo->topicNameLength ) == 0 );
+    CHECK( pPublishInfo->payloadLength == strlen( payload ) );
+    CHECK( memcmp( pPublishInfo->pPayload, payload, pPublishInfo->payloadLength ) == 0 );
+
+    return pCommand;
+}
+
+/**
+ * @brief Complete a command in place of the agent task.
+ */
+static void completeCommand( MQTTAgentCommand_t * pCommand,
+                             MQTTStatus_t returnCode )
+{
+    MQTTAgentReturnInfo_t returnInfo;
+
+    ( void ) memset( &returnInfo, 0x00, sizeof( returnInfo ) );
+    returnInfo.returnCode = returnCode;
+
+    CHECK( pCommand->pCommandCompleteCallback != NULL );
+    pCommand->pCommandCompleteCallback( pCommand->pCmdContext, &returnInfo );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The eventfd is readable exactly while commands are queued, commands
+ * are received in order, and a sender waiting on a full queue is woken.
+ */
+static void testQueueEventFd( void )
+{
+    MQTTAgentMessageContext_t msgCtx;
+    MQTTAgentCommand_t * queueStorage[ TEST_QUEUE_LENGTH ];
+    MQTTAgentCommand_t * pCommand = NULL;
+    BlockedSend_t blockedSend;
+    pthread_t thread;
+    size_t i;
+
+    CHECK( PosixAgentMessage_Init( &msgCtx, queueStorage, TEST_QUEUE_LENGTH ) );
+    CHECK( !isReadable( msgCtx.eventFd ) );
+
+    /* The eventfd becomes readable with the first command, and stays so while
+     * any remain. */
+    pCommand = &( commands[ 0 ] );
+    CHECK( PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    CHECK( isReadable( msgCtx.eventFd ) );
+    pCommand = &( commands[ 1 ] );
+    CHECK( PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    CHECK( isReadable( msgCtx.eventFd ) );
+
+    /* A full queue rejects a send that does not wait. */
+    pCommand = &( commands[ 2 ] );
+    CHECK( !PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    CHECK( !PosixAgentMessage_Send( &msgCtx, &pCommand, 20U ) );
+
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( pCommand == &( commands[ 0 ] ) );
+    CHECK( isReadable( msgCtx.eventFd ) );
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( pCommand == &( commands[ 1 ] ) );
+    CHECK( !isReadable( msgCtx.eventFd ) );
+
+    /* An empty queue times out, and stays empty. */
+    CHECK( !PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( !PosixAgentMessage_Recv( &msgCtx, &pCommand, 20U ) );
+    CHECK( !isReadable( msgCtx.eventFd ) );
+
+    /* The ring wraps around, and a sender blocked on a full queue is woken by
+     * a receive. */
+    for( i = 0U; i < TEST_QUEUE_LENGTH; i++ )
+    {
+        pCommand = &( commands[ i ] );
+        CHECK( PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    }
+
+    blockedSend.pMsgCtx = &msgCtx;
+    blockedSend.pCommand = &( commands[ TEST_QUEUE_LENGTH ] );
+    blockedSend.sent = false;
+    CHECK( pthread_create( &thread, NULL, sendBlocked, &blockedSend ) == 0 );
+
+    ( void ) usleep( 20000U );
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( pCommand == &( commands[ 0 ] ) );
+    CHECK( pthread_join( thread, NULL ) == 0 );
+    CHECK( blockedSend.sent );
+
+    for( i = 1U; i <= TEST_QUEUE_LENGTH; i++ )
+    {
+        CHECK( isReadable( msgCtx.eventFd ) );
+        CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+        CHECK( pCommand == &( commands[ i ] ) );
+    }
+
+    CHECK( !isReadable( msgCtx.eventFd ) );
+
+    PosixAgentMessage_Cleanup( &msgCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A send larger than the socket buffers is split by the kernel. The
+ * transport reports the bytes written, returns 0 when the peer is full, and
+ * the stream arrives intact, including data held back before a direct send.
+ */
+static void testTransportPartialWrites( void )
+{
+    NetworkContext_t networkContext;
+    uint8_t sendBuffer[ TEST_SEND_BUFFER_SIZE ];
+    TransportOutVector_t ioVectors[ 3 ];
+    int peerFd;
+    size_t sent = 0U;
+    size_t received = 0U;
+    size_t heldLength = 0U;
+    int32_t result;
+    size_t i;
+
+    for( i = 0U; i < TEST_STREAM_LENGTH; i++ )
+    {
+        streamOut[ i ] = ( uint8_t ) ( ( i * 7U ) + ( i >> 8 ) );
+    }
+
+    connectPair( &networkContext, &peerFd );
+
+    /* The first write fills the socket buffers, and is partial. */
+    result = PosixTransport_Send( &networkContext, streamOut, TEST_STREAM_LENGTH );
+    CHECK( result > 0 );
+    CHECK( ( size_t ) result < TEST_STREAM_LENGTH );
+    sent = ( size_t ) result;
+
+    /* With the peer full, a send times out without failing. */
+    CHECK( PosixTransport_Send( &networkContext, &( streamOut[ sent ] ), TEST_STREAM_LENGTH - sent ) == 0 );
+
+    /* Vectored sends continue the stream wherever the kernel split it. */
+    while( sent < ( TEST_STREAM_LENGTH / 2U ) )
+    {
+        received += drainPeer( peerFd, &( streamIn[ received ] ), TEST_STREAM_LENGTH - received );
+
+        ioVectors[ 0 ].iov_base = &( streamOut[ sent ] );
+        ioVectors[ 0 ].iov_len = 100U;
+        ioVectors[ 1 ].iov_base = &( streamOut[ sent + 100U ] );
+        ioVectors[ 1 ].iov_len = 1U;
+        ioVectors[ 2 ].iov_base = &( streamOut[ sent + 101U ] );
+        ioVectors[ 2 ].iov_len = 9000U;
+
+        result = PosixTransport_Writev( &networkContext, ioVectors, 3U );
+        CHECK( result >= 0 );
+        CHECK( ( size_t ) result <= 9101U );
+        sent += ( size_t ) result;
+    }
+
+    /* Data held back goes out before the data of a direct send, and only the
+     * bytes of the direct send beyond it are reported. */
+    CHECK( PosixTransport_SetSendBuffer( &networkContext, sendBuffer, sizeof( sendBuffer ) ) == POSIX_TRANSPORT_SUCCESS );
+
+    while( sent < TEST_STREAM_LENGTH )
+    {
+        received += drainPeer( peerFd, &( streamIn[ received ] ), TEST_STREAM_LENGTH - received );
+
+        if( ( heldLength == 0U ) && ( ( TEST_STREAM_LENGTH - sent ) > TEST_SEND_BUFFER_SIZE ) )
+        {
+            networkContext.holdSends = true;
+            result = PosixTransport_Send( &networkContext, &( streamOut[ sent ] ), 40U );
+            CHECK( result == 40 );
+            CHECK( networkContext.heldLength == 40U );
+            sent += 40U;
+            heldLength = 40U;
+            networkContext.holdSends = false;
+        }
+
+        result = PosixTransport_Send( &networkContext, &( streamOut[ sent ] ), TEST_STREAM_LENGTH - sent );
+        CHECK( result >= 0 );
+        CHECK( ( result == 0 ) || ( networkContext.heldLength == 0U ) );
+        heldLength = networkContext.heldLength;
+        sent += ( size_t ) result;
+    }
+
+    CHECK( PosixTransport_Flush( &networkContext ) == POSIX_TRANSPORT_SUCCESS );
+
+    while( received < TEST_STREAM_LENGTH )
+    {
+        received += drainPeer( peerFd, &( streamIn[ received ] ), TEST_STREAM_LENGTH - received );
+    }
+
+    CHECK( memcmp( streamIn, streamOut, TEST_STREAM_LENGTH ) == 0 );
+
+    /* A closed peer is a failure, not a timeout. */
+    ( void ) close( peerFd );
+    CHECK( PosixTransport_Send( &networkContext, streamOut, 1U ) < 0 );
+
+    CHECK( PosixTransport_Disconnect( &networkContext ) == POSIX_TRANSPORT_SUCCESS );
+    CHECK( networkContext.socketFd == -1 );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Packets sent while further commands are queued are held back, the
+ * receive that follows each is skipped, and everything is sent with one write
+ * when the queue is found empty, before the buffer overflows, or on
+ * disconnect.
+ */
+static void testHoldAndFlush( void )
+{
+    MQTTAgentMessageContext_t msgCtx;
+    MQTTAgentCommand_t * queueStorage[ TEST_QUEUE_LENGTH ];
+    MQTTAgentCommand_t * pCommand = NULL;
+    NetworkContext_t networkContext;
+    uint8_t sendBuffer[ TEST_SEND_BUFFER_SIZE ];
+    uint8_t packet[ TEST_SEND_BUFFER_SIZE ];
+    uint8_t peerBuffer[ 4U * TEST_SEND_BUFFER_SIZE ];
+    uint8_t recvBuffer[ 8 ];
+    int peerFd;
+    size_t i;
+
+    for( i = 0U; i < sizeof( packet ); i++ )
+    {
+        packet[ i ] = ( uint8_t ) i;
+    }
+
+    connectPair( &networkContext, &peerFd );
+    CHECK( PosixTransport_SetSendBuffer( &networkContext, sendBuffer, sizeof( sendBuffer ) ) == POSIX_TRANSPORT_SUCCESS );
+    CHECK( PosixAgentMessage_Init( &msgCtx, queueStorage, TEST_QUEUE_LENGTH ) );
+    PosixAgentMessage_WatchConnection( &msgCtx, &networkContext );
+
+    /* Nothing is held without further commands queued. */
+    pCommand = &( commands[ 0 ] );
+    CHECK( PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( !networkContext.holdSends );
+    CHECK( PosixTransport_Send( &networkContext, packet, 4U ) == 4 );
+    CHECK( networkContext.heldLength == 0U );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 4U );
+
+    /* The packets of the first of two queued commands are held back, and the
+     * receive made by the process loop after them is skipped once. */
+    for( i = 0U; i < TEST_QUEUE_LENGTH; i++ )
+    {
+        pCommand = &( commands[ i ] );
+        CHECK( PosixAgentMessage_Send( &msgCtx, &pCommand, 0U ) );
+    }
+
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( networkContext.holdSends );
+    CHECK( PosixTransport_Send( &networkContext, packet, 10U ) == 10 );
+    CHECK( networkContext.heldLength == 10U );
+    CHECK( PosixTransport_Recv( &networkContext, recvBuffer, sizeof( recvBuffer ) ) == 0 );
+    CHECK( !isReadable( peerFd ) );
+
+    /* A second receive, as coreMQTT makes while waiting for an
+     * acknowledgment, sends the data held back first. */
+    CHECK( PosixTransport_Recv( &networkContext, recvBuffer, sizeof( recvBuffer ) ) == 0 );
+    CHECK( networkContext.heldLength == 0U );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 10U );
+    CHECK( memcmp( peerBuffer, packet, 10U ) == 0 );
+
+    /* A packet that does not fit is written together with the data held back,
+     * in order. */
+    CHECK( PosixTransport_Send( &networkContext, packet, 40U ) == 40 );
+    CHECK( networkContext.heldLength == 40U );
+    CHECK( PosixTransport_Send( &networkContext, &( packet[ 40 ] ), 24U ) == 24 );
+    CHECK( networkContext.heldLength == 64U );
+    CHECK( PosixTransport_Send( &networkContext, packet, 1U ) == 1 );
+    CHECK( networkContext.heldLength == 0U );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 65U );
+    CHECK( memcmp( peerBuffer, packet, 64U ) == 0 );
+    CHECK( peerBuffer[ 64 ] == packet[ 0 ] );
+
+    /* The last queued command is sent directly, after what is held back. */
+    CHECK( PosixTransport_Send( &networkContext, packet, 3U ) == 3 );
+    CHECK( PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( !networkContext.holdSends );
+    CHECK( PosixTransport_Send( &networkContext, &( packet[ 3 ] ), 5U ) == 5 );
+    CHECK( networkContext.heldLength == 0U );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 8U );
+    CHECK( memcmp( peerBuffer, packet, 8U ) == 0 );
+
+    /* Data held back is flushed when the agent finds the queue empty. */
+    networkContext.holdSends = true;
+    CHECK( PosixTransport_Send( &networkContext, packet, 6U ) == 6 );
+    CHECK( !isReadable( peerFd ) );
+    CHECK( !PosixAgentMessage_Recv( &msgCtx, &pCommand, 0U ) );
+    CHECK( networkContext.heldLength == 0U );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 6U );
+
+    /* A wait for a command ends early when the peer sends data. */
+    CHECK( send( peerFd, packet, 1U, MSG_NOSIGNAL ) == 1 );
+    CHECK( !PosixAgentMessage_Recv( &msgCtx, &pCommand, 5000U ) );
+    CHECK( PosixTransport_Recv( &networkContext, recvBuffer, sizeof( recvBuffer ) ) == 1 );
+
+    /* Data held back is sent before the connection is closed. */
+    networkContext.holdSends = true;
+    CHECK( PosixTransport_Send( &networkContext, packet, 7U ) == 7 );
+    CHECK( PosixTransport_Disconnect( &networkContext ) == POSIX_TRANSPORT_SUCCESS );
+    CHECK( drainPeer( peerFd, peerBuffer, sizeof( peerBuffer ) ) == 7U );
+
+    PosixAgentMessage_WatchConnection( &msgCtx, NULL );
+    PosixAgentMessage_Cleanup( &msgCtx );
+    ( void ) close( peerFd );
+}
+
+/**
+ * @brief Publish to a shared queue that is not served, holding a slot until
+ * the process is killed.
+ */
+static void * publishShared( void * pArgument )
+{
+    MQTTPublishInfo_t publishInfo;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.pTopicName = TEST_SHARED_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( TEST_SHARED_TOPIC ) - 1U );
+
+    ( void ) PosixSharedQueue_Publish( ( PosixSharedQueueClient_t * ) pArgument, &publishInfo, 60000U );
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The slots of a killed process are given back, and a queue whose
+ * creator stopped without destroying it is replaced, but not one whose creator
+ * runs.
+ */
+static void testSharedQueueReclaim( void )
+{
+    static PosixSharedQueueServer_t server;
+    static PosixSharedQueueServer_t otherServer;
+    static MQTTAgentContext_t agentContext;
+    PosixSharedQueueClient_t client;
+    pthread_t threads[ MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH ];
+    MQTTPublishInfo_t publishInfo;
+    MQTTStatus_t status = MQTTNoDataAvailable;
+    char name[ 64 ];
+    pid_t childPid;
+    int childStatus;
+    size_t i;
+
+    ( void ) snprintf( name, sizeof( name ), "/mqtt-agent-port-test-%ld", ( long ) getpid() );
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.pTopicName = TEST_SHARED_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( TEST_SHARED_TOPIC ) - 1U );
+
+    /* A process that creates the queue and stops leaves the object behind. */
+    childPid = fork();
+    CHECK( childPid >= 0 );
+
+    if( childPid == 0 )
+    {
+        _exit( PosixSharedQueue_Create( &server, name, 0600, &agentContext ) ? 0 : 1 );
+    }
+
+    CHECK( waitpid( childPid, &childStatus, 0 ) == childPid );
+    CHECK( WIFEXITED( childStatus ) && ( WEXITSTATUS( childStatus ) == 0 ) );
+
+    CHECK( PosixSharedQueue_Create( &server, name, 0600, &agentContext ) );
+    CHECK( !PosixSharedQueue_Create( &otherServer, name, 0600, &agentContext ) );
+
+    /* Nothing serves the queue, so the publishes of the child hold their
+     * slots until it is killed. */
+    childPid = fork();
+    CHECK( childPid >= 0 );
+
+    if( childPid == 0 )
+    {
+        CHECK( PosixSharedQueue_Open( &client, name ) );
+
+        for( i = 0U; i < MQTT_AGENT_POSIX_SHARED_QUEUE_LENGTH; i++ )
+        {
+            CHECK( pthread_create( &( threads[ i ] ), NULL, publishShared, &client ) == 0 );
+        }
+
+        ( void ) pause();
+        _exit( 0 );
+    }
+
+    CHECK( PosixSharedQueue_Open( &client, name ) );
+
+    /* A publish that takes a free slot is withdrawn at once. */
+    for( i = 0U; ( i < 5000U ) && ( status != MQTTNoMemory ); i++ )
+    {
+        status = PosixSharedQueue_Publish( &client, &publishInfo, 0U );
+        CHECK( ( status == MQTTNoDataAvailable ) || ( status == MQTTNoMemory ) );
+        ( void ) usleep( 1000U );
+    }
+
+    CHECK( status == MQTTNoMemory );
+
+    CHECK( kill( childPid, SIGKILL ) == 0 );
+    CHECK( waitpid( childPid, &childStatus, 0 ) == childPid );
+
+    CHECK( PosixSharedQueue_Publish( &client, &publishInfo, 0U ) == MQTTNoDataAvailable );
+
+    PosixSharedQueue_Close( &client );
+    PosixSharedQueue_Destroy( &server );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Prepare the handles of a group, then wait for all of them.
+ */
+static void * waitForGroup( void * pArgument )
+{
+    CompletionWaiter_t * pWaiter = ( CompletionWaiter_t * ) pArgument;
+    size_t i;
+
+    CHECK( MQTTAgentCompletionGroup_Init( &( pWaiter->group ), pWaiter->pCompletionInterface, PosixClock_GetTimeMs ) == MQTTSuccess );
+
+    for( i = 0U; i < TEST_COMPLETION_COUNT; i++ )
+    {
+        CHECK( MQTTAgentCompletion_Prepare( &( pWaiter->completions[ i ] ),
+                                            &( pWaiter->group ),
+                                            &( pWaiter->commandInfos[ i ] ) ) == MQTTSuccess );
+    }
+
+    __atomic_store_n( &( pWaiter->prepared ), true, __ATOMIC_RELEASE );
+    pWaiter->waitStatus = MQTTAgentCompletionGroup_Wait( &( pWaiter->group ), 10000U );
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Threads waiting on groups that share a futex event sleep until the
+ * last of their handles completes, and a wait that sees no completion times
+ * out.
+ */
+static void testCompletionGroupWait( void )
+{
+    static CompletionWaiter_t waiters[ TEST_WAITER_COUNT ];
+    MQTTAgentCompletionEventContext_t eventCtx;
+    MQTTAgentCompletionInterface_t completionInterface;
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completion;
+    MQTTAgentCommandInfo_t commandInfo;
+    MQTTAgentReturnInfo_t returnInfo;
+    pthread_t threads[ TEST_WAITER_COUNT ];
+    uint32_t startTimeMs;
+    size_t i;
+    size_t j;
+
+    PosixCompletion_Init( &eventCtx, &completionInterface );
+
+    for( j = 0U; j < TEST_WAITER_COUNT; j++ )
+    {
+        ( void ) memset( &( waiters[ j ] ), 0x00, sizeof( CompletionWaiter_t ) );
+        waiters[ j ].pCompletionInterface = &completionInterface;
+        waiters[ j ].waitStatus = MQTTIllegalState;
+        CHECK( pthread_create( &( threads[ j ] ), NULL, waitForGroup, &( waiters[ j ] ) ) == 0 );
+    }
+
+    /* Both threads are on the event before anything completes. */
+    for( i = 0U; ( i < 5000U ) && ( __atomic_load_n( &( eventCtx.waiterCount ), __ATOMIC_SEQ_CST ) < TEST_WAITER_COUNT ); i++ )
+    {
+        ( void ) usleep( 1000U );
+    }
+
+    CHECK( eventCtx.waiterCount == TEST_WAITER_COUNT );
+
+    for( j = 0U; j < TEST_WAITER_COUNT; j++ )
+    {
+        CHECK( __atomic_load_n( &( waiters[ j ].prepared ), __ATOMIC_ACQUIRE ) );
+    }
+
+    /* Complete the handles of the groups in turn, as the agent thread would.
+     * Each completion wakes both threads, which go back to sleep until the
+     * last handle of their group. */
+    ( void ) memset( &returnInfo, 0x00, sizeof( returnInfo ) );
+
+    for( i = 0U; i < TEST_COMPLETION_COUNT; i++ )
+    {
+        for( j = 0U; j < TEST_WAITER_COUNT; j++ )
+        {
+            returnInfo.returnCode = ( ( i % 2U ) == 0U ) ? MQTTSuccess : MQTTSendFailed;
+            waiters[ j ].commandInfos[ i ].cmdCompleteCallback( waiters[ j ].commandInfos[ i ].pCmdCompleteCallbackContext,
+                                                                &returnInfo );
+        }
+
+        if( ( i + 1U ) < TEST_COMPLETION_COUNT )
+        {
+            CHECK( waiters[ 0 ].waitStatus == MQTTIllegalState );
+        }
+
+        ( void ) usleep( 100U );
+    }
+
+    for( j = 0U; j < TEST_WAITER_COUNT; j++ )
+    {
+        CHECK( pthread_join( threads[ j ], NULL ) == 0 );
+        CHECK( waiters[ j ].waitStatus == MQTTSuccess );
+
+        for( i = 0U; i < TEST_COMPLETION_COUNT; i++ )
+        {
+            CHECK( waiters[ j ].completions[ i ].returnCode == ( ( ( i % 2U ) == 0U ) ? MQTTSuccess : MQTTSendFailed ) );
+        }
+    }
+
+    CHECK( eventCtx.waiterCount == 0U );
+
+    /* A handle that does not complete ends the wait at the timeout. */
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    CHECK( MQTTAgentCompletionGroup_Init( &group, &completionInterface, PosixClock_GetTimeMs ) == MQTTSuccess );
+    CHECK( MQTTAgentCompletion_Prepare( &completion, &group, &commandInfo ) == MQTTSuccess );
+
+    startTimeMs = PosixClock_GetTimeMs();
+    CHECK( MQTTAgentCompletionGroup_Wait( &group, 50U ) == MQTTNoDataAvailable );
+    CHECK( ( PosixClock_GetTimeMs() - startTimeMs ) >= 50U );
+    CHECK( eventCtx.waiterCount == 0U );
+
+    CHECK( MQTTAgentCompletion_Abort( &completion, MQTTSendFailed ) == MQTTSuccess );
+    CHECK( MQTTAgentCompletionGroup_Wait( &group, 0U ) == MQTTSuccess );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A process saving its session is killed while publishes are in
+ * flight. Reopening the file restores the publishes not acknowledged and the
+ * next packet ID, and resuming the session resends exactly those publishes,
+ * with the DUP flag set, dropping the one acknowledged before the process
+ * stopped and the one that did not fit in a slot.
+ */
+static void testSessionStoreRestart( void )
+{
+    static TestAgent_t agent;
+    static uint8_t peerBuffer[ 1024 ];
+    static const char * const topics[ TEST_SESSION_PUBLISH_COUNT ] =
+    {
+        "test/session/qos1", "test/session/qos2", "test/session/large",
+        "test/session/acked", "test/session/crash"
+    };
+    static const MQTTQoS_t qos[ TEST_SESSION_PUBLISH_COUNT ] =
+    {
+        MQTTQoS1, MQTTQoS2, MQTTQoS1, MQTTQoS1, MQTTQoS2
+    };
+    uint8_t pubAck[ 4 ] = { 0x40U, 0x02U, 0x00U, 0x04U };
+    bool resent[ TEST_SESSION_PUBLISH_COUNT ] = { false };
+    struct rlimit coreLimit;
+    char path[ 64 ];
+    pid_t childPid;
+    int childStatus;
+    size_t received = 0U;
+    size_t offset = 0U;
+    size_t remainingLength;
+    size_t topicLength;
+    size_t index;
+    uint16_t packetId;
+    size_t i;
+
+    ( void ) snprintf( path, sizeof( path ), "/tmp/mqtt-agent-port-test-%ld.session", ( long ) getpid() );
+    ( void ) unlink( path );
+
+    ( void ) memset( largePayload, 'x', sizeof( largePayload ) );
+    ( void ) memset( sessionPublishes, 0x00, sizeof( sessionPublishes ) );
+
+    for( i = 0U; i < TEST_SESSION_PUBLISH_COUNT; i++ )
+    {
+        sessionPublishes[ i ].qos = qos[ i ];
+        sessionPublishes[ i ].pTopicName = topics[ i ];
+        sessionPublishes[ i ].topicNameLength = ( uint16_t ) strlen( topics[ i ] );
+        sessionPublishes[ i ].pPayload = topics[ i ];
+        sessionPublishes[ i ].payloadLength = strlen( topics[ i ] );
+    }
+
+    sessionPublishes[ 2 ].pPayload = largePayload;
+    sessionPublishes[ 2 ].payloadLength = sizeof( largePayload );
+
+    childPid = fork();
+    CHECK( childPid >= 0 );
+
+    if( childPid == 0 )
+    {
+        coreLimit.rlim_cur = 0;
+        coreLimit.rlim_max = 0;
+        ( void ) setrlimit( RLIMIT_CORE, &coreLimit );
+
+        openSessionAgent( &agent, path, false );
+
+        /* The slot of the fourth publish is kept when its PUBACK is received,
+         * as if the process stopped after coreMQTT removed its record but
+         * before the agent completed it. */
+        storeCallback = agent.agentContext.pSessionCallback;
+        keptPacketId = 4U;
+        CHECK( MQTTAgent_SetSessionCallback( &( agent.agentContext ), keepAckedSlot, &( agent.store ) ) == MQTTSuccess );
+
+        for( i = 0U; i < 4U; i++ )
+        {
+            publishSaved( &agent, i );
+        }
+
+        CHECK( agent.store.unsavedCount == 1U );
+
+        CHECK( send( agent.peerFd, pubAck, sizeof( pubAck ), MSG_NOSIGNAL ) == ( ssize_t ) sizeof( pubAck ) );
+
+        for( i = 0U; ( i < 1000U ) && !slotKept; i++ )
+        {
+            ( void ) stepSessionAgent( &agent, peerBuffer, sizeof( peerBuffer ) );
+        }
+
+        CHECK( slotKept );
+
+        /* The last publish is saved, and its record reserved, before the
+         * process stops in the middle of sending it. */
+        crashOnSend = true;
+        publishSaved( &agent, 4U );
+        _exit( EXIT_FAILURE );
+    }
+
+    CHECK( waitpid( childPid, &childStatus, 0 ) == childPid );
+    CHECK( WIFSIGNALED( childStatus ) && ( WTERMSIG( childStatus ) == SIGABRT ) );
+
+    openSessionAgent( &agent, path, true );
+    CHECK( agent.store.restoredCount == 3U );
+    CHECK( agent.agentContext.mqttContext.nextPacketId == ( uint16_t ) ( TEST_SESSION_PUBLISH_COUNT + 1U ) );
+
+    /* The record of the publish that was not saved is removed, since it
+     * cannot be resent. */
+    for( i = 0U; i < agent.agentContext.mqttContext.outgoingPublishRecordMaxCount; i++ )
+    {
+        packetId = agent.agentContext.mqttContext.outgoingPublishRecords[ i ].packetId;
+        CHECK( ( packetId != 3U ) && ( packetId != 4U ) );
+    }
+
+    CHECK( MQTTAgent_ResumeSession( &( agent.agentContext ), true ) == MQTTSuccess );
+    received = drainPeer( agent.peerFd, peerBuffer, sizeof( peerBuffer ) );
+
+    /* Each publish is resent once, with the DUP flag set, its QoS, and the
+     * topic and payload it was saved with. The remaining lengths are below
+     * 128, so they take one byte. */
+    while( offset < received )
+    {
+        CHECK( ( offset + 4U ) < received );
+        CHECK( ( peerBuffer[ offset ] & 0xF8U ) == 0x38U );
+        remainingLength = peerBuffer[ offset + 1U ];
+        CHECK( remainingLength < 128U );
+        CHECK( ( offset + 2U + remainingLength ) <= received );
+
+        topicLength = ( ( size_t ) peerBuffer[ offset + 2U ] << 8 ) | peerBuffer[ offset + 3U ];
+        CHECK( ( topicLength + 4U ) <= remainingLength );
+        packetId = ( uint16_t ) ( ( ( uint16_t ) peerBuffer[ offset + 4U + topicLength ] << 8 ) |
+                                  peerBuffer[ offset + 5U + topicLength ] );
+        CHECK( ( packetId >= 1U ) && ( packetId <= TEST_SESSION_PUBLISH_COUNT ) );
+
+        index = ( size_t ) packetId - 1U;
+        CHECK( !resent[ index ] );
+        resent[ index ] = true;
+
+        CHECK( ( ( peerBuffer[ offset ] >> 1 ) & 0x03U ) == ( uint8_t ) qos[ index ] );
+        CHECK( topicLength == sessionPublishes[ index ].topicNameLength );
+        CHECK( memcmp( &( peerBuffer[ offset + 4U ] ), topics[ index ], topicLength ) == 0 );
+        CHECK( ( remainingLength - topicLength - 4U ) == sessionPublishes[ index ].payloadLength );
+        CHECK( memcmp( &( peerBuffer[ offset + 6U + topicLength ] ),
+                       sessionPublishes[ index ].pPayload,
+                       sessionPublishes[ index ].payloadLength ) == 0 );
+
+        offset += 2U + remainingLength;
+    }
+
+    CHECK( resent[ 0 ] && resent[ 1 ] && resent[ 4 ] );
+    CHECK( !resent[ 2 ] && !resent[ 3 ] );
+
+    PosixSessionStore_Close( &( agent.store ) );
+    cleanupTestAgent( &agent );
+    CHECK( unlink( path ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Publishes are spooled while offline and while earlier ones are not
+ * acknowledged, and sent in order. A failed publish is sent again, with the
+ * others not acknowledged, once none is in flight. The drain rate lets a burst
+ * through after an idle period, then spaces the publishes out.
+ */
+static void testSpoolDrain( void )
+{
+    static TestAgent_t agent;
+    static PosixSpool_t spool;
+    static MQTTPublishInfo_t directPublish;
+    MQTTAgentCommand_t * sent[ MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ];
+    MQTTAgentCommand_t * pCommand = NULL;
+    MQTTAgentCommandInfo_t commandInfo;
+    char directory[] = "/tmp/mqtt-agent-port-test-spool-XXXXXX";
+    uint32_t startTimeMs;
+    size_t i;
+
+    CHECK( mkdtemp( directory ) != NULL );
+    initTestAgent( &agent );
+    CHECK( PosixSpool_Open( &spool, directory, &( agent.agentContext ) ) );
+    CHECK( countSegmentFiles( directory ) == 0U );
+
+    /* Offline, publishes are appended to a segment, and none is sent. */
+    for( i = 0U; i < 6U; i++ )
+    {
+        CHECK( spoolPublish( &spool, i ) == MQTTSuccess );
+    }
+
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 6U );
+    CHECK( countSegmentFiles( directory ) == 1U );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 0U );
+    CHECK( !isReadable( agent.messageContext.eventFd ) );
+
+    /* Online, a publish follows those still spooled, and they are sent in
+     * order. */
+    PosixSpool_SetOnline( &spool, true );
+    CHECK( spoolPublish( &spool, 6U ) == MQTTSuccess );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 7U );
+
+    for( i = 0U; i < 7U; i++ )
+    {
+        sent[ i ] = takeSpooledPublish( &agent, i );
+    }
+
+    CHECK( !isReadable( agent.messageContext.eventFd ) );
+
+    /* Nothing is sent again while publishes sent before a failure are in
+     * flight. Then the publishes not acknowledged are sent from the oldest. */
+    completeCommand( sent[ 0 ], MQTTSuccess );
+    completeCommand( sent[ 1 ], MQTTSendFailed );
+    completeCommand( sent[ 2 ], MQTTSuccess );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 0U );
+
+    completeCommand( sent[ 3 ], MQTTRecvFailed );
+
+    for( i = 4U; i < 7U; i++ )
+    {
+        completeCommand( sent[ i ], MQTTSuccess );
+    }
+
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 2U );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 2U );
+    completeCommand( takeSpooledPublish( &agent, 1U ), MQTTSuccess );
+    completeCommand( takeSpooledPublish( &agent, 3U ), MQTTSuccess );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 0U );
+
+    /* Once all are acknowledged, the only segment is started over rather than
+     * deleted, and a publish is sent directly. */
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 0U );
+    CHECK( countSegmentFiles( directory ) == 1U );
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    ( void ) memset( &directPublish, 0x00, sizeof( directPublish ) );
+    directPublish.qos = MQTTQoS1;
+    directPublish.pTopicName = TEST_SPOOL_TOPIC;
+    directPublish.topicNameLength = ( uint16_t ) ( sizeof( TEST_SPOOL_TOPIC ) - 1U );
+    CHECK( PosixSpool_Publish( &spool, &directPublish, &commandInfo ) == MQTTSuccess );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 0U );
+    CHECK( PosixAgentMessage_Recv( &( agent.messageContext ), &pCommand, 0U ) );
+    CHECK( pCommand->pArgs == &directPublish );
+    CHECK( PosixCommandPool_ReleaseCommand( pCommand ) );
+
+    /* The limiter is full after an idle period, so as many publishes as may
+     * be in flight are sent at once, and the next one only after a period of
+     * the drain rate. */
+    PosixSpool_SetOnline( &spool, false );
+
+    for( i = 0U; i < ( MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT + 2U ); i++ )
+    {
+        CHECK( spoolPublish( &spool, 10U + i ) == MQTTSuccess );
+    }
+
+    PosixSpool_SetOnline( &spool, true );
+    startTimeMs = PosixClock_GetTimeMs();
+    PosixSpool_SetDrainRate( &spool, TEST_SPOOL_DRAIN_RATE );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT );
+
+    for( i = 0U; i < MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT; i++ )
+    {
+        completeCommand( takeSpooledPublish( &agent, 10U + i ), MQTTSuccess );
+    }
+
+    CHECK( PosixSpool_Drain( &spool, 5000U ) == 1U );
+    CHECK( ( PosixClock_GetTimeMs() - startTimeMs ) >= ( 1000U / TEST_SPOOL_DRAIN_RATE ) );
+    completeCommand( takeSpooledPublish( &agent, 10U + MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ), MQTTSuccess );
+
+    PosixSpool_SetDrainRate( &spool, 0U );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 1U );
+    completeCommand( takeSpooledPublish( &agent, 11U + MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ), MQTTSuccess );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 0U );
+
+    PosixSpool_Close( &spool );
+    cleanupTestAgent( &agent );
+    removeSpoolDirectory( directory );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A full spool rejects publishes, and a publish larger than a segment
+ * is never spooled. Segments are deleted once all their publishes are
+ * acknowledged, which makes room for more.
+ */
+static void testSpoolFull( void )
+{
+    static TestAgent_t agent;
+    static PosixSpool_t spool;
+    MQTTAgentCommandInfo_t commandInfo;
+    MQTTPublishInfo_t publishInfo;
+    MQTTStatus_t status = MQTTSuccess;
+    char directory[] = "/tmp/mqtt-agent-port-test-spool-XXXXXX";
+    bool roomMade = false;
+    size_t total = 0U;
+    size_t next = 0U;
+    size_t sentCount;
+    size_t i;
+
+    CHECK( mkdtemp( directory ) != NULL );
+    initTestAgent( &agent );
+    CHECK( PosixSpool_Open( &spool, directory, &( agent.agentContext ) ) );
+
+    while( status == MQTTSuccess )
+    {
+        status = spoolPublish( &spool, total );
+
+        if( status == MQTTSuccess )
+        {
+            total++;
+        }
+    }
+
+    CHECK( status == MQTTNoMemory );
+    CHECK( total > MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS );
+    CHECK( countSegmentFiles( directory ) == MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == total );
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS1;
+    publishInfo.pTopicName = TEST_SPOOL_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( TEST_SPOOL_TOPIC ) - 1U );
+    publishInfo.pPayload = spoolLargePayload;
+    publishInfo.payloadLength = sizeof( spoolLargePayload );
+    CHECK( PosixSpool_Publish( &spool, &publishInfo, &commandInfo ) == MQTTBadParameter );
+
+    /* The oldest segment is deleted by the drain that follows the
+     * acknowledgment of its last publish, and a publish is then accepted
+     * into a new segment. */
+    PosixSpool_SetOnline( &spool, true );
+
+    while( next < total )
+    {
+        sentCount = PosixSpool_Drain( &spool, 0U );
+        CHECK( sentCount > 0U );
+
+        for( i = 0U; i < sentCount; i++ )
+        {
+            completeCommand( takeSpooledPublish( &agent, next ), MQTTSuccess );
+            next++;
+        }
+
+        if( !roomMade && ( countSegmentFiles( directory ) < MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS ) )
+        {
+            CHECK( spoolPublish( &spool, total ) == MQTTSuccess );
+            CHECK( countSegmentFiles( directory ) == MQTT_AGENT_POSIX_SPOOL_MAX_SEGMENTS );
+            total++;
+            roomMade = true;
+        }
+    }
+
+    CHECK( roomMade );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 0U );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 0U );
+    CHECK( countSegmentFiles( directory ) == 1U );
+
+    PosixSpool_Close( &spool );
+    cleanupTestAgent( &agent );
+    removeSpoolDirectory( directory );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The spool of a process killed with publishes in flight is opened
+ * again. The publishes not acknowledged are sent in order, including those in
+ * flight, and neither a record written past the end of a segment nor a
+ * segment whose creation was interrupted is read back.
+ */
+static void testSpoolReopen( void )
+{
+    static TestAgent_t agent;
+    static PosixSpool_t spool;
+    MQTTAgentCommand_t * sent[ MQTT_AGENT_POSIX_SPOOL_MAX_IN_FLIGHT ];
+    struct rlimit coreLimit;
+    char directory[] = "/tmp/mqtt-agent-port-test-spool-XXXXXX";
+    char path[ 128 ];
+    struct
+    {
+        uint32_t length;
+        uint32_t state;
+        uint32_t payloadLength;
+        uint16_t topicLength;
+        uint8_t qos;
+        uint8_t retain;
+        char data[ 16 ];
+    } tornRecord;
+    uint32_t writeOffset;
+    pid_t childPid;
+    int childStatus;
+    int fileDescriptor;
+    size_t i;
+
+    CHECK( mkdtemp( directory ) != NULL );
+
+    childPid = fork();
+    CHECK( childPid >= 0 );
+
+    if( childPid == 0 )
+    {
+        coreLimit.rlim_cur = 0;
+        coreLimit.rlim_max = 0;
+        ( void ) setrlimit( RLIMIT_CORE, &coreLimit );
+
+        initTestAgent( &agent );
+        CHECK( PosixSpool_Open( &spool, directory, &( agent.agentContext ) ) );
+
+        for( i = 0U; i < 6U; i++ )
+        {
+            CHECK( spoolPublish( &spool, i ) == MQTTSuccess );
+        }
+
+        PosixSpool_SetOnline( &spool, true );
+        CHECK( PosixSpool_Drain( &spool, 0U ) == 6U );
+
+        for( i = 0U; i < 6U; i++ )
+        {
+            sent[ i ] = takeSpooledPublish( &agent, i );
+        }
+
+        completeCommand( sent[ 0 ], MQTTSuccess );
+        completeCommand( sent[ 2 ], MQTTSuccess );
+        abort();
+    }
+
+    CHECK( waitpid( childPid, &childStatus, 0 ) == childPid );
+    CHECK( WIFSIGNALED( childStatus ) && ( WTERMSIG( childStatus ) == SIGABRT ) );
+    CHECK( countSegmentFiles( directory ) == 1U );
+
+    /* A process stopped in the middle of an append leaves a record past the
+     * write offset, which is the third word of the segment. The record is laid
+     * out as in posix_spool.c, and would be read back as a pending publish. */
+    ( void ) memset( &tornRecord, 0x00, sizeof( tornRecord ) );
+    tornRecord.length = ( uint32_t ) sizeof( tornRecord );
+    tornRecord.state = 1U;
+    tornRecord.payloadLength = 6U;
+    tornRecord.topicLength = ( uint16_t ) ( sizeof( TEST_SPOOL_TOPIC ) - 1U );
+    tornRecord.qos = ( uint8_t ) MQTTQoS1;
+    ( void ) memcpy( tornRecord.data, TEST_SPOOL_TOPIC "000000", sizeof( tornRecord.data ) );
+
+    ( void ) snprintf( path, sizeof( path ), "%s/spool-00000000.seg", directory );
+    fileDescriptor = open( path, O_RDWR | O_CLOEXEC );
+    CHECK( fileDescriptor >= 0 );
+    CHECK( pread( fileDescriptor, &writeOffset, sizeof( writeOffset ), 8 ) == ( ssize_t ) sizeof( writeOffset ) );
+    CHECK( pwrite( fileDescriptor, &tornRecord, sizeof( tornRecord ), ( off_t ) writeOffset ) == ( ssize_t ) sizeof( tornRecord ) );
+    ( void ) close( fileDescriptor );
+
+    /* A process stopped while creating a segment leaves an empty file. */
+    ( void ) snprintf( path, sizeof( path ), "%s/spool-00000001.seg", directory );
+    fileDescriptor = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+    CHECK( fileDescriptor >= 0 );
+    ( void ) close( fileDescriptor );
+
+    initTestAgent( &agent );
+    CHECK( PosixSpool_Open( &spool, directory, &( agent.agentContext ) ) );
+    CHECK( countSegmentFiles( directory ) == 1U );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 4U );
+
+    PosixSpool_SetOnline( &spool, true );
+    CHECK( PosixSpool_Drain( &spool, 0U ) == 4U );
+    completeCommand( takeSpooledPublish( &agent, 1U ), MQTTSuccess );
+    completeCommand( takeSpooledPublish( &agent, 3U ), MQTTSuccess );
+    completeCommand( takeSpooledPublish( &agent, 4U ), MQTTSuccess );
+    completeCommand( takeSpooledPublish( &agent, 5U ), MQTTSuccess );
+    CHECK( !isReadable( agent.messageContext.eventFd ) );
+    CHECK( PosixSpool_GetPendingCount( &spool ) == 0U );
+
+    PosixSpool_Close( &spool );
+    cleanupTestAgent( &agent );
+    removeSpoolDirectory( directory );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    CHECK( PosixCommandPool_Init() );
+
+    testQueueEventFd();
+    testTransportPartialWrites();
+    testHoldAndFlush();
+    testSharedQueueReclaim();
+    testCompletionGroupWait();
+    testSessionStoreRestart();
+    testSpoolDrain();
+    testSpoolFull();
+    testSpoolReopen();
+
+    ( void ) printf( "posix_port_test: all tests passed\n" );
+
+    return EXIT_SUCCESS;
+}
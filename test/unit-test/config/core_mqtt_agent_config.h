@@ -1,2 +1,13 @@
-/* An empty config file for the unit test to compile with the default
- * definitions of configuration macros. */
+/* Config file for the unit test. Configuration macros not defined here keep
+ * their default definitions. The tests are built twice: with the defaults,
+ * and with MQTT_AGENT_UNIT_TEST_ALL_FEATURES defined, which enables every
+ * optional feature so that it is covered by the tests. */
+
+#ifdef MQTT_AGENT_UNIT_TEST_ALL_FEATURES
+    #define MQTT_AGENT_CONFLATION_LOOKAHEAD              ( 4U )
+    #define MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS       ( 4U )
+    #define MQTT_AGENT_MAX_SUBSCRIPTIONS                 ( 4U )
+    #define MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS            ( 8U )
+    #define MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH    ( 8U )
+    #define MQTT_AGENT_MAX_STEP_COMMANDS                 ( 2U )
+#endif
@@ -0,0 +1,596 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file mqtt_agent_batch_utest.c
+ * @brief Unit tests for functions in core_mqtt_agent_batch.h
+ */
+#include <string.h>
+#include <stdbool.h>
+
+#include "unity.h"
+
+/* Include paths for public enums, structures, and macros. */
+
+#include "mock_core_mqtt.h"
+#include "mock_core_mqtt_state.h"
+#include "mock_core_mqtt_agent.h"
+#include "core_mqtt_agent_batch.h"
+
+/**
+ * @brief Command callback context.
+ */
+struct MQTTAgentCommandContext
+{
+    MQTTStatus_t returnStatus;
+    uint32_t completeCount;
+};
+
+/**
+ * @brief Size of the buffer of each envelope in the tests.
+ */
+#define TEST_ENVELOPE_SIZE    ( 16U )
+
+/**
+ * @brief Topic of the batch in the tests.
+ */
+#define TEST_TOPIC            "sensors/readings"
+
+/**
+ * @brief Buffer of the batch in the tests.
+ */
+static uint8_t batchBuffer[ 2U * TEST_ENVELOPE_SIZE ];
+
+/**
+ * @brief Current time returned by stubGetTime.
+ */
+static uint32_t globalTimeMs;
+
+/**
+ * @brief Number of calls to MQTTAgent_Publish_EnvelopeStub.
+ */
+static uint32_t envelopeCount;
+
+/**
+ * @brief Publish of the last envelope seen by MQTTAgent_Publish_EnvelopeStub.
+ */
+static MQTTPublishInfo_t * pEnvelopePublishInfo;
+
+/**
+ * @brief Command information of the last envelope seen by
+ * MQTTAgent_Publish_EnvelopeStub.
+ */
+static MQTTAgentCommandInfo_t envelopeCommandInfo;
+
+/**
+ * @brief Status returned by MQTTAgent_Publish_EnvelopeStub.
+ */
+static MQTTStatus_t envelopeStatus;
+
+/* ============================   UNITY FIXTURES ============================ */
+
+/* Called before each test method. */
+void setUp()
+{
+    globalTimeMs = 0U;
+    envelopeCount = 0U;
+    pEnvelopePublishInfo = NULL;
+    ( void ) memset( &envelopeCommandInfo, 0x00, sizeof( envelopeCommandInfo ) );
+    envelopeStatus = MQTTSuccess;
+    ( void ) memset( batchBuffer, 0x00, sizeof( batchBuffer ) );
+}
+
+/* Called after each test method. */
+void tearDown()
+{
+}
+
+/* Called at the beginning of the whole suite. */
+void suiteSetUp()
+{
+}
+
+/* Called at the end of the whole suite. */
+int suiteTearDown( int numFailures )
+{
+    return numFailures;
+}
+
+/* ========================================================================== */
+
+/**
+ * @brief A mocked time function returning #globalTimeMs.
+ */
+static uint32_t stubGetTime( void )
+{
+    return globalTimeMs;
+}
+
+/**
+ * @brief A mock completion callback counting its calls in its context.
+ */
+static void stubCompletionCallback( MQTTAgentCommandContext_t * pCommandCompletionContext,
+                                    MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    pCommandCompletionContext->returnStatus = pReturnInfo->returnCode;
+    pCommandCompletionContext->completeCount++;
+}
+
+/**
+ * @brief A stub for MQTTAgent_Publish() recording the envelope sent.
+ */
+static MQTTStatus_t MQTTAgent_Publish_EnvelopeStub( const MQTTAgentContext_t * pMqttAgentContext,
+                                                    MQTTPublishInfo_t * pPublishInfo,
+                                                    const MQTTAgentCommandInfo_t * pCommandInfo,
+                                                    int numCalls )
+{
+    ( void ) pMqttAgentContext;
+    ( void ) numCalls;
+
+    envelopeCount++;
+    pEnvelopePublishInfo = pPublishInfo;
+    envelopeCommandInfo = *pCommandInfo;
+
+    return envelopeStatus;
+}
+
+/**
+ * @brief Complete the last envelope sent with the given return code.
+ */
+static void completeEnvelope( MQTTStatus_t returnCode )
+{
+    MQTTAgentReturnInfo_t returnInfo = { 0 };
+
+    returnInfo.returnCode = returnCode;
+    envelopeCommandInfo.cmdCompleteCallback( envelopeCommandInfo.pCmdCompleteCallbackContext, &returnInfo );
+}
+
+/**
+ * @brief Initialize a batch for the tests.
+ */
+static void setupBatch( MQTTAgentBatch_t * pBatch,
+                        MQTTAgentContext_t * pAgentContext,
+                        uint32_t maxDelayMs )
+{
+    MQTTPublishInfo_t publishInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    pAgentContext->mqttContext.getTime = stubGetTime;
+    publishInfo.pTopicName = TEST_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) strlen( TEST_TOPIC );
+    publishInfo.qos = MQTTQoS1;
+
+    mqttStatus = MQTTAgentBatch_Init( pBatch,
+                                      pAgentContext,
+                                      &publishInfo,
+                                      batchBuffer,
+                                      sizeof( batchBuffer ),
+                                      maxDelayMs );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    MQTTAgent_Publish_Stub( MQTTAgent_Publish_EnvelopeStub );
+}
+
+/* ========================================================================== */
+
+/**
+ * @brief Test MQTTAgentBatch_Init() with invalid parameters.
+ */
+void test_MQTTAgentBatch_Init_Invalid_Params( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTPublishInfo_t publishInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    publishInfo.pTopicName = TEST_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) strlen( TEST_TOPIC );
+
+    mqttStatus = MQTTAgentBatch_Init( NULL, &agentContext, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Init( &batch, NULL, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, NULL, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, NULL, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* No time function. */
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    agentContext.mqttContext.getTime = stubGetTime;
+
+    /* Buffer too small for two envelopes holding an empty message each. */
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, batchBuffer,
+                                      2U * MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    publishInfo.topicNameLength = 0U;
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    publishInfo.topicNameLength = ( uint16_t ) strlen( TEST_TOPIC );
+    publishInfo.pTopicName = NULL;
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Valid parameters. */
+    publishInfo.pTopicName = TEST_TOPIC;
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, batchBuffer, sizeof( batchBuffer ), 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( TEST_ENVELOPE_SIZE, batch.envelopeSize );
+    TEST_ASSERT_EQUAL_PTR( batchBuffer, batch.envelopes[ 0 ].publishInfo.pPayload );
+    TEST_ASSERT_EQUAL_PTR( &batchBuffer[ TEST_ENVELOPE_SIZE ], batch.envelopes[ 1 ].publishInfo.pPayload );
+    TEST_ASSERT_EQUAL_PTR( TEST_TOPIC, batch.envelopes[ 1 ].publishInfo.pTopicName );
+}
+
+/**
+ * @brief Test MQTTAgentBatch_Add(), MQTTAgentBatch_Flush() and
+ * MQTTAgentBatch_FlushIfDue() with invalid parameters.
+ */
+void test_MQTTAgentBatch_Add_Invalid_Params( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    uint8_t message[ TEST_ENVELOPE_SIZE ] = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupBatch( &batch, &agentContext, 100U );
+
+    mqttStatus = MQTTAgentBatch_Add( NULL, message, 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Add( &batch, NULL, 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Add( &batch, message, 1U, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* A message which cannot fit in an empty envelope. */
+    mqttStatus = MQTTAgentBatch_Add( &batch, message, TEST_ENVELOPE_SIZE - MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE + 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Flush( NULL, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_FlushIfDue( NULL, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    TEST_ASSERT_EQUAL( 0U, batch.fillCount );
+    TEST_ASSERT_EQUAL( 0U, envelopeCount );
+}
+
+/**
+ * @brief Test that an envelope is sent when the next message does not fit,
+ * and that each message is completed with its envelope.
+ */
+void test_MQTTAgentBatch_Add_flush_by_size( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTAgentCommandContext_t messageContexts[ 3 ] = { 0 };
+    const uint8_t expectedEnvelope[] = { 0x00, 0x05, 'f', 'i', 'r', 's', 't', 0x00, 0x06, 's', 'e', 'c', 'o', 'n', 'd' };
+    MQTTStatus_t mqttStatus;
+    size_t i;
+
+    setupBatch( &batch, &agentContext, 100U );
+    commandInfo.cmdCompleteCallback = stubCompletionCallback;
+
+    commandInfo.pCmdCompleteCallbackContext = &messageContexts[ 0 ];
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "first", 5U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    commandInfo.pCmdCompleteCallbackContext = &messageContexts[ 1 ];
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "second", 6U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, envelopeCount );
+
+    /* 15 of 16 bytes are used, so the third message goes to the next envelope. */
+    commandInfo.pCmdCompleteCallbackContext = &messageContexts[ 2 ];
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "third", 5U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, envelopeCount );
+    TEST_ASSERT_EQUAL_PTR( &( batch.envelopes[ 0 ].publishInfo ), pEnvelopePublishInfo );
+    TEST_ASSERT_EQUAL( sizeof( expectedEnvelope ), pEnvelopePublishInfo->payloadLength );
+    TEST_ASSERT_EQUAL_MEMORY( expectedEnvelope, pEnvelopePublishInfo->pPayload, sizeof( expectedEnvelope ) );
+    TEST_ASSERT_TRUE( batch.envelopes[ 0 ].inFlight );
+    TEST_ASSERT_EQUAL( 1U, batch.fillCount );
+
+    /* Acknowledging the envelope completes its two messages only. */
+    completeEnvelope( MQTTSuccess );
+
+    for( i = 0U; i < 2U; i++ )
+    {
+        TEST_ASSERT_EQUAL( 1U, messageContexts[ i ].completeCount );
+        TEST_ASSERT_EQUAL( MQTTSuccess, messageContexts[ i ].returnStatus );
+    }
+
+    TEST_ASSERT_EQUAL( 0U, messageContexts[ 2 ].completeCount );
+    TEST_ASSERT_FALSE( batch.envelopes[ 0 ].inFlight );
+
+    /* The second envelope is sent on flush, and its completion is passed on. */
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, envelopeCount );
+    TEST_ASSERT_EQUAL_PTR( &( batch.envelopes[ 1 ].publishInfo ), pEnvelopePublishInfo );
+    TEST_ASSERT_EQUAL( 7U, pEnvelopePublishInfo->payloadLength );
+
+    completeEnvelope( MQTTRecvFailed );
+    TEST_ASSERT_EQUAL( 1U, messageContexts[ 2 ].completeCount );
+    TEST_ASSERT_EQUAL( MQTTRecvFailed, messageContexts[ 2 ].returnStatus );
+
+    /* Nothing left to flush. */
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, envelopeCount );
+}
+
+/**
+ * @brief Test that an envelope is sent when it has the maximum number of
+ * messages.
+ */
+void test_MQTTAgentBatch_Add_flush_by_count( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTPublishInfo_t publishInfo = { 0 };
+    static uint8_t largeBuffer[ 2U * MQTT_AGENT_BATCH_MAX_MESSAGES * 4U ];
+    MQTTStatus_t mqttStatus;
+    size_t i;
+
+    agentContext.mqttContext.getTime = stubGetTime;
+    publishInfo.pTopicName = TEST_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) strlen( TEST_TOPIC );
+    mqttStatus = MQTTAgentBatch_Init( &batch, &agentContext, &publishInfo, largeBuffer, sizeof( largeBuffer ), 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    MQTTAgent_Publish_Stub( MQTTAgent_Publish_EnvelopeStub );
+
+    for( i = 0U; i <= MQTT_AGENT_BATCH_MAX_MESSAGES; i++ )
+    {
+        mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "x", 1U, &commandInfo );
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    }
+
+    TEST_ASSERT_EQUAL( 1U, envelopeCount );
+    TEST_ASSERT_EQUAL( MQTT_AGENT_BATCH_MAX_MESSAGES, batch.envelopes[ 0 ].messageCount );
+    TEST_ASSERT_EQUAL( MQTT_AGENT_BATCH_MAX_MESSAGES * 3U, pEnvelopePublishInfo->payloadLength );
+    TEST_ASSERT_EQUAL( 1U, batch.fillCount );
+}
+
+/**
+ * @brief Test that an envelope is sent once the delay of the batch has passed.
+ */
+void test_MQTTAgentBatch_flush_by_time( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupBatch( &batch, &agentContext, 100U );
+
+    /* Nothing is due without messages. */
+    globalTimeMs = 1000U;
+    mqttStatus = MQTTAgentBatch_FlushIfDue( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, envelopeCount );
+
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "a", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    globalTimeMs = 1099U;
+    mqttStatus = MQTTAgentBatch_FlushIfDue( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, envelopeCount );
+
+    globalTimeMs = 1100U;
+    mqttStatus = MQTTAgentBatch_FlushIfDue( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, envelopeCount );
+
+    /* A message added after the delay of the first one sends the envelope,
+     * including across a wrap of the time. */
+    globalTimeMs = UINT32_MAX - 10U;
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "b", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, envelopeCount );
+
+    globalTimeMs = 89U;
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "c", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, envelopeCount );
+    TEST_ASSERT_EQUAL( 2U, batch.envelopes[ 1 ].messageCount );
+    TEST_ASSERT_EQUAL( 0U, batch.fillCount );
+}
+
+/**
+ * @brief Test that messages are refused while both envelopes are being sent,
+ * and that an envelope which could not be sent is kept.
+ */
+void test_MQTTAgentBatch_envelopes_busy( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupBatch( &batch, &agentContext, 100U );
+
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "a", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* The envelope could not be enqueued, so it is kept. */
+    envelopeStatus = MQTTNoMemory;
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTNoMemory, mqttStatus );
+    TEST_ASSERT_FALSE( batch.envelopes[ 0 ].inFlight );
+    TEST_ASSERT_EQUAL( 1U, batch.fillCount );
+    TEST_ASSERT_EQUAL( 0U, batch.fillIndex );
+
+    envelopeStatus = MQTTSuccess;
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "b", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( batch.envelopes[ 0 ].inFlight );
+    TEST_ASSERT_TRUE( batch.envelopes[ 1 ].inFlight );
+
+    /* Both envelopes are in flight. */
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "c", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTNoMemory, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, batch.fillCount );
+
+    /* Completing the first envelope frees it for new messages. */
+    batch.envelopes[ 0 ].inFlight = false;
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "c", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, batch.fillCount );
+    TEST_ASSERT_EQUAL( 'c', batchBuffer[ MQTT_AGENT_BATCH_LENGTH_PREFIX_SIZE ] );
+
+    /* A failure to send a full envelope is returned, without adding the message. */
+    envelopeStatus = MQTTSendFailed;
+    batch.fillCount = MQTT_AGENT_BATCH_MAX_MESSAGES;
+    mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) "d", 1U, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+    TEST_ASSERT_EQUAL( MQTT_AGENT_BATCH_MAX_MESSAGES, batch.fillCount );
+}
+
+/**
+ * @brief Test MQTTAgentBatch_GetNextMessage().
+ */
+void test_MQTTAgentBatch_GetNextMessage( void )
+{
+    const uint8_t envelope[] = { 0x00, 0x02, 'h', 'i', 0x00, 0x00, 0x00, 0x03, 'a', 'b', 'c' };
+    const uint8_t truncatedPrefix[] = { 0x00, 0x01, 'a', 0x00 };
+    const uint8_t truncatedMessage[] = { 0x01, 0x00, 'a' };
+    const uint8_t * pMessage = NULL;
+    size_t messageLength = 0U;
+    size_t offset = 0U;
+    MQTTStatus_t mqttStatus;
+
+    /* Invalid parameters. */
+    mqttStatus = MQTTAgentBatch_GetNextMessage( NULL, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), NULL, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, NULL, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    offset = sizeof( envelope ) + 1U;
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* An empty envelope has no message. */
+    offset = 0U;
+    mqttStatus = MQTTAgentBatch_GetNextMessage( NULL, 0U, &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &envelope[ 2 ], pMessage );
+    TEST_ASSERT_EQUAL( 2U, messageLength );
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, messageLength );
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &envelope[ 8 ], pMessage );
+    TEST_ASSERT_EQUAL( 3U, messageLength );
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( envelope, sizeof( envelope ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+    TEST_ASSERT_EQUAL( sizeof( envelope ), offset );
+
+    /* Malformed envelopes. */
+    offset = 3U;
+    mqttStatus = MQTTAgentBatch_GetNextMessage( truncatedPrefix, sizeof( truncatedPrefix ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadResponse, mqttStatus );
+
+    offset = 0U;
+    mqttStatus = MQTTAgentBatch_GetNextMessage( truncatedMessage, sizeof( truncatedMessage ), &offset, &pMessage, &messageLength );
+    TEST_ASSERT_EQUAL( MQTTBadResponse, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, offset );
+}
+
+/**
+ * @brief Test that messages added with MQTTAgentBatch_Add() are returned by
+ * MQTTAgentBatch_GetNextMessage().
+ */
+void test_MQTTAgentBatch_round_trip( void )
+{
+    MQTTAgentBatch_t batch;
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    const char * messages[] = { "t=21", "", "h=40%" };
+    const uint8_t * pMessage = NULL;
+    size_t messageLength = 0U;
+    size_t offset = 0U;
+    MQTTStatus_t mqttStatus;
+    size_t i;
+
+    setupBatch( &batch, &agentContext, 100U );
+
+    for( i = 0U; i < 3U; i++ )
+    {
+        mqttStatus = MQTTAgentBatch_Add( &batch, ( const uint8_t * ) messages[ i ], strlen( messages[ i ] ), &commandInfo );
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    }
+
+    mqttStatus = MQTTAgentBatch_Flush( &batch, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    for( i = 0U; i < 3U; i++ )
+    {
+        mqttStatus = MQTTAgentBatch_GetNextMessage( pEnvelopePublishInfo->pPayload,
+                                                    pEnvelopePublishInfo->payloadLength,
+                                                    &offset,
+                                                    &pMessage,
+                                                    &messageLength );
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( strlen( messages[ i ] ), messageLength );
+
+        if( messageLength > 0U )
+        {
+            TEST_ASSERT_EQUAL_MEMORY( messages[ i ], pMessage, messageLength );
+        }
+    }
+
+    mqttStatus = MQTTAgentBatch_GetNextMessage( pEnvelopePublishInfo->pPayload,
+                                                pEnvelopePublishInfo->payloadLength,
+                                                &offset,
+                                                &pMessage,
+                                                &messageLength );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+}
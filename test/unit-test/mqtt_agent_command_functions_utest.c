@@ -77,6 +77,21 @@ static uint32_t receiveCounter;
  */
 static uint32_t commandReleaseCallCount = 0;
 
+/**
+ * @brief Number of calls to stubSessionCallback.
+ */
+static uint32_t sessionEventCount;
+
+/**
+ * @brief Packet ID passed to the last call of stubSessionCallback.
+ */
+static uint16_t lastSessionPacketId;
+
+/**
+ * @brief Publish passed to the last call of stubSessionCallback.
+ */
+static const MQTTPublishInfo_t * pLastSessionPublish;
+
 
 /* ========================================================================== */
 
@@ -131,6 +146,39 @@ static bool stubReleaseCommand( MQTTAgentCommand_t * pCommandToRelease )
     return true;
 }
 
+/**
+ * @brief A mocked session callback recording its last notification.
+ */
+static void stubSessionCallback( void * pSessionContext,
+                                 uint16_t packetId,
+                                 const MQTTPublishInfo_t * pPublishInfo )
+{
+    TEST_ASSERT_EQUAL_PTR( &sessionEventCount, pSessionContext );
+
+    sessionEventCount++;
+    lastSessionPacketId = packetId;
+    pLastSessionPublish = pPublishInfo;
+}
+
+/**
+ * @brief A mocked MQTT_Publish function checking that the publish was saved
+ * before it is sent.
+ */
+static MQTTStatus_t MQTT_Publish_SavedStub( MQTTContext_t * pContext,
+                                            const MQTTPublishInfo_t * pPublishInfo,
+                                            uint16_t packetId,
+                                            int numCalls )
+{
+    ( void ) pContext;
+    ( void ) numCalls;
+
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+    TEST_ASSERT_EQUAL( packetId, lastSessionPacketId );
+    TEST_ASSERT_EQUAL_PTR( pPublishInfo, pLastSessionPublish );
+
+    return ( packetId == 1U ) ? MQTTSuccess : MQTTSendFailed;
+}
+
 /* ============================   UNITY FIXTURES ============================ */
 
 /* Called before each test method. */
@@ -140,6 +188,9 @@ void setUp()
     pCommandToReturn = NULL;
     commandCompleteCallbackCount = 0;
     commandReleaseCallCount = 0;
+    sessionEventCount = 0U;
+    lastSessionPacketId = 0U;
+    pLastSessionPublish = NULL;
 }
 
 /* Called after each test method. */
@@ -270,6 +321,8 @@ void test_MQTTAgentCommand_Publish_QoS1_failure( void )
 
     MQTT_GetPacketId_ExpectAndReturn( &( mqttAgentContext.mqttContext ), 1 );
     MQTT_Publish_ExpectAndReturn( &( mqttAgentContext.mqttContext ), &publishInfo, 1, MQTTSendFailed );
+    /* The state record reserved for the publish is released. */
+    MQTT_CancelCallback_ExpectAndReturn( &( mqttAgentContext.mqttContext ), 1, MQTTSuccess );
 
     mqttStatus = MQTTAgentCommand_Publish( &mqttAgentContext, &publishInfo, &returnFlags );
 
@@ -281,6 +334,45 @@ void test_MQTTAgentCommand_Publish_QoS1_failure( void )
     TEST_ASSERT_FALSE( returnFlags.endLoop );
 }
 
+/**
+ * @brief Test that MQTTAgentCommand_Publish() gives a QoS 1 publish to the
+ * session callback before sending it, and tells the callback to forget it if
+ * the send fails.
+ */
+void test_MQTTAgentCommand_Publish_QoS1_session( void )
+{
+    MQTTAgentContext_t mqttAgentContext = { 0 };
+    MQTTPublishInfo_t publishInfo = { 0 };
+    MQTTAgentCommandFuncReturns_t returnFlags = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    mqttAgentContext.pSessionCallback = stubSessionCallback;
+    mqttAgentContext.pSessionCallbackContext = &sessionEventCount;
+    publishInfo.qos = MQTTQoS1;
+
+    MQTT_Publish_Stub( MQTT_Publish_SavedStub );
+    MQTT_GetPacketId_ExpectAndReturn( &( mqttAgentContext.mqttContext ), 1 );
+
+    mqttStatus = MQTTAgentCommand_Publish( &mqttAgentContext, &publishInfo, &returnFlags );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( returnFlags.addAcknowledgment );
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+
+    /* A failed send is forgotten. */
+    sessionEventCount = 0U;
+    MQTT_GetPacketId_ExpectAndReturn( &( mqttAgentContext.mqttContext ), 2 );
+    MQTT_CancelCallback_ExpectAndReturn( &( mqttAgentContext.mqttContext ), 2, MQTTSuccess );
+
+    mqttStatus = MQTTAgentCommand_Publish( &mqttAgentContext, &publishInfo, &returnFlags );
+
+    TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+    TEST_ASSERT_FALSE( returnFlags.addAcknowledgment );
+    TEST_ASSERT_EQUAL( 2U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 2U, lastSessionPacketId );
+    TEST_ASSERT_NULL( pLastSessionPublish );
+}
+
 /**
  * @brief Test that MQTTAgentCommand_Subscribe() works as intended.
  */
@@ -0,0 +1,642 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file mqtt_agent_completion_utest.c
+ * @brief Unit tests for functions in core_mqtt_agent_completion.h
+ */
+#include <string.h>
+#include <stdbool.h>
+
+#include "unity.h"
+
+/* Include paths for public enums, structures, and macros. */
+
+#include "mock_core_mqtt.h"
+#include "mock_core_mqtt_state.h"
+#include "mock_core_mqtt_agent.h"
+#include "core_mqtt_agent_completion.h"
+
+/**
+ * @brief Maximum number of commands completed by stubWait.
+ */
+#define MAX_PENDING_COMMANDS    ( 4U )
+
+/**
+ * @brief Event context recording the calls to stubWait and stubWake.
+ */
+struct MQTTAgentCompletionEventContext
+{
+    uint32_t waitCount;
+    uint32_t wakeCount;
+    uint32_t expectedValues[ MAX_PENDING_COMMANDS ];
+    uint32_t timeouts[ MAX_PENDING_COMMANDS ];
+    const volatile uint32_t * pWokenValue;
+};
+
+/**
+ * @brief Event context of the tests.
+ */
+static MQTTAgentCompletionEventContext_t eventContext;
+
+/**
+ * @brief Completion interface of the tests.
+ */
+static MQTTAgentCompletionInterface_t completionInterface;
+
+/**
+ * @brief Current time returned by stubGetTime.
+ */
+static uint32_t globalTimeMs;
+
+/**
+ * @brief Time by which stubWait advances #globalTimeMs.
+ */
+static uint32_t waitDurationMs;
+
+/**
+ * @brief Commands completed in order by stubWait, one per call.
+ */
+static MQTTAgentCommandInfo_t pendingCommands[ MAX_PENDING_COMMANDS ];
+
+/**
+ * @brief Number of commands in #pendingCommands.
+ */
+static size_t pendingCommandCount;
+
+/**
+ * @brief Index of the next command completed by stubWait.
+ */
+static size_t pendingCommandIndex;
+
+/**
+ * @brief Completion queue stubWait posts a completion to, if not NULL.
+ */
+static MQTTAgentCompletionQueue_t * pWaitQueue;
+
+/**
+ * @brief Command contexts used as the completion contexts in the queue tests.
+ */
+static uint8_t queueContexts[ 8 ];
+
+/* ============================   UNITY FIXTURES ============================ */
+
+/* Called before each test method. */
+void setUp()
+{
+    ( void ) memset( &eventContext, 0x00, sizeof( eventContext ) );
+    globalTimeMs = 0U;
+    waitDurationMs = 0U;
+    ( void ) memset( pendingCommands, 0x00, sizeof( pendingCommands ) );
+    pendingCommandCount = 0U;
+    pendingCommandIndex = 0U;
+    pWaitQueue = NULL;
+}
+
+/* Called after each test method. */
+void tearDown()
+{
+}
+
+/* Called at the beginning of the whole suite. */
+void suiteSetUp()
+{
+}
+
+/* Called at the end of the whole suite. */
+int suiteTearDown( int numFailures )
+{
+    return numFailures;
+}
+
+/* ========================================================================== */
+
+/**
+ * @brief A mocked time function returning #globalTimeMs.
+ */
+static uint32_t stubGetTime( void )
+{
+    return globalTimeMs;
+}
+
+/**
+ * @brief Invoke the completion callback of a command, as the agent task does.
+ */
+static void completeCommand( const MQTTAgentCommandInfo_t * pCommandInfo,
+                             MQTTStatus_t returnCode )
+{
+    MQTTAgentReturnInfo_t returnInfo = { 0 };
+
+    returnInfo.returnCode = returnCode;
+    pCommandInfo->cmdCompleteCallback( pCommandInfo->pCmdCompleteCallbackContext, &returnInfo );
+}
+
+/**
+ * @brief Post a completion to a queue, as the agent task does.
+ */
+static void postCompletion( MQTTAgentCompletionQueue_t * pQueue,
+                            size_t contextIndex,
+                            MQTTStatus_t returnCode )
+{
+    MQTTAgentCompletionEntry_t * pEntry;
+
+    pEntry = &( pQueue->pEntries[ pQueue->postedCount & ( pQueue->entryCount - 1U ) ] );
+    pEntry->pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) &queueContexts[ contextIndex ];
+    pEntry->returnInfo.returnCode = returnCode;
+    pQueue->postedCount++;
+}
+
+/**
+ * @brief A mocked wait function which records its arguments, advances the time
+ * by #waitDurationMs, and completes the next command of #pendingCommands or
+ * posts a completion to #pWaitQueue.
+ */
+static void stubWait( MQTTAgentCompletionEventContext_t * pEventCtx,
+                      const volatile uint32_t * pValue,
+                      uint32_t expectedValue,
+                      uint32_t timeoutMs )
+{
+    ( void ) pValue;
+
+    if( pEventCtx->waitCount < MAX_PENDING_COMMANDS )
+    {
+        pEventCtx->expectedValues[ pEventCtx->waitCount ] = expectedValue;
+        pEventCtx->timeouts[ pEventCtx->waitCount ] = timeoutMs;
+    }
+
+    pEventCtx->waitCount++;
+    globalTimeMs += waitDurationMs;
+
+    if( pendingCommandIndex < pendingCommandCount )
+    {
+        completeCommand( &pendingCommands[ pendingCommandIndex ], MQTTSuccess );
+        pendingCommandIndex++;
+    }
+    else if( pWaitQueue != NULL )
+    {
+        postCompletion( pWaitQueue, 0U, MQTTSuccess );
+    }
+    else
+    {
+        /* Nothing completes during this wait. */
+    }
+}
+
+/**
+ * @brief A mocked wake function which records its arguments.
+ */
+static void stubWake( MQTTAgentCompletionEventContext_t * pEventCtx,
+                      const volatile uint32_t * pValue )
+{
+    pEventCtx->wakeCount++;
+    pEventCtx->pWokenValue = pValue;
+}
+
+/**
+ * @brief Initialize a completion group with the stub event.
+ */
+static void setupGroup( MQTTAgentCompletionGroup_t * pGroup )
+{
+    MQTTStatus_t mqttStatus;
+
+    completionInterface.pEventCtx = &eventContext;
+    completionInterface.wait = stubWait;
+    completionInterface.wake = stubWake;
+
+    mqttStatus = MQTTAgentCompletionGroup_Init( pGroup, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+}
+
+/**
+ * @brief Initialize a completion queue with the stub event.
+ */
+static void setupQueue( MQTTAgentCompletionQueue_t * pQueue,
+                        MQTTAgentCompletionEntry_t * pEntries,
+                        uint32_t entryCount )
+{
+    MQTTStatus_t mqttStatus;
+
+    completionInterface.pEventCtx = &eventContext;
+    completionInterface.wait = stubWait;
+    completionInterface.wake = stubWake;
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( pQueue, pEntries, entryCount, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+}
+
+/**
+ * @brief Prepare a completion handle, queuing its command to be completed by
+ * stubWait.
+ */
+static void preparePending( MQTTAgentCompletion_t * pCompletion,
+                            MQTTAgentCompletionGroup_t * pGroup )
+{
+    MQTTStatus_t mqttStatus;
+
+    mqttStatus = MQTTAgentCompletion_Prepare( pCompletion, pGroup, &pendingCommands[ pendingCommandCount ] );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    pendingCommandCount++;
+}
+
+/* ========================================================================== */
+
+/**
+ * @brief Test MQTTAgentCompletionGroup_Init() parameter validation.
+ */
+void test_MQTTAgentCompletionGroup_Init_invalid_params( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTStatus_t mqttStatus;
+
+    completionInterface.pEventCtx = &eventContext;
+    completionInterface.wait = stubWait;
+    completionInterface.wake = stubWake;
+
+    mqttStatus = MQTTAgentCompletionGroup_Init( NULL, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionGroup_Init( &group, NULL, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionGroup_Init( &group, &completionInterface, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    completionInterface.wait = NULL;
+    mqttStatus = MQTTAgentCompletionGroup_Init( &group, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    completionInterface.wait = stubWait;
+    completionInterface.wake = NULL;
+    mqttStatus = MQTTAgentCompletionGroup_Init( &group, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+}
+
+/**
+ * @brief Test MQTTAgentCompletion_Prepare() parameter validation and the
+ * command information it sets.
+ */
+void test_MQTTAgentCompletion_Prepare( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completion;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupGroup( &group );
+
+    mqttStatus = MQTTAgentCompletion_Prepare( NULL, &group, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletion_Prepare( &completion, NULL, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletion_Prepare( &completion, &group, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, group.startedCount );
+
+    commandInfo.blockTimeMs = 100U;
+    mqttStatus = MQTTAgentCompletion_Prepare( &completion, &group, &commandInfo );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_NOT_NULL( commandInfo.cmdCompleteCallback );
+    TEST_ASSERT_EQUAL_PTR( &completion, commandInfo.pCmdCompleteCallbackContext );
+    TEST_ASSERT_EQUAL( 100U, commandInfo.blockTimeMs );
+    TEST_ASSERT_EQUAL_PTR( &group, completion.pGroup );
+    TEST_ASSERT_FALSE( completion.complete );
+    TEST_ASSERT_EQUAL( 1U, group.startedCount );
+}
+
+/**
+ * @brief Test polling a handle with a timeout of 0, before and after its
+ * command completes.
+ */
+void test_MQTTAgentCompletion_Wait_poll( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completion;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTAgentReturnInfo_t returnInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupGroup( &group );
+    ( void ) MQTTAgentCompletion_Prepare( &completion, &group, &commandInfo );
+
+    mqttStatus = MQTTAgentCompletion_Wait( &completion, 0U );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+
+    returnInfo.returnCode = MQTTSendFailed;
+    returnInfo.superseded = true;
+    commandInfo.cmdCompleteCallback( commandInfo.pCmdCompleteCallbackContext, &returnInfo );
+
+    TEST_ASSERT_EQUAL( 1U, eventContext.wakeCount );
+    TEST_ASSERT_EQUAL_PTR( &group.completedCount, eventContext.pWokenValue );
+    TEST_ASSERT_EQUAL( 1U, group.completedCount );
+
+    mqttStatus = MQTTAgentCompletion_Wait( &completion, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( MQTTSendFailed, completion.returnCode );
+    TEST_ASSERT_TRUE( completion.superseded );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+}
+
+/**
+ * @brief Test waiting on the event of the group until a handle completes.
+ */
+void test_MQTTAgentCompletion_Wait_completes( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completions[ 2 ];
+    MQTTStatus_t mqttStatus;
+
+    setupGroup( &group );
+    preparePending( &completions[ 0 ], &group );
+    preparePending( &completions[ 1 ], &group );
+    waitDurationMs = 10U;
+
+    /* The first command completes on the first wait, which must not end the
+     * wait for the second one. */
+    mqttStatus = MQTTAgentCompletion_Wait( &completions[ 1 ], 100U );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( completions[ 0 ].complete );
+    TEST_ASSERT_EQUAL( 2U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.expectedValues[ 0 ] );
+    TEST_ASSERT_EQUAL( 100U, eventContext.timeouts[ 0 ] );
+    TEST_ASSERT_EQUAL( 1U, eventContext.expectedValues[ 1 ] );
+    TEST_ASSERT_EQUAL( 90U, eventContext.timeouts[ 1 ] );
+}
+
+/**
+ * @brief Test that a wait returns once its timeout has passed, waiting only
+ * for the remaining time after early returns of the wait function.
+ */
+void test_MQTTAgentCompletion_Wait_timeout( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completion;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupGroup( &group );
+    ( void ) MQTTAgentCompletion_Prepare( &completion, &group, &commandInfo );
+    waitDurationMs = 40U;
+
+    /* Times close to a wrap of the time. */
+    globalTimeMs = UINT32_MAX - 50U;
+    mqttStatus = MQTTAgentCompletion_Wait( &completion, 100U );
+
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+    TEST_ASSERT_EQUAL( 3U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 100U, eventContext.timeouts[ 0 ] );
+    TEST_ASSERT_EQUAL( 60U, eventContext.timeouts[ 1 ] );
+    TEST_ASSERT_EQUAL( 20U, eventContext.timeouts[ 2 ] );
+    TEST_ASSERT_FALSE( completion.complete );
+}
+
+/**
+ * @brief Test waiting for all handles of a group.
+ */
+void test_MQTTAgentCompletionGroup_Wait( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completions[ 3 ];
+    MQTTStatus_t mqttStatus;
+
+    mqttStatus = MQTTAgentCompletionGroup_Wait( NULL, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    setupGroup( &group );
+
+    /* A group without handles has nothing to wait for. */
+    mqttStatus = MQTTAgentCompletionGroup_Wait( &group, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+
+    preparePending( &completions[ 0 ], &group );
+    preparePending( &completions[ 1 ], &group );
+    preparePending( &completions[ 2 ], &group );
+
+    mqttStatus = MQTTAgentCompletionGroup_Wait( &group, 0U );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionGroup_Wait( &group, 100U );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 3U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.expectedValues[ 0 ] );
+    TEST_ASSERT_EQUAL( 1U, eventContext.expectedValues[ 1 ] );
+    TEST_ASSERT_EQUAL( 2U, eventContext.expectedValues[ 2 ] );
+    TEST_ASSERT_TRUE( completions[ 0 ].complete );
+    TEST_ASSERT_TRUE( completions[ 1 ].complete );
+    TEST_ASSERT_TRUE( completions[ 2 ].complete );
+
+    /* Handles may be prepared again once complete. */
+    preparePending( &completions[ 0 ], &group );
+    mqttStatus = MQTTAgentCompletionGroup_Wait( &group, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 4U, eventContext.waitCount );
+}
+
+/**
+ * @brief Test MQTTAgentCompletion_Abort() for a command which could not be
+ * enqueued.
+ */
+void test_MQTTAgentCompletion_Abort( void )
+{
+    MQTTAgentCompletionGroup_t group;
+    MQTTAgentCompletion_t completions[ 2 ];
+    MQTTAgentCompletion_t unprepared = { 0 };
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    setupGroup( &group );
+
+    mqttStatus = MQTTAgentCompletion_Abort( NULL, MQTTSendFailed );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletion_Abort( &unprepared, MQTTSendFailed );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    preparePending( &completions[ 0 ], &group );
+    ( void ) MQTTAgentCompletion_Prepare( &completions[ 1 ], &group, &commandInfo );
+
+    mqttStatus = MQTTAgentCompletion_Abort( &completions[ 1 ], MQTTNoMemory );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( completions[ 1 ].complete );
+    TEST_ASSERT_EQUAL( MQTTNoMemory, completions[ 1 ].returnCode );
+
+    /* A handle can only be aborted while pending. */
+    mqttStatus = MQTTAgentCompletion_Abort( &completions[ 1 ], MQTTNoMemory );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletion_Wait( &completions[ 1 ], 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* The group only waits for the enqueued command. */
+    mqttStatus = MQTTAgentCompletionGroup_Wait( &group, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 1U, eventContext.wakeCount );
+}
+
+/**
+ * @brief Test MQTTAgentCompletion_Wait() parameter validation.
+ */
+void test_MQTTAgentCompletion_Wait_invalid_params( void )
+{
+    MQTTAgentCompletion_t unprepared = { 0 };
+    MQTTStatus_t mqttStatus;
+
+    mqttStatus = MQTTAgentCompletion_Wait( NULL, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletion_Wait( &unprepared, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+}
+
+/**
+ * @brief Test MQTTAgentCompletionQueue_Init() parameter validation.
+ */
+void test_MQTTAgentCompletionQueue_Init_invalid_params( void )
+{
+    MQTTAgentCompletionQueue_t queue;
+    MQTTAgentCompletionEntry_t entries[ 4 ];
+    MQTTStatus_t mqttStatus;
+
+    completionInterface.pEventCtx = &eventContext;
+    completionInterface.wait = stubWait;
+    completionInterface.wake = stubWake;
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( NULL, entries, 4U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, NULL, 4U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 4U, NULL, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 0U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 3U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 4U, &completionInterface, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    completionInterface.wake = NULL;
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 4U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    completionInterface.wake = stubWake;
+    mqttStatus = MQTTAgentCompletionQueue_Init( &queue, entries, 1U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, queue.postedCount );
+    TEST_ASSERT_EQUAL( 0U, queue.reapedCount );
+    TEST_ASSERT_EQUAL( 0U, queue.overflowCount );
+}
+
+/**
+ * @brief Test reaping completions in batches, in the order they were posted,
+ * across a wrap of the counts of the queue.
+ */
+void test_MQTTAgentCompletionQueue_Reap( void )
+{
+    MQTTAgentCompletionQueue_t queue;
+    MQTTAgentCompletionEntry_t entries[ 4 ];
+    MQTTAgentCompletionEntry_t reaped[ 4 ];
+    size_t reapedCount = 0U;
+    MQTTStatus_t mqttStatus;
+
+    setupQueue( &queue, entries, 4U );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( NULL, reaped, 4U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, NULL, 4U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 0U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 4U, 0U, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* An empty queue is polled without waiting. */
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 4U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, reapedCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+
+    queue.postedCount = UINT32_MAX - 1U;
+    queue.reapedCount = UINT32_MAX - 1U;
+    postCompletion( &queue, 0U, MQTTSuccess );
+    postCompletion( &queue, 1U, MQTTSendFailed );
+    postCompletion( &queue, 2U, MQTTSuccess );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 2U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, reapedCount );
+    TEST_ASSERT_EQUAL_PTR( &queueContexts[ 0 ], reaped[ 0 ].pCmdCompleteCallbackContext );
+    TEST_ASSERT_EQUAL_PTR( &queueContexts[ 1 ], reaped[ 1 ].pCmdCompleteCallbackContext );
+    TEST_ASSERT_EQUAL( MQTTSendFailed, reaped[ 1 ].returnInfo.returnCode );
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 4U, 0U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, reapedCount );
+    TEST_ASSERT_EQUAL_PTR( &queueContexts[ 2 ], reaped[ 0 ].pCmdCompleteCallbackContext );
+    TEST_ASSERT_EQUAL( 1U, queue.reapedCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+}
+
+/**
+ * @brief Test waiting on the event of the queue until a completion is posted,
+ * or until the timeout passes.
+ */
+void test_MQTTAgentCompletionQueue_Reap_wait( void )
+{
+    MQTTAgentCompletionQueue_t queue;
+    MQTTAgentCompletionEntry_t entries[ 2 ];
+    MQTTAgentCompletionEntry_t reaped[ 2 ];
+    size_t reapedCount = 0U;
+    MQTTStatus_t mqttStatus;
+
+    setupQueue( &queue, entries, 2U );
+    waitDurationMs = 30U;
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 2U, 50U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTNoDataAvailable, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 50U, eventContext.timeouts[ 0 ] );
+    TEST_ASSERT_EQUAL( 20U, eventContext.timeouts[ 1 ] );
+
+    eventContext.waitCount = 0U;
+    pWaitQueue = &queue;
+
+    mqttStatus = MQTTAgentCompletionQueue_Reap( &queue, reaped, 2U, 50U, &reapedCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, reapedCount );
+    TEST_ASSERT_EQUAL( 1U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.expectedValues[ 0 ] );
+}
@@ -31,6 +31,7 @@
 
 /* Include paths for public enums, structures, and macros. */
 #include "core_mqtt_agent.h"
+#include "core_mqtt_agent_completion.h"
 #include "mock_core_mqtt.h"
 #include "mock_core_mqtt_state.h"
 #include "mock_core_mqtt_agent_command_functions.h"
@@ -50,6 +51,16 @@ struct MQTTAgentMessageContext
 struct MQTTAgentCommandContext
 {
     MQTTStatus_t returnStatus;
+    bool superseded;
+};
+
+/**
+ * @brief Completion queue event context.
+ */
+struct MQTTAgentCompletionEventContext
+{
+    uint32_t waitCount;
+    uint32_t wakeCount;
 };
 
 /**
@@ -103,6 +114,182 @@ static uint32_t receiveCounter;
  */
 static MQTTAgentCommandFuncReturns_t returnFlags;
 
+/**
+ * @brief Remaining data of the SUBACK delivered by MQTT_ProcessLoop_SubackStub.
+ */
+static uint8_t * pSubackRemainingData;
+
+/**
+ * @brief Remaining length of the SUBACK delivered by MQTT_ProcessLoop_SubackStub.
+ */
+static size_t subackRemainingLength;
+
+/**
+ * @brief SUBACK status codes handed to stubSubackCompletionCallback.
+ */
+static uint8_t * pReceivedSubackCodes;
+
+/**
+ * @brief Number of reconnect cycles run by the lossy reconnect soak test.
+ */
+#define LOSSY_RECONNECT_CYCLES    ( 500U )
+
+/**
+ * @brief State of the pseudo-random generator deciding which operations the
+ * simulated lossy link drops. Seeded by each test so failures are reproducible.
+ */
+static uint32_t lossyLinkSeed;
+
+/**
+ * @brief Number of calls to stubCustomCommand.
+ */
+static uint32_t customCommandCallCount;
+
+/**
+ * @brief Arguments last passed to stubCustomCommand.
+ */
+static void * pCustomCommandArgs;
+
+/**
+ * @brief Current time returned by stubGetTimerTime.
+ */
+static uint32_t timerTimeMs;
+
+/**
+ * @brief Maximum number of command wait times recorded by stubReceiveAdvanceTime.
+ */
+#define MAX_RECORDED_WAIT_TIMES    ( 10U )
+
+/**
+ * @brief Command wait times passed to stubReceiveAdvanceTime.
+ */
+static uint32_t recordedWaitTimes[ MAX_RECORDED_WAIT_TIMES ];
+
+/**
+ * @brief Number of calls to stubReceiveAdvanceTime.
+ */
+static uint32_t recordedWaitCount;
+
+/**
+ * @brief Time from which stubReceiveAdvanceTime returns the sent command.
+ */
+static uint32_t commandArrivalTimeMs;
+
+/**
+ * @brief Timer stopped by stubStopTimerCallback.
+ */
+static MQTTAgentTimer_t * pTimerToStop;
+
+/**
+ * @brief Value written as the payload by stubProducerFill, incremented on each call.
+ */
+static uint8_t producerSample;
+
+/**
+ * @brief Whether stubProducerFill reports a payload.
+ */
+static bool producerHasSample;
+
+/**
+ * @brief Payload length reported by stubProducerFill.
+ */
+static size_t producerPayloadLength;
+
+/**
+ * @brief First payload byte of the last publish seen by MQTT_Publish_ProducerStub.
+ */
+static uint8_t lastPublishedSample;
+
+/**
+ * @brief DUP flag of the last publish seen by MQTT_Publish_ProducerStub.
+ */
+static bool lastPublishedDup;
+
+/**
+ * @brief Status returned by MQTT_Publish_ProducerStub.
+ */
+static MQTTStatus_t producerPublishStatus;
+
+/**
+ * @brief Maximum number of commands queued for stubReceiveQueue.
+ */
+#define MAX_QUEUED_COMMANDS    ( 8U )
+
+/**
+ * @brief Commands returned in order by stubReceiveQueue.
+ */
+static MQTTAgentCommand_t * pQueuedCommands[ MAX_QUEUED_COMMANDS ];
+
+/**
+ * @brief Number of commands in #pQueuedCommands.
+ */
+static size_t queuedCommandCount;
+
+/**
+ * @brief Index of the next command returned by stubReceiveQueue.
+ */
+static size_t queuedCommandIndex;
+
+/**
+ * @brief Number of packets still to be received by MQTT_ProcessLoop_PendingPacketsStub.
+ */
+static uint32_t pendingPacketCount;
+
+/**
+ * @brief Number of calls to MQTT_ProcessLoop_PendingPacketsStub.
+ */
+static uint32_t processLoopCallCount;
+
+/**
+ * @brief Maximum number of notifications recorded by stubSessionCallback.
+ */
+#define MAX_RECORDED_SESSION_EVENTS    4U
+
+/**
+ * @brief Packet IDs passed to stubSessionCallback.
+ */
+static uint16_t sessionPacketIds[ MAX_RECORDED_SESSION_EVENTS ];
+
+/**
+ * @brief Publishes passed to stubSessionCallback.
+ */
+static const MQTTPublishInfo_t * pSessionPublishes[ MAX_RECORDED_SESSION_EVENTS ];
+
+/**
+ * @brief Number of calls to stubSessionCallback.
+ */
+static size_t sessionEventCount;
+
+/**
+ * @brief Maximum number of calls recorded by MQTT_Subscribe_RecordStub.
+ */
+#define MAX_RECORDED_SUBSCRIBES    4U
+
+/**
+ * @brief Subscription lists passed to MQTT_Subscribe_RecordStub.
+ */
+static const MQTTSubscribeInfo_t * pSubscribeLists[ MAX_RECORDED_SUBSCRIBES ];
+
+/**
+ * @brief Numbers of subscriptions passed to MQTT_Subscribe_RecordStub.
+ */
+static size_t subscribeListCounts[ MAX_RECORDED_SUBSCRIBES ];
+
+/**
+ * @brief Number of calls to MQTT_Subscribe_RecordStub.
+ */
+static size_t subscribeCallCount;
+
+/**
+ * @brief Return code of MQTT_Subscribe_RecordStub.
+ */
+static MQTTStatus_t subscribeStatus;
+
+/**
+ * @brief Arguments passed to MQTTAgentCommand_Unsubscribe_RecordStub.
+ */
+static const MQTTAgentSubscribeArgs_t * pUnsubscribeArgs;
+
 /* ============================   UNITY FIXTURES ============================ */
 
 /* Called before each test method. */
@@ -116,6 +303,29 @@ void setUp()
     commandCompleteCallbackCount = 0;
     packetIdentifier = 1U;
     receiveCounter = 0;
+    pSubackRemainingData = NULL;
+    subackRemainingLength = 0U;
+    pReceivedSubackCodes = NULL;
+    customCommandCallCount = 0;
+    pCustomCommandArgs = NULL;
+    timerTimeMs = 0U;
+    recordedWaitCount = 0U;
+    commandArrivalTimeMs = 0U;
+    pTimerToStop = NULL;
+    producerSample = 0U;
+    producerHasSample = true;
+    producerPayloadLength = 1U;
+    lastPublishedSample = 0U;
+    lastPublishedDup = false;
+    producerPublishStatus = MQTTSuccess;
+    queuedCommandCount = 0U;
+    queuedCommandIndex = 0U;
+    pendingPacketCount = 0U;
+    processLoopCallCount = 0U;
+    sessionEventCount = 0U;
+    subscribeCallCount = 0U;
+    subscribeStatus = MQTTSuccess;
+    pUnsubscribeArgs = NULL;
     returnFlags.addAcknowledgment = false;
     returnFlags.runProcessLoop = false;
     returnFlags.endLoop = false;
@@ -197,6 +407,29 @@ static bool stubReceiveThenFail( MQTTAgentMessageContext_t * pMsgCtx,
     return ret;
 }
 
+/**
+ * @brief A mocked receive function returning the commands in #pQueuedCommands
+ * in order, then failing once they have all been received.
+ */
+static bool stubReceiveQueue( MQTTAgentMessageContext_t * pMsgCtx,
+                              MQTTAgentCommand_t ** pReceivedCommand,
+                              uint32_t blockTimeMs )
+{
+    bool received = false;
+
+    ( void ) pMsgCtx;
+    ( void ) blockTimeMs;
+
+    if( queuedCommandIndex < queuedCommandCount )
+    {
+        *pReceivedCommand = pQueuedCommands[ queuedCommandIndex ];
+        queuedCommandIndex++;
+        received = true;
+    }
+
+    return received;
+}
+
 /**
  * @brief A mocked function to obtain an allocated command.
  */
@@ -232,15 +465,238 @@ static void stubPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 
 static void stubCompletionCallback( MQTTAgentCommandContext_t * pCommandCompletionContext,
                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    if( pCommandCompletionContext != NULL )
+    {
+        pCommandCompletionContext->returnStatus = pReturnInfo->returnCode;
+        pCommandCompletionContext->superseded = pReturnInfo->superseded;
+    }
+
+    commandCompleteCallbackCount++;
+}
+
+/**
+ * @brief A mocked session callback recording its notifications.
+ */
+static void stubSessionCallback( void * pSessionContext,
+                                 uint16_t packetId,
+                                 const MQTTPublishInfo_t * pPublishInfo )
+{
+    TEST_ASSERT_EQUAL_PTR( &sessionEventCount, pSessionContext );
+    TEST_ASSERT_TRUE( sessionEventCount < MAX_RECORDED_SESSION_EVENTS );
+
+    sessionPacketIds[ sessionEventCount ] = packetId;
+    pSessionPublishes[ sessionEventCount ] = pPublishInfo;
+    sessionEventCount++;
+}
+
+/**
+ * @brief A mocked completion queue wait function counting its calls.
+ */
+static void stubCompletionWait( MQTTAgentCompletionEventContext_t * pEventCtx,
+                                const volatile uint32_t * pValue,
+                                uint32_t expectedValue,
+                                uint32_t timeoutMs )
+{
+    ( void ) pValue;
+    ( void ) expectedValue;
+    ( void ) timeoutMs;
+
+    pEventCtx->waitCount++;
+}
+
+/**
+ * @brief A mocked completion queue wake function counting its calls.
+ */
+static void stubCompletionWake( MQTTAgentCompletionEventContext_t * pEventCtx,
+                                const volatile uint32_t * pValue )
+{
+    ( void ) pValue;
+
+    pEventCtx->wakeCount++;
+}
+
+/**
+ * @brief Initialize a publish command for the conflation tests.
+ */
+static void setupConflationPublish( MQTTAgentCommand_t * pCommand,
+                                    MQTTPublishInfo_t * pPublishInfo,
+                                    MQTTAgentCommandContext_t * pCommandContext,
+                                    const char * pTopicName,
+                                    bool conflate )
+{
+    pPublishInfo->pTopicName = pTopicName;
+    pPublishInfo->topicNameLength = ( uint16_t ) strlen( pTopicName );
+    pCommand->commandType = PUBLISH;
+    pCommand->pArgs = pPublishInfo;
+    pCommand->pCommandCompleteCallback = stubCompletionCallback;
+    pCommand->pCmdContext = pCommandContext;
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+    {
+        pCommand->conflate = conflate;
+    }
+    #else
+    {
+        ( void ) conflate;
+    }
+    #endif
+    pQueuedCommands[ queuedCommandCount ] = pCommand;
+    queuedCommandCount++;
+}
+
+/**
+ * @brief A mock completion callback which records the SUBACK status codes,
+ * and the return code in the command context if there is one.
+ */
+static void stubSubackCompletionCallback( MQTTAgentCommandContext_t * pCommandCompletionContext,
+                                          MQTTAgentReturnInfo_t * pReturnInfo )
 {
     if( pCommandCompletionContext != NULL )
     {
         pCommandCompletionContext->returnStatus = pReturnInfo->returnCode;
     }
 
+    pReceivedSubackCodes = pReturnInfo->pSubackCodes;
     commandCompleteCallbackCount++;
 }
 
+/**
+ * @brief An application command which records its arguments and returns the
+ * flags in #returnFlags.
+ */
+static MQTTStatus_t stubCustomCommand( MQTTAgentContext_t * pMqttAgentContext,
+                                       void * pArgs,
+                                       MQTTAgentCommandFuncReturns_t * pReturnFlags )
+{
+    ( void ) pMqttAgentContext;
+
+    pCustomCommandArgs = pArgs;
+    *pReturnFlags = returnFlags;
+    customCommandCallCount++;
+
+    return MQTTSuccess;
+}
+
+/**
+ * @brief A mocked timer query function returning #timerTimeMs.
+ */
+static uint32_t stubGetTimerTime( void )
+{
+    return timerTimeMs;
+}
+
+/**
+ * @brief A mock receive function which waits for the full block time, and
+ * only returns the sent command once #commandArrivalTimeMs is reached.
+ */
+static bool stubReceiveAdvanceTime( MQTTAgentMessageContext_t * pMsgCtx,
+                                    MQTTAgentCommand_t ** pReceivedCommand,
+                                    uint32_t blockTimeMs )
+{
+    bool received = false;
+
+    if( recordedWaitCount < MAX_RECORDED_WAIT_TIMES )
+    {
+        recordedWaitTimes[ recordedWaitCount ] = blockTimeMs;
+    }
+
+    recordedWaitCount++;
+    timerTimeMs += blockTimeMs;
+
+    if( timerTimeMs >= commandArrivalTimeMs )
+    {
+        *pReceivedCommand = pMsgCtx->pSentCommand;
+        received = true;
+    }
+
+    return received;
+}
+
+/**
+ * @brief A timer callback counting its calls in the uint32_t pointed to by
+ * the timer context.
+ */
+static void stubTimerCallback( MQTTAgentContext_t * pMqttAgentContext,
+                               MQTTAgentTimer_t * pTimer )
+{
+    ( void ) pMqttAgentContext;
+
+    ( *( ( uint32_t * ) pTimer->pTimerContext ) )++;
+}
+
+/**
+ * @brief A timer callback which stops #pTimerToStop and restarts its own timer
+ * with no delay.
+ */
+static void stubStopTimerCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                   MQTTAgentTimer_t * pTimer )
+{
+    MQTTStatus_t mqttStatus;
+
+    stubTimerCallback( pMqttAgentContext, pTimer );
+
+    mqttStatus = MQTTAgent_StopTimer( pMqttAgentContext, pTimerToStop );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgent_StartTimer( pMqttAgentContext, pTimer, 0U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+}
+
+/**
+ * @brief A producer fill function writing #producerSample as the payload.
+ */
+static bool stubProducerFill( MQTTAgentProducer_t * pProducer,
+                              uint8_t * pBuffer,
+                              size_t bufferSize,
+                              size_t * pPayloadLength )
+{
+    ( void ) pProducer;
+    TEST_ASSERT_GREATER_OR_EQUAL( 1U, bufferSize );
+
+    producerSample++;
+    pBuffer[ 0 ] = producerSample;
+    *pPayloadLength = producerPayloadLength;
+
+    return producerHasSample;
+}
+
+/**
+ * @brief A stub for MQTT_Publish which records the first payload byte and the
+ * DUP flag, and returns #producerPublishStatus.
+ */
+static MQTTStatus_t MQTT_Publish_ProducerStub( MQTTContext_t * pContext,
+                                               const MQTTPublishInfo_t * pPublishInfo,
+                                               uint16_t packetId,
+                                               int numCalls )
+{
+    ( void ) pContext;
+    ( void ) packetId;
+    ( void ) numCalls;
+
+    TEST_ASSERT_EQUAL( producerPayloadLength, pPublishInfo->payloadLength );
+    lastPublishedSample = ( ( const uint8_t * ) pPublishInfo->pPayload )[ 0 ];
+    lastPublishedDup = pPublishInfo->dup;
+
+    return producerPublishStatus;
+}
+
+/**
+ * @brief Set up a producer publishing to a test topic with stubProducerFill.
+ */
+static void setupProducer( MQTTAgentProducer_t * pProducer,
+                           uint8_t * pPayloadBuffer,
+                           size_t payloadBufferSize,
+                           MQTTQoS_t qos )
+{
+    ( void ) memset( pProducer, 0x00, sizeof( MQTTAgentProducer_t ) );
+    pProducer->publishInfo.pTopicName = "test/producer";
+    pProducer->publishInfo.topicNameLength = ( uint16_t ) strlen( "test/producer" );
+    pProducer->publishInfo.qos = qos;
+    pProducer->fill = stubProducerFill;
+    pProducer->pPayloadBuffer = pPayloadBuffer;
+    pProducer->payloadBufferSize = payloadBufferSize;
+}
+
 /**
  * @brief A mocked timer query function that increments on every call.
  */
@@ -315,31 +771,213 @@ MQTTStatus_t MQTT_ProcessLoop_NeedMoreBytes( MQTTContext_t * pContext,
 }
 
 /**
- * @brief A stub for MQTT_ProcessLoop function which fails on second and later calls.
+ * @brief A stub for MQTT_ProcessLoop function which delivers a SUBACK carrying
+ * #pSubackRemainingData to the event callback.
  */
-MQTTStatus_t MQTT_ProcessLoop_FailSecondAndLaterCallsStub( MQTTContext_t * pContext,
-                                                           int numCalls )
+MQTTStatus_t MQTT_ProcessLoop_SubackStub( MQTTContext_t * pContext,
+                                          int numCalls )
 {
-    MQTTPacketInfo_t packetInfo;
-    MQTTDeserializedInfo_t deserializedInfo;
-    MQTTStatus_t status;
+    MQTTPacketInfo_t packetInfo = { 0 };
+    MQTTDeserializedInfo_t deserializedInfo = { 0 };
+    MQTTAgentContext_t * pMqttAgentContext;
 
-    packetInfo.type = packetType;
+    ( void ) numCalls;
+
+    packetInfo.type = MQTT_PACKET_TYPE_SUBACK;
+    packetInfo.pRemainingData = pSubackRemainingData;
+    packetInfo.remainingLength = subackRemainingLength;
     deserializedInfo.packetIdentifier = packetIdentifier;
+    deserializedInfo.deserializationResult = MQTTSuccess;
 
-    if( numCalls == 0 )
-    {
-        pContext->appCallback( pContext, &packetInfo, &deserializedInfo );
-        status = MQTTSuccess;
-    }
-    else
-    {
-        /* MQTT_ProcessLoop returns failure second time. */
-        pContext->appCallback( pContext, &packetInfo, &deserializedInfo );
-        status = MQTTRecvFailed;
-    }
+    pContext->appCallback( pContext, &packetInfo, &deserializedInfo );
+    pMqttAgentContext = ( MQTTAgentContext_t * ) pContext;
+    pMqttAgentContext->packetReceivedInLoop = false;
 
-    return status;
+    return MQTTSuccess;
+}
+
+/**
+ * @brief A stub for MQTT_ProcessLoop function which receives one of
+ * #pendingPacketCount packets on each call.
+ */
+MQTTStatus_t MQTT_ProcessLoop_PendingPacketsStub( MQTTContext_t * pContext,
+                                                  int numCalls )
+{
+    MQTTAgentContext_t * pMqttAgentContext;
+
+    ( void ) numCalls;
+
+    processLoopCallCount++;
+    pMqttAgentContext = ( MQTTAgentContext_t * ) pContext;
+
+    if( pendingPacketCount > 0U )
+    {
+        pendingPacketCount--;
+        pMqttAgentContext->packetReceivedInLoop = true;
+    }
+
+    return MQTTSuccess;
+}
+
+/**
+ * @brief A stub for MQTT_ProcessLoop function which fails on second and later calls.
+ */
+MQTTStatus_t MQTT_ProcessLoop_FailSecondAndLaterCallsStub( MQTTContext_t * pContext,
+                                                           int numCalls )
+{
+    MQTTPacketInfo_t packetInfo;
+    MQTTDeserializedInfo_t deserializedInfo;
+    MQTTStatus_t status;
+
+    packetInfo.type = packetType;
+    deserializedInfo.packetIdentifier = packetIdentifier;
+
+    if( numCalls == 0 )
+    {
+        pContext->appCallback( pContext, &packetInfo, &deserializedInfo );
+        status = MQTTSuccess;
+    }
+    else
+    {
+        /* MQTT_ProcessLoop returns failure second time. */
+        pContext->appCallback( pContext, &packetInfo, &deserializedInfo );
+        status = MQTTRecvFailed;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Advance the pseudo-random generator of the simulated lossy link.
+ */
+static uint32_t lossyLinkNext( void )
+{
+    lossyLinkSeed = ( lossyLinkSeed * 1103515245U ) + 12345U;
+    return lossyLinkSeed >> 16;
+}
+
+/**
+ * @brief A stub for MQTT_PublishToResend function which reports every publish
+ * still pending in the agent, as coreMQTT would after a reconnect.
+ */
+static uint16_t MQTT_PublishToResend_PendingAcksStub( const MQTTContext_t * pMqttContext,
+                                                      MQTTStateCursor_t * pCursor,
+                                                      int numCalls )
+{
+    const MQTTAgentContext_t * pMqttAgentContext = ( const MQTTAgentContext_t * ) pMqttContext;
+    uint16_t packetId = MQTT_PACKET_ID_INVALID;
+
+    ( void ) numCalls;
+
+    while( ( packetId == MQTT_PACKET_ID_INVALID ) && ( *pCursor < MQTT_AGENT_MAX_OUTSTANDING_ACKS ) )
+    {
+        packetId = pMqttAgentContext->pPendingAcks[ *pCursor ].packetId;
+        ( *pCursor )++;
+    }
+
+    return packetId;
+}
+
+/**
+ * @brief A stub for MQTT_Publish function which drops roughly one publish in
+ * four to simulate a lossy link.
+ */
+static MQTTStatus_t MQTT_Publish_LossyStub( MQTTContext_t * pContext,
+                                            const MQTTPublishInfo_t * pPublishInfo,
+                                            uint16_t packetId,
+                                            int numCalls )
+{
+    MQTTStatus_t status = MQTTSuccess;
+
+    ( void ) pContext;
+    ( void ) packetId;
+    ( void ) numCalls;
+
+    TEST_ASSERT_TRUE( pPublishInfo->dup );
+
+    if( ( lossyLinkNext() & 0x3U ) == 0U )
+    {
+        status = MQTTSendFailed;
+    }
+
+    return status;
+}
+
+/**
+ * @brief A stub for MQTT_Subscribe function which records the subscription
+ * lists sent.
+ */
+static MQTTStatus_t MQTT_Subscribe_RecordStub( MQTTContext_t * pContext,
+                                               const MQTTSubscribeInfo_t * pSubscriptionList,
+                                               size_t subscriptionCount,
+                                               uint16_t packetId,
+                                               int numCalls )
+{
+    ( void ) pContext;
+    ( void ) packetId;
+    ( void ) numCalls;
+
+    TEST_ASSERT_TRUE( subscribeCallCount < MAX_RECORDED_SUBSCRIBES );
+    pSubscribeLists[ subscribeCallCount ] = pSubscriptionList;
+    subscribeListCounts[ subscribeCallCount ] = subscriptionCount;
+    subscribeCallCount++;
+
+    return subscribeStatus;
+}
+
+/**
+ * @brief A stub for MQTTAgentCommand_Unsubscribe function which records its
+ * arguments, and waits for an UNSUBACK with packet ID 5.
+ */
+static MQTTStatus_t MQTTAgentCommand_Unsubscribe_RecordStub( MQTTAgentContext_t * pMqttAgentContext,
+                                                             void * pVoidSubscribeArgs,
+                                                             MQTTAgentCommandFuncReturns_t * pReturnFlags,
+                                                             int numCalls )
+{
+    ( void ) pMqttAgentContext;
+    ( void ) numCalls;
+
+    pUnsubscribeArgs = ( const MQTTAgentSubscribeArgs_t * ) pVoidSubscribeArgs;
+    ( void ) memset( pReturnFlags, 0x00, sizeof( MQTTAgentCommandFuncReturns_t ) );
+    pReturnFlags->packetId = 5U;
+    pReturnFlags->addAcknowledgment = true;
+
+    return MQTTSuccess;
+}
+
+/**
+ * @brief Deliver an acknowledgment to the event callback of the agent.
+ *
+ * @param[in] pAgentContext Agent receiving the acknowledgment.
+ * @param[in] type Packet type of the acknowledgment.
+ * @param[in] packetId Packet ID of the acknowledgment.
+ * @param[in] pSubackCodes Status codes of a SUBACK, or NULL.
+ * @param[in] subackCodeCount Number of status codes, at most 4.
+ */
+static void deliverAck( MQTTAgentContext_t * pAgentContext,
+                        uint8_t type,
+                        uint16_t packetId,
+                        const uint8_t * pSubackCodes,
+                        size_t subackCodeCount )
+{
+    MQTTPacketInfo_t packetInfo = { 0 };
+    MQTTDeserializedInfo_t deserializedInfo = { 0 };
+    uint8_t remainingData[ 6 ] = { 0 };
+
+    TEST_ASSERT_TRUE( subackCodeCount <= 4U );
+
+    if( subackCodeCount > 0U )
+    {
+        ( void ) memcpy( &( remainingData[ 2 ] ), pSubackCodes, subackCodeCount );
+        packetInfo.pRemainingData = remainingData;
+        packetInfo.remainingLength = 2U + subackCodeCount;
+    }
+
+    packetInfo.type = type;
+    deserializedInfo.packetIdentifier = packetId;
+    deserializedInfo.deserializationResult = MQTTSuccess;
+
+    pAgentContext->mqttContext.appCallback( &( pAgentContext->mqttContext ), &packetInfo, &deserializedInfo );
 }
 
 /**
@@ -708,6 +1346,11 @@ void test_MQTTAgent_ResumeSession_failed_publish( void )
     MQTT_Publish_IgnoreAndReturn( MQTTSendFailed );
     mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, sessionPresent );
     TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+
+    /* The publish stays pending, to be resent by the next resumed session. */
+    TEST_ASSERT_EQUAL( 1U, mqttAgentContext.pPendingAcks[ 0 ].packetId );
+    TEST_ASSERT_EQUAL_PTR( &command, mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand );
+    TEST_ASSERT_EQUAL_INT( 0, commandCompleteCallbackCount );
 }
 
 void test_MQTTAgent_ResumeSession_publish_resend_success( void )
@@ -762,6 +1405,74 @@ void test_MQTTAgent_ResumeSession_no_session_present( void )
     TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
 }
 
+/**
+ * @brief Soak MQTTAgent_ResumeSession() with many reconnects over a lossy link,
+ * checking that no pending acknowledgment is leaked or completed twice.
+ */
+void test_MQTTAgent_ResumeSession_lossy_reconnect_soak( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t commands[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ];
+    MQTTPublishInfo_t publishInfo[ MQTT_AGENT_MAX_OUTSTANDING_ACKS ];
+    uint32_t commandsIssued = 0U, commandsPending, cycle;
+    uint16_t nextPacketId = 1U;
+    bool sessionPresent;
+    size_t i;
+
+    setupAgentContext( &mqttAgentContext );
+    MQTT_PublishToResend_Stub( MQTT_PublishToResend_PendingAcksStub );
+    MQTT_Publish_Stub( MQTT_Publish_LossyStub );
+    lossyLinkSeed = 1U;
+
+    for( cycle = 0U; cycle < LOSSY_RECONNECT_CYCLES; cycle++ )
+    {
+        /* Issue a new QoS 1 publish in every slot freed by the previous cycle. */
+        for( i = 0; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+        {
+            if( mqttAgentContext.pPendingAcks[ i ].packetId == MQTT_PACKET_ID_INVALID )
+            {
+                ( void ) memset( &( publishInfo[ i ] ), 0x00, sizeof( MQTTPublishInfo_t ) );
+                ( void ) memset( &( commands[ i ] ), 0x00, sizeof( MQTTAgentCommand_t ) );
+                publishInfo[ i ].qos = MQTTQoS1;
+                commands[ i ].commandType = PUBLISH;
+                commands[ i ].pArgs = &( publishInfo[ i ] );
+                commands[ i ].pCommandCompleteCallback = stubCompletionCallback;
+                mqttAgentContext.pPendingAcks[ i ].packetId = nextPacketId;
+                mqttAgentContext.pPendingAcks[ i ].pOriginalCommand = &( commands[ i ] );
+                nextPacketId = ( nextPacketId == UINT16_MAX ) ? 1U : ( uint16_t ) ( nextPacketId + 1U );
+                commandsIssued++;
+            }
+        }
+
+        /* The broker loses the session on roughly one reconnect in eight. */
+        sessionPresent = ( ( lossyLinkNext() & 0x7U ) != 0U );
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, sessionPresent );
+        TEST_ASSERT_TRUE( ( mqttStatus == MQTTSuccess ) || ( mqttStatus == MQTTSendFailed ) );
+
+        commandsPending = 0U;
+
+        for( i = 0; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+        {
+            if( mqttAgentContext.pPendingAcks[ i ].packetId != MQTT_PACKET_ID_INVALID )
+            {
+                TEST_ASSERT_EQUAL_PTR( &( commands[ i ] ), mqttAgentContext.pPendingAcks[ i ].pOriginalCommand );
+                commandsPending++;
+            }
+        }
+
+        /* Every issued command is either still pending or was concluded exactly once. */
+        TEST_ASSERT_EQUAL_UINT32( commandsIssued, commandsPending + commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL_UINT32( commandCompleteCallbackCount, commandReleaseCallCount );
+    }
+
+    /* A final clean session must drain everything that is left. */
+    mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_UINT32( commandsIssued, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL_UINT32( commandsIssued, commandReleaseCallCount );
+}
+
 /* ========================================================================== */
 
 /**
@@ -885,12 +1596,19 @@ void test_MQTTAgent_Subscribe_success( void )
     /* Success case. */
     subscribeArgs.pSubscribeInfo = &subscribeInfo;
     subscribeArgs.numSubscriptions = 1U;
+    commandInfo.pSubscriber = &agentContext;
     mqttStatus = MQTTAgent_Subscribe( &agentContext, &subscribeArgs, &commandInfo );
     TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
     TEST_ASSERT_EQUAL_PTR( &command, globalMessageContext.pSentCommand );
     TEST_ASSERT_EQUAL( SUBSCRIBE, command.commandType );
     TEST_ASSERT_EQUAL_PTR( &subscribeArgs, command.pArgs );
     TEST_ASSERT_NULL( command.pCommandCompleteCallback );
+
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        TEST_ASSERT_EQUAL_PTR( &agentContext, command.pSubscriber );
+    }
+    #endif
 }
 
 /**
@@ -1070,6 +1788,78 @@ void test_MQTTAgent_Publish_success( void )
     TEST_ASSERT_EQUAL( PUBLISH, command.commandType );
     TEST_ASSERT_EQUAL_PTR( &publishInfo, command.pArgs );
     TEST_ASSERT_EQUAL_PTR( stubCompletionCallback, command.pCommandCompleteCallback );
+
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+    {
+        TEST_ASSERT_FALSE( command.conflate );
+
+        /* The conflation policy is carried by the command. */
+        commandInfo.conflate = true;
+        mqttStatus = MQTTAgent_Publish( &agentContext, &publishInfo, &commandInfo );
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_TRUE( command.conflate );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that a command in storage given by the caller is used instead
+ * of one from the command pool, and is never released to the pool.
+ */
+void test_MQTTAgent_PublishWithStorage( void )
+{
+    MQTTAgentContext_t agentContext = { 0 };
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTAgentCommand_t command = { 0 };
+    MQTTPublishInfo_t publishInfo = { 0 };
+
+    setupAgentContext( &agentContext );
+
+    /* The command pool is empty. */
+    pCommandToReturn = NULL;
+    commandInfo.cmdCompleteCallback = stubCompletionCallback;
+    publishInfo.pTopicName = "test";
+    publishInfo.topicNameLength = 4;
+    agentContext.mqttContext.networkBuffer.size = 10;
+
+    /* The storage must be given. */
+    mqttStatus = MQTTAgent_PublishWithStorage( &agentContext, &publishInfo, &commandInfo, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* The publish itself is checked as for MQTTAgent_Publish(). */
+    mqttStatus = MQTTAgent_PublishWithStorage( &agentContext, NULL, &commandInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    TEST_ASSERT_NULL( globalMessageContext.pSentCommand );
+
+    mqttStatus = MQTTAgent_PublishWithStorage( &agentContext, &publishInfo, &commandInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &command, globalMessageContext.pSentCommand );
+    TEST_ASSERT_EQUAL( PUBLISH, command.commandType );
+    TEST_ASSERT_TRUE( command.callerOwned );
+
+    /* The command is not released when it cannot be enqueued. */
+    agentContext.agentInterface.send = stubSendFail;
+    mqttStatus = MQTTAgent_PublishWithStorage( &agentContext, &publishInfo, &commandInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+    TEST_ASSERT_EQUAL( 0, commandReleaseCallCount );
+
+    /* The command is not released when it completes. */
+    agentContext.agentInterface.recv = stubReceiveQueue;
+    pQueuedCommands[ queuedCommandCount ] = &command;
+    queuedCommandCount++;
+
+    mqttStatus = MQTTAgent_CancelAll( &agentContext );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( 0, commandReleaseCallCount );
+
+    /* A command from the pool is still released. */
+    pCommandToReturn = &command;
+    mqttStatus = MQTTAgent_Publish( &agentContext, &publishInfo, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+    TEST_ASSERT_FALSE( command.callerOwned );
+    TEST_ASSERT_EQUAL( 1, commandReleaseCallCount );
 }
 
 /* ========================================================================== */
@@ -1674,6 +2464,81 @@ void test_MQTTAgent_CommandLoop_with_eventCallback( void )
     TEST_ASSERT_EQUAL( 0, commandCompleteCallbackCount );
 }
 
+/**
+ * @brief Test that SUBACK status codes are only passed to the completion
+ * callback when the SUBACK is long enough to carry them.
+ */
+void test_MQTTAgent_CommandLoop_suback_status_codes( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentCommand_t subscribeCommand = { 0 };
+    uint8_t subackData[ 3 ] = { 0x00, 0x01, 0x01 };
+
+    setupAgentContext( &mqttAgentContext );
+
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+    returnFlags.runProcessLoop = true;
+    returnFlags.endLoop = true;
+
+    commandToSend.commandType = PUBLISH;
+    mqttAgentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+
+    subscribeCommand.commandType = SUBSCRIBE;
+    subscribeCommand.pCommandCompleteCallback = stubSubackCompletionCallback;
+
+    /* A well formed SUBACK hands its status codes to the callback. */
+    mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+    mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &subscribeCommand;
+    pSubackRemainingData = subackData;
+    subackRemainingLength = sizeof( subackData );
+
+    MQTTAgentCommand_Publish_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+    MQTT_ProcessLoop_Stub( MQTT_ProcessLoop_SubackStub );
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL_PTR( &( subackData[ 2 ] ), pReceivedSubackCodes );
+    TEST_ASSERT_EQUAL( 0, mqttAgentContext.pPendingAcks[ 0 ].packetId );
+
+    /* A SUBACK without any status codes must not expose memory past its end. */
+    commandCompleteCallbackCount = 0;
+    pReceivedSubackCodes = subackData;
+    mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+    mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &subscribeCommand;
+    subackRemainingLength = 2U;
+
+    MQTTAgentCommand_Publish_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_NULL( pReceivedSubackCodes );
+
+    /* Nor may a SUBACK without remaining data. */
+    commandCompleteCallbackCount = 0;
+    pReceivedSubackCodes = subackData;
+    mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+    mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &subscribeCommand;
+    pSubackRemainingData = NULL;
+    subackRemainingLength = sizeof( subackData );
+
+    MQTTAgentCommand_Publish_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_NULL( pReceivedSubackCodes );
+}
+
 /**
  * @brief Test mqttEventCallback invocation via MQTT_ProcessLoop.
  * TODO: Split this function up.
@@ -1892,3 +2757,1861 @@ void test_MQTTAgent_CancelAll( void )
     /* Ensure that command is released. */
     TEST_ASSERT_EQUAL( 2, commandReleaseCallCount );
 }
+
+/**
+ * @brief Test that MQTTAgent_CancelAll() cancels the commands received ahead
+ * of the command loop for conflation.
+ */
+void test_MQTTAgent_CancelAll_staged_commands( void )
+{
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+    {
+        MQTTAgentContext_t mqttAgentContext = { 0 };
+        MQTTStatus_t mqttStatus;
+        MQTTAgentCommand_t commands[ 2 ] = { 0 };
+        MQTTAgentCommandContext_t commandContexts[ 2 ] = { 0 };
+
+        setupAgentContext( &mqttAgentContext );
+        mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+
+        commands[ 0 ].pCommandCompleteCallback = stubCompletionCallback;
+        commands[ 0 ].pCmdContext = &commandContexts[ 0 ];
+        commands[ 1 ].pCommandCompleteCallback = stubCompletionCallback;
+        commands[ 1 ].pCmdContext = &commandContexts[ 1 ];
+
+        /* Staged commands wrapping around the end of the array. */
+        mqttAgentContext.stagedCommandStart = MQTT_AGENT_CONFLATION_LOOKAHEAD - 1U;
+        mqttAgentContext.stagedCommandCount = 2U;
+        mqttAgentContext.pStagedCommands[ MQTT_AGENT_CONFLATION_LOOKAHEAD - 1U ] = &commands[ 0 ];
+        mqttAgentContext.pStagedCommands[ 0 ] = &commands[ 1 ];
+
+        mqttStatus = MQTTAgent_CancelAll( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 0U, mqttAgentContext.stagedCommandCount );
+        TEST_ASSERT_EQUAL( 2, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 2, commandReleaseCallCount );
+        TEST_ASSERT_EQUAL( MQTTRecvFailed, commandContexts[ 0 ].returnStatus );
+        TEST_ASSERT_EQUAL( MQTTRecvFailed, commandContexts[ 1 ].returnStatus );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_CONFLATION_LOOKAHEAD." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that MQTTAgent_CommandLoop() completes a publish as superseded
+ * when a later publish to the same topic allowing conflation is queued, and
+ * sends all other publishes.
+ */
+void test_MQTTAgent_CommandLoop_conflation( void )
+{
+    #if ( MQTT_AGENT_CONFLATION_LOOKAHEAD > 0U )
+    {
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTStatus_t mqttStatus;
+        MQTTAgentCommand_t commands[ 5 ] = { 0 };
+        MQTTPublishInfo_t publishInfo[ 5 ] = { 0 };
+        MQTTAgentCommandContext_t commandContexts[ 5 ] = { 0 };
+        MQTTAgentCommand_t terminateCommand = { 0 };
+        MQTTAgentCommandFuncReturns_t terminateFlags = { 0 };
+
+        setupAgentContext( &mqttAgentContext );
+        mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+
+        /* Superseded by the third publish. */
+        setupConflationPublish( &commands[ 0 ], &publishInfo[ 0 ], &commandContexts[ 0 ], "a", true );
+        /* Different topic, and a topic sharing the same prefix. */
+        setupConflationPublish( &commands[ 1 ], &publishInfo[ 1 ], &commandContexts[ 1 ], "b", true );
+        setupConflationPublish( &commands[ 2 ], &publishInfo[ 2 ], &commandContexts[ 2 ], "ab", true );
+        setupConflationPublish( &commands[ 3 ], &publishInfo[ 3 ], &commandContexts[ 3 ], "a", true );
+        /* Conflation not allowed by the later publish. */
+        setupConflationPublish( &commands[ 4 ], &publishInfo[ 4 ], &commandContexts[ 4 ], "a", false );
+
+        terminateCommand.commandType = TERMINATE;
+        pQueuedCommands[ queuedCommandCount ] = &terminateCommand;
+        queuedCommandCount++;
+        terminateFlags.endLoop = true;
+
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 1 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 2 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 3 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 4 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 5, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 6, commandReleaseCallCount );
+        TEST_ASSERT_TRUE( commandContexts[ 0 ].superseded );
+        TEST_ASSERT_EQUAL( MQTTSuccess, commandContexts[ 0 ].returnStatus );
+        TEST_ASSERT_FALSE( commandContexts[ 1 ].superseded );
+        TEST_ASSERT_FALSE( commandContexts[ 2 ].superseded );
+        TEST_ASSERT_FALSE( commandContexts[ 3 ].superseded );
+        TEST_ASSERT_FALSE( commandContexts[ 4 ].superseded );
+        TEST_ASSERT_EQUAL( 0U, mqttAgentContext.stagedCommandCount );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_CONFLATION_LOOKAHEAD." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that MQTTAgent_CommandLoop() processes queued commands between
+ * at most #MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS calls to MQTT_ProcessLoop()
+ * while packets keep being received.
+ */
+void test_MQTTAgent_CommandLoop_process_loop_limit( void )
+{
+    #if ( MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS > 0U )
+    {
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTStatus_t mqttStatus;
+        MQTTAgentCommand_t commands[ 2 ] = { 0 };
+        MQTTPublishInfo_t publishInfo[ 2 ] = { 0 };
+        MQTTAgentCommandContext_t commandContexts[ 2 ] = { 0 };
+        MQTTAgentCommand_t terminateCommand = { 0 };
+        MQTTAgentCommandFuncReturns_t terminateFlags = { 0 };
+
+        setupAgentContext( &mqttAgentContext );
+        mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+        mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+
+        setupConflationPublish( &commands[ 0 ], &publishInfo[ 0 ], &commandContexts[ 0 ], "a", false );
+        setupConflationPublish( &commands[ 1 ], &publishInfo[ 1 ], &commandContexts[ 1 ], "b", false );
+
+        terminateCommand.commandType = TERMINATE;
+        pQueuedCommands[ queuedCommandCount ] = &terminateCommand;
+        queuedCommandCount++;
+        terminateFlags.endLoop = true;
+
+        /* More packets than can be received after both publishes. */
+        pendingPacketCount = ( 2U * MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS ) + 2U;
+        returnFlags.runProcessLoop = true;
+
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 0 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 1 ], NULL, MQTTSuccess );
+        MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+        MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+        MQTT_ProcessLoop_Stub( MQTT_ProcessLoop_PendingPacketsStub );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 2U * MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS, processLoopCallCount );
+        TEST_ASSERT_EQUAL( 2U, pendingPacketCount );
+        /* The remaining packets are received without waiting for a command. */
+        TEST_ASSERT_TRUE( mqttAgentContext.packetReceivedInLoop );
+        TEST_ASSERT_EQUAL( 2, commandCompleteCallbackCount );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test MQTTAgent_Step() with invalid parameters.
+ */
+void test_MQTTAgent_Step_invalid_params( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    uint32_t waitTimeMs;
+    bool endLoop;
+
+    mqttStatus = MQTTAgent_Step( NULL, &waitTimeMs, &endLoop );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    setupAgentContext( &mqttAgentContext );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, NULL, &endLoop );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttAgentContext.agentInterface.pMsgCtx = NULL;
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+}
+
+/**
+ * @brief Test that MQTTAgent_Step() processes all queued commands without
+ * waiting, and returns the time until it must be called again.
+ */
+void test_MQTTAgent_Step( void )
+{
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommand_t commands[ 2 ] = { 0 };
+    MQTTPublishInfo_t publishInfo[ 2 ] = { 0 };
+    MQTTAgentCommandContext_t commandContexts[ 2 ] = { 0 };
+    MQTTAgentCommand_t terminateCommand = { 0 };
+    MQTTAgentCommandFuncReturns_t terminateFlags = { 0 };
+    MQTTAgentTimer_t timer = { 0 };
+    uint32_t timerCount = 0U;
+    uint32_t waitTimeMs = 0U;
+    bool endLoop = true;
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+    mqttAgentContext.mqttContext.getTime = stubGetTimerTime;
+
+    setupConflationPublish( &commands[ 0 ], &publishInfo[ 0 ], &commandContexts[ 0 ], "a", false );
+    setupConflationPublish( &commands[ 1 ], &publishInfo[ 1 ], &commandContexts[ 1 ], "b", false );
+    returnFlags.runProcessLoop = true;
+
+    MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 0 ], NULL, MQTTSuccess );
+    MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+    MQTTAgentCommand_Publish_ExpectAndReturn( &mqttAgentContext, &publishInfo[ 1 ], NULL, MQTTSuccess );
+    MQTTAgentCommand_Publish_IgnoreArg_pReturnFlags();
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+    MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+    MQTT_ProcessLoop_Stub( MQTT_ProcessLoop_PendingPacketsStub );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+    #if ( MQTT_AGENT_MAX_STEP_COMMANDS == 2U )
+    {
+        /* The limit is reached before the queue is seen to be empty. */
+        TEST_ASSERT_EQUAL( 0U, waitTimeMs );
+
+        mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+    }
+    #endif
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_FALSE( endLoop );
+    TEST_ASSERT_EQUAL( 2, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( 3U, processLoopCallCount );
+    TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME, waitTimeMs );
+
+    /* The wait is shorter when a timer expires sooner. */
+    timer.callback = stubTimerCallback;
+    timer.pTimerContext = &timerCount;
+    mqttStatus = MQTTAgent_StartTimer( &mqttAgentContext, &timer, 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 10U, waitTimeMs );
+
+    #if ( MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS > 0U )
+    {
+        /* There is no wait while received packets are still to be processed. */
+        pendingPacketCount = MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS + 1U;
+        MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+        mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 0U, waitTimeMs );
+        TEST_ASSERT_EQUAL( 1U, pendingPacketCount );
+    }
+    #endif
+
+    /* The expired timer runs, and a terminate command ends the loop. */
+    timerTimeMs += 10U;
+    terminateCommand.commandType = TERMINATE;
+    pQueuedCommands[ queuedCommandCount ] = &terminateCommand;
+    queuedCommandCount++;
+    terminateFlags.endLoop = true;
+    MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( endLoop );
+    TEST_ASSERT_EQUAL( 1U, timerCount );
+}
+
+/**
+ * @brief Test that MQTTAgent_Step() returns without waiting after
+ * #MQTT_AGENT_MAX_STEP_COMMANDS commands, and processes the rest on the next
+ * call.
+ */
+void test_MQTTAgent_Step_command_limit( void )
+{
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommand_t commands[ 3 ] = { 0 };
+    MQTTPublishInfo_t publishInfo[ 3 ] = { 0 };
+    MQTTAgentCommandContext_t commandContexts[ 3 ] = { 0 };
+    uint32_t waitTimeMs = 0U;
+    bool endLoop = true;
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+    mqttAgentContext.mqttContext.getTime = stubGetTimerTime;
+
+    setupConflationPublish( &commands[ 0 ], &publishInfo[ 0 ], &commandContexts[ 0 ], "a", false );
+    setupConflationPublish( &commands[ 1 ], &publishInfo[ 1 ], &commandContexts[ 1 ], "b", false );
+    setupConflationPublish( &commands[ 2 ], &publishInfo[ 2 ], &commandContexts[ 2 ], "c", false );
+
+    MQTTAgentCommand_Publish_IgnoreAndReturn( MQTTSuccess );
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+
+    mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_FALSE( endLoop );
+
+    #if ( MQTT_AGENT_MAX_STEP_COMMANDS == 2U )
+    {
+        /* The third command is left for the next call, which is not delayed. */
+        TEST_ASSERT_EQUAL( 2, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 0U, waitTimeMs );
+
+        mqttStatus = MQTTAgent_Step( &mqttAgentContext, &waitTimeMs, &endLoop );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_FALSE( endLoop );
+    }
+    #endif
+
+    TEST_ASSERT_EQUAL( 3, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME, waitTimeMs );
+}
+
+/**
+ * @brief Test that commands with a completion context but no completion
+ * callback complete into the completion queue set on the agent.
+ */
+void test_MQTTAgent_SetCompletionQueue( void )
+{
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommand_t commands[ 5 ] = { 0 };
+    MQTTAgentCommandContext_t commandContexts[ 5 ] = { 0 };
+    MQTTAgentCompletionEntry_t entries[ 2 ];
+    MQTTAgentCompletionQueue_t completionQueue;
+    MQTTAgentCompletionInterface_t completionInterface;
+    MQTTAgentCompletionEventContext_t eventContext = { 0 };
+    size_t i;
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+
+    mqttStatus = MQTTAgent_SetCompletionQueue( NULL, &completionQueue );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    completionInterface.pEventCtx = &eventContext;
+    completionInterface.wait = stubCompletionWait;
+    completionInterface.wake = stubCompletionWake;
+    mqttStatus = MQTTAgentCompletionQueue_Init( &completionQueue, entries, 2U, &completionInterface, stubGetTime );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgent_SetCompletionQueue( &mqttAgentContext, &completionQueue );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &completionQueue, mqttAgentContext.pCompletionQueue );
+
+    for( i = 0; i < 5U; i++ )
+    {
+        commands[ i ].pCmdContext = &commandContexts[ i ];
+        pQueuedCommands[ queuedCommandCount ] = &commands[ i ];
+        queuedCommandCount++;
+    }
+
+    /* A callback is still invoked, and a command without context is not
+     * posted. */
+    commands[ 1 ].pCommandCompleteCallback = stubCompletionCallback;
+    commands[ 2 ].pCmdContext = NULL;
+
+    mqttStatus = MQTTAgent_CancelAll( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( 5, commandReleaseCallCount );
+    TEST_ASSERT_EQUAL( 2U, completionQueue.postedCount );
+    TEST_ASSERT_EQUAL( 2U, eventContext.wakeCount );
+    TEST_ASSERT_EQUAL( 0U, eventContext.waitCount );
+    TEST_ASSERT_EQUAL_PTR( &commandContexts[ 0 ], entries[ 0 ].pCmdCompleteCallbackContext );
+    TEST_ASSERT_EQUAL( MQTTRecvFailed, entries[ 0 ].returnInfo.returnCode );
+    TEST_ASSERT_NULL( entries[ 0 ].returnInfo.pSubackCodes );
+    TEST_ASSERT_EQUAL_PTR( &commandContexts[ 3 ], entries[ 1 ].pCmdCompleteCallbackContext );
+
+    /* The last completion does not fit in the queue. */
+    TEST_ASSERT_EQUAL( 1U, completionQueue.overflowCount );
+
+    /* Completions are not posted once the queue is removed. */
+    mqttStatus = MQTTAgent_SetCompletionQueue( &mqttAgentContext, NULL );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    completionQueue.reapedCount = 2U;
+    queuedCommandIndex = 0U;
+    mqttStatus = MQTTAgent_CancelAll( &mqttAgentContext );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, completionQueue.postedCount );
+}
+
+/**
+ * @brief Test MQTTAgent_RegisterCommands() parameter validation.
+ */
+void test_MQTTAgent_RegisterCommands( void )
+{
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommandFunc_t commandTable[ 2 ] = { stubCustomCommand, stubCustomCommand };
+
+    setupAgentContext( &mqttAgentContext );
+
+    /* No commands are registered after initialization. */
+    TEST_ASSERT_NULL( mqttAgentContext.pCustomCommandTable );
+    TEST_ASSERT_EQUAL( 0U, mqttAgentContext.customCommandCount );
+
+    /* Invalid parameters. */
+    mqttStatus = MQTTAgent_RegisterCommands( NULL, commandTable, 2U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, NULL, 2U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, commandTable, MQTT_AGENT_MAX_CUSTOM_COMMANDS + 1U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    commandTable[ 1 ] = NULL;
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, commandTable, 2U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    TEST_ASSERT_NULL( mqttAgentContext.pCustomCommandTable );
+    TEST_ASSERT_EQUAL( 0U, mqttAgentContext.customCommandCount );
+
+    /* Valid table. */
+    commandTable[ 1 ] = stubCustomCommand;
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, commandTable, 2U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( commandTable, mqttAgentContext.pCustomCommandTable );
+    TEST_ASSERT_EQUAL( 2U, mqttAgentContext.customCommandCount );
+
+    /* An empty table removes the registered commands. */
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, NULL, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_NULL( mqttAgentContext.pCustomCommandTable );
+    TEST_ASSERT_EQUAL( 0U, mqttAgentContext.customCommandCount );
+}
+
+/**
+ * @brief Test that MQTTAgent_CommandLoop runs a registered application command
+ * with its arguments and honors the flags it returns.
+ */
+void test_MQTTAgent_CommandLoop_custom_command( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentCommandContext_t commandContext = { 0 };
+    const MQTTAgentCommandFunc_t commandTable[ 2 ] = { MQTTAgentCommand_Ping, stubCustomCommand };
+    uint32_t commandArgs = 0U;
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, commandTable, 2U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    returnFlags.endLoop = true;
+
+    /* The second application command takes the type after the first. */
+    commandToSend.commandType = ( MQTTAgentCommandType_t ) ( ( uint32_t ) NUM_COMMANDS + 1U );
+    commandToSend.pCommandCompleteCallback = stubCompletionCallback;
+    commandToSend.pCmdContext = &commandContext;
+    commandToSend.pArgs = &commandArgs;
+    mqttAgentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, customCommandCallCount );
+    TEST_ASSERT_EQUAL_PTR( &commandArgs, pCustomCommandArgs );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, commandContext.returnStatus );
+    TEST_ASSERT_EQUAL( 1, commandReleaseCallCount );
+}
+
+/**
+ * @brief Test that MQTTAgent_CommandLoop processes a command type above the
+ * registered application commands as #NONE.
+ */
+void test_MQTTAgent_CommandLoop_unregistered_custom_command( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &mqttAgentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    returnFlags.endLoop = true;
+
+    MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+    commandToSend.commandType = ( MQTTAgentCommandType_t ) ( ( uint32_t ) NUM_COMMANDS + 1U );
+    commandToSend.pCommandCompleteCallback = stubCompletionCallback;
+    mqttAgentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, customCommandCallCount );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+}
+
+/**
+ * @brief Test MQTTAgent_CustomCommand() with invalid parameters and command IDs.
+ */
+void test_MQTTAgent_CustomCommand_Invalid_Params( void )
+{
+    MQTTAgentContext_t agentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTAgentCommand_t command = { 0 };
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &agentContext );
+    pCommandToReturn = &command;
+
+    mqttStatus = MQTTAgent_CustomCommand( NULL, 0U, NULL, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_CustomCommand( &agentContext, 0U, NULL, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* No commands are registered. */
+    mqttStatus = MQTTAgent_CustomCommand( &agentContext, 0U, NULL, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Command ID beyond the registered table. */
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgent_CustomCommand( &agentContext, 1U, NULL, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_CustomCommand( &agentContext, UINT32_MAX, NULL, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Nothing was enqueued. */
+    TEST_ASSERT_NULL( globalMessageContext.pSentCommand );
+}
+
+/**
+ * @brief Test that MQTTAgent_CustomCommand() enqueues a command which the
+ * command loop runs with the given arguments.
+ */
+void test_MQTTAgent_CustomCommand_success( void )
+{
+    MQTTAgentContext_t agentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTAgentCommand_t command = { 0 };
+    const MQTTAgentCommandFunc_t commandTable[ 2 ] = { MQTTAgentCommand_Ping, stubCustomCommand };
+    uint32_t commandArgs = 0U;
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.connectStatus = MQTTConnected;
+    pCommandToReturn = &command;
+    commandInfo.cmdCompleteCallback = stubCompletionCallback;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 2U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgent_CustomCommand( &agentContext, 1U, &commandArgs, &commandInfo );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &command, globalMessageContext.pSentCommand );
+    TEST_ASSERT_EQUAL( ( uint32_t ) NUM_COMMANDS + 1U, ( uint32_t ) command.commandType );
+    TEST_ASSERT_EQUAL_PTR( &commandArgs, command.pArgs );
+    TEST_ASSERT_EQUAL_PTR( stubCompletionCallback, command.pCommandCompleteCallback );
+
+    /* The agent runs the registered function for the command. */
+    returnFlags.endLoop = true;
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, customCommandCallCount );
+    TEST_ASSERT_EQUAL_PTR( &commandArgs, pCustomCommandArgs );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+}
+
+/**
+ * @brief Test MQTTAgent_StartTimer() and MQTTAgent_StopTimer() with invalid parameters.
+ */
+void test_MQTTAgent_Timer_Invalid_Params( void )
+{
+    MQTTAgentContext_t agentContext;
+    MQTTAgentContext_t uninitializedContext = { 0 };
+    MQTTStatus_t mqttStatus;
+    MQTTAgentTimer_t timer = { 0 };
+
+    setupAgentContext( &agentContext );
+
+    mqttStatus = MQTTAgent_StartTimer( NULL, &timer, 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, NULL, 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* No callback. */
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &timer, 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Context not initialized. */
+    timer.callback = stubTimerCallback;
+    mqttStatus = MQTTAgent_StartTimer( &uninitializedContext, &timer, 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    TEST_ASSERT_NULL( agentContext.pTimerList );
+
+    mqttStatus = MQTTAgent_StopTimer( NULL, &timer );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_StopTimer( &agentContext, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Stopping a timer that is not running is not an error. */
+    mqttStatus = MQTTAgent_StopTimer( &agentContext, &timer );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+}
+
+/**
+ * @brief Test that running timers are kept in expiry order, including across
+ * a wrap of the time, and that restarting or stopping a timer updates the list.
+ */
+void test_MQTTAgent_Timer_Ordering( void )
+{
+    MQTTAgentContext_t agentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentTimer_t timers[ 3 ] = { { 0 } };
+    uint32_t callbackCount = 0U;
+    size_t i;
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    timerTimeMs = UINT32_MAX - 5U;
+
+    for( i = 0U; i < 3U; i++ )
+    {
+        timers[ i ].callback = stubTimerCallback;
+        timers[ i ].pTimerContext = &callbackCount;
+    }
+
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &timers[ 0 ], 30U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &timers[ 1 ], 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* Started later, but expires between the other two. */
+    timerTimeMs += 5U;
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &timers[ 2 ], 10U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    TEST_ASSERT_EQUAL_PTR( &timers[ 1 ], agentContext.pTimerList );
+    TEST_ASSERT_EQUAL_PTR( &timers[ 2 ], timers[ 1 ].pNext );
+    TEST_ASSERT_EQUAL_PTR( &timers[ 0 ], timers[ 2 ].pNext );
+    TEST_ASSERT_NULL( timers[ 0 ].pNext );
+
+    /* Restarting the first timer moves it to the end. */
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &timers[ 1 ], 100U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    TEST_ASSERT_EQUAL_PTR( &timers[ 2 ], agentContext.pTimerList );
+    TEST_ASSERT_EQUAL_PTR( &timers[ 0 ], timers[ 2 ].pNext );
+    TEST_ASSERT_EQUAL_PTR( &timers[ 1 ], timers[ 0 ].pNext );
+    TEST_ASSERT_NULL( timers[ 1 ].pNext );
+
+    /* Stopping a timer in the middle of the list. */
+    mqttStatus = MQTTAgent_StopTimer( &agentContext, &timers[ 0 ] );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    TEST_ASSERT_EQUAL_PTR( &timers[ 2 ], agentContext.pTimerList );
+    TEST_ASSERT_EQUAL_PTR( &timers[ 1 ], timers[ 2 ].pNext );
+    TEST_ASSERT_NULL( timers[ 1 ].pNext );
+    TEST_ASSERT_EQUAL( 0U, callbackCount );
+}
+
+/**
+ * @brief Test that MQTTAgent_CommandLoop waits no longer than the earliest
+ * timer expiry, and runs one-shot and periodic timers on time.
+ */
+void test_MQTTAgent_CommandLoop_timers( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t agentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentTimer_t periodicTimer = { 0 };
+    MQTTAgentTimer_t oneShotTimer = { 0 };
+    uint32_t periodicCount = 0U;
+    uint32_t oneShotCount = 0U;
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+    const uint32_t expectedWaitTimes[] = { 100U, 100U, 50U, 50U, 100U, 100U };
+    size_t i;
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    agentContext.agentInterface.recv = stubReceiveAdvanceTime;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    periodicTimer.callback = stubTimerCallback;
+    periodicTimer.pTimerContext = &periodicCount;
+    oneShotTimer.callback = stubTimerCallback;
+    oneShotTimer.pTimerContext = &oneShotCount;
+
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &periodicTimer, 100U, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &oneShotTimer, 250U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* No commands arrive before 500 ms, when a command ends the loop. */
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    returnFlags.endLoop = true;
+    commandToSend.commandType = NUM_COMMANDS;
+    commandToSend.pCommandCompleteCallback = stubCompletionCallback;
+    agentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+    commandArrivalTimeMs = 500U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 500U, timerTimeMs );
+    TEST_ASSERT_EQUAL( sizeof( expectedWaitTimes ) / sizeof( expectedWaitTimes[ 0 ] ), recordedWaitCount );
+
+    for( i = 0U; i < recordedWaitCount; i++ )
+    {
+        TEST_ASSERT_EQUAL( expectedWaitTimes[ i ], recordedWaitTimes[ i ] );
+    }
+
+    /* The periodic timer expired at 100, 200, 300 and 400 ms. The loop ended
+     * before running it at 500 ms. */
+    TEST_ASSERT_EQUAL( 4U, periodicCount );
+    TEST_ASSERT_EQUAL( 1U, oneShotCount );
+
+    /* Only the periodic timer is still running, next expiring at 500 ms. */
+    TEST_ASSERT_EQUAL_PTR( &periodicTimer, agentContext.pTimerList );
+    TEST_ASSERT_NULL( periodicTimer.pNext );
+    TEST_ASSERT_EQUAL( 400U, periodicTimer.startTimeMs );
+    TEST_ASSERT_EQUAL( 100U, periodicTimer.delayMs );
+}
+
+/**
+ * @brief Test that a late periodic timer skips missed periods, that a stopped
+ * timer does not run even if it had expired, and that a timer restarted with
+ * no delay from its own callback runs on the next loop iteration.
+ */
+void test_MQTTAgent_CommandLoop_timer_callbacks( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t agentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentTimer_t stoppingTimer = { 0 };
+    MQTTAgentTimer_t stoppedTimer = { 0 };
+    MQTTAgentTimer_t periodicTimer = { 0 };
+    uint32_t stoppingCount = 0U;
+    uint32_t stoppedCount = 0U;
+    uint32_t periodicCount = 0U;
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    agentContext.agentInterface.recv = stubReceiveAdvanceTime;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    stoppingTimer.callback = stubStopTimerCallback;
+    stoppingTimer.pTimerContext = &stoppingCount;
+    stoppedTimer.callback = stubTimerCallback;
+    stoppedTimer.pTimerContext = &stoppedCount;
+    periodicTimer.callback = stubTimerCallback;
+    periodicTimer.pTimerContext = &periodicCount;
+    pTimerToStop = &stoppedTimer;
+
+    /* Both one-shot timers have expired when the loop starts. */
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &stoppingTimer, 0U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &stoppedTimer, 0U, 0U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_StartTimer( &agentContext, &periodicTimer, 10U, 10U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* The periodic timer is 3.5 periods late when the loop starts. */
+    timerTimeMs = 35U;
+
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    returnFlags.endLoop = true;
+    commandToSend.commandType = NUM_COMMANDS;
+    commandToSend.pCommandCompleteCallback = stubCompletionCallback;
+    agentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+    commandArrivalTimeMs = 35U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, recordedWaitCount );
+
+    /* The restarted timer is due, so the loop did not wait. */
+    TEST_ASSERT_EQUAL( 0U, recordedWaitTimes[ 0 ] );
+    TEST_ASSERT_EQUAL( 1U, stoppingCount );
+    TEST_ASSERT_EQUAL( 0U, stoppedCount );
+
+    /* The periodic timer ran once and was reloaded from the current time. */
+    TEST_ASSERT_EQUAL( 1U, periodicCount );
+    TEST_ASSERT_EQUAL( 35U, periodicTimer.startTimeMs );
+    TEST_ASSERT_EQUAL_PTR( &stoppingTimer, agentContext.pTimerList );
+    TEST_ASSERT_EQUAL_PTR( &periodicTimer, stoppingTimer.pNext );
+    TEST_ASSERT_NULL( agentContext.pExpiredTimerList );
+}
+
+/**
+ * @brief Test MQTTAgent_StartProducer() and MQTTAgent_StopProducer() with
+ * invalid parameters.
+ */
+void test_MQTTAgent_Producer_Invalid_Params( void )
+{
+    MQTTAgentContext_t agentContext;
+    MQTTStatus_t mqttStatus;
+    MQTTAgentProducer_t producer;
+    uint8_t payloadBuffer[ 4 ];
+
+    setupAgentContext( &agentContext );
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS0 );
+
+    mqttStatus = MQTTAgent_StartProducer( NULL, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, NULL, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 0U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    producer.fill = NULL;
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    setupProducer( &producer, NULL, sizeof( payloadBuffer ), MQTTQoS0 );
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS0 );
+    producer.publishInfo.pTopicName = NULL;
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS0 );
+    producer.publishInfo.topicNameLength = 0U;
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    TEST_ASSERT_NULL( agentContext.pTimerList );
+
+    mqttStatus = MQTTAgent_StopProducer( &agentContext, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_StopProducer( NULL, &producer );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    /* Start then stop. */
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS0 );
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL_PTR( &( producer.timer ), agentContext.pTimerList );
+
+    mqttStatus = MQTTAgent_StopProducer( &agentContext, &producer );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_NULL( agentContext.pTimerList );
+}
+
+/**
+ * @brief Test that a QoS 0 producer publishes the latest sample every period
+ * while connected, and skips periods while disconnected.
+ */
+void test_MQTTAgent_Producer_QoS0( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t agentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentProducer_t producer;
+    uint8_t payloadBuffer[ 4 ];
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    agentContext.agentInterface.recv = stubReceiveAdvanceTime;
+    agentContext.mqttContext.connectStatus = MQTTConnected;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS0 );
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_Publish_Stub( MQTT_Publish_ProducerStub );
+    returnFlags.endLoop = true;
+    commandToSend.commandType = NUM_COMMANDS;
+    agentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+    commandArrivalTimeMs = 350U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 3U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 0U, producer.skipCount );
+    TEST_ASSERT_EQUAL( 3U, lastPublishedSample );
+    /* Only the command ending the loop was released. */
+    TEST_ASSERT_EQUAL( 1, commandReleaseCallCount );
+
+    /* Nothing is published while disconnected, and the fill function is not called. */
+    agentContext.mqttContext.connectStatus = MQTTNotConnected;
+    commandArrivalTimeMs = 550U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 3U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 2U, producer.skipCount );
+    TEST_ASSERT_EQUAL( 3U, producerSample );
+
+    /* No publish when the fill function has no sample or too long a payload. */
+    agentContext.mqttContext.connectStatus = MQTTConnected;
+    producerHasSample = false;
+    commandArrivalTimeMs = 650U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    producerHasSample = true;
+    producerPayloadLength = sizeof( payloadBuffer ) + 1U;
+    commandArrivalTimeMs = 750U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 3U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 2U, producer.skipCount );
+    TEST_ASSERT_EQUAL( 5U, producerSample );
+}
+
+/**
+ * @brief Test that a QoS 1 producer tracks its publish as a pending ack and
+ * conflates samples until it is acknowledged, or when no command is available.
+ */
+void test_MQTTAgent_Producer_QoS1_conflation( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t agentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentCommand_t ackCommand = { 0 };
+    MQTTAgentProducer_t producer;
+    uint8_t payloadBuffer[ 4 ];
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    agentContext.agentInterface.recv = stubReceiveAdvanceTime;
+    agentContext.mqttContext.connectStatus = MQTTConnected;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS1 );
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_Publish_Stub( MQTT_Publish_ProducerStub );
+    MQTT_GetPacketId_ExpectAnyArgsAndReturn( 7U );
+    pCommandToReturn = &ackCommand;
+    returnFlags.endLoop = true;
+    commandToSend.commandType = NUM_COMMANDS;
+    agentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+    commandArrivalTimeMs = 350U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    /* The first publish awaits its ack, so the next two periods are skipped. */
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 2U, producer.skipCount );
+    TEST_ASSERT_EQUAL( 1U, producerSample );
+    TEST_ASSERT_EQUAL( 7U, producer.packetId );
+    TEST_ASSERT_EQUAL( 7U, agentContext.pPendingAcks[ 0 ].packetId );
+    TEST_ASSERT_EQUAL_PTR( &ackCommand, agentContext.pPendingAcks[ 0 ].pOriginalCommand );
+    TEST_ASSERT_EQUAL( PUBLISH, ackCommand.commandType );
+    TEST_ASSERT_EQUAL_PTR( &( producer.publishInfo ), ackCommand.pArgs );
+
+    /* Once acknowledged, the next period publishes the latest sample. */
+    ( void ) memset( &( agentContext.pPendingAcks[ 0 ] ), 0x00, sizeof( MQTTAgentAckInfo_t ) );
+    MQTT_GetPacketId_ExpectAnyArgsAndReturn( 8U );
+    commandArrivalTimeMs = 450U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 2U, lastPublishedSample );
+    TEST_ASSERT_EQUAL( 8U, agentContext.pPendingAcks[ 0 ].packetId );
+
+    /* A period is skipped when no command is available to track the ack. */
+    ( void ) memset( &( agentContext.pPendingAcks[ 0 ] ), 0x00, sizeof( MQTTAgentAckInfo_t ) );
+    pCommandToReturn = NULL;
+    commandArrivalTimeMs = 550U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 3U, producer.skipCount );
+    TEST_ASSERT_EQUAL( 2U, producerSample );
+}
+
+/**
+ * @brief Test that a QoS 1 producer notifies the session callback before each
+ * send like other publishes, that the sample after a resent one is not sent as
+ * a duplicate, and that a failed send releases the coreMQTT state record and
+ * the saved publish.
+ */
+void test_MQTTAgent_Producer_QoS1_resume( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t agentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentCommand_t ackCommand = { 0 };
+    MQTTAgentProducer_t producer;
+    uint8_t payloadBuffer[ 4 ];
+    const MQTTAgentCommandFunc_t commandTable[ 1 ] = { stubCustomCommand };
+
+    setupAgentContext( &agentContext );
+    agentContext.mqttContext.getTime = stubGetTimerTime;
+    agentContext.agentInterface.recv = stubReceiveAdvanceTime;
+    agentContext.mqttContext.connectStatus = MQTTConnected;
+
+    mqttStatus = MQTTAgent_RegisterCommands( &agentContext, commandTable, 1U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_SetSessionCallback( &agentContext, stubSessionCallback, &sessionEventCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    setupProducer( &producer, payloadBuffer, sizeof( payloadBuffer ), MQTTQoS1 );
+    mqttStatus = MQTTAgent_StartProducer( &agentContext, &producer, 100U );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    MQTTAgentCommand_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_ProcessLoop_IgnoreAndReturn( MQTTSuccess );
+    MQTT_Publish_Stub( MQTT_Publish_ProducerStub );
+    MQTT_GetPacketId_ExpectAnyArgsAndReturn( 7U );
+    pCommandToReturn = &ackCommand;
+    returnFlags.endLoop = true;
+    commandToSend.commandType = NUM_COMMANDS;
+    agentContext.agentInterface.pMsgCtx->pSentCommand = &commandToSend;
+    commandArrivalTimeMs = 150U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 7U, sessionPacketIds[ 0 ] );
+    TEST_ASSERT_EQUAL_PTR( &( producer.publishInfo ), pSessionPublishes[ 0 ] );
+
+    /* The publish is resent as a duplicate when the session resumes. */
+    MQTT_PublishToResend_ExpectAnyArgsAndReturn( 7U );
+    MQTT_PublishToResend_ExpectAnyArgsAndReturn( MQTT_PACKET_ID_INVALID );
+
+    mqttStatus = MQTTAgent_ResumeSession( &agentContext, true );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( lastPublishedDup );
+
+    /* Once acknowledged, the next sample is a new publish. */
+    ( void ) memset( &( agentContext.pPendingAcks[ 0 ] ), 0x00, sizeof( MQTTAgentAckInfo_t ) );
+    MQTT_GetPacketId_ExpectAnyArgsAndReturn( 8U );
+    commandArrivalTimeMs = 250U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, producer.publishCount );
+    TEST_ASSERT_FALSE( lastPublishedDup );
+    TEST_ASSERT_FALSE( producer.publishInfo.dup );
+    TEST_ASSERT_EQUAL( 2U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 8U, sessionPacketIds[ 1 ] );
+
+    /* A failed send is not tracked, and its state record is released. */
+    ( void ) memset( &( agentContext.pPendingAcks[ 0 ] ), 0x00, sizeof( MQTTAgentAckInfo_t ) );
+    producerPublishStatus = MQTTSendFailed;
+    MQTT_GetPacketId_ExpectAnyArgsAndReturn( 9U );
+    MQTT_CancelCallback_ExpectAndReturn( &( agentContext.mqttContext ), 9U, MQTTSuccess );
+    commandArrivalTimeMs = 350U;
+
+    mqttStatus = MQTTAgent_CommandLoop( &agentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 2U, producer.publishCount );
+    TEST_ASSERT_EQUAL( 4U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 9U, sessionPacketIds[ 2 ] );
+    TEST_ASSERT_EQUAL_PTR( &( producer.publishInfo ), pSessionPublishes[ 2 ] );
+    TEST_ASSERT_EQUAL( 9U, sessionPacketIds[ 3 ] );
+    TEST_ASSERT_NULL( pSessionPublishes[ 3 ] );
+    TEST_ASSERT_EQUAL( MQTT_PACKET_ID_INVALID, agentContext.pPendingAcks[ 0 ].packetId );
+}
+
+/**
+ * @brief Test that the session callback is notified when a publish stops
+ * waiting for its acknowledgment, or cannot be added to the operations waiting
+ * for one, and not for other operations. Publishes are saved before they are
+ * sent by MQTTAgentCommand_Publish().
+ */
+void test_MQTTAgent_SetSessionCallback( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t commandToSend = { 0 };
+    MQTTAgentCommand_t subscribeCommand = { 0 };
+    MQTTPublishInfo_t publishInfo = { 0 };
+    size_t i;
+
+    setupAgentContext( &mqttAgentContext );
+
+    mqttStatus = MQTTAgent_SetSessionCallback( NULL, stubSessionCallback, &sessionEventCount );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttStatus = MQTTAgent_SetSessionCallback( &mqttAgentContext, stubSessionCallback, &sessionEventCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    /* A publish awaiting its ack is notified once its PUBACK is received. */
+    mqttAgentContext.mqttContext.connectStatus = MQTTConnected;
+    returnFlags.addAcknowledgment = true;
+    returnFlags.runProcessLoop = true;
+    returnFlags.endLoop = true;
+    returnFlags.packetId = 1U;
+    packetType = MQTT_PACKET_TYPE_PUBACK;
+
+    publishInfo.qos = MQTTQoS1;
+    commandToSend.commandType = PUBLISH;
+    commandToSend.pCommandCompleteCallback = stubCompletionCallback;
+    commandToSend.pArgs = &publishInfo;
+    globalMessageContext.pSentCommand = &commandToSend;
+
+    MQTTAgentCommand_Publish_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+    MQTT_ProcessLoop_Stub( MQTT_ProcessLoop_CustomStub );
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 1U, sessionPacketIds[ 0 ] );
+    TEST_ASSERT_NULL( pSessionPublishes[ 0 ] );
+
+    /* Publishes cleared on a clean session are notified, subscribes are not. */
+    sessionEventCount = 0U;
+    subscribeCommand.commandType = SUBSCRIBE;
+    mqttAgentContext.pPendingAcks[ 0 ].packetId = 2U;
+    mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &subscribeCommand;
+    mqttAgentContext.pPendingAcks[ 1 ].packetId = 3U;
+    mqttAgentContext.pPendingAcks[ 1 ].pOriginalCommand = &commandToSend;
+
+    mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 3U, sessionPacketIds[ 0 ] );
+    TEST_ASSERT_NULL( pSessionPublishes[ 0 ] );
+
+    /* A publish sent when no more operations can await their acks is
+     * notified, as it was saved before it was sent. */
+    sessionEventCount = 0U;
+
+    for( i = 0U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+    {
+        mqttAgentContext.pPendingAcks[ i ].packetId = ( uint16_t ) ( i + 10U );
+        mqttAgentContext.pPendingAcks[ i ].pOriginalCommand = &subscribeCommand;
+    }
+
+    returnFlags.packetId = 5U;
+    MQTTAgentCommand_Publish_ExpectAnyArgsAndReturn( MQTTSuccess );
+    MQTTAgentCommand_Publish_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+    mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTNoMemory, mqttStatus );
+    TEST_ASSERT_EQUAL( 1U, sessionEventCount );
+    TEST_ASSERT_EQUAL( 5U, sessionPacketIds[ 0 ] );
+    TEST_ASSERT_NULL( pSessionPublishes[ 0 ] );
+    ( void ) memset( mqttAgentContext.pPendingAcks, 0x00, sizeof( mqttAgentContext.pPendingAcks ) );
+
+    /* Nothing is notified once the callback is removed. */
+    sessionEventCount = 0U;
+    mqttStatus = MQTTAgent_SetSessionCallback( &mqttAgentContext, NULL, NULL );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+    mqttAgentContext.pPendingAcks[ 0 ].packetId = 4U;
+    mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &commandToSend;
+
+    mqttStatus = MQTTAgent_CancelAll( &mqttAgentContext );
+
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, sessionEventCount );
+}
+
+/**
+ * @brief Test that MQTTAgent_RestorePublish() adds a publish awaiting its
+ * acknowledgment, which is resent when the session resumes.
+ */
+void test_MQTTAgent_RestorePublish( void )
+{
+    MQTTStatus_t mqttStatus;
+    MQTTAgentContext_t mqttAgentContext;
+    MQTTAgentCommand_t command, otherCommand;
+    MQTTPublishInfo_t publishInfo = { 0 };
+    size_t i;
+
+    setupAgentContext( &mqttAgentContext );
+    mqttAgentContext.mqttContext.networkBuffer.size = 64U;
+    publishInfo.qos = MQTTQoS2;
+
+    /* Invalid parameters. */
+    mqttStatus = MQTTAgent_RestorePublish( NULL, 1U, &publishInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, MQTT_PACKET_ID_INVALID, &publishInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 1U, NULL, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 1U, &publishInfo, NULL );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    publishInfo.qos = MQTTQoS0;
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 1U, &publishInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+
+    mqttAgentContext.mqttContext.nextPacketId = MQTT_PACKET_ID_INVALID;
+    publishInfo.qos = MQTTQoS2;
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 1U, &publishInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTBadParameter, mqttStatus );
+    mqttAgentContext.mqttContext.nextPacketId = 1U;
+
+    /* The session callback is not notified of a restored publish. */
+    mqttStatus = MQTTAgent_SetSessionCallback( &mqttAgentContext, stubSessionCallback, &sessionEventCount );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 5U, &publishInfo, &command );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 5U, mqttAgentContext.pPendingAcks[ 0 ].packetId );
+    TEST_ASSERT_EQUAL_PTR( &command, mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand );
+    TEST_ASSERT_EQUAL( PUBLISH, command.commandType );
+    TEST_ASSERT_EQUAL_PTR( &publishInfo, command.pArgs );
+    TEST_ASSERT_NULL( command.pCommandCompleteCallback );
+    TEST_ASSERT_TRUE( command.callerOwned );
+    TEST_ASSERT_EQUAL( 0U, sessionEventCount );
+
+    /* The same packet ID cannot be restored twice. */
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 5U, &publishInfo, &otherCommand );
+    TEST_ASSERT_EQUAL( MQTTStateCollision, mqttStatus );
+
+    /* The restored publish is resent with the DUP flag when the session is
+     * present. */
+    MQTT_PublishToResend_ExpectAnyArgsAndReturn( 5U );
+    MQTT_Publish_ExpectAndReturn( &( mqttAgentContext.mqttContext ), &publishInfo, 5U, MQTTSuccess );
+    MQTT_PublishToResend_ExpectAnyArgsAndReturn( MQTT_PACKET_ID_INVALID );
+    mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, true );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_TRUE( publishInfo.dup );
+
+    /* Once the list is full, no publish can be restored. */
+    for( i = 1U; i < MQTT_AGENT_MAX_OUTSTANDING_ACKS; i++ )
+    {
+        mqttAgentContext.pPendingAcks[ i ].packetId = ( uint16_t ) ( i + 10U );
+        mqttAgentContext.pPendingAcks[ i ].pOriginalCommand = &command;
+    }
+
+    mqttStatus = MQTTAgent_RestorePublish( &mqttAgentContext, 6U, &publishInfo, &otherCommand );
+    TEST_ASSERT_EQUAL( MQTTNoMemory, mqttStatus );
+
+    /* The restored publish is not released when it completes. */
+    mqttStatus = MQTTAgent_SetSessionCallback( &mqttAgentContext, NULL, NULL );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+    TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+    TEST_ASSERT_EQUAL( 0U, commandReleaseCallCount );
+    TEST_ASSERT_EQUAL( 0, commandCompleteCallbackCount );
+}
+
+/* ========================================================================== */
+
+/**
+ * @brief Test that the agent keeps the subscriptions acknowledged in SUBACKs
+ * and removes them on their UNSUBACK.
+ */
+void test_MQTTAgent_Subscriptions_from_acks( void )
+{
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTAgentCommand_t command = { 0 };
+        MQTTAgentSubscribeArgs_t subscribeArgs = { 0 };
+        MQTTSubscribeInfo_t subscribeInfo[ 5 ] = { 0 };
+        const char * pTopicFilters[ 5 ] = { "a/b", "c", "d", "too/long/filter", "e" };
+        const uint8_t subackCodes[ 4 ] = { 0x01, 0x80, 0x00, 0x01 };
+        const uint8_t subackAllCodes[ 4 ] = { 0x00, 0x01, 0x02, 0x00 };
+        size_t i;
+
+        setupAgentContext( &mqttAgentContext );
+
+        for( i = 0U; i < 5U; i++ )
+        {
+            subscribeInfo[ i ].qos = MQTTQoS1;
+            subscribeInfo[ i ].pTopicFilter = pTopicFilters[ i ];
+            subscribeInfo[ i ].topicFilterLength = ( uint16_t ) strlen( pTopicFilters[ i ] );
+        }
+
+        subscribeArgs.pSubscribeInfo = subscribeInfo;
+        subscribeArgs.numSubscriptions = 5U;
+        command.commandType = SUBSCRIBE;
+        command.pArgs = &subscribeArgs;
+        command.pCommandCompleteCallback = stubCompletionCallback;
+        command.callerOwned = true;
+
+        /* Refused topic filters, topic filters too long to copy, and topic filters
+         * without a status code are not kept. */
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, subackCodes, 4U );
+
+        TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL_STRING_LEN( "a/b", mqttAgentContext.subscribeInfo[ 0 ].pTopicFilter, 3 );
+        TEST_ASSERT_EQUAL( 3U, mqttAgentContext.subscribeInfo[ 0 ].topicFilterLength );
+        TEST_ASSERT_EQUAL( MQTTQoS1, mqttAgentContext.subscribeInfo[ 0 ].qos );
+        TEST_ASSERT_EQUAL_PTR( mqttAgentContext.subscriptions[ 1 ].topicFilter, mqttAgentContext.subscribeInfo[ 1 ].pTopicFilter );
+        TEST_ASSERT_EQUAL_STRING_LEN( "d", mqttAgentContext.subscribeInfo[ 1 ].pTopicFilter, 1 );
+
+        /* Subscribing again updates the QoS without adding a subscription, and a
+         * refusal removes it. */
+        subscribeInfo[ 0 ].qos = MQTTQoS0;
+        subscribeArgs.numSubscriptions = 2U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 2U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 2U, subackCodes, 2U );
+
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( MQTTQoS0, mqttAgentContext.subscribeInfo[ 0 ].qos );
+
+        subscribeArgs.pSubscribeInfo = &( subscribeInfo[ 2 ] );
+        subscribeArgs.numSubscriptions = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 3U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 3U, &( subackCodes[ 1 ] ), 1U );
+
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptionCount );
+
+        /* The subscriptions stop growing once full. */
+        subscribeInfo[ 0 ].pTopicFilter = "f";
+        subscribeInfo[ 1 ].pTopicFilter = "g";
+        subscribeInfo[ 2 ].pTopicFilter = "h";
+        subscribeInfo[ 3 ].pTopicFilter = "i";
+        subscribeInfo[ 0 ].topicFilterLength = 1U;
+        subscribeInfo[ 3 ].topicFilterLength = 1U;
+        subscribeArgs.pSubscribeInfo = subscribeInfo;
+        subscribeArgs.numSubscriptions = 4U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 4U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 4U, subackAllCodes, 4U );
+
+        TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_SUBSCRIPTIONS, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL_STRING_LEN( "h", mqttAgentContext.subscribeInfo[ 3 ].pTopicFilter, 1 );
+
+        /* An UNSUBACK removes the topic filters no task holds any more, keeping
+         * the others in order. */
+        command.commandType = UNSUBSCRIBE;
+        mqttAgentContext.subscriptions[ 1 ].refCount = 0U;
+        subscribeInfo[ 1 ].pTopicFilter = "unknown";
+        subscribeInfo[ 1 ].topicFilterLength = 7U;
+        subscribeArgs.numSubscriptions = 2U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 5U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_UNSUBACK, 5U, NULL, 0U );
+
+        TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_SUBSCRIPTIONS - 1U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL_STRING_LEN( "a/b", mqttAgentContext.subscribeInfo[ 0 ].pTopicFilter, 3 );
+        TEST_ASSERT_EQUAL_STRING_LEN( "g", mqttAgentContext.subscribeInfo[ 1 ].pTopicFilter, 1 );
+        TEST_ASSERT_EQUAL_PTR( mqttAgentContext.subscriptions[ 1 ].topicFilter, mqttAgentContext.subscribeInfo[ 1 ].pTopicFilter );
+        TEST_ASSERT_EQUAL_STRING_LEN( "h", mqttAgentContext.subscribeInfo[ 2 ].pTopicFilter, 1 );
+        TEST_ASSERT_EQUAL_PTR( mqttAgentContext.subscriptions[ 2 ].topicFilter, mqttAgentContext.subscribeInfo[ 2 ].pTopicFilter );
+        TEST_ASSERT_EQUAL( 5, commandCompleteCallbackCount );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_MAX_SUBSCRIPTIONS." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that MQTTAgent_ResumeSession() subscribes again to the kept
+ * subscriptions in as few packets as fit in the network buffer.
+ */
+void test_MQTTAgent_ResumeSession_replay_subscriptions( void )
+{
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        MQTTStatus_t mqttStatus;
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTAgentCommand_t command = { 0 };
+        MQTTAgentSubscribeArgs_t subscribeArgs = { 0 };
+        MQTTSubscribeInfo_t subscribeInfo[ 4 ] = { 0 };
+        const char * pTopicFilters[ 4 ] = { "t/0", "t/1", "t/2", "t/3" };
+        const uint8_t subackCodes[ 4 ] = { 0x01, 0x80, 0x00, 0x00 };
+        size_t i;
+
+        setupAgentContext( &mqttAgentContext );
+        MQTT_Subscribe_Stub( MQTT_Subscribe_RecordStub );
+
+        for( i = 0U; i < 4U; i++ )
+        {
+            subscribeInfo[ i ].qos = MQTTQoS1;
+            subscribeInfo[ i ].pTopicFilter = pTopicFilters[ i ];
+            subscribeInfo[ i ].topicFilterLength = 3U;
+        }
+
+        subscribeArgs.pSubscribeInfo = subscribeInfo;
+        subscribeArgs.numSubscriptions = 4U;
+        command.commandType = SUBSCRIBE;
+        command.pArgs = &subscribeArgs;
+        command.callerOwned = true;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, &( subackCodes[ 2 ] ), 2U );
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, &( subackCodes[ 2 ] ), 2U );
+        subscribeArgs.pSubscribeInfo = &( subscribeInfo[ 2 ] );
+        subscribeArgs.numSubscriptions = 2U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &command;
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, &( subackCodes[ 2 ] ), 2U );
+        TEST_ASSERT_EQUAL( 4U, mqttAgentContext.subscriptionCount );
+
+        /* Each subscription takes 6 bytes after the 2 byte packet ID, so a buffer
+         * of 16 bytes fits a packet of two subscriptions. */
+        mqttAgentContext.mqttContext.networkBuffer.size = 16U;
+        MQTT_GetPacketId_ExpectAnyArgsAndReturn( 7U );
+        MQTT_GetPacketId_ExpectAnyArgsAndReturn( 8U );
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 2U, subscribeCallCount );
+        TEST_ASSERT_EQUAL_PTR( &( mqttAgentContext.subscribeInfo[ 0 ] ), pSubscribeLists[ 0 ] );
+        TEST_ASSERT_EQUAL( 2U, subscribeListCounts[ 0 ] );
+        TEST_ASSERT_EQUAL_PTR( &( mqttAgentContext.subscribeInfo[ 2 ] ), pSubscribeLists[ 1 ] );
+        TEST_ASSERT_EQUAL( 2U, subscribeListCounts[ 1 ] );
+
+        /* The SUBACK of a replayed SUBSCRIBE completes no command, and removes
+         * the subscriptions the broker refused. A SUBACK matching no replayed
+         * SUBSCRIBE changes nothing. */
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 7U, subackCodes, 2U );
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 99U, subackCodes, 2U );
+
+        TEST_ASSERT_EQUAL( 0, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 3U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( MQTT_PACKET_ID_INVALID, mqttAgentContext.subscriptions[ 0 ].replayPacketId );
+        TEST_ASSERT_EQUAL_STRING_LEN( "t/2", mqttAgentContext.subscribeInfo[ 1 ].pTopicFilter, 3 );
+        TEST_ASSERT_EQUAL( 8U, mqttAgentContext.subscriptions[ 1 ].replayPacketId );
+        TEST_ASSERT_EQUAL( 8U, mqttAgentContext.subscriptions[ 2 ].replayPacketId );
+
+        /* With a session present, only the subscriptions whose replayed SUBSCRIBE
+         * was not acknowledged are sent again. */
+        subscribeCallCount = 0U;
+        MQTT_PublishToResend_IgnoreAndReturn( MQTT_PACKET_ID_INVALID );
+        MQTT_GetPacketId_ExpectAnyArgsAndReturn( 9U );
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, true );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 1U, subscribeCallCount );
+        TEST_ASSERT_EQUAL_PTR( &( mqttAgentContext.subscribeInfo[ 1 ] ), pSubscribeLists[ 0 ] );
+        TEST_ASSERT_EQUAL( 2U, subscribeListCounts[ 0 ] );
+
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 9U, &( subackCodes[ 2 ] ), 2U );
+        TEST_ASSERT_EQUAL( MQTT_PACKET_ID_INVALID, mqttAgentContext.subscriptions[ 2 ].replayPacketId );
+
+        subscribeCallCount = 0U;
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, true );
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 0U, subscribeCallCount );
+
+        /* A subscription larger than the network buffer is sent on its own, and a
+         * failure to send is returned. */
+        mqttAgentContext.mqttContext.networkBuffer.size = 0U;
+        subscribeStatus = MQTTSendFailed;
+        MQTT_GetPacketId_ExpectAnyArgsAndReturn( 10U );
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+
+        TEST_ASSERT_EQUAL( MQTTSendFailed, mqttStatus );
+        TEST_ASSERT_EQUAL( 1U, subscribeCallCount );
+        TEST_ASSERT_EQUAL( 1U, subscribeListCounts[ 0 ] );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_MAX_SUBSCRIPTIONS." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that subscriptions are shared by the tasks subscribing to them,
+ * so that only the first SUBSCRIBE and the last UNSUBSCRIBE of a topic filter
+ * are sent to the broker.
+ */
+void test_MQTTAgent_CommandLoop_shared_subscriptions( void )
+{
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        MQTTStatus_t mqttStatus;
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTAgentCommand_t commands[ 4 ] = { 0 };
+        MQTTAgentSubscribeArgs_t subscribeArgs[ 4 ] = { 0 };
+        MQTTSubscribeInfo_t subscribeInfo[ 6 ] = { 0 };
+        MQTTAgentCommandContext_t commandContexts[ 4 ] = { 0 };
+        MQTTAgentCommand_t terminateCommand = { 0 };
+        MQTTAgentCommandFuncReturns_t terminateFlags = { 0 };
+        const char * pTopicFilters[ 6 ] = { "a", "b", "c", "d", "e", "f" };
+        const uint8_t subackCodes[ 2 ] = { 0x01, 0x01 };
+        size_t i;
+
+        setupAgentContext( &mqttAgentContext );
+        mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+
+        for( i = 0U; i < 6U; i++ )
+        {
+            subscribeInfo[ i ].qos = MQTTQoS1;
+            subscribeInfo[ i ].pTopicFilter = pTopicFilters[ i ];
+            subscribeInfo[ i ].topicFilterLength = 1U;
+        }
+
+        for( i = 0U; i < 4U; i++ )
+        {
+            commands[ i ].pArgs = &( subscribeArgs[ i ] );
+            commands[ i ].pCommandCompleteCallback = stubSubackCompletionCallback;
+            commands[ i ].pCmdContext = &( commandContexts[ i ] );
+            pQueuedCommands[ i ] = &( commands[ i ] );
+        }
+
+        terminateCommand.commandType = TERMINATE;
+        terminateFlags.endLoop = true;
+
+        /* The first task subscribes to "a" and "b". */
+        subscribeArgs[ 0 ].pSubscribeInfo = subscribeInfo;
+        subscribeArgs[ 0 ].numSubscriptions = 2U;
+        commands[ 0 ].commandType = SUBSCRIBE;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &( commands[ 0 ] );
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, subackCodes, 2U );
+
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptions[ 0 ].refCount );
+
+        /* A second task subscribing to them is completed without sending a
+         * SUBSCRIBE, with the status codes of the active subscriptions. The same
+         * task then unsubscribes from "a" without sending an UNSUBSCRIBE. */
+        commandCompleteCallbackCount = 0;
+        subscribeArgs[ 1 ] = subscribeArgs[ 0 ];
+        commands[ 1 ].commandType = SUBSCRIBE;
+        subscribeArgs[ 2 ].pSubscribeInfo = subscribeInfo;
+        subscribeArgs[ 2 ].numSubscriptions = 1U;
+        commands[ 2 ].commandType = UNSUBSCRIBE;
+
+        /* Subscribing at a higher QoS is sent. */
+        subscribeArgs[ 3 ].pSubscribeInfo = &( subscribeInfo[ 2 ] );
+        subscribeArgs[ 3 ].numSubscriptions = 1U;
+        subscribeInfo[ 2 ].pTopicFilter = "b";
+        subscribeInfo[ 2 ].qos = MQTTQoS2;
+        commands[ 3 ].commandType = SUBSCRIBE;
+
+        pQueuedCommands[ 0 ] = &( commands[ 1 ] );
+        pQueuedCommands[ 1 ] = &( commands[ 2 ] );
+        pQueuedCommands[ 2 ] = &( commands[ 3 ] );
+        queuedCommandCount = 3U;
+        returnFlags.endLoop = true;
+        MQTTAgentCommand_Subscribe_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 3, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( MQTTQoS1, mqttAgentContext.sharedSubackCodes[ 0 ] );
+        TEST_ASSERT_EQUAL( MQTTQoS1, mqttAgentContext.sharedSubackCodes[ 1 ] );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptions[ 0 ].refCount );
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptions[ 1 ].refCount );
+
+        /* The first task unsubscribes from "a", "b" and "c". Only "a", which no
+         * other task holds, and "c", which is not an active subscription, are
+         * sent. */
+        commandCompleteCallbackCount = 0;
+        subscribeInfo[ 2 ].pTopicFilter = "c";
+        subscribeArgs[ 0 ].numSubscriptions = 3U;
+        commands[ 0 ].commandType = UNSUBSCRIBE;
+        pQueuedCommands[ 0 ] = &( commands[ 0 ] );
+        queuedCommandIndex = 0U;
+        queuedCommandCount = 1U;
+        MQTTAgentCommand_Unsubscribe_Stub( MQTTAgentCommand_Unsubscribe_RecordStub );
+        MQTTAgentCommand_ProcessLoop_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_ProcessLoop_ReturnThruPtr_pReturnFlags( &returnFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 0, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL_PTR( &( mqttAgentContext.sharedSubscribeArgs ), pUnsubscribeArgs );
+        TEST_ASSERT_EQUAL( 2U, pUnsubscribeArgs->numSubscriptions );
+        TEST_ASSERT_EQUAL_PTR( pTopicFilters[ 0 ], pUnsubscribeArgs->pSubscribeInfo[ 0 ].pTopicFilter );
+        TEST_ASSERT_EQUAL_STRING_LEN( "c", pUnsubscribeArgs->pSubscribeInfo[ 1 ].pTopicFilter, 1 );
+        TEST_ASSERT_EQUAL( 0U, mqttAgentContext.subscriptions[ 0 ].refCount );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptions[ 1 ].refCount );
+
+        /* The UNSUBACK completes the command, and removes "a" only. */
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_UNSUBACK, 5U, NULL, 0U );
+
+        TEST_ASSERT_EQUAL( 1, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL_STRING_LEN( "b", mqttAgentContext.subscribeInfo[ 0 ].pTopicFilter, 1 );
+
+        /* An UNSUBSCRIBE whose topic filters to send do not fit without the ones
+         * other tasks hold fails, and the command loop goes on with the next
+         * command. */
+        mqttAgentContext.subscriptions[ 0 ].refCount = 2U;
+        subscribeInfo[ 0 ].pTopicFilter = "b";
+        subscribeInfo[ 1 ].pTopicFilter = "g";
+        subscribeArgs[ 0 ].numSubscriptions = 6U;
+        pQueuedCommands[ 1 ] = &terminateCommand;
+        queuedCommandIndex = 0U;
+        queuedCommandCount = 2U;
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 2, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( MQTTNoMemory, commandContexts[ 0 ].returnStatus );
+        TEST_ASSERT_EQUAL( 2U, queuedCommandIndex );
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptions[ 0 ].refCount );
+
+        /* Subscriptions released by an UNSUBSCRIBE whose UNSUBACK was not received
+         * are not subscribed to again without a session. */
+        mqttAgentContext.subscriptions[ 0 ].refCount = 0U;
+        mqttStatus = MQTTAgent_ResumeSession( &mqttAgentContext, false );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 0U, mqttAgentContext.subscriptionCount );
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_MAX_SUBSCRIPTIONS." );
+    }
+    #endif
+}
+
+/**
+ * @brief Test that the holds of each task on the shared subscriptions are
+ * counted separately, and that SUBSCRIBE commands whose subscriptions do not
+ * fit fail without being sent.
+ */
+void test_MQTTAgent_CommandLoop_subscription_holds( void )
+{
+    #if ( MQTT_AGENT_MAX_SUBSCRIPTIONS > 0U )
+    {
+        MQTTStatus_t mqttStatus;
+        MQTTAgentContext_t mqttAgentContext;
+        MQTTAgentCommand_t commands[ 4 ] = { 0 };
+        MQTTAgentSubscribeArgs_t subscribeArgs[ 4 ] = { 0 };
+        MQTTSubscribeInfo_t subscribeInfo[ 6 ] = { 0 };
+        MQTTAgentCommandContext_t commandContexts[ 4 ] = { 0 };
+        MQTTAgentCommand_t terminateCommand = { 0 };
+        MQTTAgentCommandFuncReturns_t terminateFlags = { 0 };
+        const char * pTopicFilters[ 6 ] = { "a", "b", "c", "d", "e", "too/long/filter" };
+        const uint8_t subackCodes[ 3 ] = { 0x00, 0x00, 0x00 };
+        const int tasks[ 3 ] = { 0 };
+        size_t i;
+
+        setupAgentContext( &mqttAgentContext );
+        mqttAgentContext.agentInterface.recv = stubReceiveQueue;
+        returnFlags.endLoop = true;
+
+        for( i = 0U; i < 6U; i++ )
+        {
+            subscribeInfo[ i ].qos = MQTTQoS0;
+            subscribeInfo[ i ].pTopicFilter = pTopicFilters[ i ];
+            subscribeInfo[ i ].topicFilterLength = ( uint16_t ) strlen( pTopicFilters[ i ] );
+        }
+
+        for( i = 0U; i < 4U; i++ )
+        {
+            commands[ i ].pArgs = &( subscribeArgs[ i ] );
+            commands[ i ].pCommandCompleteCallback = stubSubackCompletionCallback;
+            commands[ i ].pCmdContext = &( commandContexts[ i ] );
+            commands[ i ].commandType = SUBSCRIBE;
+            subscribeArgs[ i ].pSubscribeInfo = subscribeInfo;
+            subscribeArgs[ i ].numSubscriptions = 1U;
+        }
+
+        /* Each rejected command fails on its own, and the command loop goes on
+         * with the next command, which ends it. */
+        terminateCommand.commandType = TERMINATE;
+        terminateFlags.endLoop = true;
+
+        /* The first task subscribes to "a". */
+        commands[ 0 ].pSubscriber = &( tasks[ 0 ] );
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 1U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &( commands[ 0 ] );
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 1U, subackCodes, 1U );
+
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptionHoldCount );
+        TEST_ASSERT_EQUAL_PTR( &( tasks[ 0 ] ), mqttAgentContext.subscriptionHolds[ 0 ].pSubscriber );
+
+        /* A second task subscribes to "a" without sending a SUBSCRIBE. The first
+         * task then unsubscribes from it twice: the first UNSUBSCRIBE releases
+         * its hold without being sent, and the second fails, leaving the hold
+         * of the second task. */
+        commandCompleteCallbackCount = 0;
+        commands[ 1 ].pSubscriber = &( tasks[ 1 ] );
+        commands[ 2 ].pSubscriber = &( tasks[ 0 ] );
+        commands[ 2 ].commandType = UNSUBSCRIBE;
+        pQueuedCommands[ 0 ] = &( commands[ 1 ] );
+        pQueuedCommands[ 1 ] = &( commands[ 2 ] );
+        pQueuedCommands[ 2 ] = &( commands[ 2 ] );
+        pQueuedCommands[ 3 ] = &terminateCommand;
+        queuedCommandIndex = 0U;
+        queuedCommandCount = 4U;
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 3, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( MQTTBadParameter, commandContexts[ 2 ].returnStatus );
+        TEST_ASSERT_EQUAL( 4U, queuedCommandIndex );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptions[ 0 ].refCount );
+        TEST_ASSERT_EQUAL( 1U, mqttAgentContext.subscriptionHoldCount );
+        TEST_ASSERT_EQUAL_PTR( &( tasks[ 1 ] ), mqttAgentContext.subscriptionHolds[ 0 ].pSubscriber );
+
+        /* While a SUBSCRIBE to "b", "c" and "d" waits for its SUBACK, there is no
+         * room for "e". A topic filter too long to keep takes no room. */
+        subscribeArgs[ 0 ].pSubscribeInfo = &( subscribeInfo[ 1 ] );
+        subscribeArgs[ 0 ].numSubscriptions = 3U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 2U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &( commands[ 0 ] );
+        subscribeArgs[ 3 ].pSubscribeInfo = &( subscribeInfo[ 4 ] );
+        subscribeArgs[ 3 ].numSubscriptions = 2U;
+        commands[ 3 ].pSubscriber = &( tasks[ 1 ] );
+        pQueuedCommands[ 0 ] = &( commands[ 3 ] );
+        pQueuedCommands[ 1 ] = &terminateCommand;
+        queuedCommandIndex = 0U;
+        queuedCommandCount = 2U;
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 4, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( MQTTNoMemory, commandContexts[ 3 ].returnStatus );
+        TEST_ASSERT_EQUAL( 2U, queuedCommandIndex );
+
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_SUBACK, 2U, subackCodes, 3U );
+        TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_SUBSCRIPTIONS, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( 4U, mqttAgentContext.subscriptionHoldCount );
+
+        /* The second task shares "b", "c" and "d", and the first task "a", until
+         * the holds are full and a third task cannot share "a". */
+        subscribeArgs[ 1 ].pSubscribeInfo = &( subscribeInfo[ 1 ] );
+        subscribeArgs[ 1 ].numSubscriptions = 3U;
+        commands[ 2 ].commandType = SUBSCRIBE;
+        commands[ 3 ].pSubscriber = &( tasks[ 2 ] );
+        subscribeArgs[ 3 ].pSubscribeInfo = subscribeInfo;
+        subscribeArgs[ 3 ].numSubscriptions = 1U;
+        pQueuedCommands[ 0 ] = &( commands[ 1 ] );
+        pQueuedCommands[ 1 ] = &( commands[ 2 ] );
+        pQueuedCommands[ 2 ] = &( commands[ 3 ] );
+        pQueuedCommands[ 3 ] = &terminateCommand;
+        queuedCommandIndex = 0U;
+        queuedCommandCount = 4U;
+        commandContexts[ 3 ].returnStatus = MQTTSuccess;
+        MQTTAgentCommand_Terminate_ExpectAnyArgsAndReturn( MQTTSuccess );
+        MQTTAgentCommand_Terminate_ReturnThruPtr_pReturnFlags( &terminateFlags );
+
+        mqttStatus = MQTTAgent_CommandLoop( &mqttAgentContext );
+
+        TEST_ASSERT_EQUAL( MQTTSuccess, mqttStatus );
+        TEST_ASSERT_EQUAL( 8, commandCompleteCallbackCount );
+        TEST_ASSERT_EQUAL( MQTTNoMemory, commandContexts[ 3 ].returnStatus );
+        TEST_ASSERT_EQUAL( 4U, queuedCommandIndex );
+        TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_SUBSCRIPTION_HOLDS, mqttAgentContext.subscriptionHoldCount );
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptions[ 0 ].refCount );
+        TEST_ASSERT_EQUAL( 2U, mqttAgentContext.subscriptions[ 3 ].refCount );
+
+        /* Removing a subscription removes its holds, and the holds of the
+         * others follow it. */
+        commands[ 0 ].commandType = UNSUBSCRIBE;
+        subscribeArgs[ 0 ].pSubscribeInfo = &( subscribeInfo[ 1 ] );
+        subscribeArgs[ 0 ].numSubscriptions = 1U;
+        mqttAgentContext.subscriptions[ 1 ].refCount = 0U;
+        mqttAgentContext.pPendingAcks[ 0 ].packetId = 3U;
+        mqttAgentContext.pPendingAcks[ 0 ].pOriginalCommand = &( commands[ 0 ] );
+        deliverAck( &mqttAgentContext, MQTT_PACKET_TYPE_UNSUBACK, 3U, NULL, 0U );
+
+        TEST_ASSERT_EQUAL( MQTT_AGENT_MAX_SUBSCRIPTIONS - 1U, mqttAgentContext.subscriptionCount );
+        TEST_ASSERT_EQUAL( 6U, mqttAgentContext.subscriptionHoldCount );
+        TEST_ASSERT_EQUAL_STRING_LEN( "d", mqttAgentContext.subscribeInfo[ 2 ].pTopicFilter, 1 );
+
+        for( i = 0U; i < mqttAgentContext.subscriptionHoldCount; i++ )
+        {
+            TEST_ASSERT_TRUE( mqttAgentContext.subscriptionHolds[ i ].subscriptionIndex < ( MQTT_AGENT_MAX_SUBSCRIPTIONS - 1U ) );
+        }
+    }
+    #else
+    {
+        TEST_IGNORE_MESSAGE( "Requires MQTT_AGENT_MAX_SUBSCRIPTIONS." );
+    }
+    #endif
+}
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+# Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+# SPDX-License-Identifier: MIT
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+
+DESCRIPTION = """Print a GitHub-flavored Markdown table with the code size, data
+size, sizeof( MQTTAgentContext_t ) and worst case stack depth of
+MQTTAgent_CommandLoop() for every configuration built by the memory footprint
+CMake project."""
+
+STACK_ROOT = "MQTTAgent_CommandLoop"
+PROBE_SYMBOL = "footprintAgentContext"
+
+# Indirect calls the analysis can resolve, keyed by a pattern matching the
+# source line of the call. Every other indirect call goes to an application
+# callback (message interface, transport, completion or incoming publish
+# callbacks), whose stack usage is not known here and is not included.
+INDIRECT_CALL_TARGETS = [
+    (re.compile(r"\bcommandFunction\s*\("), re.compile(r"^MQTTAgentCommand_\w+$")),
+    (re.compile(r"\bappCallback\s*\("), re.compile(r"^mqttEventCallback$")),
+]
+
+NODE_RE = re.compile(
+    r'node:\s*\{\s*title:\s*"(?P<title>[^"]+)"\s*label:\s*"(?P<label>[^"]*)"')
+EDGE_RE = re.compile(
+    r'edge:\s*\{\s*sourcename:\s*"(?P<src>[^"]+)"\s*targetname:\s*"(?P<dst>[^"]+)"'
+    r'\s*label:\s*"(?P<loc>[^"]*)"')
+STACK_RE = re.compile(r"\\n(?P<bytes>\d+) bytes \((?P<kind>[^)]*)\)")
+
+
+def get_args():
+    """Parse arguments for the report script."""
+    parser = argparse.ArgumentParser(description=DESCRIPTION)
+    parser.add_argument("--configs", required=True,
+                        help="JSON file listing the objects of each configuration")
+    parser.add_argument("--size", default="size", help="size utility")
+    parser.add_argument("--nm", default="nm", help="nm utility")
+    parser.add_argument("--output", help="also write the table to this file")
+    return parser.parse_args()
+
+
+def section_sizes(size_tool, objects):
+    """Return the summed Berkeley text, data and bss sizes of objects."""
+    text = data = bss = 0
+    output = subprocess.run([size_tool, "-B"] + objects, check=True,
+                            capture_output=True, text=True).stdout
+    for line in output.splitlines()[1:]:
+        fields = line.split()
+        text += int(fields[0])
+        data += int(fields[1])
+        bss += int(fields[2])
+    return text, data, bss
+
+
+def symbol_size(nm_tool, objects, symbol):
+    """Return the size of symbol as reported by nm, or None."""
+    output = subprocess.run([nm_tool, "-S", "--defined-only"] + objects,
+                            check=True, capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[3] == symbol:
+            return int(fields[1], 16)
+    return None
+
+
+def aux_file(obj, extension):
+    """Path of the file GCC writes next to obj for -fstack-usage and friends."""
+    return os.path.splitext(obj)[0] + extension
+
+
+def read_source_line(location, cache):
+    """Return the source text at a file:line:column location, or ''."""
+    match = re.match(r"^(?P<file>.*):(?P<line>\d+):\d+$", location)
+    if not match:
+        return ""
+    path = match.group("file")
+    if path not in cache:
+        try:
+            with open(path, encoding="utf-8", errors="replace") as source:
+                cache[path] = source.read().splitlines()
+        except OSError:
+            cache[path] = []
+    lines = cache[path]
+    index = int(match.group("line")) - 1
+    return lines[index] if 0 <= index < len(lines) else ""
+
+
+def load_call_graph(objects):
+    """Merge the -fcallgraph-info files of objects into one graph."""
+    frames = {}
+    dynamic = set()
+    edges = {}
+    names = {}
+    sources = {}
+    found = False
+    for obj in objects:
+        path = aux_file(obj, ".ci")
+        if not os.path.exists(path):
+            continue
+        found = True
+        with open(path, encoding="utf-8") as graph:
+            for line in graph:
+                node = NODE_RE.search(line)
+                if node:
+                    stack = STACK_RE.search(node.group("label"))
+                    if stack:
+                        title = node.group("title")
+                        frames[title] = int(stack.group("bytes"))
+                        names[title] = node.group("label").split("\\n")[0]
+                        if stack.group("kind") != "static":
+                            dynamic.add(title)
+                    continue
+                edge = EDGE_RE.search(line)
+                if edge:
+                    target = edge.group("dst")
+                    if target == "__indirect_call":
+                        code = read_source_line(edge.group("loc"), sources)
+                        target = ("__indirect_call", code)
+                    edges.setdefault(edge.group("src"), []).append(target)
+    return (frames, dynamic, edges, names) if found else None
+
+
+def resolve_targets(target, names):
+    """Map an edge target to the defined functions it may call."""
+    if not isinstance(target, tuple):
+        return [target]
+    code = target[1]
+    for line_pattern, name_pattern in INDIRECT_CALL_TARGETS:
+        if line_pattern.search(code):
+            return [title for title, name in names.items()
+                    if name_pattern.match(name)]
+    return []
+
+
+def worst_stack(graph, root):
+    """Return the deepest stack path from root as (bytes, path, dynamic)."""
+    frames, dynamic, edges, names = graph
+    memo = {}
+
+    def visit(function, active):
+        if function in memo:
+            return memo[function]
+        own = frames.get(function, 0)
+        best = (own, [function], function in dynamic)
+        for target in edges.get(function, []):
+            for callee in resolve_targets(target, names):
+                if callee in active:
+                    continue
+                depth, path, unbounded = visit(callee, active | {callee})
+                if own + depth > best[0]:
+                    best = (own + depth, [function] + path,
+                            unbounded or function in dynamic)
+        memo[function] = best
+        return best
+
+    roots = [title for title, name in names.items() if name == root]
+    if not roots:
+        return None
+    return visit(roots[0], {roots[0]})
+
+
+def format_table(rows):
+    """Format rows as a GitHub-flavored Markdown table."""
+    widths = [max(len(row[i]) for row in rows) for i in range(len(rows[0]))]
+    lines = []
+    for index, row in enumerate(rows):
+        lines.append("| " + " | ".join(cell.ljust(widths[i])
+                                       for i, cell in enumerate(row)) + " |")
+        if index == 0:
+            lines.append("|" + "|".join("-" * (width + 2) for width in widths) + "|")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    """Measure every configuration and print the report."""
+    args = get_args()
+    with open(args.configs, encoding="utf-8") as handle:
+        configs = json.load(handle)
+
+    rows = [["Configuration", "Agent .text", "Agent .data", "Agent .bss",
+             "sizeof( MQTTAgentContext_t )",
+             "%s() stack" % STACK_ROOT, "Deepest path"]]
+    for config in configs:
+        agent = config["agent"]
+        everything = agent + config["other"]
+        text, data, bss = section_sizes(args.size, agent)
+        context_size = symbol_size(args.nm, config["other"], PROBE_SYMBOL)
+
+        stack = "n/a"
+        path = ""
+        graph = load_call_graph(everything)
+        if graph is not None:
+            result = worst_stack(graph, STACK_ROOT)
+            if result is not None:
+                depth, functions, unbounded = result
+                stack = "%d%s" % (depth, "+" if unbounded else "")
+                path = " > ".join(graph[3][function] for function in functions)
+
+        rows.append([config["name"], str(text), str(data), str(bss),
+                     "n/a" if context_size is None else str(context_size),
+                     stack, path])
+
+    table = format_table(rows)
+    notes = ("\nSizes are in bytes. Stack depth is the static worst case from "
+             "GCC stack usage data, excluding application callbacks; a `+` "
+             "marks a path through a frame of dynamic size.\n")
+    sys.stdout.write(table + notes)
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as handle:
+            handle.write(table + notes)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,338 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file batching_benchmark.c
+ * @brief Throughput of the POSIX transport with and without a send buffer.
+ *
+ * Each connection runs an agent on its own thread, waiting for commands and
+ * socket data with the epoll-style wait of the message interface of the port.
+ * One producer thread queues bursts of QoS 0 publishes on each connection in
+ * turn. Without a send buffer, every publish costs a send and the receive the
+ * process loop makes after it. With one, the publishes of a burst are written
+ * together once the last of them is processed, and the receives in between
+ * are skipped.
+ *
+ * For each number of connections, the benchmark reports the publishes per
+ * second delivered to the loopback broker, and the CPU time of the agent
+ * threads per publish, in both modes.
+ *
+ * Usage: posix_batching_benchmark [publishes] [connections...]
+ *
+ * The publishes are shared out between the connections, 160000 by default,
+ * and the numbers of connections are 1, 100 and 1000 by default.
+ */
+
+/* Enable the POSIX and Linux declarations used by the benchmarks. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "benchmark_common.h"
+
+/* Port include. */
+#include "posix_command_pool.h"
+
+/**
+ * @brief Number of publishes queued on a connection before moving to the
+ * next.
+ */
+#define BURST_LENGTH              ( 16U )
+
+/**
+ * @brief Default number of publishes of a run.
+ */
+#define DEFAULT_PUBLISH_COUNT     ( 160000UL )
+
+/**
+ * @brief Topic of the publishes.
+ */
+#define BENCHMARK_TOPIC           "benchmark/batching"
+
+/**
+ * @brief Length of the payload of the publishes.
+ */
+#define BENCHMARK_PAYLOAD_SIZE    ( 32U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Result of one run.
+ */
+typedef struct RunResult
+{
+    double publishRate;     /**< @brief Publishes delivered per second. */
+    double cpuNsPerPublish; /**< @brief CPU time of the agent threads per publish. */
+} RunResult_t;
+
+/**
+ * @brief Loopback broker of all runs.
+ */
+static BenchmarkBroker_t broker;
+
+/**
+ * @brief Payload of the publishes.
+ */
+static uint8_t payload[ BENCHMARK_PAYLOAD_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Publish on each connection in turn, and wait for the broker to
+ * receive every publish.
+ *
+ * @param[in] pConnections Connections with their agent threads started.
+ * @param[in] connectionCount Number of connections.
+ * @param[in] publishesPerConnection Number of publishes on each connection.
+ * @param[in] packetSize Size of each PUBLISH packet.
+ *
+ * @return `true` if every publish was delivered, else `false`.
+ */
+static bool publishAll( BenchmarkConnection_t * pConnections,
+                        size_t connectionCount,
+                        unsigned long publishesPerConnection,
+                        size_t packetSize )
+{
+    MQTTPublishInfo_t publishInfo;
+    MQTTAgentCommandInfo_t commandInfo;
+    uint64_t expectedBytes;
+    unsigned long published = 0UL;
+    unsigned long burst;
+    size_t i;
+    bool success = true;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS0;
+    publishInfo.pTopicName = BENCHMARK_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( BENCHMARK_TOPIC ) - 1U );
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = sizeof( payload );
+
+    expectedBytes = BenchmarkBroker_GetBytesReceived( &broker ) +
+                    ( ( uint64_t ) connectionCount * publishesPerConnection * packetSize );
+
+    while( success && ( published < publishesPerConnection ) )
+    {
+        burst = publishesPerConnection - published;
+
+        if( burst > BURST_LENGTH )
+        {
+            burst = BURST_LENGTH;
+        }
+
+        for( i = 0U; success && ( i < ( connectionCount * burst ) ); i++ )
+        {
+            ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+            commandInfo.cmdCompleteCallback = BenchmarkConnection_CountCompletion;
+            commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) &( pConnections[ i / burst ] );
+            commandInfo.blockTimeMs = 5000U;
+
+            success = ( MQTTAgent_Publish( &( pConnections[ i / burst ].agentContext ),
+                                           &publishInfo,
+                                           &commandInfo ) == MQTTSuccess );
+        }
+
+        published += burst;
+    }
+
+    for( i = 0U; success && ( i < connectionCount ); i++ )
+    {
+        while( BenchmarkConnection_GetCompleted( &( pConnections[ i ] ) ) < publishesPerConnection )
+        {
+            ( void ) usleep( 100U );
+        }
+    }
+
+    while( success && ( BenchmarkBroker_GetBytesReceived( &broker ) < expectedBytes ) )
+    {
+        ( void ) usleep( 100U );
+    }
+
+    if( !success )
+    {
+        ( void ) fprintf( stderr, "Failed to queue a publish.\n" );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Open the connections, publish on them and close them.
+ *
+ * @param[in] connectionCount Number of connections.
+ * @param[in] publishesPerConnection Number of publishes on each connection.
+ * @param[in] holdSends Whether the connections have a send buffer.
+ * @param[out] pResult Result of the run.
+ *
+ * @return `true` if the run succeeded, else `false`.
+ */
+static bool runOnce( size_t connectionCount,
+                     unsigned long publishesPerConnection,
+                     bool holdSends,
+                     RunResult_t * pResult )
+{
+    BenchmarkConnection_t * pConnections;
+    MQTTPublishInfo_t publishInfo;
+    size_t remainingLength;
+    size_t packetSize = 0U;
+    size_t opened = 0U;
+    uint64_t startTimeNs;
+    uint64_t elapsedNs;
+    uint64_t startCpuNs = 0U;
+    uint64_t cpuNs = 0U;
+    double publishCount = ( double ) connectionCount * ( double ) publishesPerConnection;
+    bool success = true;
+    size_t i;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( BENCHMARK_TOPIC ) - 1U );
+    publishInfo.payloadLength = BENCHMARK_PAYLOAD_SIZE;
+    ( void ) MQTT_GetPublishPacketSize( &publishInfo, &remainingLength, &packetSize );
+
+    pConnections = calloc( connectionCount, sizeof( BenchmarkConnection_t ) );
+    success = ( pConnections != NULL );
+
+    while( success && ( opened < connectionCount ) )
+    {
+        success = BenchmarkConnection_Open( &( pConnections[ opened ] ), broker.port, holdSends, NULL, NULL );
+
+        if( success )
+        {
+            success = BenchmarkConnection_StartThread( &( pConnections[ opened ] ) );
+            opened++;
+        }
+    }
+
+    for( i = 0U; success && ( i < connectionCount ); i++ )
+    {
+        startCpuNs += BenchmarkConnection_GetCpuTimeNs( &( pConnections[ i ] ) );
+    }
+
+    startTimeNs = Benchmark_GetTimeNs();
+    success = success && publishAll( pConnections, connectionCount, publishesPerConnection, packetSize );
+    elapsedNs = Benchmark_GetTimeNs() - startTimeNs;
+
+    for( i = 0U; success && ( i < connectionCount ); i++ )
+    {
+        cpuNs += BenchmarkConnection_GetCpuTimeNs( &( pConnections[ i ] ) );
+    }
+
+    for( i = 0U; i < opened; i++ )
+    {
+        BenchmarkConnection_Close( &( pConnections[ i ] ) );
+    }
+
+    if( success )
+    {
+        pResult->publishRate = publishCount * 1e9 / ( double ) elapsedNs;
+        pResult->cpuNsPerPublish = ( double ) ( cpuNs - startCpuNs ) / publishCount;
+    }
+
+    free( pConnections );
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    static const unsigned long defaultConnectionCounts[] = { 1UL, 100UL, 1000UL };
+    unsigned long publishCount = DEFAULT_PUBLISH_COUNT;
+    unsigned long connectionCount;
+    unsigned long publishesPerConnection;
+    RunResult_t unbuffered;
+    RunResult_t buffered;
+    struct rlimit fileLimit;
+    int runCount;
+    int run;
+    bool success = true;
+
+    if( argc > 1 )
+    {
+        publishCount = strtoul( argv[ 1 ], NULL, 10 );
+    }
+
+    runCount = ( argc > 2 ) ? ( argc - 2 ) : ( int ) ( sizeof( defaultConnectionCounts ) / sizeof( defaultConnectionCounts[ 0 ] ) );
+
+    /* Each connection takes a socket on both ends and an eventfd. */
+    if( getrlimit( RLIMIT_NOFILE, &fileLimit ) == 0 )
+    {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        ( void ) setrlimit( RLIMIT_NOFILE, &fileLimit );
+    }
+
+    ( void ) memset( payload, 0xA5, sizeof( payload ) );
+
+    success = PosixCommandPool_Init() && BenchmarkBroker_Start( &broker );
+
+    if( success )
+    {
+        ( void ) printf( "| Connections | Publishes | Without send buffer: publishes/s | CPU ns/publish | With send buffer: publishes/s | CPU ns/publish |\n" );
+        ( void ) printf( "|---|---|---|---|---|---|\n" );
+    }
+
+    for( run = 0; success && ( run < runCount ); run++ )
+    {
+        connectionCount = ( argc > 2 ) ? strtoul( argv[ run + 2 ], NULL, 10 ) : defaultConnectionCounts[ run ];
+        if( connectionCount == 0UL )
+        {
+            connectionCount = 1UL;
+        }
+
+        publishesPerConnection = publishCount / connectionCount;
+
+        if( publishesPerConnection < BURST_LENGTH )
+        {
+            publishesPerConnection = BURST_LENGTH;
+        }
+
+        success = runOnce( connectionCount, publishesPerConnection, false, &unbuffered ) &&
+                  runOnce( connectionCount, publishesPerConnection, true, &buffered );
+
+        if( success )
+        {
+            ( void ) printf( "| %lu | %lu | %.0f | %.0f | %.0f | %.0f |\n",
+                             connectionCount,
+                             connectionCount * publishesPerConnection,
+                             unbuffered.publishRate,
+                             unbuffered.cpuNsPerPublish,
+                             buffered.publishRate,
+                             buffered.cpuNsPerPublish );
+            ( void ) fflush( stdout );
+        }
+    }
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,526 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file benchmark_common.c
+ * @brief Loopback broker and agent connections shared by the benchmarks of
+ * the POSIX port.
+ */
+
+/* Enable the POSIX and Linux declarations used by the benchmarks. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Header include. */
+#include "benchmark_common.h"
+
+/* Port includes. */
+#include "posix_clock.h"
+#include "posix_command_pool.h"
+
+/**
+ * @brief Maximum number of epoll events handled per wait of the broker.
+ */
+#define BROKER_MAX_EVENTS        ( 256 )
+
+/**
+ * @brief Flag of the epoll data of a socket whose CONNECT was answered.
+ */
+#define BROKER_CONNECTED_FLAG    ( ( uint64_t ) 1U << 32 )
+
+/**
+ * @brief Shift of the offset into the flood data of the next byte to write
+ * in the epoll data of a socket.
+ */
+#define BROKER_OFFSET_SHIFT      ( 33 )
+
+/**
+ * @brief Time in milliseconds to wait for a connection, its CONNACK, and for
+ * a command to be queued.
+ */
+#define BENCHMARK_TIMEOUT_MS     ( 5000U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Accept the pending connections on the listening socket.
+ *
+ * @param[in] pBroker Broker.
+ */
+static void acceptConnections( const BenchmarkBroker_t * pBroker );
+
+/**
+ * @brief Read everything available on an accepted socket, answering its
+ * CONNECT the first time.
+ *
+ * @param[in] pBroker Broker.
+ * @param[in,out] pEventData Epoll data of the socket, updated when the
+ * CONNECT is answered.
+ *
+ * @return `true` if the socket is still open, else `false`.
+ */
+static bool serveConnection( BenchmarkBroker_t * pBroker,
+                             uint64_t * pEventData );
+
+/**
+ * @brief Write the flood data to an accepted socket until it would block,
+ * or stop watching the socket for writing once the flood is cleared.
+ *
+ * @param[in] pBroker Broker.
+ * @param[in] eventData Epoll data of the socket.
+ */
+static void floodConnection( BenchmarkBroker_t * pBroker,
+                             uint64_t eventData );
+
+/**
+ * @brief Thread serving the sockets of the broker.
+ *
+ * @param[in] pArgument The #BenchmarkBroker_t.
+ *
+ * @return NULL, never.
+ */
+static void * brokerThread( void * pArgument );
+
+/**
+ * @brief Thread running the command loop of a connection.
+ *
+ * @param[in] pArgument The #BenchmarkConnection_t.
+ *
+ * @return NULL.
+ */
+static void * agentThread( void * pArgument );
+
+/**
+ * @brief Incoming publish callback of the agents, counting the publishes of
+ * the connection given as the context.
+ */
+static void incomingPublish( MQTTAgentContext_t * pMqttAgentContext,
+                             uint16_t packetId,
+                             MQTTPublishInfo_t * pxPublishInfo );
+
+/*-----------------------------------------------------------*/
+
+static void acceptConnections( const BenchmarkBroker_t * pBroker )
+{
+    struct epoll_event event;
+    int socketFd;
+
+    do
+    {
+        socketFd = accept4( pBroker->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+        if( socketFd >= 0 )
+        {
+            event.events = EPOLLIN;
+            event.data.u64 = ( uint64_t ) socketFd;
+            ( void ) epoll_ctl( pBroker->epollFd, EPOLL_CTL_ADD, socketFd, &event );
+        }
+    } while( socketFd >= 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool serveConnection( BenchmarkBroker_t * pBroker,
+                            uint64_t * pEventData )
+{
+    static uint8_t buffer[ 65536 ];
+    static const uint8_t connack[] = { 0x20U, 0x02U, 0x00U, 0x00U };
+    struct epoll_event event;
+    int socketFd = ( int ) ( *pEventData & 0xFFFFFFFFU );
+    ssize_t bytesRead;
+
+    do
+    {
+        bytesRead = read( socketFd, buffer, sizeof( buffer ) );
+
+        if( bytesRead == 0 )
+        {
+            ( void ) close( socketFd );
+        }
+        else if( bytesRead < 0 )
+        {
+            /* Nothing more to read. */
+        }
+        else if( ( *pEventData & BROKER_CONNECTED_FLAG ) == 0U )
+        {
+            /* The client waits for the CONNACK, so the first read holds
+             * the CONNECT packet and nothing else. The flood starts after
+             * the CONNACK. */
+            ( void ) send( socketFd, connack, sizeof( connack ), MSG_NOSIGNAL );
+            *pEventData |= BROKER_CONNECTED_FLAG;
+            event.events = EPOLLIN;
+
+            if( __atomic_load_n( &( pBroker->pFloodData ), __ATOMIC_ACQUIRE ) != NULL )
+            {
+                event.events |= EPOLLOUT;
+            }
+
+            event.data.u64 = *pEventData;
+            ( void ) epoll_ctl( pBroker->epollFd, EPOLL_CTL_MOD, socketFd, &event );
+        }
+        else
+        {
+            ( void ) __atomic_add_fetch( &( pBroker->bytesReceived ), ( uint64_t ) bytesRead, __ATOMIC_RELAXED );
+        }
+    } while( bytesRead > 0 );
+
+    return ( bytesRead != 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void floodConnection( BenchmarkBroker_t * pBroker,
+                             uint64_t eventData )
+{
+    const uint8_t * pData = __atomic_load_n( &( pBroker->pFloodData ), __ATOMIC_ACQUIRE );
+    size_t length = pBroker->floodDataLength;
+    size_t offset = ( size_t ) ( eventData >> BROKER_OFFSET_SHIFT );
+    struct epoll_event event;
+    int socketFd = ( int ) ( eventData & 0xFFFFFFFFU );
+    ssize_t bytesSent = 0;
+
+    event.events = EPOLLIN;
+
+    if( pData != NULL )
+    {
+        /* The data holds whole packets, so wrapping around keeps the
+         * stream a sequence of packets. */
+        do
+        {
+            bytesSent = send( socketFd, &( pData[ offset ] ), length - offset, MSG_NOSIGNAL );
+
+            if( bytesSent > 0 )
+            {
+                offset = ( offset + ( size_t ) bytesSent ) % length;
+            }
+        } while( bytesSent > 0 );
+
+        event.events |= EPOLLOUT;
+    }
+
+    event.data.u64 = ( eventData & ( BROKER_CONNECTED_FLAG | 0xFFFFFFFFU ) ) |
+                     ( ( uint64_t ) offset << BROKER_OFFSET_SHIFT );
+    ( void ) epoll_ctl( pBroker->epollFd, EPOLL_CTL_MOD, socketFd, &event );
+}
+
+/*-----------------------------------------------------------*/
+
+static void * brokerThread( void * pArgument )
+{
+    BenchmarkBroker_t * pBroker = ( BenchmarkBroker_t * ) pArgument;
+    struct epoll_event events[ BROKER_MAX_EVENTS ];
+    uint64_t eventData;
+    int eventCount;
+    int i;
+
+    for( ; ; )
+    {
+        eventCount = epoll_wait( pBroker->epollFd, events, BROKER_MAX_EVENTS, -1 );
+
+        for( i = 0; i < eventCount; i++ )
+        {
+            if( events[ i ].data.u64 == ( uint64_t ) pBroker->listenFd )
+            {
+                acceptConnections( pBroker );
+            }
+            else
+            {
+                eventData = events[ i ].data.u64;
+
+                /* A socket is only watched for writing once its CONNECT is
+                 * answered, so it has nothing to read on a bare EPOLLOUT. */
+                if( ( ( events[ i ].events == ( uint32_t ) EPOLLOUT ) ||
+                      serveConnection( pBroker, &eventData ) ) &&
+                    ( ( events[ i ].events & ( uint32_t ) EPOLLOUT ) != 0U ) )
+                {
+                    floodConnection( pBroker, eventData );
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void * agentThread( void * pArgument )
+{
+    BenchmarkConnection_t * pConnection = ( BenchmarkConnection_t * ) pArgument;
+
+    ( void ) MQTTAgent_CommandLoop( &( pConnection->agentContext ) );
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void incomingPublish( MQTTAgentContext_t * pMqttAgentContext,
+                             uint16_t packetId,
+                             MQTTPublishInfo_t * pxPublishInfo )
+{
+    BenchmarkConnection_t * pConnection = ( BenchmarkConnection_t * ) pMqttAgentContext->pIncomingCallbackContext;
+
+    ( void ) packetId;
+    ( void ) pxPublishInfo;
+
+    /* Only the agent thread writes the count. */
+    __atomic_store_n( &( pConnection->received ), pConnection->received + 1U, __ATOMIC_RELAXED );
+}
+
+/*-----------------------------------------------------------*/
+
+bool BenchmarkBroker_Start( BenchmarkBroker_t * pBroker )
+{
+    struct sockaddr_in address;
+    socklen_t addressLength = ( socklen_t ) sizeof( address );
+    struct epoll_event event;
+    bool started = false;
+
+    ( void ) memset( pBroker, 0x00, sizeof( BenchmarkBroker_t ) );
+    ( void ) memset( &address, 0x00, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    pBroker->listenFd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    pBroker->epollFd = epoll_create1( EPOLL_CLOEXEC );
+
+    if( ( pBroker->listenFd >= 0 ) &&
+        ( pBroker->epollFd >= 0 ) &&
+        ( bind( pBroker->listenFd, ( struct sockaddr * ) &address, sizeof( address ) ) == 0 ) &&
+        ( listen( pBroker->listenFd, 4096 ) == 0 ) &&
+        ( getsockname( pBroker->listenFd, ( struct sockaddr * ) &address, &addressLength ) == 0 ) )
+    {
+        pBroker->port = ntohs( address.sin_port );
+        event.events = EPOLLIN;
+        event.data.u64 = ( uint64_t ) pBroker->listenFd;
+
+        started = ( epoll_ctl( pBroker->epollFd, EPOLL_CTL_ADD, pBroker->listenFd, &event ) == 0 ) &&
+                  ( pthread_create( &( pBroker->thread ), NULL, brokerThread, pBroker ) == 0 );
+    }
+
+    if( !started )
+    {
+        ( void ) fprintf( stderr, "Failed to start the loopback broker.\n" );
+    }
+
+    return started;
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t BenchmarkBroker_GetBytesReceived( const BenchmarkBroker_t * pBroker )
+{
+    return __atomic_load_n( &( pBroker->bytesReceived ), __ATOMIC_RELAXED );
+}
+
+/*-----------------------------------------------------------*/
+
+void BenchmarkBroker_SetFlood( BenchmarkBroker_t * pBroker,
+                               const uint8_t * pData,
+                               size_t length )
+{
+    /* The broker thread reads the length after the data pointer, so a flood
+     * is only set while none is. */
+    if( pData != NULL )
+    {
+        pBroker->floodDataLength = length;
+    }
+
+    __atomic_store_n( &( pBroker->pFloodData ), pData, __ATOMIC_RELEASE );
+}
+
+/*-----------------------------------------------------------*/
+
+bool BenchmarkConnection_Open( BenchmarkConnection_t * pConnection,
+                               uint16_t port,
+                               bool holdSends,
+                               TransportSend_t send,
+                               TransportWritev_t writev )
+{
+    static uint32_t clientCount = 0U;
+    MQTTAgentMessageInterface_t messageInterface;
+    TransportInterface_t transport;
+    MQTTFixedBuffer_t fixedBuffer;
+    MQTTConnectInfo_t connectInfo;
+    char clientIdentifier[ 16 ];
+    bool sessionPresent = false;
+    bool opened = false;
+    MQTTStatus_t status = MQTTBadParameter;
+
+    ( void ) memset( pConnection, 0x00, sizeof( BenchmarkConnection_t ) );
+    ( void ) memset( &transport, 0x00, sizeof( transport ) );
+    ( void ) memset( &connectInfo, 0x00, sizeof( connectInfo ) );
+
+    if( ( PosixTransport_Connect( &( pConnection->networkContext ), "127.0.0.1", port, BENCHMARK_TIMEOUT_MS ) == POSIX_TRANSPORT_SUCCESS ) &&
+        ( !holdSends ||
+          ( PosixTransport_SetSendBuffer( &( pConnection->networkContext ),
+                                          pConnection->sendBuffer,
+                                          sizeof( pConnection->sendBuffer ) ) == POSIX_TRANSPORT_SUCCESS ) ) &&
+        PosixAgentMessage_Init( &( pConnection->messageContext ), pConnection->pQueueStorage, BENCHMARK_QUEUE_LENGTH ) )
+    {
+        PosixAgentMessage_WatchConnection( &( pConnection->messageContext ), &( pConnection->networkContext ) );
+
+        messageInterface.pMsgCtx = &( pConnection->messageContext );
+        messageInterface.send = PosixAgentMessage_Send;
+        messageInterface.recv = PosixAgentMessage_Recv;
+        messageInterface.getCommand = PosixCommandPool_GetCommand;
+        messageInterface.releaseCommand = PosixCommandPool_ReleaseCommand;
+
+        transport.pNetworkContext = &( pConnection->networkContext );
+        transport.send = ( send != NULL ) ? send : PosixTransport_Send;
+        transport.recv = PosixTransport_Recv;
+        transport.writev = ( writev != NULL ) ? writev : PosixTransport_Writev;
+
+        fixedBuffer.pBuffer = pConnection->networkBuffer;
+        fixedBuffer.size = sizeof( pConnection->networkBuffer );
+
+        status = MQTTAgent_Init( &( pConnection->agentContext ),
+                                 &messageInterface,
+                                 &fixedBuffer,
+                                 &transport,
+                                 PosixClock_GetTimeMs,
+                                 incomingPublish,
+                                 pConnection );
+    }
+
+    if( status == MQTTSuccess )
+    {
+        /* No keep alive, so that no PINGREQ is sent during a run. */
+        ( void ) snprintf( clientIdentifier, sizeof( clientIdentifier ), "bench%lu", ( unsigned long ) clientCount );
+        clientCount++;
+        connectInfo.cleanSession = true;
+        connectInfo.keepAliveIntervalSec = 0U;
+        connectInfo.pClientIdentifier = clientIdentifier;
+        connectInfo.clientIdentifierLength = ( uint16_t ) strlen( clientIdentifier );
+
+        status = MQTT_Connect( &( pConnection->agentContext.mqttContext ),
+                               &connectInfo,
+                               NULL,
+                               BENCHMARK_TIMEOUT_MS,
+                               &sessionPresent );
+        opened = ( status == MQTTSuccess );
+    }
+
+    if( !opened )
+    {
+        ( void ) fprintf( stderr, "Failed to connect to the loopback broker: %s.\n", MQTT_Status_strerror( status ) );
+    }
+
+    return opened;
+}
+
+/*-----------------------------------------------------------*/
+
+bool BenchmarkConnection_StartThread( BenchmarkConnection_t * pConnection )
+{
+    pConnection->threadStarted = ( pthread_create( &( pConnection->thread ), NULL, agentThread, pConnection ) == 0 );
+
+    return pConnection->threadStarted;
+}
+
+/*-----------------------------------------------------------*/
+
+void BenchmarkConnection_Close( BenchmarkConnection_t * pConnection )
+{
+    MQTTAgentCommandInfo_t commandInfo;
+
+    ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+    commandInfo.blockTimeMs = BENCHMARK_TIMEOUT_MS;
+
+    if( pConnection->threadStarted )
+    {
+        ( void ) MQTTAgent_Terminate( &( pConnection->agentContext ), &commandInfo );
+        ( void ) pthread_join( pConnection->thread, NULL );
+        pConnection->threadStarted = false;
+    }
+
+    PosixAgentMessage_WatchConnection( &( pConnection->messageContext ), NULL );
+    ( void ) PosixTransport_Disconnect( &( pConnection->networkContext ) );
+    PosixAgentMessage_Cleanup( &( pConnection->messageContext ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void BenchmarkConnection_CountCompletion( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                          MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    BenchmarkConnection_t * pConnection = ( BenchmarkConnection_t * ) pCmdCallbackContext;
+
+    ( void ) pReturnInfo;
+
+    /* Only the agent thread writes the count. */
+    __atomic_store_n( &( pConnection->completed ), pConnection->completed + 1U, __ATOMIC_RELEASE );
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t BenchmarkConnection_GetCompleted( const BenchmarkConnection_t * pConnection )
+{
+    return __atomic_load_n( &( pConnection->completed ), __ATOMIC_ACQUIRE );
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t BenchmarkConnection_GetCpuTimeNs( const BenchmarkConnection_t * pConnection )
+{
+    clockid_t clockId;
+    struct timespec cpuTime = { 0 };
+
+    if( pthread_getcpuclockid( pConnection->thread, &clockId ) == 0 )
+    {
+        ( void ) clock_gettime( clockId, &cpuTime );
+    }
+
+    return ( ( uint64_t ) cpuTime.tv_sec * 1000000000U ) + ( uint64_t ) cpuTime.tv_nsec;
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t BenchmarkConnection_GetReceived( const BenchmarkConnection_t * pConnection )
+{
+    return __atomic_load_n( &( pConnection->received ), __ATOMIC_RELAXED );
+}
+
+/*-----------------------------------------------------------*/
+
+uint64_t Benchmark_GetTimeNs( void )
+{
+    struct timespec now;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( ( uint64_t ) now.tv_sec * 1000000000U ) + ( uint64_t ) now.tv_nsec;
+}
@@ -0,0 +1,219 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file benchmark_common.h
+ * @brief Loopback broker and agent connections shared by the benchmarks of
+ * the POSIX port.
+ *
+ * The broker accepts TCP connections on the loopback interface, answers each
+ * CONNECT with a CONNACK and otherwise reads and discards everything it
+ * receives, with one epoll thread for all connections. While a flood is set,
+ * it also writes the packets of the flood over and over to the connections it
+ * answers, as fast as they are read. Each connection runs an
+ * agent over the transport and message interface of the port, connected with
+ * MQTT_Connect() of the real coreMQTT library.
+ */
+#ifndef BENCHMARK_COMMON_H
+#define BENCHMARK_COMMON_H
+
+/* Standard includes. */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* POSIX includes. */
+#include <pthread.h>
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+
+/* Port includes. */
+#include "posix_transport.h"
+#include "posix_agent_message.h"
+
+/**
+ * @brief Number of entries of the command queue of each connection.
+ */
+#define BENCHMARK_QUEUE_LENGTH           ( 64U )
+
+/**
+ * @brief Size of the network buffer of each connection.
+ */
+#define BENCHMARK_NETWORK_BUFFER_SIZE    ( 1024U )
+
+/**
+ * @brief Size of the send buffer of each connection that holds packets back.
+ */
+#define BENCHMARK_SEND_BUFFER_SIZE       ( 4096U )
+
+/**
+ * @brief Loopback broker that discards what it receives.
+ */
+typedef struct BenchmarkBroker
+{
+    int listenFd;                /**< @brief Listening socket. */
+    int epollFd;                 /**< @brief Epoll instance watching the listening and accepted sockets. */
+    uint16_t port;               /**< @brief Port the broker listens on. */
+    pthread_t thread;            /**< @brief Thread serving the sockets. */
+    uint64_t bytesReceived;      /**< @brief Number of bytes received after the CONNECT packets. */
+    const uint8_t * pFloodData;  /**< @brief Packets written over and over to the connections, or NULL. */
+    size_t floodDataLength;      /**< @brief Length of `pFloodData`. */
+} BenchmarkBroker_t;
+
+/**
+ * @brief Agent connected to the loopback broker.
+ */
+typedef struct BenchmarkConnection
+{
+    MQTTAgentContext_t agentContext;                              /**< @brief Agent of the connection. */
+    MQTTAgentMessageContext_t messageContext;                     /**< @brief Command queue of the agent. */
+    MQTTAgentCommand_t * pQueueStorage[ BENCHMARK_QUEUE_LENGTH ]; /**< @brief Storage of the command queue. */
+    NetworkContext_t networkContext;                              /**< @brief Socket of the connection. */
+    uint8_t networkBuffer[ BENCHMARK_NETWORK_BUFFER_SIZE ];       /**< @brief Network buffer of coreMQTT. */
+    uint8_t sendBuffer[ BENCHMARK_SEND_BUFFER_SIZE ];             /**< @brief Buffer packets are held back in. */
+    pthread_t thread;                                             /**< @brief Thread running the command loop. */
+    bool threadStarted;                                           /**< @brief Whether `thread` was started. */
+    uint64_t completed;                                           /**< @brief Number of commands completed with a callback counting them. */
+    uint64_t received;                                            /**< @brief Number of publishes received. */
+} BenchmarkConnection_t;
+
+/**
+ * @brief Start the loopback broker on an ephemeral port.
+ *
+ * @param[out] pBroker Broker to start.
+ *
+ * @return `true` if the broker is listening, else `false`.
+ */
+bool BenchmarkBroker_Start( BenchmarkBroker_t * pBroker );
+
+/**
+ * @brief Get the number of bytes the broker received after the CONNECT
+ * packets.
+ *
+ * @param[in] pBroker Started broker.
+ *
+ * @return The number of bytes received.
+ */
+uint64_t BenchmarkBroker_GetBytesReceived( const BenchmarkBroker_t * pBroker );
+
+/**
+ * @brief Start or stop flooding connections with packets.
+ *
+ * The broker writes the data over and over to each connection whose CONNECT
+ * it answers while the flood is set, as fast as the client reads it, and
+ * stops writing to all of them once the flood is cleared.
+ *
+ * @param[in] pBroker Started broker.
+ * @param[in] pData Whole packets to write, which must outlive the flood, or
+ * NULL to stop flooding.
+ * @param[in] length Length of `pData`.
+ */
+void BenchmarkBroker_SetFlood( BenchmarkBroker_t * pBroker,
+                               const uint8_t * pData,
+                               size_t length );
+
+/**
+ * @brief Connect an agent to the loopback broker.
+ *
+ * @param[out] pConnection Connection to open.
+ * @param[in] port Port of the loopback broker.
+ * @param[in] holdSends Whether to give the connection a send buffer, so that
+ * the packets of queued commands are written together.
+ * @param[in] send Send function of the transport, or NULL for
+ * PosixTransport_Send(). Other functions must call PosixTransport_Send().
+ * @param[in] writev Vectored send function of the transport, or NULL for
+ * PosixTransport_Writev(). Other functions must call PosixTransport_Writev().
+ *
+ * @return `true` if the agent is connected, else `false`.
+ */
+bool BenchmarkConnection_Open( BenchmarkConnection_t * pConnection,
+                               uint16_t port,
+                               bool holdSends,
+                               TransportSend_t send,
+                               TransportWritev_t writev );
+
+/**
+ * @brief Run the command loop of a connection on a new thread.
+ *
+ * @param[in] pConnection Open connection.
+ *
+ * @return `true` if the thread was started, else `false`.
+ */
+bool BenchmarkConnection_StartThread( BenchmarkConnection_t * pConnection );
+
+/**
+ * @brief Terminate the command loop of a connection, join its thread if it
+ * was started with BenchmarkConnection_StartThread(), and close the socket.
+ *
+ * @param[in] pConnection Open connection.
+ */
+void BenchmarkConnection_Close( BenchmarkConnection_t * pConnection );
+
+/**
+ * @brief Completion callback counting the commands completed on a
+ * connection, given as the context.
+ *
+ * @param[in] pCmdCallbackContext The #BenchmarkConnection_t of the command.
+ * @param[in] pReturnInfo Unused.
+ */
+void BenchmarkConnection_CountCompletion( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                          MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Get the number of commands of a connection completed with
+ * BenchmarkConnection_CountCompletion().
+ *
+ * @param[in] pConnection Connection.
+ *
+ * @return The number of commands completed.
+ */
+uint64_t BenchmarkConnection_GetCompleted( const BenchmarkConnection_t * pConnection );
+
+/**
+ * @brief Get the number of publishes a connection received.
+ *
+ * @param[in] pConnection Connection.
+ *
+ * @return The number of publishes received.
+ */
+uint64_t BenchmarkConnection_GetReceived( const BenchmarkConnection_t * pConnection );
+
+/**
+ * @brief Get the time of `CLOCK_MONOTONIC` in nanoseconds.
+ *
+ * @return The time in nanoseconds.
+ */
+uint64_t Benchmark_GetTimeNs( void );
+
+/**
+ * @brief Get the CPU time used by the thread of a connection, in user and
+ * kernel mode.
+ *
+ * @param[in] pConnection Connection whose thread was started with
+ * BenchmarkConnection_StartThread(), and is still running.
+ *
+ * @return The CPU time in nanoseconds.
+ */
+uint64_t BenchmarkConnection_GetCpuTimeNs( const BenchmarkConnection_t * pConnection );
+
+#endif /* BENCHMARK_COMMON_H */
@@ -0,0 +1,283 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file fairness_benchmark.c
+ * @brief Outbound publish throughput of an agent under a flood of incoming
+ * publishes.
+ *
+ * One connection runs an agent on its own thread, and the main thread queues
+ * QoS 0 publishes on it for the duration of a run. In the second run, the
+ * loopback broker floods the connection with QoS 0 publishes as fast as the
+ * agent reads them. Without a limit on MQTT_ProcessLoop() calls in a row, the
+ * agent keeps receiving while the flood lasts and the queued publishes wait.
+ * With MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS set, it processes a queued
+ * command after that many calls.
+ *
+ * The limit is a build option of the agent, so the benchmark is built once
+ * with each setting, as posix_fairness_benchmark and
+ * posix_fairness_benchmark_capped. Each reports the publishes per second
+ * delivered to the broker and received from it, without and with the flood.
+ *
+ * Usage: posix_fairness_benchmark [milliseconds]
+ *
+ * Each run lasts 2000 milliseconds by default.
+ */
+
+/* Enable the POSIX and Linux declarations used by the benchmarks. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark_common.h"
+
+/* Port include. */
+#include "posix_command_pool.h"
+
+/**
+ * @brief Default duration of a run in milliseconds.
+ */
+#define DEFAULT_DURATION_MS       ( 2000UL )
+
+/**
+ * @brief Time in milliseconds to wait for room in the command queue.
+ */
+#define QUEUE_BLOCK_TIME_MS       ( 10U )
+
+/**
+ * @brief Number of packets in the flood data the broker writes over and
+ * over.
+ */
+#define FLOOD_PACKET_COUNT        ( 1024U )
+
+/**
+ * @brief Topic of the outbound publishes.
+ */
+#define OUTBOUND_TOPIC            "benchmark/outbound"
+
+/**
+ * @brief Topic of the publishes of the flood.
+ */
+#define INBOUND_TOPIC             "benchmark/inbound"
+
+/**
+ * @brief Length of the payload of the publishes.
+ */
+#define BENCHMARK_PAYLOAD_SIZE    ( 32U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Result of one run.
+ */
+typedef struct RunResult
+{
+    double outboundRate; /**< @brief Publishes delivered to the broker per second. */
+    double inboundRate;  /**< @brief Publishes received from the broker per second. */
+} RunResult_t;
+
+/**
+ * @brief Loopback broker of all runs.
+ */
+static BenchmarkBroker_t broker;
+
+/**
+ * @brief Payload of the publishes.
+ */
+static uint8_t payload[ BENCHMARK_PAYLOAD_SIZE ];
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Serialize the flood data of the broker.
+ *
+ * @param[out] ppData Allocated flood data, to be freed by the caller.
+ * @param[out] pLength Length of the flood data.
+ *
+ * @return `true` if the data was serialized, else `false`.
+ */
+static bool createFloodData( uint8_t ** ppData,
+                             size_t * pLength )
+{
+    MQTTPublishInfo_t publishInfo;
+    MQTTFixedBuffer_t fixedBuffer;
+    size_t remainingLength;
+    size_t packetSize;
+    size_t i;
+    bool success;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS0;
+    publishInfo.pTopicName = INBOUND_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( INBOUND_TOPIC ) - 1U );
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = sizeof( payload );
+
+    success = ( MQTT_GetPublishPacketSize( &publishInfo, &remainingLength, &packetSize ) == MQTTSuccess );
+
+    if( success )
+    {
+        *ppData = malloc( packetSize * FLOOD_PACKET_COUNT );
+        success = ( *ppData != NULL );
+    }
+
+    if( success )
+    {
+        fixedBuffer.pBuffer = *ppData;
+        fixedBuffer.size = packetSize;
+        success = ( MQTT_SerializePublish( &publishInfo, 0U, remainingLength, &fixedBuffer ) == MQTTSuccess );
+    }
+
+    for( i = 1U; success && ( i < FLOOD_PACKET_COUNT ); i++ )
+    {
+        ( void ) memcpy( &( ( *ppData )[ i * packetSize ] ), *ppData, packetSize );
+    }
+
+    *pLength = packetSize * FLOOD_PACKET_COUNT;
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Open a connection, publish on it for the duration of the run, and
+ * close it.
+ *
+ * @param[in] durationMs Duration of the run in milliseconds.
+ * @param[in] pFloodData Flood data of the broker, or NULL for no flood.
+ * @param[in] floodDataLength Length of `pFloodData`.
+ * @param[out] pResult Result of the run.
+ *
+ * @return `true` if the run succeeded, else `false`.
+ */
+static bool runOnce( unsigned long durationMs,
+                     const uint8_t * pFloodData,
+                     size_t floodDataLength,
+                     RunResult_t * pResult )
+{
+    static BenchmarkConnection_t connection;
+    MQTTPublishInfo_t publishInfo;
+    MQTTAgentCommandInfo_t commandInfo;
+    uint64_t startTimeNs;
+    uint64_t endTimeNs;
+    uint64_t nowNs;
+    uint64_t startCompleted;
+    uint64_t startReceived;
+    double elapsedNs;
+    bool success;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS0;
+    publishInfo.pTopicName = OUTBOUND_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( OUTBOUND_TOPIC ) - 1U );
+    publishInfo.pPayload = payload;
+    publishInfo.payloadLength = sizeof( payload );
+
+    BenchmarkBroker_SetFlood( &broker, pFloodData, floodDataLength );
+
+    success = BenchmarkConnection_Open( &connection, broker.port, false, NULL, NULL ) &&
+              BenchmarkConnection_StartThread( &connection );
+
+    startCompleted = BenchmarkConnection_GetCompleted( &connection );
+    startReceived = BenchmarkConnection_GetReceived( &connection );
+    startTimeNs = Benchmark_GetTimeNs();
+    endTimeNs = startTimeNs + ( ( uint64_t ) durationMs * 1000000U );
+    nowNs = startTimeNs;
+
+    /* A publish that finds the queue full is dropped, so the producer keeps
+     * going while the agent is busy receiving. */
+    while( success && ( nowNs < endTimeNs ) )
+    {
+        ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+        commandInfo.cmdCompleteCallback = BenchmarkConnection_CountCompletion;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) &connection;
+        commandInfo.blockTimeMs = QUEUE_BLOCK_TIME_MS;
+
+        ( void ) MQTTAgent_Publish( &( connection.agentContext ), &publishInfo, &commandInfo );
+        nowNs = Benchmark_GetTimeNs();
+    }
+
+    if( success )
+    {
+        elapsedNs = ( double ) ( nowNs - startTimeNs );
+        pResult->outboundRate = ( double ) ( BenchmarkConnection_GetCompleted( &connection ) - startCompleted ) * 1e9 / elapsedNs;
+        pResult->inboundRate = ( double ) ( BenchmarkConnection_GetReceived( &connection ) - startReceived ) * 1e9 / elapsedNs;
+    }
+
+    /* Stop the flood first, so that the agent drains the socket and takes
+     * the termination command. */
+    BenchmarkBroker_SetFlood( &broker, NULL, 0U );
+    BenchmarkConnection_Close( &connection );
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    unsigned long durationMs = DEFAULT_DURATION_MS;
+    uint8_t * pFloodData = NULL;
+    size_t floodDataLength = 0U;
+    RunResult_t quiet;
+    RunResult_t flooded;
+    bool success;
+
+    if( argc > 1 )
+    {
+        durationMs = strtoul( argv[ 1 ], NULL, 10 );
+    }
+
+    ( void ) memset( payload, 0xA5, sizeof( payload ) );
+
+    success = PosixCommandPool_Init() &&
+              BenchmarkBroker_Start( &broker ) &&
+              createFloodData( &pFloodData, &floodDataLength ) &&
+              runOnce( durationMs, NULL, 0U, &quiet ) &&
+              runOnce( durationMs, pFloodData, floodDataLength, &flooded );
+
+    if( success )
+    {
+        ( void ) printf( "| MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS | Without flood: outbound publishes/s | With flood: outbound publishes/s | Inbound publishes/s |\n" );
+        ( void ) printf( "|---|---|---|---|\n" );
+        ( void ) printf( "| %lu | %.0f | %.0f | %.0f |\n",
+                         ( unsigned long ) MQTT_AGENT_MAX_PROCESS_LOOP_ITERATIONS,
+                         quiet.outboundRate,
+                         flooded.outboundRate,
+                         flooded.inboundRate );
+    }
+    else
+    {
+        ( void ) fprintf( stderr, "Failed to run the benchmark.\n" );
+    }
+
+    free( pFloodData );
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,448 @@
+/*
+ * coreMQTT Agent <DEVELOPMENT BRANCH>
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file latency_benchmark.c
+ * @brief Latency and jitter from queuing a publish to writing it to the
+ * socket, with and without the real-time options of the agent thread, and
+ * with and without spinning before the agent waits.
+ *
+ * One connection runs its agent on a thread started with
+ * PosixAgentThread_Start(). The main thread queues one QoS 0 publish at a
+ * time, at a fixed interval, while other threads keep every CPU busy. The send
+ * functions of the transport record the time from MQTTAgent_Publish() to the
+ * write of the PUBLISH packet, and the benchmark reports percentiles of these
+ * latencies, for an agent thread with the default options and one pinned to
+ * CPU 0 with a `SCHED_FIFO` priority, locked memory and pre-faulting, each
+ * without spinning and spinning with PosixAgentMessage_SetSpinTime(). The
+ * spin rows also report how many spins ended with an event. Spinning only
+ * pays off when the agent thread has a CPU of its own, so the load threads
+ * can be left out for that comparison.
+ *
+ * The real-time options require the `CAP_SYS_NICE` and `CAP_IPC_LOCK`
+ * capabilities or suitable resource limits; without them their row reports
+ * that the thread could not be started.
+ *
+ * Usage: posix_latency_benchmark [samples] [load threads] [interval us] [spin us]
+ *
+ * The defaults are 10000 samples, one load thread per CPU, 1000 us, and a spin
+ * time of twice the interval, so that the agent spins until the next publish.
+ */
+
+/* Enable the POSIX and Linux declarations used by the benchmarks. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX includes. */
+#include <unistd.h>
+#include <time.h>
+
+#include "benchmark_common.h"
+
+/* Port includes. */
+#include "posix_command_pool.h"
+#include "posix_agent_thread.h"
+
+/**
+ * @brief Default number of publishes timed in each configuration.
+ */
+#define DEFAULT_SAMPLE_COUNT        ( 10000UL )
+
+/**
+ * @brief Default time between two publishes.
+ */
+#define DEFAULT_INTERVAL_US         ( 1000UL )
+
+/**
+ * @brief Largest number of load threads.
+ */
+#define MAX_LOAD_THREADS            ( 256 )
+
+/**
+ * @brief Topic of the publishes.
+ */
+#define BENCHMARK_TOPIC             "benchmark/latency"
+
+/**
+ * @brief Type and flags byte of a QoS 0 PUBLISH packet without retain.
+ */
+#define PUBLISH_PACKET_TYPE         ( 0x30U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Options of one configuration of the agent thread.
+ */
+typedef struct LatencyConfig
+{
+    const char * pName;                    /**< @brief Name of the configuration in the table. */
+    PosixAgentThreadConfig_t threadConfig; /**< @brief Options of the agent thread. */
+    bool spin;                             /**< @brief Whether the agent spins before waiting. */
+} LatencyConfig_t;
+
+/**
+ * @brief Loopback broker of all runs.
+ */
+static BenchmarkBroker_t broker;
+
+/**
+ * @brief Time at which the publish being timed was queued, or 0 once its
+ * packet has been written.
+ */
+static uint64_t publishTimeNs;
+
+/**
+ * @brief Latencies of the publishes of a run.
+ */
+static uint64_t * pLatenciesNs;
+
+/**
+ * @brief Number of latencies recorded in #pLatenciesNs.
+ */
+static size_t latencyCount;
+
+/**
+ * @brief Set to stop the load threads.
+ */
+static bool stopLoad;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Record the latency of the publish being timed, if a packet is its
+ * PUBLISH packet.
+ *
+ * @param[in] pFirstByte First byte written by a send function.
+ */
+static void recordLatency( const uint8_t * pFirstByte )
+{
+    uint64_t startNs;
+
+    if( ( *pFirstByte & 0xF0U ) == PUBLISH_PACKET_TYPE )
+    {
+        startNs = __atomic_exchange_n( &publishTimeNs, 0U, __ATOMIC_ACQ_REL );
+
+        if( startNs != 0U )
+        {
+            pLatenciesNs[ latencyCount ] = Benchmark_GetTimeNs() - startNs;
+            __atomic_store_n( &latencyCount, latencyCount + 1U, __ATOMIC_RELEASE );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Send function of the transport, timing the PUBLISH packets.
+ */
+static int32_t timedSend( NetworkContext_t * pNetworkContext,
+                          const void * pBuffer,
+                          size_t bytesToSend )
+{
+    if( bytesToSend > 0U )
+    {
+        recordLatency( ( const uint8_t * ) pBuffer );
+    }
+
+    return PosixTransport_Send( pNetworkContext, pBuffer, bytesToSend );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Vectored send function of the transport, timing the PUBLISH packets.
+ */
+static int32_t timedWritev( NetworkContext_t * pNetworkContext,
+                            TransportOutVector_t * pIoVec,
+                            size_t ioVecCount )
+{
+    if( ( ioVecCount > 0U ) && ( pIoVec[ 0 ].iov_len > 0U ) )
+    {
+        recordLatency( ( const uint8_t * ) pIoVec[ 0 ].iov_base );
+    }
+
+    return PosixTransport_Writev( pNetworkContext, pIoVec, ioVecCount );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Keep a CPU busy until #stopLoad is set.
+ */
+static void * loadThread( void * pArgument )
+{
+    volatile unsigned long spins = 0UL;
+
+    ( void ) pArgument;
+
+    while( !__atomic_load_n( &stopLoad, __ATOMIC_RELAXED ) )
+    {
+        spins++;
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Order latencies for qsort().
+ */
+static int compareLatencies( const void * pFirst,
+                             const void * pSecond )
+{
+    uint64_t first = *( ( const uint64_t * ) pFirst );
+    uint64_t second = *( ( const uint64_t * ) pSecond );
+
+    return ( first < second ) ? -1 : ( ( first > second ) ? 1 : 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Time publishes queued one at a time on an open connection.
+ *
+ * @param[in] pConnection Connection with its agent thread started.
+ * @param[in] sampleCount Number of publishes to time.
+ * @param[in] intervalUs Time between two publishes.
+ *
+ * @return `true` if every publish was written, else `false`.
+ */
+static bool timePublishes( BenchmarkConnection_t * pConnection,
+                           unsigned long sampleCount,
+                           unsigned long intervalUs )
+{
+    MQTTPublishInfo_t publishInfo;
+    MQTTAgentCommandInfo_t commandInfo;
+    struct timespec interval;
+    unsigned long sample;
+    uint64_t deadlineNs;
+    bool success = true;
+
+    ( void ) memset( &publishInfo, 0x00, sizeof( publishInfo ) );
+    publishInfo.qos = MQTTQoS0;
+    publishInfo.pTopicName = BENCHMARK_TOPIC;
+    publishInfo.topicNameLength = ( uint16_t ) ( sizeof( BENCHMARK_TOPIC ) - 1U );
+
+    interval.tv_sec = ( time_t ) ( intervalUs / 1000000UL );
+    interval.tv_nsec = ( long ) ( intervalUs % 1000000UL ) * 1000L;
+
+    for( sample = 0UL; success && ( sample < sampleCount ); sample++ )
+    {
+        ( void ) nanosleep( &interval, NULL );
+
+        ( void ) memset( &commandInfo, 0x00, sizeof( commandInfo ) );
+        commandInfo.blockTimeMs = 1000U;
+
+        __atomic_store_n( &publishTimeNs, Benchmark_GetTimeNs(), __ATOMIC_RELEASE );
+        success = ( MQTTAgent_Publish( &( pConnection->agentContext ), &publishInfo, &commandInfo ) == MQTTSuccess );
+
+        /* Wait for the packet, so that publishes are timed one at a time. */
+        deadlineNs = Benchmark_GetTimeNs() + 1000000000ULL;
+
+        while( success && ( __atomic_load_n( &latencyCount, __ATOMIC_ACQUIRE ) <= sample ) )
+        {
+            success = ( Benchmark_GetTimeNs() < deadlineNs );
+        }
+    }
+
+    if( !success )
+    {
+        ( void ) fprintf( stderr, "A publish was not written within one second.\n" );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Time the publishes of one configuration and print its row.
+ *
+ * @param[in] pConfig Configuration of the agent thread.
+ * @param[in] sampleCount Number of publishes to time.
+ * @param[in] intervalUs Time between two publishes.
+ * @param[in] spinTimeUs Spin time of the configurations that spin.
+ *
+ * @return `false` if the benchmark failed, else `true`, including if the
+ * agent thread could not be started with the options.
+ */
+static bool runConfig( const LatencyConfig_t * pConfig,
+                       unsigned long sampleCount,
+                       unsigned long intervalUs,
+                       uint32_t spinTimeUs )
+{
+    static BenchmarkConnection_t connection;
+    static PosixAgentThread_t agentThread;
+    uint32_t spinHits = 0U;
+    uint32_t spinMisses = 0U;
+    bool success;
+
+    latencyCount = 0U;
+    __atomic_store_n( &publishTimeNs, 0U, __ATOMIC_RELEASE );
+
+    success = BenchmarkConnection_Open( &connection, broker.port, false, timedSend, timedWritev );
+
+    if( success && pConfig->spin )
+    {
+        PosixAgentMessage_SetSpinTime( &( connection.messageContext ), spinTimeUs );
+    }
+
+    if( success && PosixAgentThread_Start( &agentThread, &( pConfig->threadConfig ), &( connection.agentContext ), NULL, NULL ) )
+    {
+        /* The connection joins the thread when it is closed. */
+        connection.thread = agentThread.thread;
+        connection.threadStarted = true;
+
+        success = timePublishes( &connection, sampleCount, intervalUs );
+        PosixAgentMessage_GetSpinCounts( &( connection.messageContext ), &spinHits, &spinMisses );
+
+        if( success )
+        {
+            qsort( pLatenciesNs, latencyCount, sizeof( pLatenciesNs[ 0 ] ), compareLatencies );
+
+            ( void ) printf( "| %s | %s | %lu | %lu/%lu | %.1f | %.1f | %.1f | %.1f |\n",
+                             pConfig->pName,
+                             pConfig->spin ? "yes" : "no",
+                             ( unsigned long ) latencyCount,
+                             ( unsigned long ) spinHits,
+                             ( unsigned long ) ( spinHits + spinMisses ),
+                             ( double ) pLatenciesNs[ latencyCount / 2U ] / 1e3,
+                             ( double ) pLatenciesNs[ ( latencyCount * 99U ) / 100U ] / 1e3,
+                             ( double ) pLatenciesNs[ ( latencyCount * 999U ) / 1000U ] / 1e3,
+                             ( double ) pLatenciesNs[ latencyCount - 1U ] / 1e3 );
+        }
+    }
+    else if( success )
+    {
+        ( void ) printf( "| %s | %s | could not start the agent thread with these options | | | | | |\n",
+                         pConfig->pName,
+                         pConfig->spin ? "yes" : "no" );
+    }
+    else
+    {
+        /* Empty else MISRA 15.7 */
+    }
+
+    ( void ) fflush( stdout );
+
+    if( success )
+    {
+        BenchmarkConnection_Close( &connection );
+    }
+
+    return success;
+}
+
+/*-----------------------------------------------------------*/
+
+int main( int argc,
+          char ** argv )
+{
+    static pthread_t loadThreads[ MAX_LOAD_THREADS ];
+    LatencyConfig_t configs[ 4 ];
+    unsigned long sampleCount = DEFAULT_SAMPLE_COUNT;
+    unsigned long intervalUs = DEFAULT_INTERVAL_US;
+    unsigned long spinTimeUs;
+    long loadCount = sysconf( _SC_NPROCESSORS_ONLN );
+    long started = 0L;
+    size_t i;
+    bool success = true;
+
+    if( argc > 1 )
+    {
+        sampleCount = strtoul( argv[ 1 ], NULL, 10 );
+    }
+
+    if( argc > 2 )
+    {
+        loadCount = strtol( argv[ 2 ], NULL, 10 );
+    }
+
+    if( argc > 3 )
+    {
+        intervalUs = strtoul( argv[ 3 ], NULL, 10 );
+    }
+
+    spinTimeUs = ( argc > 4 ) ? strtoul( argv[ 4 ], NULL, 10 ) : ( 2UL * intervalUs );
+
+    if( sampleCount == 0UL )
+    {
+        sampleCount = 1UL;
+    }
+
+    if( loadCount > MAX_LOAD_THREADS )
+    {
+        loadCount = MAX_LOAD_THREADS;
+    }
+
+    ( void ) memset( configs, 0x00, sizeof( configs ) );
+    configs[ 0 ].pName = "Default";
+    configs[ 0 ].threadConfig.cpu = -1;
+    configs[ 1 ] = configs[ 0 ];
+    configs[ 1 ].spin = true;
+    configs[ 2 ].pName = "CPU 0, SCHED_FIFO 50, locked, pre-faulted";
+    configs[ 2 ].threadConfig.cpu = 0;
+    configs[ 2 ].threadConfig.priority = 50;
+    configs[ 2 ].threadConfig.lockMemory = true;
+    configs[ 2 ].threadConfig.prefault = true;
+    configs[ 3 ] = configs[ 2 ];
+    configs[ 3 ].spin = true;
+
+    pLatenciesNs = calloc( sampleCount, sizeof( uint64_t ) );
+    success = ( pLatenciesNs != NULL ) && PosixCommandPool_Init() && BenchmarkBroker_Start( &broker );
+
+    while( success && ( started < loadCount ) )
+    {
+        success = ( pthread_create( &( loadThreads[ started ] ), NULL, loadThread, NULL ) == 0 );
+        started += success ? 1L : 0L;
+    }
+
+    if( success )
+    {
+        ( void ) printf( "| Agent thread | Spin | Samples | Spin hits | p50 us | p99 us | p99.9 us | max us |\n" );
+        ( void ) printf( "|---|---|---|---|---|---|---|---|\n" );
+    }
+
+    for( i = 0U; success && ( i < ( sizeof( configs ) / sizeof( configs[ 0 ] ) ) ); i++ )
+    {
+        success = runConfig( &( configs[ i ] ), sampleCount, intervalUs, ( uint32_t ) spinTimeUs );
+    }
+
+    __atomic_store_n( &stopLoad, true, __ATOMIC_RELAXED );
+
+    while( started > 0L )
+    {
+        started--;
+        ( void ) pthread_join( loadThreads[ started ], NULL );
+    }
+
+    free( pLatenciesNs );
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}